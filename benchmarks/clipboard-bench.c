@@ -0,0 +1,1050 @@
+/*
+ *  Copyright (c) 2015 The Xfce development team
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Throughput and latency benchmark of the clipboard manager. A private
+ * Xvfb is started and the manager runs in this process, driven by two
+ * synthetic clients on their own connections:
+ *
+ *  - the owner takes the CLIPBOARD and asks the manager to save it with
+ *    SAVE_TARGETS. The manager fetches the targets with MULTIPLE, targets
+ *    larger than a request are sent incrementally (INCR receive).
+ *  - the requestor fetches all targets back from the manager with
+ *    MULTIPLE, large targets are sent incrementally (INCR send). The
+ *    received data is verified.
+ *
+ * For each payload size the handoff (SAVE_TARGETS) and fetch throughput
+ * and p50/p99 latencies are reported, followed by the peak RSS of the
+ * process. The owner keeps one copy of each target, so the peak includes
+ * the payload size times the number of targets.
+ *
+ * The default sizes go from 1 MiB to 512 MiB, the largest needs a few
+ * GiB of memory with the default number of targets. Use --sizes for a
+ * quick run.
+ *
+ * The manager reads its policy from xfconf, run it with a private
+ * session bus and configuration, see "make benchmark".
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#ifdef HAVE_ERRNO_H
+#include <errno.h>
+#endif
+
+#ifdef HAVE_SIGNAL_H
+#include <signal.h>
+#endif
+
+#ifdef HAVE_SYS_TYPES_H
+#include <sys/types.h>
+#endif
+
+#ifdef HAVE_SYS_WAIT_H
+#include <sys/wait.h>
+#endif
+
+#include <X11/Xlib.h>
+#include <X11/Xatom.h>
+
+#include <gtk/gtk.h>
+#include <xfconf/xfconf.h>
+
+#include <xfsettingsd/clipboard-manager.h>
+
+
+
+/* seconds before a save or fetch is considered lost */
+#define BENCH_TIMEOUT (30)
+
+/* largest chunk the owner sends at once */
+#define BENCH_CHUNK_MAX (256 * 1024)
+
+
+
+typedef struct _Bench         Bench;
+typedef struct _BenchClient   BenchClient;
+typedef struct _BenchSource   BenchSource;
+typedef struct _BenchTarget   BenchTarget;
+typedef struct _BenchTransfer BenchTransfer;
+
+typedef void (*BenchEventFunc) (Bench  *bench,
+                                XEvent *xevent);
+
+
+
+struct _BenchClient
+{
+    Display        *dpy;
+    Window          window;
+    BenchEventFunc  handle_event;
+    GSource        *source;
+};
+
+struct _BenchSource
+{
+    GSource      __parent__;
+
+    GPollFD      poll_fd;
+    Bench       *bench;
+    BenchClient *client;
+};
+
+struct _BenchTarget
+{
+    Atom     target;
+    Atom     property;
+
+    /* payload of the owner */
+    guchar  *data;
+    gsize    length;
+    guint32  checksum;
+
+    /* what the requestor received */
+    gboolean incr;
+    gboolean done;
+    gsize    received;
+    guint32  received_checksum;
+};
+
+/* an incremental transfer of the owner to the manager */
+struct _BenchTransfer
+{
+    Window       requestor;
+    Atom         property;
+    BenchTarget *target;
+    gsize        offset;
+};
+
+struct _Bench
+{
+    BenchClient  owner;
+    BenchClient  requestor;
+
+    BenchTarget *targets;
+    guint        n_targets;
+
+    gsize        chunk_size;
+    GSList      *transfers;
+
+    gboolean     saved;
+    gboolean     save_failed;
+
+    gboolean     fetched;
+    guint        n_fetch_pending;
+    guint        n_errors;
+};
+
+
+
+static Atom XA_ATOM_PAIR = None;
+static Atom XA_CLIPBOARD = None;
+static Atom XA_CLIPBOARD_MANAGER = None;
+static Atom XA_INCR = None;
+static Atom XA_MULTIPLE = None;
+static Atom XA_SAVE_TARGETS = None;
+static Atom XA_TARGETS = None;
+static Atom XA_BENCH_SAVE = None;
+static Atom XA_BENCH_MULTIPLE = None;
+
+
+
+static gchar    *opt_sizes = NULL;
+static gint      opt_targets = 4;
+static gint      opt_iterations = 10;
+static gchar    *opt_xvfb = NULL;
+static gchar    *opt_display = NULL;
+
+
+
+static GOptionEntry option_entries[] =
+{
+    { "sizes", 's', 0, G_OPTION_ARG_STRING, &opt_sizes, "Comma separated payload sizes in bytes", "SIZES" },
+    { "targets", 't', 0, G_OPTION_ARG_INT, &opt_targets, "Number of targets in the clipboard", "N" },
+    { "iterations", 'n', 0, G_OPTION_ARG_INT, &opt_iterations, "Saves and fetches for each size", "N" },
+    { "xvfb", 0, 0, G_OPTION_ARG_STRING, &opt_xvfb, "Xvfb binary to start", "PATH" },
+    { "display", 'd', 0, G_OPTION_ARG_STRING, &opt_display, "Use a running X server instead of Xvfb", "DISPLAY" },
+    { NULL }
+};
+
+
+
+static guint32
+bench_checksum (guint32       checksum,
+                const guchar *data,
+                gsize         length)
+{
+    gsize i;
+
+    /* FNV-1a */
+    for (i = 0; i < length; i++)
+    {
+        checksum ^= data[i];
+        checksum *= 16777619;
+    }
+
+    return checksum;
+}
+
+
+
+static BenchTarget *
+bench_find_target (Bench    *bench,
+                   Atom      atom,
+                   gboolean  by_property)
+{
+    guint i;
+
+    for (i = 0; i < bench->n_targets; i++)
+    {
+        if ((by_property ? bench->targets[i].property : bench->targets[i].target) == atom)
+            return &bench->targets[i];
+    }
+
+    return NULL;
+}
+
+
+
+static gboolean
+bench_source_prepare (GSource *source,
+                      gint    *timeout)
+{
+    BenchSource *bsource = (BenchSource *) source;
+
+    *timeout = -1;
+
+    XFlush (bsource->client->dpy);
+
+    return XEventsQueued (bsource->client->dpy, QueuedAlready) > 0;
+}
+
+
+
+static gboolean
+bench_source_check (GSource *source)
+{
+    BenchSource *bsource = (BenchSource *) source;
+
+    if ((bsource->poll_fd.revents & G_IO_IN) != 0)
+        return XPending (bsource->client->dpy) > 0;
+
+    return XEventsQueued (bsource->client->dpy, QueuedAlready) > 0;
+}
+
+
+
+static gboolean
+bench_source_dispatch (GSource     *source,
+                       GSourceFunc  callback,
+                       gpointer     user_data)
+{
+    BenchSource *bsource = (BenchSource *) source;
+    XEvent       xevent;
+
+    while (XPending (bsource->client->dpy) > 0)
+    {
+        XNextEvent (bsource->client->dpy, &xevent);
+        bsource->client->handle_event (bsource->bench, &xevent);
+    }
+
+    return TRUE;
+}
+
+
+
+static GSourceFuncs bench_source_funcs =
+{
+    bench_source_prepare,
+    bench_source_check,
+    bench_source_dispatch,
+    NULL
+};
+
+
+
+static gboolean
+bench_client_open (Bench          *bench,
+                   BenchClient    *client,
+                   BenchEventFunc  handle_event)
+{
+    BenchSource *bsource;
+
+    client->dpy = XOpenDisplay (NULL);
+    if (client->dpy == NULL)
+        return FALSE;
+
+    client->window = XCreateSimpleWindow (client->dpy, DefaultRootWindow (client->dpy),
+                                          0, 0, 10, 10, 0, 0, 0);
+    XSelectInput (client->dpy, client->window, PropertyChangeMask);
+    client->handle_event = handle_event;
+
+    client->source = g_source_new (&bench_source_funcs, sizeof (BenchSource));
+    bsource = (BenchSource *) client->source;
+    bsource->bench = bench;
+    bsource->client = client;
+    bsource->poll_fd.fd = ConnectionNumber (client->dpy);
+    bsource->poll_fd.events = G_IO_IN;
+    g_source_add_poll (client->source, &bsource->poll_fd);
+    g_source_attach (client->source, NULL);
+
+    return TRUE;
+}
+
+
+
+static void
+bench_client_close (BenchClient *client)
+{
+    if (client->source != NULL)
+    {
+        g_source_destroy (client->source);
+        g_source_unref (client->source);
+    }
+
+    if (client->dpy != NULL)
+        XCloseDisplay (client->dpy);
+}
+
+
+
+static void
+bench_owner_send_chunk (Bench         *bench,
+                        BenchTransfer *transfer)
+{
+    gsize length;
+
+    length = MIN (bench->chunk_size, transfer->target->length - transfer->offset);
+
+    XChangeProperty (bench->owner.dpy, transfer->requestor, transfer->property,
+                     transfer->target->target, 8, PropModeReplace,
+                     transfer->target->data + transfer->offset, length);
+
+    /* the zero length chunk ends the transfer */
+    if (length == 0)
+    {
+        bench->transfers = g_slist_remove (bench->transfers, transfer);
+        g_slice_free (BenchTransfer, transfer);
+    }
+    else
+    {
+        transfer->offset += length;
+    }
+}
+
+
+
+static gboolean
+bench_owner_convert (Bench  *bench,
+                     Window  requestor,
+                     Atom    target,
+                     Atom    property)
+{
+    BenchTarget   *btarget;
+    BenchTransfer *transfer;
+    Atom          *targets;
+    glong          length;
+    guint          i;
+
+    if (target == XA_TARGETS)
+    {
+        targets = g_new (Atom, bench->n_targets + 2);
+        targets[0] = XA_TARGETS;
+        targets[1] = XA_MULTIPLE;
+        for (i = 0; i < bench->n_targets; i++)
+            targets[i + 2] = bench->targets[i].target;
+
+        XChangeProperty (bench->owner.dpy, requestor, property, XA_ATOM, 32,
+                         PropModeReplace, (guchar *) targets, bench->n_targets + 2);
+        g_free (targets);
+
+        return TRUE;
+    }
+
+    btarget = bench_find_target (bench, target, FALSE);
+    if (btarget == NULL)
+        return FALSE;
+
+    if (btarget->length > bench->chunk_size)
+    {
+        /* the INCR property holds a lower bound of the size */
+        length = btarget->length;
+        XChangeProperty (bench->owner.dpy, requestor, property, XA_INCR, 32,
+                         PropModeReplace, (guchar *) &length, 1);
+
+        transfer = g_slice_new (BenchTransfer);
+        transfer->requestor = requestor;
+        transfer->property = property;
+        transfer->target = btarget;
+        transfer->offset = 0;
+        bench->transfers = g_slist_prepend (bench->transfers, transfer);
+    }
+    else
+    {
+        XChangeProperty (bench->owner.dpy, requestor, property, target, 8,
+                         PropModeReplace, btarget->data, btarget->length);
+    }
+
+    return TRUE;
+}
+
+
+
+static void
+bench_owner_selection_request (Bench                  *bench,
+                               XSelectionRequestEvent *request)
+{
+    XSelectionEvent  notify;
+    Atom             type;
+    gint             format;
+    gulong           nitems, remaining, i;
+    Atom            *pairs = NULL;
+    gboolean         success = FALSE;
+
+    /* watch the deletes of incremental transfers */
+    XSelectInput (bench->owner.dpy, request->requestor, PropertyChangeMask);
+
+    if (request->target == XA_MULTIPLE)
+    {
+        XGetWindowProperty (bench->owner.dpy, request->requestor, request->property,
+                            0, 0x1FFFFFFF, False, XA_ATOM_PAIR,
+                            &type, &format, &nitems, &remaining,
+                            (guchar **) &pairs);
+
+        if (type == XA_ATOM_PAIR && pairs != NULL)
+        {
+            /* failed conversions are replaced by None */
+            for (i = 0; i + 1 < nitems; i += 2)
+            {
+                if (!bench_owner_convert (bench, request->requestor, pairs[i], pairs[i + 1]))
+                    pairs[i + 1] = None;
+            }
+
+            XChangeProperty (bench->owner.dpy, request->requestor, request->property,
+                             XA_ATOM_PAIR, 32, PropModeReplace, (guchar *) pairs, nitems);
+            success = TRUE;
+        }
+
+        if (pairs != NULL)
+            XFree (pairs);
+    }
+    else
+    {
+        success = bench_owner_convert (bench, request->requestor,
+                                       request->target, request->property);
+    }
+
+    notify.type = SelectionNotify;
+    notify.serial = 0;
+    notify.send_event = True;
+    notify.display = bench->owner.dpy;
+    notify.requestor = request->requestor;
+    notify.selection = request->selection;
+    notify.target = request->target;
+    notify.property = success ? request->property : None;
+    notify.time = request->time;
+
+    XSendEvent (bench->owner.dpy, request->requestor, False, NoEventMask, (XEvent *) &notify);
+}
+
+
+
+static void
+bench_owner_event (Bench  *bench,
+                   XEvent *xevent)
+{
+    GSList        *li;
+    BenchTransfer *transfer;
+
+    switch (xevent->type)
+    {
+        case SelectionRequest:
+            if (xevent->xselectionrequest.selection == XA_CLIPBOARD)
+                bench_owner_selection_request (bench, &xevent->xselectionrequest);
+            break;
+
+        case PropertyNotify:
+            if (xevent->xproperty.state != PropertyDelete)
+                break;
+
+            /* the manager received the previous chunk */
+            for (li = bench->transfers; li != NULL; li = li->next)
+            {
+                transfer = li->data;
+                if (transfer->requestor == xevent->xproperty.window
+                    && transfer->property == xevent->xproperty.atom)
+                {
+                    bench_owner_send_chunk (bench, transfer);
+                    break;
+                }
+            }
+            break;
+
+        case SelectionNotify:
+            if (xevent->xselection.selection == XA_CLIPBOARD_MANAGER
+                && xevent->xselection.target == XA_SAVE_TARGETS)
+            {
+                bench->saved = TRUE;
+                bench->save_failed = xevent->xselection.property == None;
+            }
+            break;
+
+        default:
+            break;
+    }
+}
+
+
+
+static void
+bench_requestor_done (Bench       *bench,
+                      BenchTarget *btarget)
+{
+    btarget->done = TRUE;
+
+    if (btarget->received != btarget->length
+        || btarget->received_checksum != btarget->checksum)
+    {
+        g_printerr ("Target %u: received %" G_GSIZE_FORMAT " of %" G_GSIZE_FORMAT " bytes%s\n",
+                    (guint) (btarget - bench->targets), btarget->received, btarget->length,
+                    btarget->received == btarget->length ? ", data differs" : "");
+        bench->n_errors++;
+    }
+
+    if (--bench->n_fetch_pending == 0)
+        bench->fetched = TRUE;
+}
+
+
+
+static void
+bench_requestor_read (Bench       *bench,
+                      BenchTarget *btarget)
+{
+    Atom    type;
+    gint    format;
+    gulong  nitems, remaining;
+    guchar *data = NULL;
+
+    XGetWindowProperty (bench->requestor.dpy, bench->requestor.window, btarget->property,
+                        0, 0x1FFFFFFF, True, AnyPropertyType,
+                        &type, &format, &nitems, &remaining, &data);
+
+    if (type == XA_INCR)
+    {
+        /* deleting the property starts the transfer */
+        btarget->incr = TRUE;
+    }
+    else if (type == None || format != 8)
+    {
+        bench_requestor_done (bench, btarget);
+    }
+    else if (nitems > 0)
+    {
+        btarget->received += nitems;
+        btarget->received_checksum = bench_checksum (btarget->received_checksum, data, nitems);
+
+        if (!btarget->incr)
+            bench_requestor_done (bench, btarget);
+    }
+    else
+    {
+        bench_requestor_done (bench, btarget);
+    }
+
+    if (data != NULL)
+        XFree (data);
+}
+
+
+
+static void
+bench_requestor_event (Bench  *bench,
+                       XEvent *xevent)
+{
+    BenchTarget *btarget;
+    guint        i;
+
+    switch (xevent->type)
+    {
+        case SelectionNotify:
+            if (xevent->xselection.selection != XA_CLIPBOARD
+                || xevent->xselection.target != XA_MULTIPLE)
+                break;
+
+            if (xevent->xselection.property == None)
+            {
+                g_printerr ("The manager refused the MULTIPLE conversion\n");
+                bench->n_errors++;
+                bench->fetched = TRUE;
+                break;
+            }
+
+            for (i = 0; i < bench->n_targets; i++)
+                bench_requestor_read (bench, &bench->targets[i]);
+            break;
+
+        case PropertyNotify:
+            if (xevent->xproperty.state != PropertyNewValue
+                || xevent->xproperty.window != bench->requestor.window)
+                break;
+
+            /* the next chunk of an incremental transfer */
+            btarget = bench_find_target (bench, xevent->xproperty.atom, TRUE);
+            if (btarget != NULL && btarget->incr && !btarget->done)
+                bench_requestor_read (bench, btarget);
+            break;
+
+        default:
+            break;
+    }
+}
+
+
+
+static gboolean
+bench_wait_timeout (gpointer user_data)
+{
+    *((gboolean *) user_data) = TRUE;
+
+    return FALSE;
+}
+
+
+
+static gboolean
+bench_wait (gboolean *done)
+{
+    gboolean timed_out = FALSE;
+    guint    timeout_id;
+
+    timeout_id = g_timeout_add_seconds (BENCH_TIMEOUT, bench_wait_timeout, &timed_out);
+
+    while (!*done && !timed_out)
+        g_main_context_iteration (NULL, TRUE);
+
+    if (!timed_out)
+        g_source_remove (timeout_id);
+
+    return !timed_out;
+}
+
+
+
+static gboolean
+bench_round (Bench  *bench,
+             gsize   size,
+             guint   round,
+             gint64 *save_time,
+             gint64 *fetch_time)
+{
+    BenchTarget *btarget;
+    Atom        *atoms;
+    gint64       start;
+    gsize        n;
+    guint        i;
+
+    /* new data for every round, so nothing is shared with the
+     * previous contents */
+    for (i = 0; i < bench->n_targets; i++)
+    {
+        btarget = &bench->targets[i];
+        btarget->data = g_realloc (btarget->data, size);
+        btarget->length = size;
+        for (n = 0; n < size; n++)
+            btarget->data[n] = (n * 131 + i * 17 + round) & 0xff;
+        btarget->checksum = bench_checksum (2166136261U, btarget->data, size);
+
+        btarget->incr = FALSE;
+        btarget->done = FALSE;
+        btarget->received = 0;
+        btarget->received_checksum = 2166136261U;
+    }
+
+    /* the owner takes the clipboard and hands it to the manager */
+    atoms = g_new (Atom, bench->n_targets);
+    for (i = 0; i < bench->n_targets; i++)
+        atoms[i] = bench->targets[i].target;
+
+    XSetSelectionOwner (bench->owner.dpy, XA_CLIPBOARD, bench->owner.window, CurrentTime);
+    XChangeProperty (bench->owner.dpy, bench->owner.window, XA_BENCH_SAVE, XA_ATOM, 32,
+                     PropModeReplace, (guchar *) atoms, bench->n_targets);
+
+    bench->saved = FALSE;
+    bench->save_failed = FALSE;
+
+    start = g_get_monotonic_time ();
+    XConvertSelection (bench->owner.dpy, XA_CLIPBOARD_MANAGER, XA_SAVE_TARGETS,
+                       XA_BENCH_SAVE, bench->owner.window, CurrentTime);
+
+    if (!bench_wait (&bench->saved))
+    {
+        g_printerr ("No SAVE_TARGETS reply from the manager\n");
+        g_free (atoms);
+        return FALSE;
+    }
+
+    *save_time = g_get_monotonic_time () - start;
+
+    if (bench->save_failed)
+    {
+        g_printerr ("The manager refused to save the clipboard\n");
+        g_free (atoms);
+        return FALSE;
+    }
+
+    /* the requestor fetches everything back */
+    atoms = g_renew (Atom, atoms, 2 * bench->n_targets);
+    for (i = 0; i < bench->n_targets; i++)
+    {
+        atoms[2 * i] = bench->targets[i].target;
+        atoms[2 * i + 1] = bench->targets[i].property;
+    }
+
+    XChangeProperty (bench->requestor.dpy, bench->requestor.window, XA_BENCH_MULTIPLE,
+                     XA_ATOM_PAIR, 32, PropModeReplace, (guchar *) atoms, 2 * bench->n_targets);
+    g_free (atoms);
+
+    bench->fetched = FALSE;
+    bench->n_fetch_pending = bench->n_targets;
+
+    start = g_get_monotonic_time ();
+    XConvertSelection (bench->requestor.dpy, XA_CLIPBOARD, XA_MULTIPLE,
+                       XA_BENCH_MULTIPLE, bench->requestor.window, CurrentTime);
+
+    if (!bench_wait (&bench->fetched))
+    {
+        g_printerr ("Fetching the clipboard from the manager timed out\n");
+        return FALSE;
+    }
+
+    *fetch_time = g_get_monotonic_time () - start;
+
+    return TRUE;
+}
+
+
+
+static gint
+bench_compare_time (gconstpointer a,
+                    gconstpointer b)
+{
+    gint64 ta = *(const gint64 *) a;
+    gint64 tb = *(const gint64 *) b;
+
+    if (ta == tb)
+        return 0;
+
+    return ta < tb ? -1 : 1;
+}
+
+
+
+static void
+bench_report (const gchar *name,
+              gsize        bytes,
+              GArray      *times)
+{
+    gint64 total = 0, p50, p99;
+    guint  i;
+
+    for (i = 0; i < times->len; i++)
+        total += g_array_index (times, gint64, i);
+
+    g_array_sort (times, bench_compare_time);
+    p50 = g_array_index (times, gint64, times->len * 50 / 100);
+    p99 = g_array_index (times, gint64, times->len * 99 / 100);
+
+    g_print ("  %-6s %10.1f MB/s   p50 %9.2f ms   p99 %9.2f ms\n", name,
+             total > 0 ? (bytes * times->len) / (gdouble) total : 0.0,
+             p50 / 1000.0, p99 / 1000.0);
+}
+
+
+
+static gboolean
+bench_run (Bench       *bench,
+           const gchar *sizes)
+{
+    gchar  **sizev;
+    gsize    size;
+    GArray  *save_times, *fetch_times;
+    gint64   save_time, fetch_time;
+    guint    i, round;
+    gboolean succeed = TRUE;
+
+    save_times = g_array_sized_new (FALSE, FALSE, sizeof (gint64), opt_iterations);
+    fetch_times = g_array_sized_new (FALSE, FALSE, sizeof (gint64), opt_iterations);
+
+    sizev = g_strsplit (sizes, ",", -1);
+    for (i = 0; succeed && sizev[i] != NULL; i++)
+    {
+        size = g_ascii_strtoull (sizev[i], NULL, 10);
+        if (size == 0)
+            continue;
+
+        g_array_set_size (save_times, 0);
+        g_array_set_size (fetch_times, 0);
+
+        for (round = 0; round < (guint) opt_iterations; round++)
+        {
+            if (!bench_round (bench, size, round, &save_time, &fetch_time))
+            {
+                succeed = FALSE;
+                break;
+            }
+
+            g_array_append_val (save_times, save_time);
+            g_array_append_val (fetch_times, fetch_time);
+        }
+
+        if (save_times->len == 0)
+            break;
+
+        g_print ("%" G_GSIZE_FORMAT " bytes x %u targets%s\n", size, bench->n_targets,
+                 size > bench->chunk_size ? " (INCR)" : "");
+        bench_report ("save", size * bench->n_targets, save_times);
+        bench_report ("fetch", size * bench->n_targets, fetch_times);
+    }
+
+    g_strfreev (sizev);
+    g_array_free (save_times, TRUE);
+    g_array_free (fetch_times, TRUE);
+
+    return succeed && bench->n_errors == 0;
+}
+
+
+
+static GPid
+bench_spawn_xvfb (const gchar  *xvfb,
+                  gint         *out_fd,
+                  GError      **error)
+{
+    gchar   *argv[] = { (gchar *) xvfb, (gchar *) "-displayfd", (gchar *) "1",
+                        (gchar *) "-screen", (gchar *) "0", (gchar *) "1024x768x24",
+                        (gchar *) "-nolisten", (gchar *) "tcp", NULL };
+    GPid     pid;
+    GString *display_name;
+    gchar    c;
+    ssize_t  n;
+
+    if (!g_spawn_async_with_pipes (NULL, argv, NULL,
+                                   G_SPAWN_SEARCH_PATH | G_SPAWN_DO_NOT_REAP_CHILD
+                                   | G_SPAWN_STDERR_TO_DEV_NULL,
+                                   NULL, NULL, &pid, NULL, out_fd, NULL, error))
+        return 0;
+
+    /* the server writes its display number once it accepts connections */
+    display_name = g_string_new (":");
+    for (;;)
+    {
+        n = read (*out_fd, &c, 1);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n != 1 || c == '\n')
+            break;
+        g_string_append_c (display_name, c);
+    }
+
+    if (display_name->len == 1)
+    {
+        g_set_error (error, G_SPAWN_ERROR, G_SPAWN_ERROR_FAILED,
+                     "%s did not report a display number", xvfb);
+        g_string_free (display_name, TRUE);
+
+        kill (pid, SIGTERM);
+        waitpid (pid, NULL, 0);
+        g_spawn_close_pid (pid);
+        close (*out_fd);
+
+        return 0;
+    }
+
+    g_setenv ("DISPLAY", display_name->str, TRUE);
+    g_string_free (display_name, TRUE);
+
+    return pid;
+}
+
+
+
+gint
+main (gint    argc,
+      gchar **argv)
+{
+    GOptionContext      *context;
+    GError              *error = NULL;
+    GPid                 xvfb_pid = 0;
+    gint                 xvfb_fd = -1;
+    Bench                bench;
+    GsdClipboardManager *manager = NULL;
+    GsdClipboardStats    stats;
+    gulong               max_request_size;
+    gchar                name[64];
+    guint                i;
+    gint                 retval = EXIT_FAILURE;
+
+    context = g_option_context_new (NULL);
+    g_option_context_add_main_entries (context, option_entries, NULL);
+    if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+        g_printerr ("%s: %s\n", G_LOG_DOMAIN, error->message);
+        g_error_free (error);
+        g_option_context_free (context);
+        return EXIT_FAILURE;
+    }
+    g_option_context_free (context);
+
+    if (opt_targets < 1 || opt_iterations < 1)
+    {
+        g_printerr ("%s: at least one target and iteration are needed\n", G_LOG_DOMAIN);
+        return EXIT_FAILURE;
+    }
+
+    if (opt_display != NULL)
+    {
+        g_setenv ("DISPLAY", opt_display, TRUE);
+    }
+    else
+    {
+        xvfb_pid = bench_spawn_xvfb (opt_xvfb != NULL ? opt_xvfb : "Xvfb", &xvfb_fd, &error);
+        if (xvfb_pid == 0)
+        {
+            g_printerr ("%s: failed to start Xvfb: %s\n", G_LOG_DOMAIN, error->message);
+            g_error_free (error);
+            return EXIT_FAILURE;
+        }
+    }
+
+    memset (&bench, 0, sizeof (bench));
+
+    if (!gtk_init_check (&argc, &argv))
+    {
+        g_printerr ("%s: unable to open display %s\n", G_LOG_DOMAIN, g_getenv ("DISPLAY"));
+        goto out;
+    }
+
+    if (!xfconf_init (&error))
+    {
+        g_printerr ("%s: failed to connect to xfconfd: %s\n", G_LOG_DOMAIN, error->message);
+        g_error_free (error);
+        goto out;
+    }
+
+    if (!bench_client_open (&bench, &bench.owner, bench_owner_event)
+        || !bench_client_open (&bench, &bench.requestor, bench_requestor_event))
+    {
+        g_printerr ("%s: unable to open the client connections\n", G_LOG_DOMAIN);
+        goto out_xfconf;
+    }
+
+    XA_ATOM_PAIR = XInternAtom (bench.owner.dpy, "ATOM_PAIR", False);
+    XA_CLIPBOARD = XInternAtom (bench.owner.dpy, "CLIPBOARD", False);
+    XA_CLIPBOARD_MANAGER = XInternAtom (bench.owner.dpy, "CLIPBOARD_MANAGER", False);
+    XA_INCR = XInternAtom (bench.owner.dpy, "INCR", False);
+    XA_MULTIPLE = XInternAtom (bench.owner.dpy, "MULTIPLE", False);
+    XA_SAVE_TARGETS = XInternAtom (bench.owner.dpy, "SAVE_TARGETS", False);
+    XA_TARGETS = XInternAtom (bench.owner.dpy, "TARGETS", False);
+    XA_BENCH_SAVE = XInternAtom (bench.owner.dpy, "_XFSETTINGSD_BENCH_SAVE", False);
+    XA_BENCH_MULTIPLE = XInternAtom (bench.owner.dpy, "_XFSETTINGSD_BENCH_MULTIPLE", False);
+
+    /* chunks of the owner, as a toolkit would send them */
+    max_request_size = XExtendedMaxRequestSize (bench.owner.dpy);
+    if (max_request_size == 0)
+        max_request_size = XMaxRequestSize (bench.owner.dpy);
+    bench.chunk_size = MIN (max_request_size * 4 - 100, BENCH_CHUNK_MAX);
+
+    bench.n_targets = opt_targets;
+    bench.targets = g_new0 (BenchTarget, bench.n_targets);
+    for (i = 0; i < bench.n_targets; i++)
+    {
+        g_snprintf (name, sizeof (name), "application/x-xfsettingsd-bench-%u", i);
+        bench.targets[i].target = XInternAtom (bench.owner.dpy, name, False);
+
+        g_snprintf (name, sizeof (name), "_XFSETTINGSD_BENCH_PROP_%u", i);
+        bench.targets[i].property = XInternAtom (bench.owner.dpy, name, False);
+    }
+
+    /* every target is saved and fetched back, so the total of the
+     * targets must not be limited by the budget */
+    xfconf_channel_set_int (xfconf_channel_get ("clipboard"), "/MaxTotalSize", -1);
+
+    manager = g_object_new (GSD_TYPE_CLIPBOARD_MANAGER, NULL);
+    if (!gsd_clipboard_manager_start (manager, TRUE))
+    {
+        g_printerr ("%s: failed to start the clipboard manager\n", G_LOG_DOMAIN);
+        goto out_clients;
+    }
+
+    if (bench_run (&bench, opt_sizes != NULL ? opt_sizes : "1048576,8388608,67108864,536870912"))
+        retval = EXIT_SUCCESS;
+
+    gsd_clipboard_manager_get_stats (manager, &stats);
+    g_print ("peak RSS %ld KiB\n", stats.peak_rss);
+
+    if (bench.n_errors > 0)
+        g_printerr ("%u targets were not received correctly\n", bench.n_errors);
+
+    gsd_clipboard_manager_stop (manager);
+
+out_clients:
+    if (manager != NULL)
+        g_object_unref (manager);
+
+    for (i = 0; i < bench.n_targets; i++)
+        g_free (bench.targets[i].data);
+    g_free (bench.targets);
+
+    while (bench.transfers != NULL)
+    {
+        g_slice_free (BenchTransfer, bench.transfers->data);
+        bench.transfers = g_slist_delete_link (bench.transfers, bench.transfers);
+    }
+
+    bench_client_close (&bench.owner);
+    bench_client_close (&bench.requestor);
+
+out_xfconf:
+    xfconf_shutdown ();
+
+out:
+    if (xvfb_pid != 0)
+    {
+        kill (xvfb_pid, SIGTERM);
+        waitpid (xvfb_pid, NULL, 0);
+        g_spawn_close_pid (xvfb_pid);
+        close (xvfb_fd);
+    }
+
+    return retval;
+}
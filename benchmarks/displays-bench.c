@@ -0,0 +1,566 @@
+/*
+ *  Copyright (c) 2015 The Xfce development team
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Latency and request count benchmark of the displays helper. The helper
+ * runs in this process on the fake RandR backend, no X server is needed.
+ * The screen is a laptop panel with a dock that adds two monitors:
+ *
+ *  - scheme apply: the schemes "Docked" and "DockedLeft" are applied in
+ *    turn through "/Schemes/Apply", until the helper removed the property
+ *    again.
+ *  - dock and undock: the monitors are plugged in and out, the links
+ *    bounce a few times like on a real dock. The time runs from the last
+ *    change until the helper restored the layout of the monitors, so it
+ *    includes the delay the helper waits for the outputs to settle.
+ *
+ * For each the p50/p99 latencies and the number of requests sent to the
+ * backend are reported, the requests include those of the changes the
+ * backend notified afterwards.
+ *
+ * The helper reads the schemes from xfconf, run it with a private
+ * session bus and configuration, see "make benchmark".
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+
+#include <glib.h>
+#include <glib-object.h>
+#include <xfconf/xfconf.h>
+
+#include <common/displays-backend-fake.h>
+#include <xfsettingsd/displays.h>
+
+
+
+/* seconds before an apply is considered lost */
+#define BENCH_TIMEOUT (30)
+
+/* milliseconds, longer than the helper waits for the outputs to settle */
+#define BENCH_SETTLE  (1000)
+
+#define APPLY_SCHEME_PROP "/Schemes/Apply"
+
+
+
+typedef struct _Bench Bench;
+
+
+
+struct _Bench
+{
+    XfceDisplaysBackend *backend;
+    XfconfChannel       *channel;
+
+    RRMode               mode_panel;
+    RRMode               mode_wide;
+    RRMode               mode_full;
+    RROutput             lvds;
+    RROutput             dp;
+    RROutput             hdmi;
+
+    /* ungrab of the fake backend, wrapped to see the applies end */
+    gboolean           (*ungrab) (XfceDisplaysBackend *backend);
+    gboolean             ungrabbed;
+
+    /* the helper removed the apply property */
+    gboolean             applied;
+};
+
+
+
+static gint      opt_iterations = 10;
+static gint      opt_bounces = 2;
+static gint      opt_gap = 50;
+
+
+
+static GOptionEntry option_entries[] =
+{
+    { "iterations", 'n', 0, G_OPTION_ARG_INT, &opt_iterations, "Applies and docks of each kind", "N" },
+    { "bounces", 'b', 0, G_OPTION_ARG_INT, &opt_bounces, "Times the links go down and up again when docking", "N" },
+    { "gap", 'g', 0, G_OPTION_ARG_INT, &opt_gap, "Milliseconds between the output changes of a dock", "MS" },
+    { NULL }
+};
+
+
+
+/* the backend has no user data, the wrapper finds the bench here */
+static Bench *bench_instance = NULL;
+
+
+
+static gboolean
+bench_ungrab (XfceDisplaysBackend *backend)
+{
+    bench_instance->ungrabbed = TRUE;
+
+    return bench_instance->ungrab (backend);
+}
+
+
+
+static void
+bench_property_changed (XfconfChannel *channel,
+                        const gchar   *property_name,
+                        const GValue  *value,
+                        Bench         *bench)
+{
+    if (strcmp (property_name, APPLY_SCHEME_PROP) == 0
+        && !G_VALUE_HOLDS_STRING (value))
+        bench->applied = TRUE;
+}
+
+
+
+static gboolean
+bench_wait_timeout (gpointer user_data)
+{
+    *((gboolean *) user_data) = TRUE;
+
+    return FALSE;
+}
+
+
+
+static gboolean
+bench_wait (gboolean *done)
+{
+    gboolean timed_out = FALSE;
+    guint    timeout_id;
+
+    timeout_id = g_timeout_add_seconds (BENCH_TIMEOUT, bench_wait_timeout, &timed_out);
+
+    while (!*done && !timed_out)
+        g_main_context_iteration (NULL, TRUE);
+
+    if (!timed_out)
+        g_source_remove (timeout_id);
+
+    return !timed_out;
+}
+
+
+
+static void
+bench_sleep (guint ms)
+{
+    gboolean done = FALSE;
+
+    g_timeout_add (ms, bench_wait_timeout, &done);
+
+    while (!done)
+        g_main_context_iteration (NULL, TRUE);
+}
+
+
+
+/* deliver the changes the backend still has to notify */
+static void
+bench_drain (void)
+{
+    while (g_main_context_iteration (NULL, FALSE))
+        ;
+}
+
+
+
+/* number of configured CRTCs, the requests of the check are not counted */
+static gint
+bench_count_active (Bench *bench)
+{
+    XfceDisplaysResources *resources;
+    XfceDisplaysCrtcInfo  *crtc_info;
+    guint                  n_requests = bench->backend->n_requests;
+    gint                   n, active = 0;
+
+    resources = bench->backend->get_screen_resources (bench->backend, TRUE);
+    for (n = 0; n < resources->ncrtc; n++)
+    {
+        crtc_info = bench->backend->get_crtc_info (bench->backend, resources, resources->crtcs[n]);
+        if (crtc_info != NULL && crtc_info->mode != None)
+            active++;
+        xfce_displays_crtc_info_free (crtc_info);
+    }
+    xfce_displays_resources_free (resources);
+
+    bench->backend->n_requests = n_requests;
+
+    return active;
+}
+
+
+
+static void
+bench_set_output (Bench       *bench,
+                  const gchar *scheme,
+                  const gchar *output,
+                  gboolean     active,
+                  const gchar *resolution,
+                  gint         x,
+                  gboolean     primary)
+{
+    gchar property[512];
+
+    g_snprintf (property, sizeof (property), "/%s/%s", scheme, output);
+    xfconf_channel_set_string (bench->channel, property, output);
+
+    g_snprintf (property, sizeof (property), "/%s/%s/Active", scheme, output);
+    xfconf_channel_set_bool (bench->channel, property, active);
+
+    if (!active)
+        return;
+
+    g_snprintf (property, sizeof (property), "/%s/%s/Resolution", scheme, output);
+    xfconf_channel_set_string (bench->channel, property, resolution);
+    g_snprintf (property, sizeof (property), "/%s/%s/RefreshRate", scheme, output);
+    xfconf_channel_set_double (bench->channel, property, 60.0);
+    g_snprintf (property, sizeof (property), "/%s/%s/Rotation", scheme, output);
+    xfconf_channel_set_int (bench->channel, property, 0);
+    g_snprintf (property, sizeof (property), "/%s/%s/Reflection", scheme, output);
+    xfconf_channel_set_string (bench->channel, property, "0");
+    g_snprintf (property, sizeof (property), "/%s/%s/Position/X", scheme, output);
+    xfconf_channel_set_int (bench->channel, property, x);
+    g_snprintf (property, sizeof (property), "/%s/%s/Position/Y", scheme, output);
+    xfconf_channel_set_int (bench->channel, property, 0);
+    g_snprintf (property, sizeof (property), "/%s/%s/Primary", scheme, output);
+    xfconf_channel_set_bool (bench->channel, property, primary);
+}
+
+
+
+static void
+bench_setup (Bench *bench)
+{
+    XfceDisplaysBackend *backend;
+
+    backend = xfce_displays_backend_fake_new ();
+    bench->backend = backend;
+
+    bench->mode_panel = xfce_displays_backend_fake_add_mode (backend, 1366, 768, 60.0);
+    bench->mode_full = xfce_displays_backend_fake_add_mode (backend, 1920, 1080, 60.0);
+    bench->mode_wide = xfce_displays_backend_fake_add_mode (backend, 2560, 1440, 60.0);
+    xfce_displays_backend_fake_add_mode (backend, 1280, 1024, 60.0);
+    xfce_displays_backend_fake_add_mode (backend, 1024, 768, 60.0);
+
+    xfce_displays_backend_fake_add_crtc (backend, RR_Rotate_90 | RR_Rotate_180 | RR_Rotate_270);
+    xfce_displays_backend_fake_add_crtc (backend, RR_Rotate_90 | RR_Rotate_180 | RR_Rotate_270);
+    xfce_displays_backend_fake_add_crtc (backend, RR_Rotate_90 | RR_Rotate_180 | RR_Rotate_270);
+
+    bench->lvds = xfce_displays_backend_fake_add_output (backend, "LVDS1");
+    bench->dp = xfce_displays_backend_fake_add_output (backend, "DP1");
+    bench->hdmi = xfce_displays_backend_fake_add_output (backend, "HDMI1");
+
+    xfce_displays_backend_fake_connect (backend, bench->lvds, 344, 194,
+                                        &bench->mode_panel, 1, 1);
+
+    /* the laptop alone, and two layouts on the dock */
+    bench->channel = xfconf_channel_get ("displays");
+    xfconf_channel_reset_property (bench->channel, "/", TRUE);
+    xfconf_channel_set_bool (bench->channel, "/Notify", FALSE);
+
+    bench_set_output (bench, "Default", "LVDS1", TRUE, "1366x768", 0, TRUE);
+
+    bench_set_output (bench, "Docked", "LVDS1", FALSE, NULL, 0, FALSE);
+    bench_set_output (bench, "Docked", "DP1", TRUE, "2560x1440", 0, TRUE);
+    bench_set_output (bench, "Docked", "HDMI1", TRUE, "1920x1080", 2560, FALSE);
+
+    bench_set_output (bench, "DockedLeft", "LVDS1", FALSE, NULL, 0, FALSE);
+    bench_set_output (bench, "DockedLeft", "DP1", TRUE, "2560x1440", 1920, TRUE);
+    bench_set_output (bench, "DockedLeft", "HDMI1", TRUE, "1920x1080", 0, FALSE);
+
+    g_signal_connect (G_OBJECT (bench->channel), "property-changed",
+                      G_CALLBACK (bench_property_changed), bench);
+
+    bench->ungrab = backend->ungrab;
+    backend->ungrab = bench_ungrab;
+    bench_instance = bench;
+}
+
+
+
+static gboolean
+bench_apply (Bench       *bench,
+             const gchar *scheme,
+             gint64      *time,
+             guint       *n_requests)
+{
+    guint  start_requests = bench->backend->n_requests;
+    gint64 start;
+
+    bench->applied = FALSE;
+
+    start = g_get_monotonic_time ();
+    xfconf_channel_set_string (bench->channel, APPLY_SCHEME_PROP, scheme);
+
+    if (!bench_wait (&bench->applied))
+    {
+        g_printerr ("The helper did not apply scheme %s\n", scheme);
+        return FALSE;
+    }
+
+    *time = g_get_monotonic_time () - start;
+
+    bench_drain ();
+    *n_requests = bench->backend->n_requests - start_requests;
+
+    return TRUE;
+}
+
+
+
+static void
+bench_plug (Bench    *bench,
+            gboolean  dock)
+{
+    XfceDisplaysBackend *backend = bench->backend;
+    gint                 n;
+    RRMode               wide_modes[] = { bench->mode_wide, bench->mode_full };
+    RRMode               full_modes[] = { bench->mode_full };
+
+    if (dock)
+    {
+        xfce_displays_backend_fake_connect (backend, bench->dp, 597, 336, wide_modes, 2, 2);
+        bench_sleep (opt_gap);
+        xfce_displays_backend_fake_connect (backend, bench->hdmi, 477, 268, full_modes, 1, 3);
+
+        /* the links are trained again */
+        for (n = 0; n < opt_bounces; n++)
+        {
+            bench_sleep (opt_gap);
+            xfce_displays_backend_fake_disconnect (backend, bench->dp);
+            bench_sleep (opt_gap);
+            xfce_displays_backend_fake_connect (backend, bench->dp, 597, 336, wide_modes, 2, 2);
+        }
+    }
+    else
+    {
+        xfce_displays_backend_fake_disconnect (backend, bench->hdmi);
+        bench_sleep (opt_gap);
+        xfce_displays_backend_fake_disconnect (backend, bench->dp);
+    }
+}
+
+
+
+static gboolean
+bench_dock (Bench    *bench,
+            gboolean  dock,
+            gint64   *time,
+            guint    *n_requests)
+{
+    guint  start_requests = bench->backend->n_requests;
+    gint64 start;
+
+    bench_plug (bench, dock);
+
+    bench->ungrabbed = FALSE;
+    start = g_get_monotonic_time ();
+
+    if (!bench_wait (&bench->ungrabbed))
+    {
+        g_printerr ("The helper did not restore the layout after %s\n",
+                    dock ? "docking" : "undocking");
+        return FALSE;
+    }
+
+    *time = g_get_monotonic_time () - start;
+
+    bench_drain ();
+    *n_requests = bench->backend->n_requests - start_requests;
+
+    if (bench_count_active (bench) != (dock ? 2 : 1))
+    {
+        g_printerr ("Wrong layout after %s\n", dock ? "docking" : "undocking");
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+
+
+static gint
+bench_compare_time (gconstpointer a,
+                    gconstpointer b)
+{
+    gint64 ta = *(const gint64 *) a;
+    gint64 tb = *(const gint64 *) b;
+
+    if (ta == tb)
+        return 0;
+
+    return ta < tb ? -1 : 1;
+}
+
+
+
+static void
+bench_report (const gchar *name,
+              GArray      *times,
+              guint        n_requests)
+{
+    gint64 p50, p99;
+
+    g_array_sort (times, bench_compare_time);
+    p50 = g_array_index (times, gint64, times->len * 50 / 100);
+    p99 = g_array_index (times, gint64, times->len * 99 / 100);
+
+    g_print ("  %-7s p50 %9.2f ms   p99 %9.2f ms   %6.1f requests\n", name,
+             p50 / 1000.0, p99 / 1000.0, n_requests / (gdouble) times->len);
+}
+
+
+
+static gboolean
+bench_run (Bench *bench)
+{
+    GArray   *apply_times, *dock_times, *undock_times;
+    guint     apply_requests = 0, dock_requests = 0, undock_requests = 0;
+    gint64    time;
+    guint     n_requests;
+    gint      i;
+    gboolean  succeed = FALSE;
+
+    apply_times = g_array_sized_new (FALSE, FALSE, sizeof (gint64), 2 * opt_iterations);
+    dock_times = g_array_sized_new (FALSE, FALSE, sizeof (gint64), opt_iterations);
+    undock_times = g_array_sized_new (FALSE, FALSE, sizeof (gint64), opt_iterations);
+
+    /* the helper remembers the applied schemes for the monitors, so
+     * both layouts are restored when the outputs change. The first time
+     * it knows nothing about the dock and leaves the monitors off */
+    if (!bench_apply (bench, "Default", &time, &n_requests))
+        goto out;
+    bench_plug (bench, TRUE);
+    bench_sleep (BENCH_SETTLE);
+    if (!bench_apply (bench, "Docked", &time, &n_requests))
+        goto out;
+
+    for (i = 0; i < opt_iterations; i++)
+    {
+        if (!bench_apply (bench, "DockedLeft", &time, &n_requests))
+            goto out;
+        g_array_append_val (apply_times, time);
+        apply_requests += n_requests;
+
+        if (!bench_apply (bench, "Docked", &time, &n_requests))
+            goto out;
+        g_array_append_val (apply_times, time);
+        apply_requests += n_requests;
+    }
+
+    for (i = 0; i < opt_iterations; i++)
+    {
+        if (!bench_dock (bench, FALSE, &time, &n_requests))
+            goto out;
+        g_array_append_val (undock_times, time);
+        undock_requests += n_requests;
+
+        if (!bench_dock (bench, TRUE, &time, &n_requests))
+            goto out;
+        g_array_append_val (dock_times, time);
+        dock_requests += n_requests;
+    }
+
+    g_print ("scheme apply\n");
+    bench_report ("apply", apply_times, apply_requests);
+    g_print ("dock with %d bounces, %d ms apart (includes the settle delay)\n",
+             opt_bounces, opt_gap);
+    bench_report ("dock", dock_times, dock_requests);
+    bench_report ("undock", undock_times, undock_requests);
+
+    succeed = TRUE;
+
+out:
+    g_array_free (apply_times, TRUE);
+    g_array_free (dock_times, TRUE);
+    g_array_free (undock_times, TRUE);
+
+    return succeed;
+}
+
+
+
+gint
+main (gint    argc,
+      gchar **argv)
+{
+    GOptionContext *context;
+    GError         *error = NULL;
+    Bench           bench;
+    GObject        *helper;
+    gint            retval = EXIT_FAILURE;
+
+    context = g_option_context_new (NULL);
+    g_option_context_add_main_entries (context, option_entries, NULL);
+    if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+        g_printerr ("%s: %s\n", G_LOG_DOMAIN, error->message);
+        g_error_free (error);
+        g_option_context_free (context);
+        return EXIT_FAILURE;
+    }
+    g_option_context_free (context);
+
+    if (opt_iterations < 1 || opt_bounces < 0 || opt_gap < 0)
+    {
+        g_printerr ("%s: invalid iterations, bounces or gap\n", G_LOG_DOMAIN);
+        return EXIT_FAILURE;
+    }
+
+#if !GLIB_CHECK_VERSION (2, 36, 0)
+    g_type_init ();
+#endif
+
+    if (!xfconf_init (&error))
+    {
+        g_printerr ("%s: failed to connect to xfconfd: %s\n", G_LOG_DOMAIN, error->message);
+        g_error_free (error);
+        return EXIT_FAILURE;
+    }
+
+    memset (&bench, 0, sizeof (bench));
+    bench_setup (&bench);
+
+    /* the helper owns the backend */
+    helper = g_object_new (XFCE_TYPE_DISPLAYS_HELPER, "backend", bench.backend, NULL);
+    bench_drain ();
+
+    if (bench_count_active (&bench) != 1)
+        g_printerr ("%s: the helper did not enable the panel\n", G_LOG_DOMAIN);
+    else if (bench_run (&bench))
+        retval = EXIT_SUCCESS;
+
+    g_signal_handlers_disconnect_by_func (G_OBJECT (bench.channel),
+                                          G_CALLBACK (bench_property_changed), &bench);
+    g_object_unref (helper);
+
+    xfconf_shutdown ();
+
+    return retval;
+}
@@ -0,0 +1,857 @@
+/*
+ *  Copyright (c) 2015 The Xfce development team
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * A backend without X server, the screen is a set of CRTCs, outputs and
+ * modes kept in memory. It behaves like a RandR 1.3 server for the
+ * requests the displays helper and the dialog send: changes are
+ * notified from the main loop, after the request returned, and
+ * configuring a CRTC with an outdated configuration timestamp fails.
+ * Monitors are plugged in and out with xfce_displays_backend_fake_connect
+ * and xfce_displays_backend_fake_disconnect.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#include <glib.h>
+
+#include "displays-backend-fake.h"
+
+
+
+#define FAKE_MIN_SIZE  (320)
+#define FAKE_MAX_SIZE  (8192)
+
+#define EDID_LENGTH    (128)
+
+
+
+typedef struct _XfceDisplaysBackendFake XfceDisplaysBackendFake;
+typedef struct _FakeCrtc                FakeCrtc;
+typedef struct _FakeOutput              FakeOutput;
+
+
+
+struct _XfceDisplaysBackendFake
+{
+    XfceDisplaysBackend  __parent__;
+
+    XID                  next_id;
+    Time                 config_timestamp;
+
+    GArray              *modes;
+    GPtrArray           *crtcs;
+    GPtrArray           *outputs;
+
+    gint                 width;
+    gint                 height;
+    gint                 mm_width;
+    gint                 mm_height;
+    RROutput             primary;
+
+    /* set when a request between grab and ungrab failed */
+    guint                grabbed : 1;
+    guint                failed : 1;
+
+    /* events waiting for the main loop */
+    gboolean             selected;
+    GArray              *events;
+    guint                events_id;
+};
+
+struct _FakeCrtc
+{
+    RRCrtc    id;
+    gint      x;
+    gint      y;
+    RRMode    mode;
+    Rotation  rotation;
+    Rotation  rotations;
+    GArray   *outputs;
+};
+
+struct _FakeOutput
+{
+    RROutput    id;
+    gchar      *name;
+    Connection  connection;
+    RRCrtc      crtc;
+    gulong      mm_width;
+    gulong      mm_height;
+    GArray     *modes;
+    guchar     *edid;
+};
+
+
+
+static gboolean
+xfce_displays_backend_fake_dispatch (gpointer data)
+{
+    XfceDisplaysBackendFake *fake = data;
+    XfceDisplaysEvent        event;
+    guint                    n, len = fake->events->len;
+
+    fake->events_id = 0;
+
+    /* events of the requests sent by the handlers wait for the next
+     * iteration, like the replies of the server */
+    for (n = 0; n < len && n < fake->events->len; ++n)
+    {
+        event = g_array_index (fake->events, XfceDisplaysEvent, n);
+        xfce_displays_backend_notify ((XfceDisplaysBackend *) fake, &event);
+    }
+
+    g_array_remove_range (fake->events, 0, MIN (n, fake->events->len));
+
+    return FALSE;
+}
+
+
+
+static void
+xfce_displays_backend_fake_queue (XfceDisplaysBackendFake *fake,
+                                  XfceDisplaysEventType    type,
+                                  RRCrtc                   crtc,
+                                  RROutput                 output,
+                                  Connection               connection)
+{
+    XfceDisplaysEvent event;
+
+    if (!fake->selected)
+        return;
+
+    event.type = type;
+    event.crtc = crtc;
+    event.output = output;
+    event.connection = connection;
+    g_array_append_val (fake->events, event);
+
+    if (fake->events_id == 0)
+        fake->events_id = g_idle_add (xfce_displays_backend_fake_dispatch, fake);
+}
+
+
+
+static FakeCrtc *
+xfce_displays_backend_fake_find_crtc (XfceDisplaysBackendFake *fake,
+                                      RRCrtc                   id)
+{
+    FakeCrtc *crtc;
+    guint     n;
+
+    for (n = 0; n < fake->crtcs->len; ++n)
+    {
+        crtc = g_ptr_array_index (fake->crtcs, n);
+        if (crtc->id == id)
+            return crtc;
+    }
+
+    return NULL;
+}
+
+
+
+static FakeOutput *
+xfce_displays_backend_fake_find_output (XfceDisplaysBackendFake *fake,
+                                        RROutput                 id)
+{
+    FakeOutput *output;
+    guint       n;
+
+    for (n = 0; n < fake->outputs->len; ++n)
+    {
+        output = g_ptr_array_index (fake->outputs, n);
+        if (output->id == id)
+            return output;
+    }
+
+    return NULL;
+}
+
+
+
+static const XfceDisplaysModeInfo *
+xfce_displays_backend_fake_find_mode (XfceDisplaysBackendFake *fake,
+                                      RRMode                   id)
+{
+    guint n;
+
+    for (n = 0; n < fake->modes->len; ++n)
+    {
+        if (g_array_index (fake->modes, XfceDisplaysModeInfo, n).id == id)
+            return &g_array_index (fake->modes, XfceDisplaysModeInfo, n);
+    }
+
+    return NULL;
+}
+
+
+
+static gboolean
+xfce_displays_backend_fake_query_version (XfceDisplaysBackend *backend,
+                                          gint                *major,
+                                          gint                *minor)
+{
+    backend->n_requests++;
+
+    *major = 1;
+    *minor = 3;
+
+    return TRUE;
+}
+
+
+
+static XfceDisplaysResources *
+xfce_displays_backend_fake_get_screen_resources (XfceDisplaysBackend *backend,
+                                                 gboolean             current)
+{
+    XfceDisplaysBackendFake *fake = (XfceDisplaysBackendFake *) backend;
+    XfceDisplaysResources   *resources;
+    guint                    n;
+
+    backend->n_requests++;
+
+    resources = g_slice_new0 (XfceDisplaysResources);
+    resources->config_timestamp = fake->config_timestamp;
+
+    resources->ncrtc = fake->crtcs->len;
+    resources->crtcs = g_new (RRCrtc, fake->crtcs->len);
+    for (n = 0; n < fake->crtcs->len; ++n)
+        resources->crtcs[n] = ((FakeCrtc *) g_ptr_array_index (fake->crtcs, n))->id;
+
+    resources->noutput = fake->outputs->len;
+    resources->outputs = g_new (RROutput, fake->outputs->len);
+    for (n = 0; n < fake->outputs->len; ++n)
+        resources->outputs[n] = ((FakeOutput *) g_ptr_array_index (fake->outputs, n))->id;
+
+    resources->nmode = fake->modes->len;
+    resources->modes = g_memdup (fake->modes->data,
+                                 fake->modes->len * sizeof (XfceDisplaysModeInfo));
+
+    return resources;
+}
+
+
+
+static gboolean
+xfce_displays_backend_fake_get_screen_size_range (XfceDisplaysBackend *backend,
+                                                  gint                *min_width,
+                                                  gint                *min_height,
+                                                  gint                *max_width,
+                                                  gint                *max_height)
+{
+    backend->n_requests++;
+
+    *min_width = *min_height = FAKE_MIN_SIZE;
+    *max_width = *max_height = FAKE_MAX_SIZE;
+
+    return TRUE;
+}
+
+
+
+static void
+xfce_displays_backend_fake_get_screen_size (XfceDisplaysBackend *backend,
+                                            gint                *width,
+                                            gint                *height,
+                                            gint                *mm_width,
+                                            gint                *mm_height)
+{
+    XfceDisplaysBackendFake *fake = (XfceDisplaysBackendFake *) backend;
+
+    *width = fake->width;
+    *height = fake->height;
+    *mm_width = fake->mm_width;
+    *mm_height = fake->mm_height;
+}
+
+
+
+static XfceDisplaysOutputInfo *
+xfce_displays_backend_fake_get_output_info (XfceDisplaysBackend   *backend,
+                                            XfceDisplaysResources *resources,
+                                            RROutput               id)
+{
+    XfceDisplaysBackendFake *fake = (XfceDisplaysBackendFake *) backend;
+    XfceDisplaysOutputInfo  *info;
+    FakeOutput              *output;
+    guint                    n;
+
+    backend->n_requests++;
+
+    output = xfce_displays_backend_fake_find_output (fake, id);
+    if (output == NULL)
+        return NULL;
+
+    info = g_slice_new0 (XfceDisplaysOutputInfo);
+    info->id = output->id;
+    info->name = g_strdup (output->name);
+    info->connection = output->connection;
+    info->crtc = output->crtc;
+    info->mm_width = output->mm_width;
+    info->mm_height = output->mm_height;
+
+    /* every CRTC drives every output, and outputs do not clone */
+    info->ncrtc = fake->crtcs->len;
+    info->crtcs = g_new (RRCrtc, fake->crtcs->len);
+    for (n = 0; n < fake->crtcs->len; ++n)
+        info->crtcs[n] = ((FakeCrtc *) g_ptr_array_index (fake->crtcs, n))->id;
+
+    /* the first mode of the monitor is the preferred one */
+    info->nmode = output->modes->len;
+    info->npreferred = MIN (output->modes->len, 1);
+    info->modes = g_memdup (output->modes->data, output->modes->len * sizeof (RRMode));
+
+    return info;
+}
+
+
+
+static guchar *
+xfce_displays_backend_fake_get_edid (XfceDisplaysBackend *backend,
+                                     RROutput             id,
+                                     gsize               *length)
+{
+    XfceDisplaysBackendFake *fake = (XfceDisplaysBackendFake *) backend;
+    FakeOutput              *output;
+
+    backend->n_requests++;
+
+    *length = 0;
+
+    output = xfce_displays_backend_fake_find_output (fake, id);
+    if (output == NULL || output->edid == NULL)
+        return NULL;
+
+    *length = EDID_LENGTH;
+
+    return g_memdup (output->edid, EDID_LENGTH);
+}
+
+
+
+static XfceDisplaysCrtcInfo *
+xfce_displays_backend_fake_get_crtc_info (XfceDisplaysBackend   *backend,
+                                          XfceDisplaysResources *resources,
+                                          RRCrtc                 id)
+{
+    XfceDisplaysBackendFake    *fake = (XfceDisplaysBackendFake *) backend;
+    XfceDisplaysCrtcInfo       *info;
+    const XfceDisplaysModeInfo *mode_info;
+    FakeCrtc                   *crtc;
+    guint                       n;
+
+    backend->n_requests++;
+
+    crtc = xfce_displays_backend_fake_find_crtc (fake, id);
+    if (crtc == NULL)
+        return NULL;
+
+    info = g_slice_new0 (XfceDisplaysCrtcInfo);
+    info->id = crtc->id;
+    info->x = crtc->x;
+    info->y = crtc->y;
+    info->mode = crtc->mode;
+    info->rotation = crtc->rotation;
+    info->rotations = crtc->rotations;
+
+    mode_info = xfce_displays_backend_fake_find_mode (fake, crtc->mode);
+    if (mode_info != NULL)
+    {
+        if ((crtc->rotation & (RR_Rotate_90 | RR_Rotate_270)) != 0)
+        {
+            info->width = mode_info->height;
+            info->height = mode_info->width;
+        }
+        else
+        {
+            info->width = mode_info->width;
+            info->height = mode_info->height;
+        }
+    }
+
+    info->noutput = crtc->outputs->len;
+    info->outputs = g_memdup (crtc->outputs->data, crtc->outputs->len * sizeof (RROutput));
+
+    info->npossible = fake->outputs->len;
+    info->possible = g_new (RROutput, fake->outputs->len);
+    for (n = 0; n < fake->outputs->len; ++n)
+        info->possible[n] = ((FakeOutput *) g_ptr_array_index (fake->outputs, n))->id;
+
+    return info;
+}
+
+
+
+static Status
+xfce_displays_backend_fake_set_crtc_config (XfceDisplaysBackend   *backend,
+                                            XfceDisplaysResources *resources,
+                                            RRCrtc                 id,
+                                            gint                   x,
+                                            gint                   y,
+                                            RRMode                 mode,
+                                            Rotation               rotation,
+                                            RROutput              *outputs,
+                                            gint                   noutputs)
+{
+    XfceDisplaysBackendFake    *fake = (XfceDisplaysBackendFake *) backend;
+    const XfceDisplaysModeInfo *mode_info = NULL;
+    FakeCrtc                   *crtc;
+    FakeOutput                 *output;
+    guint                       n;
+    gint                        m, width, height;
+    gboolean                    supported;
+
+    backend->n_requests++;
+
+    /* the configuration changed since the resources were fetched */
+    if (resources->config_timestamp != fake->config_timestamp)
+        return RRSetConfigInvalidConfigTime;
+
+    crtc = xfce_displays_backend_fake_find_crtc (fake, id);
+    if (crtc == NULL)
+        goto failed;
+
+    if (mode != None)
+    {
+        mode_info = xfce_displays_backend_fake_find_mode (fake, mode);
+        if (mode_info == NULL || noutputs == 0
+            || (rotation & crtc->rotations) != rotation)
+            goto failed;
+
+        if ((rotation & (RR_Rotate_90 | RR_Rotate_270)) != 0)
+        {
+            width = mode_info->height;
+            height = mode_info->width;
+        }
+        else
+        {
+            width = mode_info->width;
+            height = mode_info->height;
+        }
+
+        /* like the server, the CRTC must fit in the screen */
+        if (x < 0 || y < 0 || x + width > fake->width || y + height > fake->height)
+            goto failed;
+
+        for (m = 0; m < noutputs; ++m)
+        {
+            output = xfce_displays_backend_fake_find_output (fake, outputs[m]);
+            if (output == NULL || output->connection != RR_Connected)
+                goto failed;
+
+            /* a BadMatch error on X */
+            supported = FALSE;
+            for (n = 0; n < output->modes->len && !supported; ++n)
+                supported = g_array_index (output->modes, RRMode, n) == mode;
+            if (!supported)
+                goto failed;
+        }
+    }
+    else if (noutputs != 0)
+    {
+        goto failed;
+    }
+
+    /* the outputs that leave the CRTC */
+    for (n = 0; n < crtc->outputs->len; ++n)
+    {
+        output = xfce_displays_backend_fake_find_output (fake, g_array_index (crtc->outputs, RROutput, n));
+        if (output != NULL && output->crtc == crtc->id)
+        {
+            output->crtc = None;
+            xfce_displays_backend_fake_queue (fake, XFCE_DISPLAYS_EVENT_OUTPUT,
+                                              None, output->id, output->connection);
+        }
+    }
+
+    crtc->x = mode != None ? x : 0;
+    crtc->y = mode != None ? y : 0;
+    crtc->mode = mode;
+    crtc->rotation = mode != None ? rotation : RR_Rotate_0;
+    g_array_set_size (crtc->outputs, 0);
+    g_array_append_vals (crtc->outputs, outputs, noutputs);
+
+    for (m = 0; m < noutputs; ++m)
+    {
+        output = xfce_displays_backend_fake_find_output (fake, outputs[m]);
+        output->crtc = crtc->id;
+        xfce_displays_backend_fake_queue (fake, XFCE_DISPLAYS_EVENT_OUTPUT,
+                                          crtc->id, output->id, output->connection);
+    }
+
+    xfce_displays_backend_fake_queue (fake, XFCE_DISPLAYS_EVENT_CRTC,
+                                      crtc->id, None, RR_Connected);
+
+    return RRSetConfigSuccess;
+
+failed:
+    if (fake->grabbed)
+        fake->failed = TRUE;
+
+    return RRSetConfigFailed;
+}
+
+
+
+static void
+xfce_displays_backend_fake_set_screen_size (XfceDisplaysBackend *backend,
+                                            gint                 width,
+                                            gint                 height,
+                                            gint                 mm_width,
+                                            gint                 mm_height)
+{
+    XfceDisplaysBackendFake *fake = (XfceDisplaysBackendFake *) backend;
+
+    backend->n_requests++;
+
+    if (width < FAKE_MIN_SIZE || height < FAKE_MIN_SIZE
+        || width > FAKE_MAX_SIZE || height > FAKE_MAX_SIZE)
+    {
+        /* a BadValue error on X */
+        if (fake->grabbed)
+            fake->failed = TRUE;
+        return;
+    }
+
+    fake->width = width;
+    fake->height = height;
+    fake->mm_width = mm_width;
+    fake->mm_height = mm_height;
+
+    xfce_displays_backend_fake_queue (fake, XFCE_DISPLAYS_EVENT_SCREEN,
+                                      None, None, RR_Connected);
+}
+
+
+
+static RROutput
+xfce_displays_backend_fake_get_output_primary (XfceDisplaysBackend *backend)
+{
+    backend->n_requests++;
+
+    return ((XfceDisplaysBackendFake *) backend)->primary;
+}
+
+
+
+static void
+xfce_displays_backend_fake_set_output_primary (XfceDisplaysBackend *backend,
+                                               RROutput             id)
+{
+    XfceDisplaysBackendFake *fake = (XfceDisplaysBackendFake *) backend;
+    FakeOutput              *output;
+    guint                    n;
+
+    backend->n_requests++;
+
+    if (fake->primary == id)
+        return;
+
+    fake->primary = id;
+
+    /* the server notifies all the outputs */
+    for (n = 0; n < fake->outputs->len; ++n)
+    {
+        output = g_ptr_array_index (fake->outputs, n);
+        xfce_displays_backend_fake_queue (fake, XFCE_DISPLAYS_EVENT_OUTPUT,
+                                          output->crtc, output->id, output->connection);
+    }
+}
+
+
+
+static void
+xfce_displays_backend_fake_grab (XfceDisplaysBackend *backend)
+{
+    XfceDisplaysBackendFake *fake = (XfceDisplaysBackendFake *) backend;
+
+    backend->n_requests++;
+
+    fake->grabbed = TRUE;
+    fake->failed = FALSE;
+}
+
+
+
+static gboolean
+xfce_displays_backend_fake_ungrab (XfceDisplaysBackend *backend)
+{
+    XfceDisplaysBackendFake *fake = (XfceDisplaysBackendFake *) backend;
+
+    backend->n_requests++;
+
+    fake->grabbed = FALSE;
+
+    return !fake->failed;
+}
+
+
+
+static void
+xfce_displays_backend_fake_select_input (XfceDisplaysBackend *backend,
+                                         gboolean             enable)
+{
+    XfceDisplaysBackendFake *fake = (XfceDisplaysBackendFake *) backend;
+
+    backend->n_requests++;
+
+    fake->selected = enable;
+
+    if (!enable)
+    {
+        g_array_set_size (fake->events, 0);
+        if (fake->events_id != 0)
+        {
+            g_source_remove (fake->events_id);
+            fake->events_id = 0;
+        }
+    }
+}
+
+
+
+static void
+xfce_displays_backend_fake_free_crtc (FakeCrtc *crtc)
+{
+    g_array_free (crtc->outputs, TRUE);
+    g_slice_free (FakeCrtc, crtc);
+}
+
+
+
+static void
+xfce_displays_backend_fake_free_output (FakeOutput *output)
+{
+    g_free (output->name);
+    g_free (output->edid);
+    g_array_free (output->modes, TRUE);
+    g_slice_free (FakeOutput, output);
+}
+
+
+
+static void
+xfce_displays_backend_fake_free (XfceDisplaysBackend *backend)
+{
+    XfceDisplaysBackendFake *fake = (XfceDisplaysBackendFake *) backend;
+
+    if (fake->events_id != 0)
+        g_source_remove (fake->events_id);
+
+    g_array_free (fake->events, TRUE);
+    g_array_free (fake->modes, TRUE);
+    g_ptr_array_free (fake->crtcs, TRUE);
+    g_ptr_array_free (fake->outputs, TRUE);
+
+    g_slice_free (XfceDisplaysBackendFake, fake);
+}
+
+
+
+XfceDisplaysBackend *
+xfce_displays_backend_fake_new (void)
+{
+    XfceDisplaysBackendFake *fake;
+    XfceDisplaysBackend     *backend;
+
+    fake = g_slice_new0 (XfceDisplaysBackendFake);
+    fake->next_id = 1;
+    fake->config_timestamp = 1;
+    fake->modes = g_array_new (FALSE, FALSE, sizeof (XfceDisplaysModeInfo));
+    fake->crtcs = g_ptr_array_new_with_free_func ((GDestroyNotify) xfce_displays_backend_fake_free_crtc);
+    fake->outputs = g_ptr_array_new_with_free_func ((GDestroyNotify) xfce_displays_backend_fake_free_output);
+    fake->events = g_array_new (FALSE, FALSE, sizeof (XfceDisplaysEvent));
+
+    /* an empty screen of 96 dpi */
+    fake->width = fake->height = FAKE_MIN_SIZE;
+    fake->mm_width = fake->mm_height = FAKE_MIN_SIZE * 254 / 960;
+
+    backend = (XfceDisplaysBackend *) fake;
+    backend->name = "fake";
+    backend->query_version = xfce_displays_backend_fake_query_version;
+    backend->get_screen_resources = xfce_displays_backend_fake_get_screen_resources;
+    backend->get_screen_size_range = xfce_displays_backend_fake_get_screen_size_range;
+    backend->get_screen_size = xfce_displays_backend_fake_get_screen_size;
+    backend->get_output_info = xfce_displays_backend_fake_get_output_info;
+    backend->get_edid = xfce_displays_backend_fake_get_edid;
+    backend->get_crtc_info = xfce_displays_backend_fake_get_crtc_info;
+    backend->set_crtc_config = xfce_displays_backend_fake_set_crtc_config;
+    backend->set_screen_size = xfce_displays_backend_fake_set_screen_size;
+    backend->get_output_primary = xfce_displays_backend_fake_get_output_primary;
+    backend->set_output_primary = xfce_displays_backend_fake_set_output_primary;
+    backend->grab = xfce_displays_backend_fake_grab;
+    backend->ungrab = xfce_displays_backend_fake_ungrab;
+    backend->select_input = xfce_displays_backend_fake_select_input;
+    backend->free = xfce_displays_backend_fake_free;
+
+    return backend;
+}
+
+
+
+RRMode
+xfce_displays_backend_fake_add_mode (XfceDisplaysBackend *backend,
+                                     guint                width,
+                                     guint                height,
+                                     gdouble              rate)
+{
+    XfceDisplaysBackendFake *fake = (XfceDisplaysBackendFake *) backend;
+    XfceDisplaysModeInfo     mode_info;
+
+    g_return_val_if_fail (backend != NULL && backend->free == xfce_displays_backend_fake_free, None);
+
+    mode_info.id = fake->next_id++;
+    mode_info.width = width;
+    mode_info.height = height;
+    mode_info.rate = rate;
+    g_array_append_val (fake->modes, mode_info);
+
+    return mode_info.id;
+}
+
+
+
+RRCrtc
+xfce_displays_backend_fake_add_crtc (XfceDisplaysBackend *backend,
+                                     Rotation             rotations)
+{
+    XfceDisplaysBackendFake *fake = (XfceDisplaysBackendFake *) backend;
+    FakeCrtc                *crtc;
+
+    g_return_val_if_fail (backend != NULL && backend->free == xfce_displays_backend_fake_free, None);
+
+    crtc = g_slice_new0 (FakeCrtc);
+    crtc->id = fake->next_id++;
+    crtc->mode = None;
+    crtc->rotation = RR_Rotate_0;
+    crtc->rotations = rotations | RR_Rotate_0;
+    crtc->outputs = g_array_new (FALSE, FALSE, sizeof (RROutput));
+    g_ptr_array_add (fake->crtcs, crtc);
+
+    return crtc->id;
+}
+
+
+
+RROutput
+xfce_displays_backend_fake_add_output (XfceDisplaysBackend *backend,
+                                       const gchar         *name)
+{
+    XfceDisplaysBackendFake *fake = (XfceDisplaysBackendFake *) backend;
+    FakeOutput              *output;
+
+    g_return_val_if_fail (backend != NULL && backend->free == xfce_displays_backend_fake_free, None);
+    g_return_val_if_fail (name != NULL, None);
+
+    output = g_slice_new0 (FakeOutput);
+    output->id = fake->next_id++;
+    output->name = g_strdup (name);
+    output->connection = RR_Disconnected;
+    output->crtc = None;
+    output->modes = g_array_new (FALSE, FALSE, sizeof (RRMode));
+    g_ptr_array_add (fake->outputs, output);
+
+    return output->id;
+}
+
+
+
+void
+xfce_displays_backend_fake_connect (XfceDisplaysBackend *backend,
+                                    RROutput             id,
+                                    gulong               mm_width,
+                                    gulong               mm_height,
+                                    const RRMode        *modes,
+                                    gint                 nmode,
+                                    guint32              serial)
+{
+    XfceDisplaysBackendFake *fake = (XfceDisplaysBackendFake *) backend;
+    FakeOutput              *output;
+    guchar                   sum = 0;
+    guint                    n;
+    static const guchar      header[] = { 0x00, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x00 };
+
+    g_return_if_fail (backend != NULL && backend->free == xfce_displays_backend_fake_free);
+
+    output = xfce_displays_backend_fake_find_output (fake, id);
+    g_return_if_fail (output != NULL);
+
+    output->connection = RR_Connected;
+    output->mm_width = mm_width;
+    output->mm_height = mm_height;
+    g_array_set_size (output->modes, 0);
+    g_array_append_vals (output->modes, modes, nmode);
+
+    /* an EDID block that only tells the monitors apart */
+    g_free (output->edid);
+    output->edid = g_malloc0 (EDID_LENGTH);
+    memcpy (output->edid, header, sizeof (header));
+    output->edid[12] = serial & 0xff;
+    output->edid[13] = (serial >> 8) & 0xff;
+    output->edid[14] = (serial >> 16) & 0xff;
+    output->edid[15] = (serial >> 24) & 0xff;
+    output->edid[21] = mm_width / 10;
+    output->edid[22] = mm_height / 10;
+    for (n = 0; n < EDID_LENGTH - 1; ++n)
+        sum += output->edid[n];
+    output->edid[EDID_LENGTH - 1] = -sum;
+
+    /* probing changes the configuration timestamp */
+    fake->config_timestamp++;
+
+    xfce_displays_backend_fake_queue (fake, XFCE_DISPLAYS_EVENT_OUTPUT,
+                                      output->crtc, output->id, RR_Connected);
+    xfce_displays_backend_fake_queue (fake, XFCE_DISPLAYS_EVENT_SCREEN,
+                                      None, None, RR_Connected);
+}
+
+
+
+void
+xfce_displays_backend_fake_disconnect (XfceDisplaysBackend *backend,
+                                       RROutput             id)
+{
+    XfceDisplaysBackendFake *fake = (XfceDisplaysBackendFake *) backend;
+    FakeOutput              *output;
+
+    g_return_if_fail (backend != NULL && backend->free == xfce_displays_backend_fake_free);
+
+    output = xfce_displays_backend_fake_find_output (fake, id);
+    g_return_if_fail (output != NULL);
+
+    /* like the server, the CRTC of the output stays configured until
+     * the client disables it */
+    output->connection = RR_Disconnected;
+    output->mm_width = output->mm_height = 0;
+    g_array_set_size (output->modes, 0);
+    g_free (output->edid);
+    output->edid = NULL;
+
+    fake->config_timestamp++;
+
+    xfce_displays_backend_fake_queue (fake, XFCE_DISPLAYS_EVENT_OUTPUT,
+                                      output->crtc, output->id, RR_Disconnected);
+    xfce_displays_backend_fake_queue (fake, XFCE_DISPLAYS_EVENT_SCREEN,
+                                      None, None, RR_Connected);
+}
@@ -0,0 +1,50 @@
+/*
+ *  Copyright (c) 2015 The Xfce development team
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __DISPLAYS_BACKEND_FAKE_H__
+#define __DISPLAYS_BACKEND_FAKE_H__
+
+#include <common/displays-backend.h>
+
+/* The fake backend is only built into the benchmarks */
+XfceDisplaysBackend *xfce_displays_backend_fake_new        (void);
+
+RRMode               xfce_displays_backend_fake_add_mode   (XfceDisplaysBackend  *backend,
+                                                            guint                 width,
+                                                            guint                 height,
+                                                            gdouble               rate);
+
+RRCrtc               xfce_displays_backend_fake_add_crtc   (XfceDisplaysBackend  *backend,
+                                                            Rotation              rotations);
+
+/* outputs are added disconnected */
+RROutput             xfce_displays_backend_fake_add_output (XfceDisplaysBackend  *backend,
+                                                            const gchar          *name);
+
+void                 xfce_displays_backend_fake_connect    (XfceDisplaysBackend  *backend,
+                                                            RROutput              output,
+                                                            gulong                mm_width,
+                                                            gulong                mm_height,
+                                                            const RRMode         *modes,
+                                                            gint                  nmode,
+                                                            guint32               serial);
+
+void                 xfce_displays_backend_fake_disconnect (XfceDisplaysBackend  *backend,
+                                                            RROutput              output);
+
+#endif /* !__DISPLAYS_BACKEND_FAKE_H__ */
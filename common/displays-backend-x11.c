@@ -0,0 +1,534 @@
+/*
+ *  Copyright (c) 2015 The Xfce development team
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <glib.h>
+#include <gdk/gdkx.h>
+
+#include <X11/Xatom.h>
+#include <X11/extensions/Xrandr.h>
+
+#include "displays-backend.h"
+
+
+
+/* check for randr 1.3 or better */
+#if RANDR_MAJOR > 1 || (RANDR_MAJOR == 1 && RANDR_MINOR >= 3)
+#define HAS_RANDR_ONE_POINT_THREE
+#else
+#undef HAS_RANDR_ONE_POINT_THREE
+#endif
+
+
+
+typedef struct _XfceDisplaysBackendX11 XfceDisplaysBackendX11;
+
+
+
+struct _XfceDisplaysBackendX11
+{
+    XfceDisplaysBackend  __parent__;
+
+    GdkDisplay          *display;
+    Display             *xdisplay;
+    GdkWindow           *root_window;
+    Window               root;
+    Atom                 edid_atom;
+
+    /* -1 without RandR */
+    gint                 event_base;
+    guint                has_filter : 1;
+};
+
+
+
+static XfceDisplaysResources *
+xfce_displays_backend_x11_get_screen_resources (XfceDisplaysBackend *backend,
+                                                gboolean             current)
+{
+    XfceDisplaysBackendX11 *x11 = (XfceDisplaysBackendX11 *) backend;
+    XRRScreenResources     *xresources = NULL;
+    XfceDisplaysResources  *resources;
+    gint                    m;
+
+    backend->n_requests++;
+
+    gdk_error_trap_push ();
+#ifdef HAS_RANDR_ONE_POINT_THREE
+    /* current resources do not make the server probe the hardware */
+    if (current)
+        xresources = XRRGetScreenResourcesCurrent (x11->xdisplay, x11->root);
+    else
+#endif
+        xresources = XRRGetScreenResources (x11->xdisplay, x11->root);
+    gdk_flush ();
+    if (gdk_error_trap_pop () != 0 || xresources == NULL)
+    {
+        if (xresources != NULL)
+            XRRFreeScreenResources (xresources);
+        return NULL;
+    }
+
+    resources = g_slice_new0 (XfceDisplaysResources);
+    resources->config_timestamp = xresources->configTimestamp;
+    resources->ncrtc = xresources->ncrtc;
+    resources->crtcs = g_memdup (xresources->crtcs, xresources->ncrtc * sizeof (RRCrtc));
+    resources->noutput = xresources->noutput;
+    resources->outputs = g_memdup (xresources->outputs, xresources->noutput * sizeof (RROutput));
+    resources->nmode = xresources->nmode;
+    resources->modes = g_new0 (XfceDisplaysModeInfo, xresources->nmode);
+    for (m = 0; m < xresources->nmode; ++m)
+    {
+        resources->modes[m].id = xresources->modes[m].id;
+        resources->modes[m].width = xresources->modes[m].width;
+        resources->modes[m].height = xresources->modes[m].height;
+        if (xresources->modes[m].hTotal != 0 && xresources->modes[m].vTotal != 0)
+            resources->modes[m].rate = (gdouble) xresources->modes[m].dotClock /
+                                       ((gdouble) xresources->modes[m].hTotal *
+                                        (gdouble) xresources->modes[m].vTotal);
+    }
+
+    XRRFreeScreenResources (xresources);
+
+    return resources;
+}
+
+
+
+static gboolean
+xfce_displays_backend_x11_query_version (XfceDisplaysBackend *backend,
+                                         gint                *major,
+                                         gint                *minor)
+{
+    XfceDisplaysBackendX11 *x11 = (XfceDisplaysBackendX11 *) backend;
+
+    *major = *minor = 0;
+
+    if (x11->event_base < 0)
+        return FALSE;
+
+    backend->n_requests++;
+
+    return XRRQueryVersion (x11->xdisplay, major, minor);
+}
+
+
+
+static gboolean
+xfce_displays_backend_x11_get_screen_size_range (XfceDisplaysBackend *backend,
+                                                 gint                *min_width,
+                                                 gint                *min_height,
+                                                 gint                *max_width,
+                                                 gint                *max_height)
+{
+    XfceDisplaysBackendX11 *x11 = (XfceDisplaysBackendX11 *) backend;
+
+    backend->n_requests++;
+
+    return XRRGetScreenSizeRange (x11->xdisplay, x11->root,
+                                  min_width, min_height,
+                                  max_width, max_height);
+}
+
+
+
+static void
+xfce_displays_backend_x11_get_screen_size (XfceDisplaysBackend *backend,
+                                           gint                *width,
+                                           gint                *height,
+                                           gint                *mm_width,
+                                           gint                *mm_height)
+{
+    XfceDisplaysBackendX11 *x11 = (XfceDisplaysBackendX11 *) backend;
+    GdkScreen              *screen = gdk_display_get_default_screen (x11->display);
+
+    /* gdk keeps the size up to date with the RandR events */
+    *width = gdk_screen_get_width (screen);
+    *height = gdk_screen_get_height (screen);
+    *mm_width = gdk_screen_get_width_mm (screen);
+    *mm_height = gdk_screen_get_height_mm (screen);
+}
+
+
+
+static XfceDisplaysOutputInfo *
+xfce_displays_backend_x11_get_output_info (XfceDisplaysBackend   *backend,
+                                           XfceDisplaysResources *resources,
+                                           RROutput               output)
+{
+    XfceDisplaysBackendX11 *x11 = (XfceDisplaysBackendX11 *) backend;
+    XRRScreenResources      xresources = { 0, };
+    XRROutputInfo          *xinfo;
+    XfceDisplaysOutputInfo *info;
+
+    backend->n_requests++;
+
+    /* only the configuration timestamp of the resources is sent */
+    xresources.configTimestamp = resources->config_timestamp;
+
+    gdk_error_trap_push ();
+    xinfo = XRRGetOutputInfo (x11->xdisplay, &xresources, output);
+    gdk_flush ();
+    if (gdk_error_trap_pop () != 0 || xinfo == NULL)
+    {
+        if (xinfo != NULL)
+            XRRFreeOutputInfo (xinfo);
+        return NULL;
+    }
+
+    info = g_slice_new0 (XfceDisplaysOutputInfo);
+    info->id = output;
+    info->name = g_strndup (xinfo->name, xinfo->nameLen);
+    info->connection = xinfo->connection;
+    info->crtc = xinfo->crtc;
+    info->mm_width = xinfo->mm_width;
+    info->mm_height = xinfo->mm_height;
+    info->ncrtc = xinfo->ncrtc;
+    info->crtcs = g_memdup (xinfo->crtcs, xinfo->ncrtc * sizeof (RRCrtc));
+    info->nclone = xinfo->nclone;
+    info->clones = g_memdup (xinfo->clones, xinfo->nclone * sizeof (RROutput));
+    info->nmode = xinfo->nmode;
+    info->npreferred = xinfo->npreferred;
+    info->modes = g_memdup (xinfo->modes, xinfo->nmode * sizeof (RRMode));
+
+    XRRFreeOutputInfo (xinfo);
+
+    return info;
+}
+
+
+
+static guchar *
+xfce_displays_backend_x11_get_edid (XfceDisplaysBackend *backend,
+                                    RROutput             output,
+                                    gsize               *length)
+{
+    XfceDisplaysBackendX11 *x11 = (XfceDisplaysBackendX11 *) backend;
+    guchar                 *prop = NULL, *edid = NULL;
+    Atom                    actual_type;
+    gint                    actual_format, ret;
+    unsigned long           nitems, bytes_after;
+
+    *length = 0;
+
+    if (x11->edid_atom == None)
+        return NULL;
+
+    backend->n_requests++;
+
+    gdk_error_trap_push ();
+    ret = XRRGetOutputProperty (x11->xdisplay, output, x11->edid_atom, 0, 100,
+                                False, False, AnyPropertyType,
+                                &actual_type, &actual_format, &nitems,
+                                &bytes_after, &prop);
+    gdk_flush ();
+    if (gdk_error_trap_pop () == 0 && ret == Success
+        && actual_type == XA_INTEGER && actual_format == 8 && nitems > 0)
+    {
+        edid = g_memdup (prop, nitems);
+        *length = nitems;
+    }
+
+    if (prop != NULL)
+        XFree (prop);
+
+    return edid;
+}
+
+
+
+static XfceDisplaysCrtcInfo *
+xfce_displays_backend_x11_get_crtc_info (XfceDisplaysBackend   *backend,
+                                         XfceDisplaysResources *resources,
+                                         RRCrtc                 crtc)
+{
+    XfceDisplaysBackendX11 *x11 = (XfceDisplaysBackendX11 *) backend;
+    XRRScreenResources      xresources = { 0, };
+    XRRCrtcInfo            *xinfo;
+    XfceDisplaysCrtcInfo   *info;
+
+    backend->n_requests++;
+
+    xresources.configTimestamp = resources->config_timestamp;
+
+    gdk_error_trap_push ();
+    xinfo = XRRGetCrtcInfo (x11->xdisplay, &xresources, crtc);
+    gdk_flush ();
+    if (gdk_error_trap_pop () != 0 || xinfo == NULL)
+    {
+        if (xinfo != NULL)
+            XRRFreeCrtcInfo (xinfo);
+        return NULL;
+    }
+
+    info = g_slice_new0 (XfceDisplaysCrtcInfo);
+    info->id = crtc;
+    info->x = xinfo->x;
+    info->y = xinfo->y;
+    info->width = xinfo->width;
+    info->height = xinfo->height;
+    info->mode = xinfo->mode;
+    info->rotation = xinfo->rotation;
+    info->rotations = xinfo->rotations;
+    info->noutput = xinfo->noutput;
+    info->outputs = g_memdup (xinfo->outputs, xinfo->noutput * sizeof (RROutput));
+    info->npossible = xinfo->npossible;
+    info->possible = g_memdup (xinfo->possible, xinfo->npossible * sizeof (RROutput));
+
+    XRRFreeCrtcInfo (xinfo);
+
+    return info;
+}
+
+
+
+static Status
+xfce_displays_backend_x11_set_crtc_config (XfceDisplaysBackend   *backend,
+                                           XfceDisplaysResources *resources,
+                                           RRCrtc                 crtc,
+                                           gint                   x,
+                                           gint                   y,
+                                           RRMode                 mode,
+                                           Rotation               rotation,
+                                           RROutput              *outputs,
+                                           gint                   noutputs)
+{
+    XfceDisplaysBackendX11 *x11 = (XfceDisplaysBackendX11 *) backend;
+    XRRScreenResources      xresources = { 0, };
+
+    backend->n_requests++;
+
+    xresources.configTimestamp = resources->config_timestamp;
+
+    return XRRSetCrtcConfig (x11->xdisplay, &xresources, crtc, CurrentTime,
+                             x, y, mode, rotation, outputs, noutputs);
+}
+
+
+
+static void
+xfce_displays_backend_x11_set_screen_size (XfceDisplaysBackend *backend,
+                                           gint                 width,
+                                           gint                 height,
+                                           gint                 mm_width,
+                                           gint                 mm_height)
+{
+    XfceDisplaysBackendX11 *x11 = (XfceDisplaysBackendX11 *) backend;
+
+    backend->n_requests++;
+
+    XRRSetScreenSize (x11->xdisplay, x11->root, width, height, mm_width, mm_height);
+}
+
+
+
+static RROutput
+xfce_displays_backend_x11_get_output_primary (XfceDisplaysBackend *backend)
+{
+#ifdef HAS_RANDR_ONE_POINT_THREE
+    XfceDisplaysBackendX11 *x11 = (XfceDisplaysBackendX11 *) backend;
+
+    backend->n_requests++;
+
+    return XRRGetOutputPrimary (x11->xdisplay, x11->root);
+#else
+    return None;
+#endif
+}
+
+
+
+static void
+xfce_displays_backend_x11_set_output_primary (XfceDisplaysBackend *backend,
+                                              RROutput             output)
+{
+#ifdef HAS_RANDR_ONE_POINT_THREE
+    XfceDisplaysBackendX11 *x11 = (XfceDisplaysBackendX11 *) backend;
+
+    backend->n_requests++;
+
+    XRRSetOutputPrimary (x11->xdisplay, x11->root, output);
+#endif
+}
+
+
+
+static void
+xfce_displays_backend_x11_grab (XfceDisplaysBackend *backend)
+{
+    XfceDisplaysBackendX11 *x11 = (XfceDisplaysBackendX11 *) backend;
+
+    backend->n_requests++;
+
+    /* errors of the requests are collected until the ungrab */
+    gdk_error_trap_push ();
+    gdk_x11_display_grab (x11->display);
+}
+
+
+
+static gboolean
+xfce_displays_backend_x11_ungrab (XfceDisplaysBackend *backend)
+{
+    XfceDisplaysBackendX11 *x11 = (XfceDisplaysBackendX11 *) backend;
+
+    backend->n_requests++;
+
+    gdk_x11_display_ungrab (x11->display);
+    gdk_flush ();
+
+    return gdk_error_trap_pop () == 0;
+}
+
+
+
+static GdkFilterReturn
+xfce_displays_backend_x11_filter (GdkXEvent *gdkxevent,
+                                  GdkEvent  *gdkevent,
+                                  gpointer   data)
+{
+    XfceDisplaysBackend    *backend = data;
+    XfceDisplaysBackendX11 *x11 = data;
+    XEvent                 *xevent = gdkxevent;
+    XRRNotifyEvent         *notify;
+    XfceDisplaysEvent       event = { 0, };
+
+    if (xevent->type == x11->event_base + RRScreenChangeNotify)
+    {
+        event.type = XFCE_DISPLAYS_EVENT_SCREEN;
+    }
+    else if (xevent->type == x11->event_base + RRNotify)
+    {
+        notify = (XRRNotifyEvent *) xevent;
+        if (notify->subtype == RRNotify_CrtcChange)
+        {
+            event.type = XFCE_DISPLAYS_EVENT_CRTC;
+            event.crtc = ((XRRCrtcChangeNotifyEvent *) xevent)->crtc;
+        }
+        else if (notify->subtype == RRNotify_OutputChange)
+        {
+            event.type = XFCE_DISPLAYS_EVENT_OUTPUT;
+            event.output = ((XRROutputChangeNotifyEvent *) xevent)->output;
+            event.crtc = ((XRROutputChangeNotifyEvent *) xevent)->crtc;
+            event.connection = ((XRROutputChangeNotifyEvent *) xevent)->connection;
+        }
+        else
+        {
+            return GDK_FILTER_CONTINUE;
+        }
+    }
+    else
+    {
+        return GDK_FILTER_CONTINUE;
+    }
+
+    xfce_displays_backend_notify (backend, &event);
+
+    /* Pass the event on to GTK+ */
+    return GDK_FILTER_CONTINUE;
+}
+
+
+
+static void
+xfce_displays_backend_x11_select_input (XfceDisplaysBackend *backend,
+                                        gboolean             enable)
+{
+    XfceDisplaysBackendX11 *x11 = (XfceDisplaysBackendX11 *) backend;
+
+    if (x11->event_base < 0 || x11->has_filter == enable)
+        return;
+
+    backend->n_requests++;
+
+    if (enable)
+    {
+        /* the events are reported on the root window, so the backend
+         * gets them without the event handling of its user */
+        XRRSelectInput (x11->xdisplay, x11->root,
+                        RRScreenChangeNotifyMask
+                        | RRCrtcChangeNotifyMask
+                        | RROutputChangeNotifyMask);
+        gdk_x11_register_standard_event_type (x11->display, x11->event_base,
+                                              RRNotify + 1);
+        gdk_window_add_filter (x11->root_window, xfce_displays_backend_x11_filter, x11);
+    }
+    else
+    {
+        /* the selection is shared with gdk, which tracks the screen
+         * size, so only drop the CRTC and output changes */
+        XRRSelectInput (x11->xdisplay, x11->root, RRScreenChangeNotifyMask);
+        gdk_window_remove_filter (x11->root_window, xfce_displays_backend_x11_filter, x11);
+    }
+
+    x11->has_filter = enable;
+}
+
+
+
+static void
+xfce_displays_backend_x11_free (XfceDisplaysBackend *backend)
+{
+    g_slice_free (XfceDisplaysBackendX11, (XfceDisplaysBackendX11 *) backend);
+}
+
+
+
+XfceDisplaysBackend *
+xfce_displays_backend_x11_new (GdkDisplay *display)
+{
+    XfceDisplaysBackendX11 *x11;
+    XfceDisplaysBackend    *backend;
+    gint                    error_base;
+
+    g_return_val_if_fail (GDK_IS_DISPLAY (display), NULL);
+
+    x11 = g_slice_new0 (XfceDisplaysBackendX11);
+    x11->display = display;
+    x11->xdisplay = gdk_x11_display_get_xdisplay (display);
+    x11->root_window = gdk_screen_get_root_window (gdk_display_get_default_screen (display));
+    x11->root = GDK_WINDOW_XID (x11->root_window);
+    x11->edid_atom = gdk_x11_get_xatom_by_name_for_display (display, RR_PROPERTY_RANDR_EDID);
+
+    /* query_version fails without the extension */
+    if (!XRRQueryExtension (x11->xdisplay, &x11->event_base, &error_base))
+        x11->event_base = -1;
+
+    backend = (XfceDisplaysBackend *) x11;
+    backend->name = "x11";
+    backend->query_version = xfce_displays_backend_x11_query_version;
+    backend->get_screen_resources = xfce_displays_backend_x11_get_screen_resources;
+    backend->get_screen_size_range = xfce_displays_backend_x11_get_screen_size_range;
+    backend->get_screen_size = xfce_displays_backend_x11_get_screen_size;
+    backend->get_output_info = xfce_displays_backend_x11_get_output_info;
+    backend->get_edid = xfce_displays_backend_x11_get_edid;
+    backend->get_crtc_info = xfce_displays_backend_x11_get_crtc_info;
+    backend->set_crtc_config = xfce_displays_backend_x11_set_crtc_config;
+    backend->set_screen_size = xfce_displays_backend_x11_set_screen_size;
+    backend->get_output_primary = xfce_displays_backend_x11_get_output_primary;
+    backend->set_output_primary = xfce_displays_backend_x11_set_output_primary;
+    backend->grab = xfce_displays_backend_x11_grab;
+    backend->ungrab = xfce_displays_backend_x11_ungrab;
+    backend->select_input = xfce_displays_backend_x11_select_input;
+    backend->free = xfce_displays_backend_x11_free;
+
+    return backend;
+}
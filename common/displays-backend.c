@@ -0,0 +1,108 @@
+/*
+ *  Copyright (c) 2015 The Xfce development team
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <glib.h>
+
+#include "displays-backend.h"
+
+
+
+void
+xfce_displays_backend_set_notify (XfceDisplaysBackend    *backend,
+                                  XfceDisplaysNotifyFunc  func,
+                                  gpointer                user_data)
+{
+    g_return_if_fail (backend != NULL);
+
+    backend->notify = func;
+    backend->notify_data = user_data;
+
+    backend->select_input (backend, func != NULL);
+}
+
+
+
+void
+xfce_displays_backend_notify (XfceDisplaysBackend     *backend,
+                              const XfceDisplaysEvent *event)
+{
+    g_return_if_fail (backend != NULL && event != NULL);
+
+    if (backend->notify != NULL)
+        backend->notify (backend, event, backend->notify_data);
+}
+
+
+
+void
+xfce_displays_backend_free (XfceDisplaysBackend *backend)
+{
+    if (backend == NULL)
+        return;
+
+    if (backend->notify != NULL)
+        xfce_displays_backend_set_notify (backend, NULL, NULL);
+
+    backend->free (backend);
+}
+
+
+
+void
+xfce_displays_resources_free (XfceDisplaysResources *resources)
+{
+    if (resources == NULL)
+        return;
+
+    g_free (resources->crtcs);
+    g_free (resources->outputs);
+    g_free (resources->modes);
+    g_slice_free (XfceDisplaysResources, resources);
+}
+
+
+
+void
+xfce_displays_output_info_free (XfceDisplaysOutputInfo *output_info)
+{
+    if (output_info == NULL)
+        return;
+
+    g_free (output_info->name);
+    g_free (output_info->crtcs);
+    g_free (output_info->clones);
+    g_free (output_info->modes);
+    g_slice_free (XfceDisplaysOutputInfo, output_info);
+}
+
+
+
+void
+xfce_displays_crtc_info_free (XfceDisplaysCrtcInfo *crtc_info)
+{
+    if (crtc_info == NULL)
+        return;
+
+    g_free (crtc_info->outputs);
+    g_free (crtc_info->possible);
+    g_slice_free (XfceDisplaysCrtcInfo, crtc_info);
+}
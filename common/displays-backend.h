@@ -0,0 +1,199 @@
+/*
+ *  Copyright (c) 2015 The Xfce development team
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __DISPLAYS_BACKEND_H__
+#define __DISPLAYS_BACKEND_H__
+
+#include <gdk/gdk.h>
+#include <X11/Xlib.h>
+#include <X11/extensions/Xrandr.h>
+
+typedef struct _XfceDisplaysBackend    XfceDisplaysBackend;
+typedef struct _XfceDisplaysResources  XfceDisplaysResources;
+typedef struct _XfceDisplaysModeInfo   XfceDisplaysModeInfo;
+typedef struct _XfceDisplaysOutputInfo XfceDisplaysOutputInfo;
+typedef struct _XfceDisplaysCrtcInfo   XfceDisplaysCrtcInfo;
+typedef struct _XfceDisplaysEvent      XfceDisplaysEvent;
+
+typedef enum
+{
+    XFCE_DISPLAYS_EVENT_SCREEN,
+    XFCE_DISPLAYS_EVENT_CRTC,
+    XFCE_DISPLAYS_EVENT_OUTPUT
+}
+XfceDisplaysEventType;
+
+typedef void (*XfceDisplaysNotifyFunc) (XfceDisplaysBackend     *backend,
+                                        const XfceDisplaysEvent *event,
+                                        gpointer                 user_data);
+
+/* The structures below are owned by the caller and freed with the
+ * functions at the end of this file, whatever backend filled them. The
+ * ids are RandR XIDs for the X11 backend. */
+struct _XfceDisplaysModeInfo
+{
+    RRMode    id;
+    guint     width;
+    guint     height;
+    gdouble   rate;
+};
+
+struct _XfceDisplaysResources
+{
+    Time                  config_timestamp;
+
+    gint                  ncrtc;
+    RRCrtc               *crtcs;
+    gint                  noutput;
+    RROutput             *outputs;
+    gint                  nmode;
+    XfceDisplaysModeInfo *modes;
+};
+
+struct _XfceDisplaysOutputInfo
+{
+    RROutput    id;
+    gchar      *name;
+    Connection  connection;
+    RRCrtc      crtc;
+    gulong      mm_width;
+    gulong      mm_height;
+
+    gint        ncrtc;
+    RRCrtc     *crtcs;
+    gint        nclone;
+    RROutput   *clones;
+
+    /* the first npreferred modes are the preferred ones */
+    gint        nmode;
+    gint        npreferred;
+    RRMode     *modes;
+};
+
+struct _XfceDisplaysCrtcInfo
+{
+    RRCrtc      id;
+    gint        x;
+    gint        y;
+    guint       width;
+    guint       height;
+    RRMode      mode;
+    Rotation    rotation;
+    Rotation    rotations;
+
+    gint        noutput;
+    RROutput   *outputs;
+    gint        npossible;
+    RROutput   *possible;
+};
+
+/* A change of the screen, or of a CRTC or output, like the RandR
+ * notifications */
+struct _XfceDisplaysEvent
+{
+    XfceDisplaysEventType  type;
+    RRCrtc                 crtc;
+    RROutput               output;
+    Connection             connection;
+};
+
+/* The RandR requests of the displays helper and the display dialog.
+ * Everything they know about the screen comes from here, so another
+ * implementation can stand in for the X server. Requests that fail
+ * return NULL, FALSE or an error status. */
+struct _XfceDisplaysBackend
+{
+    const gchar             *name;
+
+    gboolean                 (*query_version)          (XfceDisplaysBackend    *backend,
+                                                        gint                   *major,
+                                                        gint                   *minor);
+    XfceDisplaysResources   *(*get_screen_resources)   (XfceDisplaysBackend    *backend,
+                                                        gboolean                current);
+    gboolean                 (*get_screen_size_range)  (XfceDisplaysBackend    *backend,
+                                                        gint                   *min_width,
+                                                        gint                   *min_height,
+                                                        gint                   *max_width,
+                                                        gint                   *max_height);
+    void                     (*get_screen_size)        (XfceDisplaysBackend    *backend,
+                                                        gint                   *width,
+                                                        gint                   *height,
+                                                        gint                   *mm_width,
+                                                        gint                   *mm_height);
+    XfceDisplaysOutputInfo  *(*get_output_info)        (XfceDisplaysBackend    *backend,
+                                                        XfceDisplaysResources  *resources,
+                                                        RROutput                output);
+    guchar                  *(*get_edid)               (XfceDisplaysBackend    *backend,
+                                                        RROutput                output,
+                                                        gsize                  *length);
+    XfceDisplaysCrtcInfo    *(*get_crtc_info)          (XfceDisplaysBackend    *backend,
+                                                        XfceDisplaysResources  *resources,
+                                                        RRCrtc                  crtc);
+    Status                   (*set_crtc_config)        (XfceDisplaysBackend    *backend,
+                                                        XfceDisplaysResources  *resources,
+                                                        RRCrtc                  crtc,
+                                                        gint                    x,
+                                                        gint                    y,
+                                                        RRMode                  mode,
+                                                        Rotation                rotation,
+                                                        RROutput               *outputs,
+                                                        gint                    noutputs);
+    void                     (*set_screen_size)        (XfceDisplaysBackend    *backend,
+                                                        gint                    width,
+                                                        gint                    height,
+                                                        gint                    mm_width,
+                                                        gint                    mm_height);
+    RROutput                 (*get_output_primary)     (XfceDisplaysBackend    *backend);
+    void                     (*set_output_primary)     (XfceDisplaysBackend    *backend,
+                                                        RROutput                output);
+
+    /* requests between grab and ungrab are sent at once, ungrab
+     * returns FALSE if one of them failed */
+    void                     (*grab)                   (XfceDisplaysBackend    *backend);
+    gboolean                 (*ungrab)                 (XfceDisplaysBackend    *backend);
+
+    /* start or stop sending the changes to notify */
+    void                     (*select_input)           (XfceDisplaysBackend    *backend,
+                                                        gboolean                enable);
+    void                     (*free)                   (XfceDisplaysBackend    *backend);
+
+    XfceDisplaysNotifyFunc   notify;
+    gpointer                 notify_data;
+
+    /* number of requests sent through the backend */
+    guint                    n_requests;
+};
+
+XfceDisplaysBackend *xfce_displays_backend_x11_new       (GdkDisplay             *display);
+
+void                 xfce_displays_backend_set_notify    (XfceDisplaysBackend    *backend,
+                                                          XfceDisplaysNotifyFunc  func,
+                                                          gpointer                user_data);
+
+void                 xfce_displays_backend_notify        (XfceDisplaysBackend    *backend,
+                                                          const XfceDisplaysEvent *event);
+
+void                 xfce_displays_backend_free          (XfceDisplaysBackend    *backend);
+
+void                 xfce_displays_resources_free        (XfceDisplaysResources  *resources);
+
+void                 xfce_displays_output_info_free      (XfceDisplaysOutputInfo *output_info);
+
+void                 xfce_displays_crtc_info_free        (XfceDisplaysCrtcInfo   *crtc_info);
+
+#endif /* !__DISPLAYS_BACKEND_H__ */
@@ -132,9 +132,6 @@ static guint active_output;
 /* Pointer to the used randr structure */
 static XfceRandr *xfce_randr = NULL;
 
-/* event base for XRandR notifications */
-static gint randr_event_base;
-
 /* Used to identify the display */
 static GHashTable *display_popups = NULL;
 gboolean show_popups = FALSE;
@@ -1521,21 +1518,14 @@ display_settings_minimal_extend_right_toggled (GtkToggleButton *button,
     gtk_widget_set_sensitive (GTK_WIDGET (buttons), TRUE);
 }
 
-static GdkFilterReturn
-screen_on_event (GdkXEvent *xevent,
-                 GdkEvent  *event,
-                 gpointer   data)
+static void
+screen_on_event (XfceDisplaysBackend     *backend,
+                 const XfceDisplaysEvent *event,
+                 gpointer                 data)
 {
     GtkBuilder *builder = data;
-    XEvent     *e = xevent;
-    gint        event_num;
-
-    if (!e)
-        return GDK_FILTER_CONTINUE;
 
-    event_num = e->type - randr_event_base;
-
-    if (event_num == RRScreenChangeNotify)
+    if (event->type == XFCE_DISPLAYS_EVENT_SCREEN)
     {
         xfce_randr_reload (xfce_randr);
         display_settings_combobox_populate (builder);
@@ -1548,9 +1538,6 @@ screen_on_event (GdkXEvent *xevent,
 
     initialize_connected_outputs();
     foo_scroll_area_invalidate (FOO_SCROLL_AREA (randr_gui_area));
-
-    /* Pass the event on to GTK+ */
-    return GDK_FILTER_CONTINUE;
 }
 
 /* Xfce RANDR GUI **TODO** Place these functions in a sensible location */
@@ -2748,13 +2735,8 @@ display_settings_show_main_dialog (GdkDisplay *display)
         /* Build the dialog */
         dialog = display_settings_dialog_new (builder);
         /* Set up notifications */
-        XRRSelectInput (gdk_x11_display_get_xdisplay (display),
-                        GDK_WINDOW_XID (gdk_get_default_root_window ()),
-                        RRScreenChangeNotifyMask);
-        gdk_x11_register_standard_event_type (display,
-                                              randr_event_base,
-                                              RRNotify + 1);
-        gdk_window_add_filter (gdk_get_default_root_window (), screen_on_event, builder);
+        xfce_displays_backend_set_notify (xfce_randr_get_backend (xfce_randr),
+                                          screen_on_event, builder);
 
         /* Show/Hide the helper popups when the dialog is shown/hidden */
         g_signal_connect(G_OBJECT(dialog), "focus-out-event", G_CALLBACK (focus_out_event), builder);
@@ -2823,7 +2805,7 @@ display_settings_show_main_dialog (GdkDisplay *display)
         g_error_free (error);
     }
 
-    gdk_window_remove_filter (gdk_get_default_root_window (), screen_on_event, builder);
+    xfce_displays_backend_set_notify (xfce_randr_get_backend (xfce_randr), NULL, NULL);
 
     /* Release the builder */
     g_object_unref (G_OBJECT (builder));
@@ -3002,7 +2984,6 @@ main (gint argc, gchar **argv)
     GdkDisplay  *display;
     GError      *error = NULL;
     gboolean     succeeded = TRUE;
-    gint         error_base;
     gchar       *command;
     const gchar *alternative = NULL;
     const gchar *alternative_icon = NULL;
@@ -3047,16 +3028,6 @@ main (gint argc, gchar **argv)
     /* Get the default display */
     display = gdk_display_get_default ();
 
-    /* Check if the randr extension is avaible on the system */
-    if (!XRRQueryExtension (gdk_x11_display_get_xdisplay (display), &randr_event_base, &error_base))
-    {
-        g_set_error (&error, 0, 0, _("Unable to query the version of the RandR extension being used"));
-        xfce_dialog_show_error (NULL, error, _("Unable to start the Xfce Display Settings"));
-        g_error_free (error);
-
-        return EXIT_FAILURE;
-    }
-
     /* Initialize xfconf */
     if (!xfconf_init (&error))
     {
@@ -26,11 +26,9 @@
 #endif
 
 #include <glib.h>
-#include <gdk/gdkx.h>
+#include <gdk/gdk.h>
 #include <libxfce4util/libxfce4util.h>
 
-#include <X11/Xatom.h>
-
 #include "xfce-randr.h"
 #include "edid.h"
 
@@ -42,30 +40,29 @@ struct _XfceRandrPrivate
     /* xrandr 1.3 capable */
     gint                 has_1_3;
 
-    GdkDisplay          *display;
-    XRRScreenResources  *resources;
+    /* the RandR requests go through the backend */
+    XfceDisplaysBackend     *backend;
+    XfceDisplaysResources   *resources;
 
     /* cache for the output/mode info */
-    XRROutputInfo      **output_info;
-    XfceRRMode         **modes;
+    XfceDisplaysOutputInfo **output_info;
+    XfceRRMode             **modes;
 };
 
 
 
 static gchar *xfce_randr_friendly_name (XfceRandr *randr,
-                                        guint      output,
-                                        guint      output_rr_id);
+                                        guint      output);
 
 
 
 static Rotation
 xfce_randr_get_safe_rotations (XfceRandr *randr,
-                               Display   *xdisplay,
                                guint      num_output)
 {
-    XRRCrtcInfo *crtc_info;
-    Rotation     rot;
-    gint         n;
+    XfceDisplaysCrtcInfo *crtc_info;
+    Rotation              rot;
+    gint                  n;
 
     g_return_val_if_fail (num_output < randr->noutput, RR_Rotate_0);
     g_return_val_if_fail (randr->priv->output_info[num_output]->ncrtc > 0, RR_Rotate_0);
@@ -73,10 +70,13 @@ xfce_randr_get_safe_rotations (XfceRandr *randr,
     rot = XFCE_RANDR_ROTATIONS_MASK | XFCE_RANDR_REFLECTIONS_MASK;
     for (n = 0; n < randr->priv->output_info[num_output]->ncrtc; ++n)
     {
-        crtc_info = XRRGetCrtcInfo (xdisplay, randr->priv->resources,
-                                    randr->priv->output_info[num_output]->crtcs[n]);
+        crtc_info = randr->priv->backend->get_crtc_info (randr->priv->backend,
+                                                         randr->priv->resources,
+                                                         randr->priv->output_info[num_output]->crtcs[n]);
+        if (crtc_info == NULL)
+            continue;
         rot &= crtc_info->rotations;
-        XRRFreeCrtcInfo (crtc_info);
+        xfce_displays_crtc_info_free (crtc_info);
     }
 
     return rot;
@@ -85,8 +85,8 @@ xfce_randr_get_safe_rotations (XfceRandr *randr,
 
 
 static XfceRRMode *
-xfce_randr_list_supported_modes (XRRScreenResources *resources,
-                                XRROutputInfo       *output_info)
+xfce_randr_list_supported_modes (XfceDisplaysResources  *resources,
+                                 XfceDisplaysOutputInfo *output_info)
 {
     XfceRRMode *modes;
     gint m, n;
@@ -110,8 +110,7 @@ xfce_randr_list_supported_modes (XRRScreenResources *resources,
             {
                 modes[n].width = resources->modes[m].width;
                 modes[n].height = resources->modes[m].height;
-                modes[n].rate = (gdouble) resources->modes[m].dotClock /
-                                ((gdouble) resources->modes[m].hTotal * (gdouble) resources->modes[m].vTotal);
+                modes[n].rate = resources->modes[m].rate;
 
                 break;
             }
@@ -152,16 +151,14 @@ xfce_randr_guess_relations (XfceRandr *randr)
 
 
 static void
-xfce_randr_populate (XfceRandr *randr,
-                     Display   *xdisplay,
-                     GdkWindow *root_window)
+xfce_randr_populate (XfceRandr *randr)
 {
-    GPtrArray      *outputs;
-    XRROutputInfo  *output_info;
-    XRRCrtcInfo    *crtc_info;
-    gint            n;
-    guint           m, connected;
-    guint          *output_ids = NULL;
+    GPtrArray              *outputs;
+    XfceDisplaysOutputInfo *output_info;
+    XfceDisplaysCrtcInfo   *crtc_info;
+    RROutput                primary = None;
+    gint                    n;
+    guint                   m;
 
     XfconfChannel *display_channel = xfconf_channel_new ("displays");
 
@@ -171,27 +168,23 @@ xfce_randr_populate (XfceRandr *randr,
 
     /* prepare the temporary cache */
     outputs = g_ptr_array_new ();
-    output_ids = g_malloc0 (randr->priv->resources->noutput * sizeof (guint));
 
     /* walk the outputs */
-    connected = 0;
     for (n = 0; n < randr->priv->resources->noutput; ++n)
     {
         /* get the output info */
-        output_info = XRRGetOutputInfo (xdisplay, randr->priv->resources,
-                                        randr->priv->resources->outputs[n]);
+        output_info = randr->priv->backend->get_output_info (randr->priv->backend,
+                                                             randr->priv->resources,
+                                                             randr->priv->resources->outputs[n]);
+        if (output_info == NULL)
+            continue;
 
         /* forget about disconnected outputs */
         if (output_info->connection != RR_Connected)
         {
-            XRRFreeOutputInfo (output_info);
+            xfce_displays_output_info_free (output_info);
             continue;
         }
-        else
-        {
-            output_ids[connected] = n;
-            connected++;
-        }
 
         /* cache it */
         g_ptr_array_add (outputs, output_info);
@@ -199,7 +192,7 @@ xfce_randr_populate (XfceRandr *randr,
 
     /* migrate the temporary cache */
     randr->noutput = outputs->len;
-    randr->priv->output_info = (XRROutputInfo **) g_ptr_array_free (outputs, FALSE);
+    randr->priv->output_info = (XfceDisplaysOutputInfo **) g_ptr_array_free (outputs, FALSE);
 
     /* allocate final space for the settings */
     randr->mode = g_new0 (RRMode, randr->noutput);
@@ -211,41 +204,48 @@ xfce_randr_populate (XfceRandr *randr,
     randr->status = g_new0 (XfceOutputStatus, randr->noutput);
     randr->friendly_name = g_new0 (gchar *, randr->noutput);
 
+#ifdef HAS_RANDR_ONE_POINT_THREE
+    /* find the primary screen if supported */
+    if (randr->priv->has_1_3)
+        primary = randr->priv->backend->get_output_primary (randr->priv->backend);
+#endif
+
     /* walk the connected outputs */
     for (m = 0; m < randr->noutput; ++m)
     {
         /* fill in supported modes */
         randr->priv->modes[m] = xfce_randr_list_supported_modes (randr->priv->resources, randr->priv->output_info[m]);
 
-#ifdef HAS_RANDR_ONE_POINT_THREE
-        /* find the primary screen if supported */
-        if (randr->priv->has_1_3 && XRRGetOutputPrimary (xdisplay, GDK_WINDOW_XID (root_window)) == randr->priv->resources->outputs[output_ids[m]])
+        if (primary != None && primary == randr->priv->output_info[m]->id)
             randr->status[m] = XFCE_OUTPUT_STATUS_PRIMARY;
         else
-#endif
             randr->status[m] = XFCE_OUTPUT_STATUS_SECONDARY;
 
+        crtc_info = NULL;
         if (randr->priv->output_info[m]->crtc != None)
+            crtc_info = randr->priv->backend->get_crtc_info (randr->priv->backend,
+                                                             randr->priv->resources,
+                                                             randr->priv->output_info[m]->crtc);
+
+        if (crtc_info != NULL)
         {
-            crtc_info = XRRGetCrtcInfo (xdisplay, randr->priv->resources,
-                                        randr->priv->output_info[m]->crtc);
             randr->mode[m] = crtc_info->mode;
             randr->rotation[m] = crtc_info->rotation;
             randr->rotations[m] = crtc_info->rotations;
             randr->position[m].x = crtc_info->x;
             randr->position[m].y = crtc_info->y;
-            XRRFreeCrtcInfo (crtc_info);
+            xfce_displays_crtc_info_free (crtc_info);
         }
         else
         {
             /* output disabled */
             randr->mode[m] = None;
             randr->rotation[m] = RR_Rotate_0;
-            randr->rotations[m] = xfce_randr_get_safe_rotations (randr, xdisplay, m);
+            randr->rotations[m] = xfce_randr_get_safe_rotations (randr, m);
         }
 
         /* fill in the name used by the UI */
-        randr->friendly_name[m] = xfce_randr_friendly_name (randr, m, output_ids[m]);
+        randr->friendly_name[m] = xfce_randr_friendly_name (randr, m);
 
         /* Update display info, primary display may have changed. */
         xfce_randr_save_output (randr, "Default", display_channel, m);
@@ -255,8 +255,6 @@ xfce_randr_populate (XfceRandr *randr,
     }
     /* populate mirrored details */
     xfce_randr_guess_relations (randr);
-
-    g_free (output_ids);
 }
 
 
@@ -265,21 +263,29 @@ XfceRandr *
 xfce_randr_new (GdkDisplay  *display,
                 GError     **error)
 {
-    XfceRandr *randr;
-    Display   *xdisplay;
-    GdkWindow *root_window;
-    gint       major, minor;
-
     g_return_val_if_fail (GDK_IS_DISPLAY (display), NULL);
-    g_return_val_if_fail (error == NULL || *error == NULL, NULL);
 
-    /* get the x display */
-    xdisplay = gdk_x11_display_get_xdisplay (display);
+    return xfce_randr_new_with_backend (xfce_displays_backend_x11_new (display), error);
+}
+
+
+
+XfceRandr *
+xfce_randr_new_with_backend (XfceDisplaysBackend  *backend,
+                             GError              **error)
+{
+    XfceRandr             *randr;
+    XfceDisplaysResources *resources;
+    gint                   major, minor;
+
+    g_return_val_if_fail (backend != NULL, NULL);
+    g_return_val_if_fail (error == NULL || *error == NULL, NULL);
 
     /* check if the randr extension is available */
-    if (XRRQueryVersion (xdisplay, &major, &minor) == FALSE)
+    if (!backend->query_version (backend, &major, &minor))
     {
         g_set_error (error, 0, 0, _("Unable to query the version of the RandR extension being used"));
+        xfce_displays_backend_free (backend);
         return NULL;
     }
 
@@ -289,6 +295,16 @@ xfce_randr_new (GdkDisplay  *display,
         /* 1.2 is required */
         g_set_error (error, 0, 0, _("This system is using RandR %d.%d. For the display settings to work "
                                     "version 1.2 is required at least"), major, minor);
+        xfce_displays_backend_free (backend);
+        return NULL;
+    }
+
+    /* get the screen resource */
+    resources = backend->get_screen_resources (backend, FALSE);
+    if (resources == NULL)
+    {
+        g_set_error (error, 0, 0, _("Unable to get the screen resources of the RandR extension"));
+        xfce_displays_backend_free (backend);
         return NULL;
     }
 
@@ -298,16 +314,11 @@ xfce_randr_new (GdkDisplay  *display,
 
     randr->priv->has_1_3 = (major > 1 || (major == 1 && minor >= 3));
 
-    /* set display */
-    randr->priv->display = display;
-
-    /* get the root window */
-    root_window = gdk_get_default_root_window ();
+    /* the randr owns the backend */
+    randr->priv->backend = backend;
+    randr->priv->resources = resources;
 
-    /* get the screen resource */
-    randr->priv->resources = XRRGetScreenResources (xdisplay, GDK_WINDOW_XID (root_window));
-
-    xfce_randr_populate (randr, xdisplay, root_window);
+    xfce_randr_populate (randr);
 
     return randr;
 }
@@ -323,7 +334,7 @@ xfce_randr_cleanup (XfceRandr *randr)
     for (n = 0; n < randr->noutput; ++n)
     {
         if (G_LIKELY (randr->priv->output_info[n]))
-            XRRFreeOutputInfo (randr->priv->output_info[n]);
+            xfce_displays_output_info_free (randr->priv->output_info[n]);
         if (G_LIKELY (randr->priv->modes[n]))
             g_free (randr->priv->modes[n]);
         if (G_LIKELY (randr->friendly_name[n]))
@@ -331,7 +342,8 @@ xfce_randr_cleanup (XfceRandr *randr)
     }
 
     /* free the screen resources */
-    XRRFreeScreenResources (randr->priv->resources);
+    xfce_displays_resources_free (randr->priv->resources);
+    randr->priv->resources = NULL;
 
     /* free the settings */
     g_free (randr->friendly_name);
@@ -351,6 +363,7 @@ void
 xfce_randr_free (XfceRandr *randr)
 {
     xfce_randr_cleanup (randr);
+    xfce_displays_backend_free (randr->priv->backend);
 
     /* free the structure */
     g_slice_free (XfceRandrPrivate, randr->priv);
@@ -362,30 +375,35 @@ xfce_randr_free (XfceRandr *randr)
 void
 xfce_randr_reload (XfceRandr *randr)
 {
-    Display   *xdisplay;
-    GdkWindow *root_window;
+    XfceDisplaysResources *resources;
+
+    /* get the screen resource, xfce_randr_reload() is only called after
+       a xrandr notification, which means that X is aware of the new
+       hardware already. So, if possible, do not reprobe the hardware
+       again. */
+    resources = randr->priv->backend->get_screen_resources (randr->priv->backend,
+                                                            randr->priv->has_1_3);
+    if (resources == NULL)
+    {
+        g_warning ("Failed to reload the RandR resources.");
+        return;
+    }
 
     xfce_randr_cleanup (randr);
+    randr->priv->resources = resources;
 
-    /* get the x display */
-    xdisplay = gdk_x11_display_get_xdisplay (randr->priv->display);
+    /* repopulate */
+    xfce_randr_populate (randr);
+}
 
-    /* get the root window */
-    root_window = gdk_get_default_root_window ();
 
-    /* get the screen resource */
-#ifdef HAS_RANDR_ONE_POINT_THREE
-    /* xfce_randr_reload() is only called after a xrandr notification, which
-       means that X is aware of the new hardware already. So, if possible,
-       do not reprobe the hardware again. */
-    if (randr->priv->has_1_3)
-        randr->priv->resources = XRRGetScreenResourcesCurrent (xdisplay, GDK_WINDOW_XID (root_window));
-    else
-#endif
-    randr->priv->resources = XRRGetScreenResources (xdisplay, GDK_WINDOW_XID (root_window));
 
-    /* repopulate */
-    xfce_randr_populate (randr, xdisplay, root_window);
+XfceDisplaysBackend *
+xfce_randr_get_backend (XfceRandr *randr)
+{
+    g_return_val_if_fail (randr != NULL, NULL);
+
+    return randr->priv->backend;
 }
 
 
@@ -504,46 +522,13 @@ xfce_randr_load (XfceRandr     *randr,
 
 
 
-static guint8 *
-xfce_randr_read_edid_data (Display  *xdisplay,
-                           RROutput  output)
-{
-    unsigned char *prop;
-    int            actual_format;
-    unsigned long  nitems, bytes_after;
-    Atom           actual_type;
-    Atom           edid_atom;
-    guint8        *result = NULL;
-
-    edid_atom = gdk_x11_get_xatom_by_name (RR_PROPERTY_RANDR_EDID);
-
-    if (edid_atom != None)
-    {
-        if (XRRGetOutputProperty (xdisplay, output, edid_atom, 0, 100,
-                                  False, False, AnyPropertyType,
-                                  &actual_type, &actual_format, &nitems,
-                                  &bytes_after, &prop) == Success)
-        {
-            if (actual_type == XA_INTEGER && actual_format == 8)
-                result = g_memdup (prop, nitems);
-        }
-
-        XFree (prop);
-    }
-
-    return result;
-}
-
-
-
 static gchar *
 xfce_randr_friendly_name (XfceRandr *randr,
-                          guint      output,
-                          guint      output_rr_id)
+                          guint      output)
 {
-    Display        *xdisplay;
     MonitorInfo    *info = NULL;
     guint8         *edid_data;
+    gsize           edid_length;
     gchar          *friendly_name = NULL;
     const gchar *name = randr->priv->output_info[output]->name;
 
@@ -553,10 +538,12 @@ xfce_randr_friendly_name (XfceRandr *randr,
         return g_strdup (_("Laptop"));
 
     /* otherwise, get the vendor & size */
-    xdisplay = gdk_x11_display_get_xdisplay (randr->priv->display);
-    edid_data = xfce_randr_read_edid_data (xdisplay, randr->priv->resources->outputs[output_rr_id]);
+    edid_data = randr->priv->backend->get_edid (randr->priv->backend,
+                                                randr->priv->output_info[output]->id,
+                                                &edid_length);
 
-    if (edid_data)
+    /* a full EDID block */
+    if (edid_data && edid_length >= 128)
         info = decode_edid (edid_data);
 
     if (info)
@@ -616,10 +603,14 @@ xfce_randr_preferred_mode (XfceRandr *randr,
 {
     RRMode best_mode;
     gint   best_dist, dist, n;
+    gint   width, height, mm_width, mm_height;
 
     g_return_val_if_fail (randr != NULL, None);
     g_return_val_if_fail (output < randr->noutput, None);
 
+    randr->priv->backend->get_screen_size (randr->priv->backend,
+                                           &width, &height, &mm_width, &mm_height);
+
     /* mimic xrandr's preferred_mode () */
 
     best_mode = None;
@@ -629,11 +620,11 @@ xfce_randr_preferred_mode (XfceRandr *randr,
         if (n < randr->priv->output_info[output]->npreferred)
             dist = 0;
         else if (randr->priv->output_info[output]->mm_height != 0)
-            dist = (1000 * gdk_screen_height () / gdk_screen_height_mm () -
-                1000 * randr->priv->modes[output][n].height /
-                    randr->priv->output_info[output]->mm_height);
+            dist = (1000 * height / MAX (mm_height, 1) -
+                1000 * (gint) randr->priv->modes[output][n].height /
+                    (gint) randr->priv->output_info[output]->mm_height);
         else
-            dist = gdk_screen_height () - randr->priv->modes[output][n].height;
+            dist = height - (gint) randr->priv->modes[output][n].height;
 
         dist = ABS (dist);
 
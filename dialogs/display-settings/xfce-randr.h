@@ -21,6 +21,8 @@
 #include <gdk/gdk.h>
 #include <X11/extensions/Xrandr.h>
 
+#include <common/displays-backend.h>
+
 #ifndef __XFCE_RANDR_H__
 #define __XFCE_RANDR_H__
 
@@ -111,10 +113,15 @@ struct _XfceOutputInfo
 XfceRandr        *xfce_randr_new             (GdkDisplay      *display,
                                               GError         **error);
 
+XfceRandr        *xfce_randr_new_with_backend (XfceDisplaysBackend *backend,
+                                               GError             **error);
+
 void              xfce_randr_free            (XfceRandr        *randr);
 
 void              xfce_randr_reload          (XfceRandr        *randr);
 
+XfceDisplaysBackend *xfce_randr_get_backend  (XfceRandr        *randr);
+
 void              xfce_randr_save_output     (XfceRandr        *randr,
                                               const gchar      *scheme,
                                               XfconfChannel    *channel,
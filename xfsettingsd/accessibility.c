@@ -44,6 +44,7 @@
 #endif /* !HAVE_LIBNOTIFY */
 
 #include "debug.h"
+#include "dispatcher.h"
 #include "accessibility.h"
 
 
@@ -88,6 +89,9 @@ struct _XfceAccessibilityHelper
 
 #ifdef HAVE_LIBNOTIFY
     NotifyNotification *notification;
+
+    /* xkb event type */
+    gint                xkb_event_type;
 #endif /* !HAVE_LIBNOTIFY */
 };
 
@@ -111,14 +115,15 @@ xfce_accessibility_helper_class_init (XfceAccessibilityHelperClass *klass)
 static void
 xfce_accessibility_helper_init (XfceAccessibilityHelper *helper)
 {
-    gint dummy;
+    gint dummy, event_base;
 
     helper->channel = NULL;
 #ifdef HAVE_LIBNOTIFY
     helper->notification = NULL;
+    helper->xkb_event_type = 0;
 #endif /* !HAVE_LIBNOTIFY */
 
-    if (XkbQueryExtension (GDK_DISPLAY (), &dummy, &dummy, &dummy, &dummy, &dummy))
+    if (XkbQueryExtension (GDK_DISPLAY (), &dummy, &event_base, &dummy, &dummy, &dummy))
     {
         /* open the channel */
         helper->channel = xfconf_channel_get ("accessibility");
@@ -137,8 +142,10 @@ xfce_accessibility_helper_init (XfceAccessibilityHelper *helper)
         /* add event filter */
         XkbSelectEvents (GDK_DISPLAY (), XkbUseCoreKbd, XkbControlsNotifyMask, XkbControlsNotifyMask);
 
-        /* monitor all window events */
-        gdk_window_add_filter (NULL, xfce_accessibility_helper_event_filter, helper);
+        /* monitor xkb events, all share the event base and the filter
+         * only handles XkbControlsNotify */
+        helper->xkb_event_type = event_base;
+        xfsettings_dispatcher_add (event_base, xfce_accessibility_helper_event_filter, helper);
 #endif /* !HAVE_LIBNOTIFY */
     }
     else
@@ -159,6 +166,9 @@ xfce_accessibility_helper_finalize (GObject *object)
     /* close an opened notification */
     if (G_UNLIKELY (helper->notification))
         notify_notification_close (helper->notification, NULL);
+
+    if (helper->xkb_event_type != 0)
+        xfsettings_dispatcher_remove (helper->xkb_event_type, xfce_accessibility_helper_event_filter, helper);
 #endif /* !HAVE_LIBNOTIFY */
 
     (*G_OBJECT_CLASS (xfce_accessibility_helper_parent_class)->finalize) (object);
@@ -30,39 +30,140 @@
 #include <string.h>
 #endif
 
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#ifdef HAVE_ERRNO_H
+#include <errno.h>
+#endif
+
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+#ifdef HAVE_SYS_RESOURCE_H
+#include <sys/resource.h>
+#endif
+
 #include <X11/Xlib.h>
 #include <X11/Xatom.h>
 
 #include <gdk/gdk.h>
 #include <gdk/gdkx.h>
 #include <gtk/gtk.h>
+#include <xfconf/xfconf.h>
 
 #include "clipboard-manager.h"
+#include "debug.h"
+#include "dispatcher.h"
 #include "xsettings.h"
 
+/* number of recent latencies the percentiles are taken from */
+#define N_LATENCY_SAMPLES (256)
+
+typedef struct
+{
+        gint64 samples[N_LATENCY_SAMPLES];
+        guint  n_samples;
+} LatencySamples;
+
 struct _GsdClipboardManagerPrivate
 {
-        guint    start_idle_id;
-        Display *display;
-        Window   window;
-        Time     timestamp;
+        guint          start_idle_id;
+        Display       *display;
+        Window         window;
+        Time           timestamp;
+
+        /* saved targets, indexed by target atom */
+        GSList        *contents;
+        GHashTable    *contents_index;
+        guint          n_incr_pending;
+
+        /* incremental transfers, by requestor and property, and the
+         * transfers waiting for their next chunk */
+        GHashTable    *conversions;
+        GQueue        *ready;
+        guint          serve_id;
+
+        /* payloads shared between targets with the same data */
+        GHashTable    *payloads;
+        gsize          n_bytes_shared;
+
+        /* saving policy, loaded for each save */
+        XfconfChannel *channel;
+        gint           max_target_size;
+        gint           max_total_size;
+        gchar        **priorities;
+        GHashTable    *limits;
+        gsize          n_bytes_saving;
+        gsize          n_bytes_budget;
+
+        /* recently saved contents, most recent first */
+        GQueue        *history;
+        GHashTable    *history_payloads;
+        gsize          history_bytes;
+        guint          history_next_id;
+        gint           history_size;
+        gint           history_max_size;
+
+        /* statistics of saves and incremental sends */
+        gint64         save_start_time;
+        guint64        n_saves;
+        guint64        n_bytes_saved;
+        gint64         save_time;
+        guint64        n_transfers;
+        guint64        n_bytes_sent;
+        gint64         send_time;
+        LatencySamples save_latency;
+        LatencySamples chunk_latency;
+
+        Window         requestor;
+        Atom           property;
+        Time           time;
+};
 
-        GSList  *contents;
-        GSList  *conversions;
+typedef struct
+{
+        guchar     *data;
+        gsize       length;
+        guint       hash;
+        gint        refcount;
 
-        Window   requestor;
-        Atom     property;
-        Time     time;
-};
+        /* set of the payload */
+        GHashTable *table;
+
+        /* large data moved out of the heap, mapped while served */
+        gint        fd;
+        guchar     *map;
+        guint       map_count;
+} TargetPayload;
 
 typedef struct
 {
-        guchar *data;
-        gulong  length;
-        Atom    target;
-        Atom    type;
-        gint    format;
-        gint    refcount;
+        guchar        *data;
+        gulong         length;
+        Atom           target;
+        Atom           type;
+        gint           format;
+        gint           refcount;
+
+        /* stored data, shared with other targets */
+        TargetPayload *payload;
+
+        /* size limit, the data is thrown away when exceeded */
+        gint           limit;
+        gboolean       discard;
+
+        /* incremental receive buffer */
+        gsize          allocated;
+        guint          n_chunks;
+        guint          n_grows;
+        gint64         start_time;
 } TargetData;
 
 typedef struct
@@ -72,16 +173,75 @@ typedef struct
         Atom        property;
         Window      requestor;
         gint        offset;
+        gboolean    mapped;
+
+        /* transfer statistics */
+        gint64      start_time;
+        gint64      ready_time;
+        gint64      max_latency;
+        gint64      total_latency;
+        guint       n_chunks;
 } IncrConversion;
 
+typedef struct
+{
+        Atom           target;
+        Atom           type;
+        gint           format;
+        gulong         length;
+        TargetPayload *payload;
+} HistoryTarget;
+
+typedef struct
+{
+        guint          id;
+        guint          hash;
+        gint64         time;
+
+        /* allocated in the same block as the entry */
+        HistoryTarget *targets;
+        guint          n_targets;
+        gchar         *preview;
+} HistoryEntry;
+
 static void     gsd_clipboard_manager_finalize    (GObject                  *object);
-static void     clipboard_manager_watch_cb        (GsdClipboardManager *manager,
-                                                   Window               window,
-                                                   Bool                 is_start,
-                                                   long                 mask,
-                                                   void                *cb_data);
+static guint    conversion_hash                   (gconstpointer             key);
+static gboolean conversion_equal                  (gconstpointer             a,
+                                                   gconstpointer             b);
+static void     conversion_free                   (IncrConversion           *rdata);
+static guint    payload_hash                      (gconstpointer             key);
+static gboolean payload_equal                     (gconstpointer             a,
+                                                   gconstpointer             b);
+static void     history_clear                     (GsdClipboardManager      *manager);
+
+/* first allocation of an incremental receive buffer */
+#define INCR_MIN_ALLOCATION (64 * 1024)
+
+/* targets larger than this are moved to a memfd */
+#define SPILL_THRESHOLD (1024 * 1024)
+
+/* default size limits of the saving policy, -1 is unlimited; the
+ * non-text targets of a save share a budget */
+#define DEFAULT_MAX_TARGET_SIZE (-1)
+#define DEFAULT_MAX_TOTAL_SIZE  (128 * 1024 * 1024)
+
+/* defaults of the history, disabled unless a size is set */
+#define DEFAULT_HISTORY_SIZE     (0)
+#define DEFAULT_HISTORY_MAX_SIZE (32 * 1024 * 1024)
+
+/* bytes of text shown for a history entry */
+#define HISTORY_PREVIEW_LENGTH (80)
+
+#define HISTORY_ALIGN(size) (((size) + G_MEM_ALIGN - 1) & ~((gsize) G_MEM_ALIGN - 1))
+
+/* largest chunk of an incremental send with BIG-REQUESTS */
+#define INCR_CHUNK_MAX (1024 * 1024)
+
+/* bytes sent to requestors before returning to the main loop */
+#define SERVE_BUDGET (4 * INCR_CHUNK_MAX)
 
 static gulong SELECTION_MAX_SIZE = 0;
+static gulong INCR_CHUNK_SIZE = 0;
 
 static Atom XA_ATOM_PAIR = None;
 static Atom XA_CLIPBOARD_MANAGER = None;
@@ -122,6 +282,20 @@ gsd_clipboard_manager_init (GsdClipboardManager *manager)
 
         manager->priv->display = GDK_DISPLAY_XDISPLAY (gdk_display_get_default ());
 
+        manager->priv->contents_index = g_hash_table_new (g_direct_hash, g_direct_equal);
+        manager->priv->conversions = g_hash_table_new_full (conversion_hash, conversion_equal,
+                                                            NULL, (GDestroyNotify) conversion_free);
+        manager->priv->ready = g_queue_new ();
+        manager->priv->payloads = g_hash_table_new (payload_hash, payload_equal);
+        manager->priv->history = g_queue_new ();
+        manager->priv->history_payloads = g_hash_table_new (g_direct_hash, g_direct_equal);
+        manager->priv->history_next_id = 1;
+
+        manager->priv->channel = xfconf_channel_get ("clipboard");
+        manager->priv->max_target_size = DEFAULT_MAX_TARGET_SIZE;
+        manager->priv->max_total_size = DEFAULT_MAX_TOTAL_SIZE;
+        manager->priv->history_size = DEFAULT_HISTORY_SIZE;
+        manager->priv->history_max_size = DEFAULT_HISTORY_MAX_SIZE;
 }
 
 static void
@@ -132,9 +306,226 @@ gsd_clipboard_manager_finalize (GObject *object)
         if (clipboard_manager->priv->start_idle_id !=0)
                 g_source_remove (clipboard_manager->priv->start_idle_id);
 
+        if (clipboard_manager->priv->serve_id != 0)
+                g_source_remove (clipboard_manager->priv->serve_id);
+
+        g_queue_free (clipboard_manager->priv->ready);
+        g_hash_table_destroy (clipboard_manager->priv->conversions);
+        g_hash_table_destroy (clipboard_manager->priv->contents_index);
+
+        /* history entries release their payloads */
+        history_clear (clipboard_manager);
+        g_queue_free (clipboard_manager->priv->history);
+        g_hash_table_destroy (clipboard_manager->priv->history_payloads);
+
+        g_hash_table_destroy (clipboard_manager->priv->payloads);
+
+        g_strfreev (clipboard_manager->priv->priorities);
+        if (clipboard_manager->priv->limits != NULL)
+                g_hash_table_destroy (clipboard_manager->priv->limits);
+
         G_OBJECT_CLASS (gsd_clipboard_manager_parent_class)->finalize (object);
 }
 
+/* Payloads are the stored bytes of a target. Applications offer the
+ * same text under several targets, so identical payloads are shared
+ * between targets and only stored once.
+ */
+static guint
+payload_hash_data (const guchar *data,
+                   gsize         length)
+{
+        guint32 hash = 2166136261u;
+        gsize   i;
+
+        /* FNV-1a */
+        for (i = 0; i < length; i++) {
+                hash ^= data[i];
+                hash *= 16777619u;
+        }
+
+        return hash;
+}
+
+static TargetPayload *
+payload_ref (TargetPayload *payload)
+{
+        payload->refcount++;
+        return payload;
+}
+
+static void
+payload_unref (TargetPayload *payload)
+{
+        payload->refcount--;
+        if (payload->refcount == 0) {
+                if (payload->table != NULL)
+                        g_hash_table_remove (payload->table, payload);
+
+                g_free (payload->data);
+#ifdef HAVE_SYS_MMAN_H
+                if (payload->map != NULL)
+                        munmap (payload->map, payload->length);
+#endif
+                if (payload->fd >= 0)
+                        close (payload->fd);
+                g_slice_free (TargetPayload, payload);
+        }
+}
+
+#ifdef HAVE_SYS_MMAN_H
+static gint
+payload_spill_fd (void)
+{
+        gint   fd;
+        gchar *path;
+
+#ifdef HAVE_MEMFD_CREATE
+        fd = memfd_create ("xfsettingsd-clipboard", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+        if (fd >= 0)
+                return fd;
+#endif
+
+        /* fall back to an unlinked file in the runtime directory */
+        path = g_build_filename (g_get_user_runtime_dir (), "xfsettingsd-clipboard-XXXXXX", NULL);
+        fd = g_mkstemp_full (path, O_RDWR | O_CLOEXEC, 0600);
+        if (fd >= 0)
+                unlink (path);
+        g_free (path);
+
+        return fd;
+}
+#endif
+
+/* Move the data of a large payload out of the heap. The file is
+ * sealed and only mapped while the payload is sent to a requestor.
+ */
+static void
+payload_spill (TargetPayload *payload)
+{
+#ifdef HAVE_SYS_MMAN_H
+        gint   fd;
+        gsize  written = 0;
+        gssize n;
+
+        if (payload->fd >= 0
+            || payload->data == NULL
+            || payload->length < SPILL_THRESHOLD)
+                return;
+
+        fd = payload_spill_fd ();
+        if (fd < 0) {
+                g_warning ("Failed to create a file for clipboard contents: %s",
+                           g_strerror (errno));
+                return;
+        }
+
+        while (written < payload->length) {
+                n = write (fd, payload->data + written, payload->length - written);
+                if (n < 0) {
+                        if (errno == EINTR)
+                                continue;
+
+                        g_warning ("Failed to write clipboard contents: %s",
+                                   g_strerror (errno));
+                        close (fd);
+                        return;
+                }
+                written += n;
+        }
+
+#ifdef F_ADD_SEALS
+        /* fails on the fallback file, only a memfd can be sealed */
+        if (fcntl (fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) == -1)
+                xfsettings_dbg_filtered (XFSD_DEBUG_CLIPBOARD, "failed to seal the clipboard file: %s",
+                                         g_strerror (errno));
+#endif
+
+        g_free (payload->data);
+        payload->data = NULL;
+        payload->fd = fd;
+
+        xfsettings_dbg_filtered (XFSD_DEBUG_CLIPBOARD,
+                                 "moved %" G_GSIZE_FORMAT " bytes out of the heap",
+                                 payload->length);
+#endif
+}
+
+static const guchar *
+payload_map (TargetPayload *payload)
+{
+#ifdef HAVE_SYS_MMAN_H
+        gpointer map;
+
+        if (payload->fd < 0)
+                return payload->data;
+
+        if (payload->map == NULL) {
+                map = mmap (NULL, payload->length, PROT_READ, MAP_PRIVATE, payload->fd, 0);
+                if (map == MAP_FAILED) {
+                        g_warning ("Failed to map clipboard contents: %s",
+                                   g_strerror (errno));
+                        return NULL;
+                }
+                payload->map = map;
+        }
+
+        payload->map_count++;
+
+        return payload->map;
+#else
+        return payload->data;
+#endif
+}
+
+static void
+payload_unmap (TargetPayload *payload)
+{
+#ifdef HAVE_SYS_MMAN_H
+        if (payload->fd < 0 || payload->map == NULL)
+                return;
+
+        if (--payload->map_count == 0) {
+                munmap (payload->map, payload->length);
+                payload->map = NULL;
+        }
+#endif
+}
+
+static guint
+payload_hash (gconstpointer key)
+{
+        return ((const TargetPayload *) key)->hash;
+}
+
+static gboolean
+payload_equal (gconstpointer a,
+               gconstpointer b)
+{
+        TargetPayload *pa = (TargetPayload *) a;
+        TargetPayload *pb = (TargetPayload *) b;
+        const guchar  *da, *db;
+        gboolean       equal;
+
+        if (pa->length != pb->length || pa->hash != pb->hash)
+                return FALSE;
+
+        if (pa->length == 0)
+                return TRUE;
+
+        da = payload_map (pa);
+        db = payload_map (pb);
+
+        equal = da != NULL && db != NULL && memcmp (da, db, pa->length) == 0;
+
+        if (da != NULL)
+                payload_unmap (pa);
+        if (db != NULL)
+                payload_unmap (pb);
+
+        return equal;
+}
+
 /* We need to use reference counting for the target data, since we may
  * need to keep the data around after loosing the CLIPBOARD ownership
  * to complete incremental transfers.
@@ -152,15 +543,69 @@ target_data_unref (TargetData *data)
         data->refcount--;
         if (data->refcount == 0) {
                 g_free (data->data);
+                if (data->payload != NULL)
+                        payload_unref (data->payload);
                 g_slice_free (TargetData, data);
         }
 }
 
+/* Turn the received data of a target into a payload, sharing it when
+ * another target already stored the same bytes.
+ */
+/* Returns FALSE if the data is shared with a payload stored before */
+static gboolean
+target_data_store (GsdClipboardManager *manager,
+                   TargetData          *tdata)
+{
+        TargetPayload  key;
+        TargetPayload *payload, *shared;
+
+        key.data = tdata->data;
+        key.length = tdata->data != NULL ? tdata->length : 0;
+        key.hash = payload_hash_data (key.data, key.length);
+        key.fd = -1;
+        key.map = NULL;
+
+        shared = g_hash_table_lookup (manager->priv->payloads, &key);
+        if (shared != NULL) {
+                tdata->payload = payload_ref (shared);
+                g_free (tdata->data);
+
+                manager->priv->n_bytes_shared += key.length;
+                xfsettings_dbg_filtered (XFSD_DEBUG_CLIPBOARD,
+                                         "target %s shares %" G_GSIZE_FORMAT " bytes, "
+                                         "%" G_GSIZE_FORMAT " bytes saved in total",
+                                         gdk_x11_get_xatom_name (tdata->target),
+                                         key.length, manager->priv->n_bytes_shared);
+        } else {
+                payload = g_slice_new0 (TargetPayload);
+                payload->data = tdata->data;
+                payload->length = key.length;
+                payload->hash = key.hash;
+                payload->refcount = 1;
+                payload->fd = -1;
+                payload->table = manager->priv->payloads;
+                g_hash_table_add (manager->priv->payloads, payload);
+
+                payload_spill (payload);
+
+                tdata->payload = payload;
+        }
+
+        tdata->data = NULL;
+        tdata->allocated = 0;
+
+        return shared == NULL;
+}
+
 static void
 conversion_free (IncrConversion *rdata)
 {
-        if (rdata->data)
+        if (rdata->data) {
+                if (rdata->mapped)
+                        payload_unmap (rdata->data->payload);
                 target_data_unref (rdata->data);
+        }
         g_slice_free (IncrConversion, rdata);
 }
 
@@ -238,18 +683,633 @@ clipboard_bytes_per_item (int format)
         return 0;
 }
 
+static TargetData *
+find_content (GsdClipboardManager *manager,
+              Atom                 target)
+{
+        return g_hash_table_lookup (manager->priv->contents_index,
+                                    GUINT_TO_POINTER (target));
+}
+
+static void
+clear_contents (GsdClipboardManager *manager)
+{
+        g_slist_foreach (manager->priv->contents, (GFunc) target_data_unref, NULL);
+        g_slist_free (manager->priv->contents);
+        manager->priv->contents = NULL;
+
+        g_hash_table_remove_all (manager->priv->contents_index);
+        manager->priv->n_incr_pending = 0;
+}
+
+static void
+remove_content (GsdClipboardManager *manager,
+                TargetData          *tdata)
+{
+        manager->priv->contents = g_slist_remove (manager->priv->contents, tdata);
+        if (find_content (manager, tdata->target) == tdata)
+                g_hash_table_remove (manager->priv->contents_index,
+                                     GUINT_TO_POINTER (tdata->target));
+        target_data_unref (tdata);
+}
+
+static gboolean
+target_is_text (Atom target)
+{
+        const gchar *name;
+
+        name = gdk_x11_get_xatom_name (target);
+
+        return strcmp (name, "UTF8_STRING") == 0
+               || strcmp (name, "STRING") == 0
+               || strcmp (name, "TEXT") == 0
+               || strcmp (name, "COMPOUND_TEXT") == 0
+               || strncmp (name, "text/", 5) == 0;
+}
+
+/* The saving policy is read from the clipboard channel:
+ *
+ * /MaxTargetSize     int, bytes, default limit of a single target
+ * /MaxTotalSize      int, bytes, limit of all non-text targets, 128 MiB
+ *                    by default, the largest are dropped above it
+ * /TargetPriorities  string list, targets or major types saved first
+ * /TargetLimits/<t>  int, bytes, limit of target or major type <t>
+ * /HistorySize       int, number of saved contents kept, 0 disables it
+ * /HistoryMaxSize    int, bytes, limit of the contents in the history
+ *
+ * A negative limit means no limit, 0 means never save the target.
+ */
+static void
+load_policy (GsdClipboardManager *manager)
+{
+        XfconfChannel *channel = manager->priv->channel;
+
+        manager->priv->max_target_size =
+                xfconf_channel_get_int (channel, "/MaxTargetSize", DEFAULT_MAX_TARGET_SIZE);
+        manager->priv->max_total_size =
+                xfconf_channel_get_int (channel, "/MaxTotalSize", DEFAULT_MAX_TOTAL_SIZE);
+
+        g_strfreev (manager->priv->priorities);
+        manager->priv->priorities = xfconf_channel_get_string_list (channel, "/TargetPriorities");
+
+        if (manager->priv->limits != NULL)
+                g_hash_table_destroy (manager->priv->limits);
+        manager->priv->limits = xfconf_channel_get_properties (channel, "/TargetLimits");
+
+        manager->priv->history_size =
+                xfconf_channel_get_int (channel, "/HistorySize", DEFAULT_HISTORY_SIZE);
+        manager->priv->history_max_size =
+                xfconf_channel_get_int (channel, "/HistoryMaxSize", DEFAULT_HISTORY_MAX_SIZE);
+}
+
+static gboolean
+target_limit_lookup (GsdClipboardManager *manager,
+                     const gchar         *type,
+                     gint                *limit)
+{
+        gchar        *property;
+        const GValue *value;
+
+        property = g_strconcat ("/TargetLimits/", type, NULL);
+        value = g_hash_table_lookup (manager->priv->limits, property);
+        g_free (property);
+
+        if (value == NULL || !G_VALUE_HOLDS_INT (value))
+                return FALSE;
+
+        *limit = g_value_get_int (value);
+
+        return TRUE;
+}
+
+static gint
+target_size_limit (GsdClipboardManager *manager,
+                   Atom                 target)
+{
+        const gchar *name;
+        gchar       *type, *slash;
+        gint         limit = manager->priv->max_target_size;
+
+        if (manager->priv->limits == NULL)
+                return limit;
+
+        /* strip the mime parameters, they are not valid in a property name */
+        name = gdk_x11_get_xatom_name (target);
+        type = g_strndup (name, strcspn (name, ";"));
+
+        if (!target_limit_lookup (manager, type, &limit)) {
+                /* try the major type */
+                slash = strchr (type, '/');
+                if (slash != NULL) {
+                        *slash = '\0';
+                        target_limit_lookup (manager, type, &limit);
+                }
+        }
+
+        g_free (type);
+
+        return limit;
+}
+
+/* Text targets first, then the configured priorities, then the rest */
+static gint
+target_rank (GsdClipboardManager *manager,
+             Atom                 target)
+{
+        const gchar *name;
+        const gchar *priority;
+        gsize        len;
+        gint         i;
+
+        if (target_is_text (target))
+                return 0;
+
+        if (manager->priv->priorities == NULL)
+                return G_MAXINT;
+
+        name = gdk_x11_get_xatom_name (target);
+        for (i = 0; manager->priv->priorities[i] != NULL; i++) {
+                priority = manager->priv->priorities[i];
+
+                /* an entry without a slash is a major type */
+                len = strlen (priority);
+                if (strcmp (name, priority) == 0
+                    || (strchr (priority, '/') == NULL
+                        && strncmp (name, priority, len) == 0
+                        && name[len] == '/'))
+                        return i + 1;
+        }
+
+        return G_MAXINT;
+}
+
+/* Whether a target of size bytes does not fit in the policy */
+static gboolean
+target_over_limit (GsdClipboardManager *manager,
+                   TargetData          *tdata,
+                   gulong               size)
+{
+        if (tdata->limit >= 0 && size > (gulong) tdata->limit)
+                return TRUE;
+
+        /* the budget holds the stored non-text targets, not this one */
+        if (manager->priv->max_total_size >= 0
+            && !target_is_text (tdata->target)
+            && manager->priv->n_bytes_budget + size > (gulong) manager->priv->max_total_size)
+                return TRUE;
+
+        return FALSE;
+}
+
+/* Store a received target, only non-text data that is not shared
+ * with a target saved before counts against /MaxTotalSize */
+static void
+target_data_save (GsdClipboardManager *manager,
+                  TargetData          *tdata)
+{
+        gsize length = tdata->length;
+
+        if (target_data_store (manager, tdata) && !target_is_text (tdata->target))
+                manager->priv->n_bytes_budget += length;
+}
+
+static gint
+compare_content_length (gconstpointer a,
+                        gconstpointer b)
+{
+        const TargetData *ta = a;
+        const TargetData *tb = b;
+
+        /* largest first */
+        if (ta->length == tb->length)
+                return 0;
+
+        return ta->length > tb->length ? -1 : 1;
+}
+
+/* Drop the largest non-text targets until the saved contents fit in
+ * the budget, text targets are always kept.
+ */
+static void
+enforce_budget (GsdClipboardManager *manager)
+{
+        GSList         *sorted, *li;
+        TargetData     *tdata;
+        gsize           total = 0;
+        GHashTable     *uses;
+        guint           n_uses;
+
+        if (manager->priv->max_total_size < 0)
+                return;
+
+        /* shared payloads only count once, payloads of the history
+         * are limited by the history itself */
+        uses = g_hash_table_new (g_direct_hash, g_direct_equal);
+        for (li = manager->priv->contents; li != NULL; li = li->next) {
+                tdata = li->data;
+                if (tdata->payload == NULL || target_is_text (tdata->target))
+                        continue;
+
+                n_uses = GPOINTER_TO_UINT (g_hash_table_lookup (uses, tdata->payload));
+                if (n_uses == 0)
+                        total += tdata->payload->length;
+                g_hash_table_insert (uses, tdata->payload, GUINT_TO_POINTER (n_uses + 1));
+        }
+
+        if (total <= (gsize) manager->priv->max_total_size) {
+                g_hash_table_destroy (uses);
+                return;
+        }
+
+        sorted = g_slist_sort (g_slist_copy (manager->priv->contents),
+                               compare_content_length);
+
+        for (li = sorted;
+             li != NULL && total > (gsize) manager->priv->max_total_size;
+             li = li->next) {
+                tdata = li->data;
+                if (target_is_text (tdata->target))
+                        continue;
+
+                xfsettings_dbg_filtered (XFSD_DEBUG_CLIPBOARD,
+                                         "dropped target %s (%lu bytes) to fit the budget",
+                                         gdk_x11_get_xatom_name (tdata->target),
+                                         tdata->length);
+
+                /* only counts if no other target uses the payload */
+                if (tdata->payload != NULL) {
+                        n_uses = GPOINTER_TO_UINT (g_hash_table_lookup (uses, tdata->payload));
+                        if (n_uses == 1)
+                                total -= tdata->payload->length;
+                        g_hash_table_insert (uses, tdata->payload, GUINT_TO_POINTER (n_uses - 1));
+                }
+
+                remove_content (manager, tdata);
+        }
+
+        g_slist_free (sorted);
+        g_hash_table_destroy (uses);
+}
+
+/* Each history entry is one block: the targets and the preview are
+ * bump-allocated behind the entry, so an entry costs one allocation
+ * and is released at once when it is evicted.
+ */
+static HistoryEntry *
+history_entry_new (guint n_targets,
+                   gsize preview_length)
+{
+        guchar       *arena;
+        HistoryEntry *entry;
+
+        arena = g_malloc0 (HISTORY_ALIGN (sizeof (HistoryEntry))
+                           + HISTORY_ALIGN (n_targets * sizeof (HistoryTarget))
+                           + preview_length + 1);
+
+        entry = (HistoryEntry *) arena;
+        arena += HISTORY_ALIGN (sizeof (HistoryEntry));
+
+        entry->targets = (HistoryTarget *) arena;
+        entry->n_targets = n_targets;
+        arena += HISTORY_ALIGN (n_targets * sizeof (HistoryTarget));
+
+        entry->preview = (gchar *) arena;
+
+        return entry;
+}
+
+/* Payloads are shared between entries, the byte budget of the history
+ * counts each payload once, no matter how many entries use it.
+ */
+static TargetPayload *
+history_payload_hold (GsdClipboardManager *manager,
+                      TargetPayload       *payload)
+{
+        guint n_uses;
+
+        n_uses = GPOINTER_TO_UINT (g_hash_table_lookup (manager->priv->history_payloads, payload));
+        if (n_uses == 0)
+                manager->priv->history_bytes += payload->length;
+        g_hash_table_insert (manager->priv->history_payloads, payload,
+                             GUINT_TO_POINTER (n_uses + 1));
+
+        return payload_ref (payload);
+}
+
+static void
+history_payload_release (GsdClipboardManager *manager,
+                         TargetPayload       *payload)
+{
+        guint n_uses;
+
+        n_uses = GPOINTER_TO_UINT (g_hash_table_lookup (manager->priv->history_payloads, payload));
+        if (n_uses <= 1) {
+                g_hash_table_remove (manager->priv->history_payloads, payload);
+                manager->priv->history_bytes -= payload->length;
+        } else {
+                g_hash_table_insert (manager->priv->history_payloads, payload,
+                                     GUINT_TO_POINTER (n_uses - 1));
+        }
+
+        payload_unref (payload);
+}
+
+static void
+history_entry_free (GsdClipboardManager *manager,
+                    HistoryEntry        *entry)
+{
+        guint i;
+
+        for (i = 0; i < entry->n_targets; i++)
+                history_payload_release (manager, entry->targets[i].payload);
+
+        g_free (entry);
+}
+
+static gboolean
+history_entry_equal (const HistoryEntry *a,
+                     const HistoryEntry *b)
+{
+        guint i, j;
+
+        if (a->hash != b->hash || a->n_targets != b->n_targets)
+                return FALSE;
+
+        /* payloads are unique, so comparing the pointers is enough */
+        for (i = 0; i < a->n_targets; i++) {
+                for (j = 0; j < b->n_targets; j++)
+                        if (a->targets[i].target == b->targets[j].target
+                            && a->targets[i].payload == b->targets[j].payload)
+                                break;
+
+                if (j == b->n_targets)
+                        return FALSE;
+        }
+
+        return TRUE;
+}
+
+static void
+history_clear (GsdClipboardManager *manager)
+{
+        HistoryEntry *entry;
+
+        while ((entry = g_queue_pop_head (manager->priv->history)) != NULL)
+                history_entry_free (manager, entry);
+}
+
+/* Evict the least recently used entries until the history fits */
+static void
+history_trim (GsdClipboardManager *manager)
+{
+        HistoryEntry *entry;
+
+        while (!g_queue_is_empty (manager->priv->history)
+               && ((gint) g_queue_get_length (manager->priv->history) > manager->priv->history_size
+                   || (manager->priv->history_max_size >= 0
+                       && manager->priv->history_bytes > (gsize) manager->priv->history_max_size))) {
+                entry = g_queue_pop_tail (manager->priv->history);
+
+                xfsettings_dbg_filtered (XFSD_DEBUG_CLIPBOARD,
+                                         "evicted history entry %u, %" G_GSIZE_FORMAT
+                                         " bytes in the history",
+                                         entry->id, manager->priv->history_bytes);
+
+                history_entry_free (manager, entry);
+        }
+}
+
+/* Short text describing the contents, from the UTF-8 text if there
+ * is one, otherwise the first target name.
+ */
+static gchar *
+history_preview (GsdClipboardManager *manager)
+{
+        TargetData   *tdata;
+        const guchar *data;
+        const gchar  *end;
+        gsize         length;
+        gchar        *preview;
+
+        tdata = find_content (manager, gdk_x11_get_xatom_by_name ("UTF8_STRING"));
+        if (tdata == NULL || tdata->payload == NULL) {
+                tdata = manager->priv->contents != NULL ? manager->priv->contents->data : NULL;
+                if (tdata == NULL)
+                        return g_strdup ("");
+
+                return g_strdup_printf ("[%s]", gdk_x11_get_xatom_name (tdata->target));
+        }
+
+        data = payload_map (tdata->payload);
+        if (data == NULL)
+                return g_strdup ("");
+
+        length = MIN (tdata->length, HISTORY_PREVIEW_LENGTH);
+        if (!g_utf8_validate ((const gchar *) data, length, &end))
+                length = end - (const gchar *) data;
+        preview = g_strndup ((const gchar *) data, length);
+
+        payload_unmap (tdata->payload);
+
+        return preview;
+}
+
+/* Add the contents of a finished save to the history. Saving the same
+ * contents again moves the existing entry to the front.
+ */
+static void
+history_add (GsdClipboardManager *manager)
+{
+        HistoryEntry  *entry;
+        HistoryTarget *target;
+        GList         *li;
+        GSList        *lp;
+        TargetData    *tdata;
+        guint          n_targets = 0;
+        gchar         *preview;
+
+        if (manager->priv->history_size <= 0) {
+                history_clear (manager);
+                return;
+        }
+
+        for (lp = manager->priv->contents; lp != NULL; lp = lp->next) {
+                tdata = lp->data;
+                if (tdata->payload != NULL && tdata->type != XA_INCR)
+                        n_targets++;
+        }
+
+        if (n_targets == 0)
+                return;
+
+        preview = history_preview (manager);
+        entry = history_entry_new (n_targets, strlen (preview));
+        strcpy (entry->preview, preview);
+        g_free (preview);
+
+        entry->time = g_get_real_time ();
+
+        target = entry->targets;
+        for (lp = manager->priv->contents; lp != NULL; lp = lp->next) {
+                tdata = lp->data;
+                if (tdata->payload == NULL || tdata->type == XA_INCR)
+                        continue;
+
+                target->target = tdata->target;
+                target->type = tdata->type;
+                target->format = tdata->format;
+                target->length = tdata->length;
+                target->payload = history_payload_hold (manager, tdata->payload);
+
+                entry->hash += tdata->target ^ tdata->payload->hash;
+                target++;
+        }
+
+        for (li = manager->priv->history->head; li != NULL; li = li->next) {
+                if (history_entry_equal (li->data, entry)) {
+                        /* already in the history, only refresh it */
+                        ((HistoryEntry *) li->data)->time = entry->time;
+                        g_queue_unlink (manager->priv->history, li);
+                        g_queue_push_head_link (manager->priv->history, li);
+
+                        history_entry_free (manager, entry);
+                        return;
+                }
+        }
+
+        entry->id = manager->priv->history_next_id++;
+        g_queue_push_head (manager->priv->history, entry);
+
+        xfsettings_dbg_filtered (XFSD_DEBUG_CLIPBOARD,
+                                 "added history entry %u with %u targets",
+                                 entry->id, n_targets);
+
+        history_trim (manager);
+}
+
+static void
+latency_add (LatencySamples *latency,
+             gint64          sample)
+{
+        latency->samples[latency->n_samples++ % N_LATENCY_SAMPLES] = sample;
+}
+
+static gint
+compare_latency (gconstpointer a,
+                 gconstpointer b,
+                 gpointer      user_data)
+{
+        gint64 la = *(const gint64 *) a;
+        gint64 lb = *(const gint64 *) b;
+
+        if (la == lb)
+                return 0;
+
+        return la < lb ? -1 : 1;
+}
+
+static void
+latency_percentiles (const LatencySamples *latency,
+                     gint64               *p50,
+                     gint64               *p99)
+{
+        gint64 sorted[N_LATENCY_SAMPLES];
+        guint  n;
+
+        n = MIN (latency->n_samples, N_LATENCY_SAMPLES);
+        if (n == 0) {
+                *p50 = *p99 = 0;
+                return;
+        }
+
+        memcpy (sorted, latency->samples, n * sizeof (gint64));
+        g_qsort_with_data (sorted, n, sizeof (gint64), compare_latency, NULL);
+
+        *p50 = sorted[n * 50 / 100];
+        *p99 = sorted[n * 99 / 100];
+}
+
+/* The handoff latency of a save is the time between the SAVE_TARGETS
+ * request and the notification the application can exit.
+ */
+static void
+save_done (GsdClipboardManager *manager)
+{
+        gint64 elapsed, p50, p99;
+
+        if (manager->priv->save_start_time == 0)
+                return;
+
+        elapsed = g_get_monotonic_time () - manager->priv->save_start_time;
+        manager->priv->save_start_time = 0;
+
+        manager->priv->n_saves++;
+        manager->priv->n_bytes_saved += manager->priv->n_bytes_saving;
+        manager->priv->save_time += elapsed;
+        latency_add (&manager->priv->save_latency, elapsed);
+
+        latency_percentiles (&manager->priv->save_latency, &p50, &p99);
+        xfsettings_dbg_filtered (XFSD_DEBUG_CLIPBOARD,
+                                 "saved %" G_GSIZE_FORMAT " bytes in %.1f ms, "
+                                 "handoff p50 %.2f ms p99 %.2f ms",
+                                 manager->priv->n_bytes_saving, elapsed / 1000.0,
+                                 p50 / 1000.0, p99 / 1000.0);
+
+        history_add (manager);
+}
+
+/* Conversions are keyed by the requestor window and property */
+static guint
+conversion_hash (gconstpointer key)
+{
+        const IncrConversion *rdata = key;
+
+        return (guint) (rdata->requestor * 31 + rdata->property);
+}
+
+static gboolean
+conversion_equal (gconstpointer a,
+                  gconstpointer b)
+{
+        const IncrConversion *ra = a;
+        const IncrConversion *rb = b;
+
+        return ra->requestor == rb->requestor && ra->property == rb->property;
+}
+
+typedef struct
+{
+        Atom target;
+        gint rank;
+} SaveTarget;
+
+static gint
+compare_save_target (gconstpointer a,
+                     gconstpointer b,
+                     gpointer      user_data)
+{
+        return ((const SaveTarget *) a)->rank - ((const SaveTarget *) b)->rank;
+}
+
 static void
 save_targets (GsdClipboardManager *manager,
               Atom                *targets,
               int                  nitems)
 {
-        gint        nout, i;
+        gint        nout, nsave, i;
         Atom       *multiple;
         TargetData *tdata;
+        SaveTarget *save;
+        gint        limit;
+        GSList     *contents = NULL;
 
-        multiple = g_new (Atom, 2 * nitems);
+        load_policy (manager);
+        manager->priv->n_bytes_saving = 0;
+        manager->priv->n_bytes_budget = 0;
 
-        nout = 0;
+        save = g_new (SaveTarget, nitems);
+
+        nsave = 0;
         for (i = 0; i < nitems; i++) {
                 if (targets[i] != XA_TARGETS &&
                     targets[i] != XA_MULTIPLE &&
@@ -257,22 +1317,54 @@ save_targets (GsdClipboardManager *manager,
                     targets[i] != XA_INSERT_PROPERTY &&
                     targets[i] != XA_INSERT_SELECTION &&
                     targets[i] != XA_PIXMAP) {
-                        tdata = g_slice_new (TargetData);
-                        tdata->data = NULL;
-                        tdata->length = 0;
-                        tdata->target = targets[i];
-                        tdata->type = None;
-                        tdata->format = 0;
-                        tdata->refcount = 1;
-                        manager->priv->contents = g_slist_prepend (manager->priv->contents, tdata);
-
-                        multiple[nout++] = targets[i];
-                        multiple[nout++] = targets[i];
+                        save[nsave].target = targets[i];
+                        save[nsave].rank = target_rank (manager, targets[i]);
+                        nsave++;
                 }
         }
 
         XFree (targets);
 
+        /* the owner converts the targets in the order of the request */
+        g_qsort_with_data (save, nsave, sizeof (SaveTarget), compare_save_target, NULL);
+
+        multiple = g_new (Atom, 2 * nsave);
+
+        nout = 0;
+        for (i = 0; i < nsave; i++) {
+                limit = target_size_limit (manager, save[i].target);
+                if (limit == 0)
+                        continue;
+
+                tdata = g_slice_new (TargetData);
+                tdata->data = NULL;
+                tdata->length = 0;
+                tdata->target = save[i].target;
+                tdata->type = None;
+                tdata->format = 0;
+                tdata->refcount = 1;
+                tdata->allocated = 0;
+                tdata->n_chunks = 0;
+                tdata->n_grows = 0;
+                tdata->start_time = 0;
+                tdata->payload = NULL;
+                tdata->limit = limit;
+                tdata->discard = FALSE;
+                contents = g_slist_prepend (contents, tdata);
+                g_hash_table_insert (manager->priv->contents_index,
+                                     GUINT_TO_POINTER (tdata->target), tdata);
+
+                multiple[nout++] = save[i].target;
+                multiple[nout++] = save[i].target;
+        }
+
+        g_free (save);
+
+        /* keep the contents in rank order, so the properties are
+         * received and count against the budget by priority */
+        manager->priv->contents = g_slist_concat (g_slist_reverse (contents),
+                                                  manager->priv->contents);
+
         XChangeProperty (manager->priv->display, manager->priv->window,
                          XA_MULTIPLE, XA_ATOM_PAIR,
                          32, PropModeReplace, (const guchar *) multiple, nout);
@@ -283,28 +1375,6 @@ save_targets (GsdClipboardManager *manager,
                            manager->priv->window, manager->priv->time);
 }
 
-static int
-find_content_target (TargetData *tdata,
-                     Atom       *target)
-{
-        return !(tdata->target == *target);
-}
-
-static int
-find_content_type (TargetData *tdata,
-                   Atom        *type)
-{
-        return !(tdata->type == *type);
-}
-
-static int
-find_conversion_requestor (IncrConversion *rdata,
-                           XEvent         *xev)
-{
-        return !(rdata->requestor == xev->xproperty.window
-                 && rdata->property == xev->xproperty.atom);
-}
-
 static void
 get_property (TargetData          *tdata,
               GsdClipboardManager *manager)
@@ -314,6 +1384,7 @@ get_property (TargetData          *tdata,
         gulong  length;
         gulong  remaining;
         guchar *data;
+        gulong  size;
 
         XGetWindowProperty (manager->priv->display,
                             manager->priv->window,
@@ -329,25 +1400,124 @@ get_property (TargetData          *tdata,
                             &data);
 
         if (type == None) {
-                manager->priv->contents = g_slist_remove (manager->priv->contents, tdata);
-                g_slice_free (TargetData, tdata);
+                remove_content (manager, tdata);
         } else if (type == XA_INCR) {
                 tdata->type = type;
                 tdata->length = 0;
+                manager->priv->n_incr_pending++;
+                tdata->start_time = g_get_monotonic_time ();
+
+                /* the property holds a lower bound of the size, the
+                 * transfer is still completed, but the data is not kept */
+                if (format == 32 && length > 0
+                    && target_over_limit (manager, tdata, *((gulong *) data))) {
+                        xfsettings_dbg_filtered (XFSD_DEBUG_CLIPBOARD,
+                                                 "not saving target %s of at least %lu bytes",
+                                                 gdk_x11_get_xatom_name (tdata->target),
+                                                 *((gulong *) data));
+                        tdata->discard = TRUE;
+                }
+
                 XFree (data);
         } else {
+                size = length * clipboard_bytes_per_item (format);
+                if (target_over_limit (manager, tdata, size)) {
+                        xfsettings_dbg_filtered (XFSD_DEBUG_CLIPBOARD,
+                                                 "not saving target %s of %lu bytes",
+                                                 gdk_x11_get_xatom_name (tdata->target),
+                                                 size);
+                        XFree (data);
+                        remove_content (manager, tdata);
+                        return;
+                }
+
                 tdata->type = type;
                 tdata->data = data;
-                tdata->length = length * clipboard_bytes_per_item (format);
+                tdata->length = size;
                 tdata->format = format;
+                manager->priv->n_bytes_saving += size;
+
+                target_data_save (manager, tdata);
+        }
+}
+
+/* Append a chunk of an incremental transfer. The buffer grows
+ * geometrically, so a large transfer is not copied for every chunk.
+ */
+static void
+receive_incrementally_append (GsdClipboardManager *manager,
+                              TargetData          *tdata,
+                              const guchar        *data,
+                              gulong               length)
+{
+        gsize needed, allocated;
+
+        if (tdata->discard)
+                return;
+
+        /* abort oversized transfers, the remaining chunks are dropped */
+        if (target_over_limit (manager, tdata, tdata->length + length)) {
+                xfsettings_dbg_filtered (XFSD_DEBUG_CLIPBOARD,
+                                         "not saving target %s, exceeded %lu bytes",
+                                         gdk_x11_get_xatom_name (tdata->target),
+                                         tdata->length + length);
+
+                manager->priv->n_bytes_saving -= tdata->length;
+                g_free (tdata->data);
+                tdata->data = NULL;
+                tdata->length = 0;
+                tdata->allocated = 0;
+                tdata->discard = TRUE;
+                return;
+        }
+
+        /* keep room for the nul-terminator Xlib adds to properties */
+        needed = tdata->length + length + 1;
+        if (needed > tdata->allocated) {
+                allocated = MAX (tdata->allocated, INCR_MIN_ALLOCATION);
+                while (allocated < needed)
+                        allocated *= 2;
+
+                tdata->data = g_realloc (tdata->data, allocated);
+                tdata->allocated = allocated;
+                tdata->n_grows++;
+        }
+
+        memcpy (tdata->data + tdata->length, data, length);
+        tdata->length += length;
+        manager->priv->n_bytes_saving += length;
+        tdata->data[tdata->length] = '\0';
+        tdata->n_chunks++;
+}
+
+static void
+receive_incrementally_finish (GsdClipboardManager *manager,
+                              TargetData          *tdata)
+{
+        gint64 elapsed;
+
+        /* release the unused part of the buffer */
+        if (tdata->data != NULL && tdata->allocated > tdata->length + 1) {
+                tdata->data = g_realloc (tdata->data, tdata->length + 1);
+                tdata->allocated = tdata->length + 1;
         }
+
+        target_data_save (manager, tdata);
+
+        elapsed = g_get_monotonic_time () - tdata->start_time;
+        xfsettings_dbg_filtered (XFSD_DEBUG_CLIPBOARD,
+                                 "received %lu bytes of target %lu in %u chunks, "
+                                 "%u reallocations, %.1f ms, %.1f MB/s",
+                                 tdata->length, tdata->target,
+                                 tdata->n_chunks, tdata->n_grows,
+                                 elapsed / 1000.0,
+                                 elapsed > 0 ? tdata->length / (gdouble) elapsed : 0.0);
 }
 
 static Bool
 receive_incrementally (GsdClipboardManager *manager,
                        XEvent              *xev)
 {
-        GSList     *list;
         TargetData *tdata;
         Atom        type;
         gint        format;
@@ -357,15 +1527,10 @@ receive_incrementally (GsdClipboardManager *manager,
         if (xev->xproperty.window != manager->priv->window)
                 return False;
 
-        list = g_slist_find_custom (manager->priv->contents,
-                                    &xev->xproperty.atom,
-                                    (GCompareFunc) find_content_target);
-
-        if (!list)
+        tdata = find_content (manager, xev->xproperty.atom);
+        if (!tdata)
                 return False;
 
-        tdata = (TargetData *) list->data;
-
         if (tdata->type != XA_INCR)
                 return False;
 
@@ -377,55 +1542,57 @@ receive_incrementally (GsdClipboardManager *manager,
 
         length = nitems * clipboard_bytes_per_item (format);
         if (length == 0) {
-                tdata->type = type;
-                tdata->format = format;
+                if (manager->priv->n_incr_pending > 0)
+                        manager->priv->n_incr_pending--;
 
-                if (!g_slist_find_custom (manager->priv->contents,
-                                          &XA_INCR, (GCompareFunc) find_content_type)) {
+                if (tdata->discard) {
+                        remove_content (manager, tdata);
+                } else {
+                        tdata->type = type;
+                        tdata->format = format;
+
+                        receive_incrementally_finish (manager, tdata);
+                }
+
+                if (manager->priv->n_incr_pending == 0) {
 
                         /* all incremental transfers done */
+                        enforce_budget (manager);
                         send_selection_notify (manager, True);
+                        save_done (manager);
                         manager->priv->requestor = None;
                 }
 
                 XFree (data);
         } else {
-                if (!tdata->data) {
-                        tdata->data = data;
-                        tdata->length = length;
-                } else {
-                        tdata->data = g_realloc (tdata->data, tdata->length + length + 1);
-                        memcpy (tdata->data + tdata->length, data, length + 1);
-                        tdata->length += length;
-                        XFree (data);
-                }
+                receive_incrementally_append (manager, tdata, data, length);
+                XFree (data);
         }
 
         return True;
 }
 
-static Bool
-send_incrementally (GsdClipboardManager *manager,
-                    XEvent              *xev)
+/* Send the next chunk of a transfer, returns the size of the chunk */
+static gulong
+send_chunk (GsdClipboardManager *manager,
+            IncrConversion      *rdata)
 {
-        GSList         *list;
-        IncrConversion *rdata;
-        gulong          length;
-        gulong          items;
-        gulong          bytes;
-        guchar         *data;
-
-        list = g_slist_find_custom (manager->priv->conversions, xev,
-                                    (GCompareFunc) find_conversion_requestor);
-        if (list == NULL)
-                return False;
-
-        rdata = (IncrConversion *) list->data;
-
-        data = rdata->data->data + rdata->offset;
+        TargetPayload *payload;
+        gulong         length;
+        gulong         items;
+        gulong         bytes;
+        const guchar  *data;
+        gint64         now, latency, elapsed;
+
+        /* spilled data was mapped when the transfer started */
+        payload = rdata->data->payload;
+        if (payload->fd >= 0)
+                data = payload->map + rdata->offset;
+        else
+                data = payload->data + rdata->offset;
         length = rdata->data->length - rdata->offset;
-        if (length > SELECTION_MAX_SIZE)
-                length = SELECTION_MAX_SIZE;
+        if (length > INCR_CHUNK_SIZE)
+                length = INCR_CHUNK_SIZE;
 
         rdata->offset += length;
 
@@ -437,11 +1604,81 @@ send_incrementally (GsdClipboardManager *manager,
                          rdata->data->format, PropModeAppend,
                          data, items);
 
+        now = g_get_monotonic_time ();
+        latency = now - rdata->ready_time;
+        rdata->max_latency = MAX (rdata->max_latency, latency);
+        rdata->total_latency += latency;
+        rdata->n_chunks++;
+        latency_add (&manager->priv->chunk_latency, latency);
+
         if (length == 0) {
-                manager->priv->conversions = g_slist_remove (manager->priv->conversions, rdata);
-                conversion_free (rdata);
+                elapsed = now - rdata->start_time;
+                manager->priv->n_transfers++;
+                manager->priv->n_bytes_sent += rdata->data->length;
+                manager->priv->send_time += elapsed;
+
+                xfsettings_dbg_filtered (XFSD_DEBUG_CLIPBOARD,
+                                         "sent %lu bytes of target %s to 0x%lx in %u chunks, "
+                                         "%.1f ms, %.1f MB/s, latency %.2f ms avg %.2f ms max",
+                                         rdata->data->length,
+                                         gdk_x11_get_xatom_name (rdata->target),
+                                         rdata->requestor, rdata->n_chunks,
+                                         elapsed / 1000.0,
+                                         elapsed > 0 ? rdata->data->length / (gdouble) elapsed : 0.0,
+                                         rdata->total_latency / (rdata->n_chunks * 1000.0),
+                                         rdata->max_latency / 1000.0);
+
+                g_hash_table_remove (manager->priv->conversions, rdata);
+        }
+
+        return length;
+}
+
+/* Requestors that deleted the property are served in the order they
+ * did so, one chunk each, so a fast requestor cannot starve the others.
+ * After SERVE_BUDGET bytes the main loop gets to process new events.
+ */
+static gboolean
+serve_incrementally (gpointer user_data)
+{
+        GsdClipboardManager *manager = GSD_CLIPBOARD_MANAGER (user_data);
+        IncrConversion      *rdata;
+        gsize                served = 0;
+
+        while (served < SERVE_BUDGET
+               && (rdata = g_queue_pop_head (manager->priv->ready)) != NULL)
+                served += send_chunk (manager, rdata);
+
+        if (g_queue_is_empty (manager->priv->ready)) {
+                manager->priv->serve_id = 0;
+                return FALSE;
+        }
+
+        return TRUE;
+}
+
+static Bool
+send_incrementally (GsdClipboardManager *manager,
+                    XEvent              *xev)
+{
+        IncrConversion  key;
+        IncrConversion *rdata;
+
+        key.requestor = xev->xproperty.window;
+        key.property = xev->xproperty.atom;
+        rdata = g_hash_table_lookup (manager->priv->conversions, &key);
+        if (rdata == NULL)
+                return False;
+
+        /* the requestor is ready for the next chunk */
+        if (g_queue_find (manager->priv->ready, rdata) == NULL) {
+                rdata->ready_time = g_get_monotonic_time ();
+                g_queue_push_tail (manager->priv->ready, rdata);
         }
 
+        if (manager->priv->serve_id == 0)
+                manager->priv->serve_id = g_idle_add (serve_incrementally, manager);
+
         return True;
 }
 
@@ -466,11 +1703,6 @@ convert_clipboard_manager (GsdClipboardManager *manager,
                 } else {
                         gdk_error_trap_push ();
 
-                        clipboard_manager_watch_cb (manager,
-                                                    xev->xselectionrequest.requestor,
-                                                    True,
-                                                    StructureNotifyMask,
-                                                    NULL);
                         XSelectInput (manager->priv->display,
                                       xev->xselectionrequest.requestor,
                                       StructureNotifyMask);
@@ -500,6 +1732,7 @@ convert_clipboard_manager (GsdClipboardManager *manager,
                         manager->priv->requestor = xev->xselectionrequest.requestor;
                         manager->priv->property = xev->xselectionrequest.property;
                         manager->priv->time = xev->xselectionrequest.time;
+                        manager->priv->save_start_time = g_get_monotonic_time ();
 
                         if (type == None)
                                 XConvertSelection (manager->priv->display, XA_CLIPBOARD,
@@ -538,6 +1771,7 @@ convert_clipboard_target (IncrConversion      *rdata,
                           GsdClipboardManager *manager)
 {
         TargetData        *tdata;
+        const guchar      *data;
         Atom              *targets;
         gint               n_targets;
         GSList            *list;
@@ -565,32 +1799,38 @@ convert_clipboard_target (IncrConversion      *rdata,
                 g_free (targets);
         } else  {
                 /* Convert from stored CLIPBOARD data */
-                list = g_slist_find_custom (manager->priv->contents,
-                                            &rdata->target,
-                                            (GCompareFunc) find_content_target);
+                tdata = find_content (manager, rdata->target);
 
                 /* We got a target that we don't support */
-                if (!list)
+                if (!tdata)
                         return;
 
-                tdata = (TargetData *)list->data;
                 if (tdata->type == XA_INCR) {
                         /* we haven't completely received this target yet  */
                         rdata->property = None;
                         return;
                 }
 
+                data = payload_map (tdata->payload);
+                if (data == NULL && tdata->length > 0) {
+                        rdata->property = None;
+                        return;
+                }
+
                 rdata->data = target_data_ref (tdata);
                 bytes = clipboard_bytes_per_item (tdata->format);
                 items = bytes == 0 ? 0 : tdata->length / bytes;
-                if (tdata->length <= SELECTION_MAX_SIZE)
+                if (tdata->length <= SELECTION_MAX_SIZE) {
                         XChangeProperty (manager->priv->display, rdata->requestor,
                                          rdata->property,
                                          tdata->type, tdata->format, PropModeReplace,
-                                         tdata->data, items);
-                else {
-                        /* start incremental transfer */
+                                         data, items);
+                        payload_unmap (tdata->payload);
+                } else {
+                        /* start incremental transfer, the data stays mapped
+                         * until the conversion is freed */
                         rdata->offset = 0;
+                        rdata->mapped = TRUE;
 
                         gdk_error_trap_push ();
 
@@ -617,10 +1857,19 @@ static void
 collect_incremental (IncrConversion      *rdata,
                      GsdClipboardManager *manager)
 {
-        if (rdata->offset >= 0)
-                manager->priv->conversions = g_slist_prepend (manager->priv->conversions, rdata);
-        else
+        IncrConversion *old;
+
+        if (rdata->offset >= 0) {
+                /* this replaces a pending transfer to the same property */
+                old = g_hash_table_lookup (manager->priv->conversions, rdata);
+                if (old != NULL)
+                        g_queue_remove (manager->priv->ready, old);
+
+                rdata->start_time = g_get_monotonic_time ();
+                g_hash_table_replace (manager->priv->conversions, rdata, rdata);
+        } else {
                 conversion_free (rdata);
+        }
 }
 
 static void
@@ -657,6 +1906,10 @@ convert_clipboard (GsdClipboardManager *manager,
                         rdata->property = multiple[i+1];
                         rdata->data = NULL;
                         rdata->offset = -1;
+                        rdata->mapped = FALSE;
+                        rdata->max_latency = 0;
+                        rdata->total_latency = 0;
+                        rdata->n_chunks = 0;
                         conversions = g_slist_prepend (conversions, rdata);
                 }
         } else {
@@ -668,6 +1921,10 @@ convert_clipboard (GsdClipboardManager *manager,
                 rdata->property = xev->xselectionrequest.property;
                 rdata->data = NULL;
                 rdata->offset = -1;
+                rdata->mapped = FALSE;
+                rdata->max_latency = 0;
+                rdata->total_latency = 0;
+                rdata->n_chunks = 0;
                 conversions = g_slist_prepend (conversions, rdata);
         }
 
@@ -713,15 +1970,8 @@ clipboard_manager_process_event (GsdClipboardManager *manager,
         switch (xev->xany.type) {
         case DestroyNotify:
                 if (xev->xdestroywindow.window == manager->priv->requestor) {
-                        g_slist_foreach (manager->priv->contents, (GFunc) target_data_unref, NULL);
-                        g_slist_free (manager->priv->contents);
-                        manager->priv->contents = NULL;
-
-                        clipboard_manager_watch_cb (manager,
-                                                    manager->priv->requestor,
-                                                    False,
-                                                    0,
-                                                    NULL);
+                        clear_contents (manager);
+
                         manager->priv->requestor = None;
                 }
                 break;
@@ -741,9 +1991,7 @@ clipboard_manager_process_event (GsdClipboardManager *manager,
                 if (xev->xselectionclear.selection == XA_CLIPBOARD_MANAGER) {
                         /* We lost the manager selection */
                         if (manager->priv->contents) {
-                                g_slist_foreach (manager->priv->contents, (GFunc) target_data_unref, NULL);
-                                g_slist_free (manager->priv->contents);
-                                manager->priv->contents = NULL;
+                                clear_contents (manager);
 
                                 XSetSelectionOwner (manager->priv->display,
                                                     XA_CLIPBOARD,
@@ -754,14 +2002,7 @@ clipboard_manager_process_event (GsdClipboardManager *manager,
                 }
                 if (xev->xselectionclear.selection == XA_CLIPBOARD) {
                         /* We lost the clipboard selection */
-                        g_slist_foreach (manager->priv->contents, (GFunc) target_data_unref, NULL);
-                        g_slist_free (manager->priv->contents);
-                        manager->priv->contents = NULL;
-                        clipboard_manager_watch_cb (manager,
-                                                    manager->priv->requestor,
-                                                    False,
-                                                    0,
-                                                    NULL);
+                        clear_contents (manager);
                         manager->priv->requestor = None;
 
                         return True;
@@ -799,25 +2040,17 @@ clipboard_manager_process_event (GsdClipboardManager *manager,
                                                          XA_ATOM, 32, PropModeReplace,
                                                          (guchar *)&XA_NULL, 1);
 
-                                if (!g_slist_find_custom (manager->priv->contents,
-                                                          &XA_INCR, (GCompareFunc) find_content_type)) {
+                                if (manager->priv->n_incr_pending == 0) {
                                         /* all transfers done */
+                                        enforce_budget (manager);
                                         send_selection_notify (manager, True);
-                                        clipboard_manager_watch_cb (manager,
-                                                                    manager->priv->requestor,
-                                                                    False,
-                                                                    0,
-                                                                    NULL);
+                                        save_done (manager);
                                         manager->priv->requestor = None;
                                 }
                         }
                         else if (xev->xselection.property == None) {
                                 send_selection_notify (manager, False);
-                                clipboard_manager_watch_cb (manager,
-                                                            manager->priv->requestor,
-                                                            False,
-                                                            0,
-                                                            NULL);
+                                manager->priv->save_start_time = 0;
                                 manager->priv->requestor = None;
                         }
 
@@ -858,44 +2091,28 @@ clipboard_manager_event_filter (GdkXEvent           *xevent,
 }
 
 static void
-clipboard_manager_watch_cb (GsdClipboardManager *manager,
-                            Window               window,
-                            Bool                 is_start,
-                            long                 mask,
-                            void                *cb_data)
-{
-        GdkWindow  *gdkwin;
-        GdkDisplay *display;
-
-        display = gdk_display_get_default ();
-#if GTK_CHECK_VERSION (2, 24, 0)
-        gdkwin = gdk_x11_window_lookup_for_display (display, window);
-#else
-        gdkwin = gdk_window_lookup_for_display (display, window);
-#endif
-
-        if (is_start) {
-                if (gdkwin == NULL) {
-#if GTK_CHECK_VERSION (2, 24, 0)
-                        gdkwin = gdk_x11_window_foreign_new_for_display (display, window);
-#else
-                        gdkwin = gdk_window_foreign_new_for_display (display, window);
-#endif
-                } else {
-                        g_object_ref (gdkwin);
-                }
-
-                gdk_window_add_filter (gdkwin,
-                                       (GdkFilterFunc) clipboard_manager_event_filter,
-                                       manager);
-        } else {
-                if (gdkwin == NULL) {
-                        return;
-                }
-                gdk_window_remove_filter (gdkwin,
-                                          (GdkFilterFunc) clipboard_manager_event_filter,
-                                          manager);
-                g_object_unref (gdkwin);
+clipboard_manager_dispatch (GsdClipboardManager *manager,
+                            gboolean             add)
+{
+        /* the events clipboard_manager_process_event handles: the
+         * selection events on our window, PropertyNotify for the INCR
+         * transfers, and DestroyNotify of a requestor; the filters on
+         * the single windows got no other events either */
+        static const gint event_types[] = {
+                DestroyNotify, PropertyNotify, SelectionClear,
+                SelectionNotify, SelectionRequest
+        };
+        guint i;
+
+        for (i = 0; i < G_N_ELEMENTS (event_types); i++) {
+                if (add)
+                        xfsettings_dispatcher_add (event_types[i],
+                                                   (GdkFilterFunc) clipboard_manager_event_filter,
+                                                   manager);
+                else
+                        xfsettings_dispatcher_remove (event_types[i],
+                                                      (GdkFilterFunc) clipboard_manager_event_filter,
+                                                      manager);
         }
 }
 
@@ -928,6 +2145,15 @@ init_atoms (Display *display)
     SELECTION_MAX_SIZE = max_request_size - 100;
     if (SELECTION_MAX_SIZE > 262144)
       SELECTION_MAX_SIZE =  262144;
+
+    /* the request size is in 4 byte units, with BIG-REQUESTS it is
+     * large enough to send incremental transfers in bigger chunks;
+     * keep the chunks a multiple of the largest item size */
+    INCR_CHUNK_SIZE = MIN (max_request_size * 4 - 100, INCR_CHUNK_MAX) & ~7UL;
+
+    xfsettings_dbg_filtered (XFSD_DEBUG_CLIPBOARD,
+                             "max request size %lu bytes, sending in chunks of %lu bytes",
+                             max_request_size * 4, INCR_CHUNK_SIZE);
 }
 
 gboolean
@@ -944,8 +2170,9 @@ gsd_clipboard_manager_start (GsdClipboardManager *manager,
                 return FALSE;
         }
 
-        manager->priv->contents = NULL;
-        manager->priv->conversions = NULL;
+        clear_contents (manager);
+        g_queue_clear (manager->priv->ready);
+        g_hash_table_remove_all (manager->priv->conversions);
         manager->priv->requestor = None;
 
         manager->priv->window = XCreateSimpleWindow (manager->priv->display,
@@ -955,11 +2182,7 @@ gsd_clipboard_manager_start (GsdClipboardManager *manager,
                                                                  DefaultScreen (manager->priv->display)),
                                                      WhitePixel (manager->priv->display,
                                                                  DefaultScreen (manager->priv->display)));
-        clipboard_manager_watch_cb (manager,
-                                    manager->priv->window,
-                                    True,
-                                    PropertyChangeMask,
-                                    NULL);
+        clipboard_manager_dispatch (manager, TRUE);
         XSelectInput (manager->priv->display,
                       manager->priv->window,
                       PropertyChangeMask);
@@ -990,11 +2213,7 @@ gsd_clipboard_manager_start (GsdClipboardManager *manager,
                             StructureNotifyMask,
                             (XEvent *)&xev);
         } else {
-                clipboard_manager_watch_cb (manager,
-                                            manager->priv->window,
-                                            False,
-                                            0,
-                                            NULL);
+                clipboard_manager_dispatch (manager, FALSE);
         }
 
         manager->priv->start_idle_id = 0;
@@ -1005,25 +2224,159 @@ gsd_clipboard_manager_start (GsdClipboardManager *manager,
 void
 gsd_clipboard_manager_stop (GsdClipboardManager *manager)
 {
+        GsdClipboardStats stats;
+
         if (manager->priv->window != None) {
-                clipboard_manager_watch_cb (manager,
-                                            manager->priv->window,
-                                            False,
-                                            0,
-                                            NULL);
+                clipboard_manager_dispatch (manager, FALSE);
                 XDestroyWindow (manager->priv->display, manager->priv->window);
                 manager->priv->window = None;
         }
 
-        if (manager->priv->conversions != NULL) {
-                g_slist_foreach (manager->priv->conversions, (GFunc) conversion_free, NULL);
-                g_slist_free (manager->priv->conversions);
-                manager->priv->conversions = NULL;
+        g_queue_clear (manager->priv->ready);
+        g_hash_table_remove_all (manager->priv->conversions);
+        clear_contents (manager);
+        history_clear (manager);
+
+        if (manager->priv->n_saves > 0 || manager->priv->n_transfers > 0) {
+                gsd_clipboard_manager_get_stats (manager, &stats);
+                xfsettings_dbg_filtered (XFSD_DEBUG_CLIPBOARD,
+                                         "%" G_GUINT64_FORMAT " saves, %.1f MB/s, handoff p50 %.2f ms "
+                                         "p99 %.2f ms; %" G_GUINT64_FORMAT " transfers, %.1f MB/s, "
+                                         "chunk latency p50 %.2f ms p99 %.2f ms; peak rss %ld KiB",
+                                         stats.n_saves, stats.save_rate,
+                                         stats.save_latency_p50 / 1000.0,
+                                         stats.save_latency_p99 / 1000.0,
+                                         stats.n_transfers, stats.send_rate,
+                                         stats.chunk_latency_p50 / 1000.0,
+                                         stats.chunk_latency_p99 / 1000.0,
+                                         stats.peak_rss);
         }
+}
 
-        if (manager->priv->contents != NULL) {
-                g_slist_foreach (manager->priv->contents, (GFunc) target_data_unref, NULL);
-                g_slist_free (manager->priv->contents);
-                manager->priv->contents = NULL;
+void
+gsd_clipboard_manager_get_stats (GsdClipboardManager *manager,
+                                 GsdClipboardStats   *stats)
+{
+#ifdef HAVE_SYS_RESOURCE_H
+        struct rusage usage;
+#endif
+
+        g_return_if_fail (GSD_IS_CLIPBOARD_MANAGER (manager));
+        g_return_if_fail (stats != NULL);
+
+        stats->n_saves = manager->priv->n_saves;
+        stats->n_bytes_saved = manager->priv->n_bytes_saved;
+        stats->n_transfers = manager->priv->n_transfers;
+        stats->n_bytes_sent = manager->priv->n_bytes_sent;
+
+        /* bytes per usec is MB/s */
+        stats->save_rate = manager->priv->save_time > 0
+                ? manager->priv->n_bytes_saved / (gdouble) manager->priv->save_time : 0.0;
+        stats->send_rate = manager->priv->send_time > 0
+                ? manager->priv->n_bytes_sent / (gdouble) manager->priv->send_time : 0.0;
+
+        latency_percentiles (&manager->priv->save_latency,
+                             &stats->save_latency_p50, &stats->save_latency_p99);
+        latency_percentiles (&manager->priv->chunk_latency,
+                             &stats->chunk_latency_p50, &stats->chunk_latency_p99);
+
+        stats->peak_rss = 0;
+#ifdef HAVE_SYS_RESOURCE_H
+        if (getrusage (RUSAGE_SELF, &usage) == 0)
+                stats->peak_rss = usage.ru_maxrss;
+#endif
+}
+
+void
+gsd_clipboard_manager_history_foreach (GsdClipboardManager     *manager,
+                                       GsdClipboardHistoryFunc  func,
+                                       gpointer                 user_data)
+{
+        GList        *li;
+        HistoryEntry *entry;
+        gsize         size;
+        guint         i;
+
+        g_return_if_fail (GSD_IS_CLIPBOARD_MANAGER (manager));
+        g_return_if_fail (func != NULL);
+
+        for (li = manager->priv->history->head; li != NULL; li = li->next) {
+                entry = li->data;
+
+                size = 0;
+                for (i = 0; i < entry->n_targets; i++)
+                        size += entry->targets[i].length;
+
+                func (entry->id, entry->time, entry->preview, size, user_data);
+        }
+}
+
+/* Take the CLIPBOARD selection with the contents of a history entry.
+ * The targets are served from the stored payloads, the application
+ * that owned the contents is not involved.
+ */
+gboolean
+gsd_clipboard_manager_history_restore (GsdClipboardManager *manager,
+                                       guint                id)
+{
+        GList         *li;
+        HistoryEntry  *entry = NULL;
+        HistoryTarget *target;
+        TargetData    *tdata;
+        guint          i;
+
+        g_return_val_if_fail (GSD_IS_CLIPBOARD_MANAGER (manager), FALSE);
+
+        /* not while a save is in progress */
+        if (manager->priv->window == None
+            || manager->priv->requestor != None)
+                return FALSE;
+
+        for (li = manager->priv->history->head; li != NULL; li = li->next) {
+                if (((HistoryEntry *) li->data)->id == id) {
+                        entry = li->data;
+                        break;
+                }
+        }
+
+        if (entry == NULL)
+                return FALSE;
+
+        clear_contents (manager);
+
+        for (i = 0; i < entry->n_targets; i++) {
+                target = &entry->targets[i];
+
+                tdata = g_slice_new0 (TargetData);
+                tdata->target = target->target;
+                tdata->type = target->type;
+                tdata->format = target->format;
+                tdata->length = target->length;
+                tdata->refcount = 1;
+                tdata->limit = -1;
+                tdata->payload = payload_ref (target->payload);
+                manager->priv->contents = g_slist_prepend (manager->priv->contents, tdata);
+                g_hash_table_insert (manager->priv->contents_index,
+                                     GUINT_TO_POINTER (tdata->target), tdata);
         }
+
+        manager->priv->time = xfce_xsettings_get_server_time (manager->priv->display,
+                                                              manager->priv->window);
+        XSetSelectionOwner (manager->priv->display, XA_CLIPBOARD,
+                            manager->priv->window, manager->priv->time);
+
+        if (XGetSelectionOwner (manager->priv->display, XA_CLIPBOARD) != manager->priv->window) {
+                clear_contents (manager);
+                return FALSE;
+        }
+
+        /* most recently used */
+        g_queue_unlink (manager->priv->history, li);
+        g_queue_push_head_link (manager->priv->history, li);
+
+        xfsettings_dbg_filtered (XFSD_DEBUG_CLIPBOARD,
+                                 "restored history entry %u with %u targets",
+                                 entry->id, entry->n_targets);
+
+        return TRUE;
 }
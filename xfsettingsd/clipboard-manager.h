@@ -28,6 +28,13 @@ G_BEGIN_DECLS
 typedef struct _GsdClipboardManager        GsdClipboardManager;
 typedef struct _GsdClipboardManagerClass   GsdClipboardManagerClass;
 typedef struct _GsdClipboardManagerPrivate GsdClipboardManagerPrivate;
+typedef struct _GsdClipboardStats          GsdClipboardStats;
+
+typedef void (*GsdClipboardHistoryFunc) (guint        id,
+                                         gint64       time,
+                                         const gchar *preview,
+                                         gsize        size,
+                                         gpointer     user_data);
 
 #define GSD_TYPE_CLIPBOARD_MANAGER         (gsd_clipboard_manager_get_type ())
 #define GSD_CLIPBOARD_MANAGER(o)           (G_TYPE_CHECK_INSTANCE_CAST ((o), GSD_TYPE_CLIPBOARD_MANAGER, GsdClipboardManager))
@@ -47,6 +54,27 @@ struct _GsdClipboardManagerClass
     GObjectClass parent_class;
 };
 
+struct _GsdClipboardStats
+{
+    guint64 n_saves;
+    guint64 n_bytes_saved;
+    guint64 n_transfers;
+    guint64 n_bytes_sent;
+
+    /* throughput in MB/s */
+    gdouble save_rate;
+    gdouble send_rate;
+
+    /* latencies in usec, over the last saves and chunks */
+    gint64  save_latency_p50;
+    gint64  save_latency_p99;
+    gint64  chunk_latency_p50;
+    gint64  chunk_latency_p99;
+
+    /* peak resident set size of the daemon in KiB */
+    glong   peak_rss;
+};
+
 GType gsd_clipboard_manager_get_type (void);
 
 gboolean gsd_clipboard_manager_start (GsdClipboardManager *manager,
@@ -54,6 +82,16 @@ gboolean gsd_clipboard_manager_start (GsdClipboardManager *manager,
 
 void     gsd_clipboard_manager_stop  (GsdClipboardManager *manager);
 
+void     gsd_clipboard_manager_get_stats (GsdClipboardManager *manager,
+                                          GsdClipboardStats   *stats);
+
+void     gsd_clipboard_manager_history_foreach (GsdClipboardManager     *manager,
+                                                GsdClipboardHistoryFunc  func,
+                                                gpointer                 user_data);
+
+gboolean gsd_clipboard_manager_history_restore (GsdClipboardManager *manager,
+                                                guint                id);
+
 G_END_DECLS
 
 #endif /* __GSD_CLIPBOARD_MANAGER_H */
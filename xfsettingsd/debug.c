@@ -16,6 +16,18 @@
  *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
+/*
+ * All debug messages are written to an in-memory ring of fixed size
+ * records, so tracing can stay enabled in a running session. Writers
+ * claim a slot with an atomic increment and publish it by storing the
+ * sequence number last, readers skip records that are being written.
+ * When XFSETTINGSD_DEBUG is set, the messages are also printed.
+ *
+ * The ring is filled when XFSETTINGSD_DEBUG or XFSETTINGSD_DEBUG_RING is
+ * set, or once it is enabled at runtime. Otherwise messages are dropped
+ * before they are formatted.
+ */
+
 #ifdef HAVE_CONFIG_H
 #include <config.h>
 #endif
@@ -30,6 +42,30 @@
 
 
 
+/* number of records in the ring, must be a power of 2 */
+#define RING_SIZE (2048)
+
+/* length of the message in a record, messages are truncated */
+#define RECORD_TEXT_LEN (112)
+
+
+
+typedef struct _XfsdDebugRecord XfsdDebugRecord;
+
+
+
+struct _XfsdDebugRecord
+{
+    /* message number + 1, 0 while the record is written */
+    volatile gint   seq;
+    XfsdDebugDomain domain;
+    gint64          time;
+    gchar           text[RECORD_TEXT_LEN];
+};
+
+
+
+/* this must be sorted on the value, the name is looked up by bit */
 static const GDebugKey dbg_keys[] =
 {
     { "xsettings",  XFSD_DEBUG_XSETTINGS },
@@ -41,8 +77,17 @@ static const GDebugKey dbg_keys[] =
     { "accessibility", XFSD_DEBUG_ACCESSIBILITY },
     { "pointers", XFSD_DEBUG_POINTERS },
     { "displays", XFSD_DEBUG_DISPLAYS },
+    { "snapshot", XFSD_DEBUG_SNAPSHOT },
+    { "startup", XFSD_DEBUG_STARTUP },
+    { "dispatcher", XFSD_DEBUG_DISPATCHER },
+    { "clipboard", XFSD_DEBUG_CLIPBOARD },
 };
 
+static XfsdDebugRecord dbg_ring[RING_SIZE];
+static volatile gint   dbg_ring_head = 0;
+static volatile gint   dbg_ring_enabled = FALSE;
+
+
 
 static XfsdDebugDomain
 xfsettings_dbg_init (void)
@@ -62,6 +107,9 @@ xfsettings_dbg_init (void)
             dbg_domains |= XFSD_DEBUG_YES;
         }
 
+        if (dbg_domains != 0 || g_getenv ("XFSETTINGSD_DEBUG_RING") != NULL)
+            g_atomic_int_set (&dbg_ring_enabled, TRUE);
+
         inited = TRUE;
     }
 
@@ -70,30 +118,65 @@ xfsettings_dbg_init (void)
 
 
 
-static void __attribute__((format (gnu_printf, 2,0)))
-xfsettings_dbg_print (XfsdDebugDomain  domain,
-                      const gchar     *message,
-                      va_list          args)
+static const gchar *
+xfsettings_dbg_domain_name (XfsdDebugDomain domain)
 {
-    const gchar *domain_name = NULL;
-    guint        i;
-    gchar       *string;
+    gint bit;
+
+    /* domain 1 << n is stored in dbg_keys[n - 1] */
+    bit = g_bit_nth_lsf (domain, -1);
+    g_assert (bit > 0 && bit <= (gint) G_N_ELEMENTS (dbg_keys));
+    g_assert (dbg_keys[bit - 1].value == (guint) domain);
+
+    return dbg_keys[bit - 1].key;
+}
 
-    /* lookup domain name */
-    for (i = 0; i < G_N_ELEMENTS (dbg_keys); i++)
-    {
-        if (dbg_keys[i].value == domain)
-        {
-            domain_name = dbg_keys[i].key;
-            break;
-        }
-    }
 
-    g_assert (domain_name != NULL);
 
-    string = g_strdup_vprintf (message, args);
-    g_printerr (PACKAGE_NAME "(%s): %s\n", domain_name, string);
-    g_free (string);
+static void __attribute__((format (gnu_printf, 3,0)))
+xfsettings_dbg_log (XfsdDebugDomain  domain,
+                    gboolean         print,
+                    const gchar     *message,
+                    va_list          args)
+{
+    gint             n, len;
+    XfsdDebugRecord *record;
+    gchar            text[RECORD_TEXT_LEN];
+    gchar           *string;
+    va_list          args_copy;
+
+    /* nothing to do with the message */
+    if (!print && !g_atomic_int_get (&dbg_ring_enabled))
+        return;
+
+    G_VA_COPY (args_copy, args);
+    len = g_vsnprintf (text, sizeof (text), message, args_copy);
+    va_end (args_copy);
+
+    /* claim a record and publish it when it is filled */
+    n = g_atomic_int_add (&dbg_ring_head, 1);
+    record = &dbg_ring[n & (RING_SIZE - 1)];
+
+    g_atomic_int_set (&record->seq, 0);
+    record->domain = domain;
+    record->time = g_get_monotonic_time ();
+    memcpy (record->text, text, sizeof (text));
+    g_atomic_int_set (&record->seq, n + 1);
+
+    if (G_LIKELY (!print))
+        return;
+
+    if (len < (gint) sizeof (text))
+    {
+        g_printerr (PACKAGE_NAME "(%s): %s\n", xfsettings_dbg_domain_name (domain), text);
+    }
+    else
+    {
+        /* message was truncated in the ring */
+        string = g_strdup_vprintf (message, args);
+        g_printerr (PACKAGE_NAME "(%s): %s\n", xfsettings_dbg_domain_name (domain), string);
+        g_free (string);
+    }
 }
 
 
@@ -107,12 +190,9 @@ xfsettings_dbg (XfsdDebugDomain  domain,
 
     g_return_if_fail (message != NULL);
 
-    /* leave when debug is disabled */
-    if (xfsettings_dbg_init () == 0)
-        return;
-
+    /* print when debug is enabled */
     va_start (args, message);
-    xfsettings_dbg_print (domain, message, args);
+    xfsettings_dbg_log (domain, xfsettings_dbg_init () != 0, message, args);
     va_end (args);
 }
 
@@ -127,11 +207,81 @@ xfsettings_dbg_filtered (XfsdDebugDomain  domain,
 
     g_return_if_fail (message != NULL);
 
-    /* leave when the filter does not match */
-    if ((xfsettings_dbg_init () & domain) == 0)
-        return;
-
+    /* print when the filter matches */
     va_start (args, message);
-    xfsettings_dbg_print (domain, message, args);
+    xfsettings_dbg_log (domain, (xfsettings_dbg_init () & domain) != 0, message, args);
     va_end (args);
 }
+
+
+
+void
+xfsettings_dbg_set_ring (gboolean enabled)
+{
+    /* apply the environment first, so it does not override this */
+    xfsettings_dbg_init ();
+
+    g_atomic_int_set (&dbg_ring_enabled, enabled);
+}
+
+
+
+void
+xfsettings_dbg_foreach (XfsdDebugFunc func,
+                        gpointer      user_data)
+{
+    guint            head, n;
+    gint             seq;
+    XfsdDebugRecord *slot;
+    XfsdDebugRecord  record;
+    const gchar     *end;
+
+    g_return_if_fail (func != NULL);
+
+    head = g_atomic_int_get (&dbg_ring_head);
+    n = head > RING_SIZE ? head - RING_SIZE : 0;
+
+    for (; n != head; n++)
+    {
+        slot = &dbg_ring[n & (RING_SIZE - 1)];
+
+        /* copy the record and check it was not (re)written meanwhile */
+        seq = g_atomic_int_get (&slot->seq);
+        if ((guint) seq != n + 1)
+            continue;
+
+        record.domain = slot->domain;
+        record.time = slot->time;
+        memcpy (record.text, slot->text, sizeof (record.text));
+
+        if (g_atomic_int_get (&slot->seq) != seq)
+            continue;
+
+        /* strip a character cut in half by the truncation */
+        record.text[sizeof (record.text) - 1] = '\0';
+        if (!g_utf8_validate (record.text, -1, &end))
+            *((gchar *) end) = '\0';
+        func (record.time, xfsettings_dbg_domain_name (record.domain), record.text, user_data);
+    }
+}
+
+
+
+static void
+xfsettings_dbg_dump_func (gint64       time,
+                          const gchar *domain_name,
+                          const gchar *message,
+                          gpointer     user_data)
+{
+    g_printerr (PACKAGE_NAME "(%s): [%" G_GINT64_FORMAT ".%06" G_GINT64_FORMAT "] %s\n",
+                domain_name, time / G_USEC_PER_SEC, time % G_USEC_PER_SEC, message);
+}
+
+
+
+void
+xfsettings_dbg_dump (void)
+{
+    g_printerr (PACKAGE_NAME ": dump of the debug log\n");
+    xfsettings_dbg_foreach (xfsettings_dbg_dump_func, NULL);
+}
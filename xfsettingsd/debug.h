@@ -33,9 +33,18 @@ typedef enum
    XFSD_DEBUG_ACCESSIBILITY      = 1 << 7,
    XFSD_DEBUG_POINTERS           = 1 << 8,
    XFSD_DEBUG_DISPLAYS           = 1 << 9,
+   XFSD_DEBUG_SNAPSHOT           = 1 << 10,
+   XFSD_DEBUG_STARTUP            = 1 << 11,
+   XFSD_DEBUG_DISPATCHER         = 1 << 12,
+   XFSD_DEBUG_CLIPBOARD          = 1 << 13,
 }
 XfsdDebugDomain;
 
+typedef void (*XfsdDebugFunc) (gint64       time,
+                               const gchar *domain_name,
+                               const gchar *message,
+                               gpointer     user_data);
+
 void xfsettings_dbg          (XfsdDebugDomain  domain,
                               const gchar     *message,
                               ...) G_GNUC_PRINTF (2, 3);
@@ -44,4 +53,11 @@ void xfsettings_dbg_filtered (XfsdDebugDomain  domain,
                               const gchar     *message,
                               ...) G_GNUC_PRINTF (2, 3);
 
+void xfsettings_dbg_set_ring (gboolean         enabled);
+
+void xfsettings_dbg_foreach  (XfsdDebugFunc    func,
+                              gpointer         user_data);
+
+void xfsettings_dbg_dump     (void);
+
 #endif /* !__DEBUG_H__ */
@@ -0,0 +1,260 @@
+/*
+ *  Copyright (c) 2015 The Xfce development team
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * All helpers share a single default GDK filter. Handlers are registered
+ * for an X event type (for extensions this is the event base returned by
+ * the extension plus the event number), so an event is only passed to
+ * the helpers that asked for it, instead of walking every filter of
+ * every helper for each event on the connection.
+ *
+ * There is no catch-all: a helper gets nothing but the types it
+ * registered, so each registration lists the types its filter (or the
+ * library it feeds) needs. All X event types, extensions included, fit
+ * in the 7 bits of the table index.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <X11/Xlib.h>
+
+#include <glib.h>
+#include <gdk/gdk.h>
+#include <gdk/gdkx.h>
+
+#include "dispatcher.h"
+#include "debug.h"
+
+
+
+/* event types are 7 bits, the 8th bit is the send_event flag */
+#define N_EVENT_TYPES (128)
+
+/* dump the statistics each time this many events passed */
+#define STATS_INTERVAL (1 << 16)
+
+
+
+typedef struct _XfsdDispatcherHandler XfsdDispatcherHandler;
+
+
+
+struct _XfsdDispatcherHandler
+{
+    GdkFilterFunc func;
+    gpointer      user_data;
+};
+
+
+
+/* handlers per event type */
+static GSList  *dispatcher_handlers[N_EVENT_TYPES];
+static guint    dispatcher_n_handlers = 0;
+
+/* set while handlers run, removals are delayed until it is done */
+static guint    dispatcher_depth = 0;
+static gboolean dispatcher_purge = FALSE;
+
+/* number of events received and delivered to a helper */
+static guint64  dispatcher_n_events[N_EVENT_TYPES];
+static guint64  dispatcher_n_delivered[N_EVENT_TYPES];
+static guint64  dispatcher_n_total = 0;
+
+static const gchar *core_event_names[] =
+{
+    NULL, NULL, "KeyPress", "KeyRelease", "ButtonPress", "ButtonRelease",
+    "MotionNotify", "EnterNotify", "LeaveNotify", "FocusIn", "FocusOut",
+    "KeymapNotify", "Expose", "GraphicsExpose", "NoExpose",
+    "VisibilityNotify", "CreateNotify", "DestroyNotify", "UnmapNotify",
+    "MapNotify", "MapRequest", "ReparentNotify", "ConfigureNotify",
+    "ConfigureRequest", "GravityNotify", "ResizeRequest",
+    "CirculateNotify", "CirculateRequest", "PropertyNotify",
+    "SelectionClear", "SelectionRequest", "SelectionNotify",
+    "ColormapNotify", "ClientMessage", "MappingNotify", "GenericEvent"
+};
+
+
+
+static void
+xfsettings_dispatcher_purge (void)
+{
+    guint                  type;
+    GSList                *li, *lnext;
+    XfsdDispatcherHandler *handler;
+
+    for (type = 0; type < N_EVENT_TYPES; type++)
+    {
+        for (li = dispatcher_handlers[type]; li != NULL; li = lnext)
+        {
+            lnext = li->next;
+            handler = li->data;
+
+            if (handler->func == NULL)
+            {
+                dispatcher_handlers[type] = g_slist_delete_link (dispatcher_handlers[type], li);
+                g_slice_free (XfsdDispatcherHandler, handler);
+            }
+        }
+    }
+
+    dispatcher_purge = FALSE;
+}
+
+
+
+static GdkFilterReturn
+xfsettings_dispatcher_filter (GdkXEvent *gdkxevent,
+                              GdkEvent  *gdkevent,
+                              gpointer   data)
+{
+    XEvent                *xevent = gdkxevent;
+    guint                  type;
+    GSList                *li;
+    XfsdDispatcherHandler *handler;
+    GdkFilterReturn        result = GDK_FILTER_CONTINUE;
+
+    type = xevent->type & 0x7f;
+    dispatcher_n_events[type]++;
+
+    if (dispatcher_handlers[type] != NULL)
+    {
+        dispatcher_n_delivered[type]++;
+        dispatcher_depth++;
+
+        for (li = dispatcher_handlers[type]; li != NULL; li = li->next)
+        {
+            handler = li->data;
+            if (handler->func == NULL)
+                continue;
+
+            result = handler->func (gdkxevent, gdkevent, handler->user_data);
+            if (result != GDK_FILTER_CONTINUE)
+                break;
+        }
+
+        dispatcher_depth--;
+
+        if (dispatcher_depth == 0 && dispatcher_purge)
+            xfsettings_dispatcher_purge ();
+    }
+
+    if (G_UNLIKELY (++dispatcher_n_total % STATS_INTERVAL == 0))
+        xfsettings_dispatcher_dump_stats ();
+
+    return result;
+}
+
+
+
+void
+xfsettings_dispatcher_add (gint          event_type,
+                           GdkFilterFunc func,
+                           gpointer      user_data)
+{
+    XfsdDispatcherHandler *handler;
+
+    g_return_if_fail (event_type > 0 && event_type < N_EVENT_TYPES);
+    g_return_if_fail (func != NULL);
+
+    /* install the filter on the first handler */
+    if (dispatcher_n_handlers == 0)
+        gdk_window_add_filter (NULL, xfsettings_dispatcher_filter, NULL);
+
+    handler = g_slice_new (XfsdDispatcherHandler);
+    handler->func = func;
+    handler->user_data = user_data;
+
+    dispatcher_handlers[event_type] = g_slist_append (dispatcher_handlers[event_type], handler);
+    dispatcher_n_handlers++;
+}
+
+
+
+void
+xfsettings_dispatcher_remove (gint          event_type,
+                              GdkFilterFunc func,
+                              gpointer      user_data)
+{
+    GSList                *li;
+    XfsdDispatcherHandler *handler;
+
+    g_return_if_fail (event_type > 0 && event_type < N_EVENT_TYPES);
+
+    for (li = dispatcher_handlers[event_type]; li != NULL; li = li->next)
+    {
+        handler = li->data;
+
+        if (handler->func == func
+            && handler->user_data == user_data)
+        {
+            if (dispatcher_depth > 0)
+            {
+                /* free the handler when the dispatching is done */
+                handler->func = NULL;
+                dispatcher_purge = TRUE;
+            }
+            else
+            {
+                dispatcher_handlers[event_type] = g_slist_delete_link (dispatcher_handlers[event_type], li);
+                g_slice_free (XfsdDispatcherHandler, handler);
+            }
+
+            /* remove the filter with the last handler */
+            if (--dispatcher_n_handlers == 0)
+                gdk_window_remove_filter (NULL, xfsettings_dispatcher_filter, NULL);
+
+            return;
+        }
+    }
+}
+
+
+
+void
+xfsettings_dispatcher_dump_stats (void)
+{
+    guint        type;
+    const gchar *name;
+
+    xfsettings_dbg_filtered (XFSD_DEBUG_DISPATCHER, "%" G_GUINT64_FORMAT " events, "
+                             "%u handlers", dispatcher_n_total, dispatcher_n_handlers);
+
+    for (type = 0; type < N_EVENT_TYPES; type++)
+    {
+        if (dispatcher_n_events[type] == 0)
+            continue;
+
+        name = type < G_N_ELEMENTS (core_event_names) ? core_event_names[type] : NULL;
+        if (name != NULL)
+        {
+            xfsettings_dbg_filtered (XFSD_DEBUG_DISPATCHER, "%s: %" G_GUINT64_FORMAT
+                                     " received, %" G_GUINT64_FORMAT " delivered",
+                                     name, dispatcher_n_events[type],
+                                     dispatcher_n_delivered[type]);
+        }
+        else
+        {
+            xfsettings_dbg_filtered (XFSD_DEBUG_DISPATCHER, "extension event %u: %"
+                                     G_GUINT64_FORMAT " received, %" G_GUINT64_FORMAT
+                                     " delivered", type, dispatcher_n_events[type],
+                                     dispatcher_n_delivered[type]);
+        }
+    }
+}
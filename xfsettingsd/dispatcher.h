@@ -0,0 +1,34 @@
+/*
+ *  Copyright (c) 2015 The Xfce development team
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __DISPATCHER_H__
+#define __DISPATCHER_H__
+
+#include <gdk/gdk.h>
+
+void xfsettings_dispatcher_add         (gint           event_type,
+                                        GdkFilterFunc  func,
+                                        gpointer       user_data);
+
+void xfsettings_dispatcher_remove      (gint           event_type,
+                                        GdkFilterFunc  func,
+                                        gpointer       user_data);
+
+void xfsettings_dispatcher_dump_stats  (void);
+
+#endif /* !__DISPATCHER_H__ */
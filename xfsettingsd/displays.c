@@ -29,13 +29,15 @@
 #endif
 
 #include <glib.h>
-#include <gdk/gdkx.h>
+#include <gdk/gdk.h>
 #include <gtk/gtk.h>
 #include <xfconf/xfconf.h>
 #include <libxfce4ui/libxfce4ui.h>
 
 #include <X11/extensions/Xrandr.h>
 
+#include <common/displays-backend.h>
+
 #include "debug.h"
 #include "displays.h"
 #ifdef HAVE_UPOWERGLIB
@@ -52,38 +54,99 @@
 /* Xfconf properties */
 #define APPLY_SCHEME_PROP   "/Schemes/Apply"
 #define DEFAULT_SCHEME_NAME "Default"
-#define OUTPUT_FMT          "/%s/%s"
-#define PRIMARY_PROP        OUTPUT_FMT "/Primary"
-#define ACTIVE_PROP         OUTPUT_FMT "/Active"
-#define ROTATION_PROP       OUTPUT_FMT "/Rotation"
-#define REFLECTION_PROP     OUTPUT_FMT "/Reflection"
-#define RESOLUTION_PROP     OUTPUT_FMT "/Resolution"
-#define RRATE_PROP          OUTPUT_FMT "/RefreshRate"
-#define POSX_PROP           OUTPUT_FMT "/Position/X"
-#define POSY_PROP           OUTPUT_FMT "/Position/Y"
+/* properties of an output in a scheme, below "/<scheme>/<output>" */
+#define PRIMARY_PROP        "/Primary"
+#define ACTIVE_PROP         "/Active"
+#define ROTATION_PROP       "/Rotation"
+#define REFLECTION_PROP     "/Reflection"
+#define RESOLUTION_PROP     "/Resolution"
+#define RRATE_PROP          "/RefreshRate"
+#define POSX_PROP           "/Position/X"
+#define POSY_PROP           "/Position/Y"
 #define NOTIFY_PROP         "/Notify"
 
+/* print the requests of an apply instead of sending them */
+#define DRY_RUN_PROP        "/Schemes/DryRun"
+
+/* schemes saved for a set of connected monitors, "/<scheme>/Fingerprint"
+ * holds the fingerprint of the set */
+#define FINGERPRINT_PROP    "/Fingerprint"
+#define PROFILE_PREFIX      "Profile_"
+/* names of the profile schemes, most recently saved first */
+#define PROFILES_PROP       "/Schemes/Profiles"
+/* older profiles are removed */
+#define MAX_PROFILES        (16)
+
+/* ms without output changes before a hotplug burst is over */
+#define SETTLE_TIMEOUT      (500)
+/* ms after which a burst is handled even if outputs keep changing */
+#define SETTLE_MAX_TIME     (5000)
+
 
 
 /* wrappers to avoid querying too often */
-typedef struct _XfceRRCrtc   XfceRRCrtc;
-typedef struct _XfceRROutput XfceRROutput;
+typedef struct _XfceRRCrtc      XfceRRCrtc;
+typedef struct _XfceRROutput    XfceRROutput;
+typedef struct _XfceSavedOutput XfceSavedOutput;
+typedef struct _XfceRRStep      XfceRRStep;
+
+typedef enum
+{
+    XFCE_RR_STEP_DISABLE_CRTC,
+    XFCE_RR_STEP_SCREEN_SIZE,
+    XFCE_RR_STEP_SET_CRTC,
+    XFCE_RR_STEP_PRIMARY
+}
+XfceRRStepType;
+
+/* Property identifiers */
+enum
+{
+    PROP_0,
+    PROP_BACKEND
+};
 
 
 
+static void             xfce_displays_helper_set_property                   (GObject                 *object,
+                                                                             guint                    prop_id,
+                                                                             const GValue            *value,
+                                                                             GParamSpec              *pspec);
+static void             xfce_displays_helper_constructed                    (GObject                 *object);
 static void             xfce_displays_helper_dispose                        (GObject                 *object);
 static void             xfce_displays_helper_finalize                       (GObject                 *object);
-static void             xfce_displays_helper_reload                         (XfceDisplaysHelper      *helper);
-static GdkFilterReturn  xfce_displays_helper_screen_on_event                (GdkXEvent               *xevent,
-                                                                             GdkEvent                *event,
+static void             xfce_displays_helper_refresh_resources              (XfceDisplaysHelper      *helper);
+static void             xfce_displays_helper_crtc_changed                   (XfceDisplaysHelper      *helper,
+                                                                             const XfceDisplaysEvent *event);
+static void             xfce_displays_helper_output_changed                 (XfceDisplaysHelper      *helper,
+                                                                             const XfceDisplaysEvent *event);
+static void             xfce_displays_helper_settle_queue                   (XfceDisplaysHelper      *helper);
+static gboolean         xfce_displays_helper_settle                         (gpointer                 data);
+static void             xfce_displays_helper_screen_on_event                (XfceDisplaysBackend     *backend,
+                                                                             const XfceDisplaysEvent *event,
                                                                              gpointer                 data);
-static void             xfce_displays_helper_set_screen_size                (XfceDisplaysHelper      *helper);
+static void             xfce_displays_helper_query_size_range               (XfceDisplaysHelper      *helper);
+static void             xfce_displays_helper_index_modes                    (XfceDisplaysHelper      *helper);
+static GHashTable      *xfce_displays_helper_parse_scheme                   (const gchar             *scheme,
+                                                                             GHashTable              *properties);
+static GHashTable      *xfce_displays_helper_get_scheme                     (XfceDisplaysHelper      *helper,
+                                                                             const gchar             *scheme);
+static gchar           *xfce_displays_helper_fingerprint                    (XfceDisplaysHelper      *helper);
+static void             xfce_displays_helper_load_profiles                  (XfceDisplaysHelper      *helper);
+static const gchar     *xfce_displays_helper_find_profile                   (XfceDisplaysHelper      *helper);
+static void             xfce_displays_helper_prune_profiles                 (XfceDisplaysHelper      *helper,
+                                                                             const gchar             *saved);
+static void             xfce_displays_helper_save_profile                   (XfceDisplaysHelper      *helper,
+                                                                             const gchar             *scheme);
 static gboolean         xfce_displays_helper_load_from_xfconf               (XfceDisplaysHelper      *helper,
-                                                                             const gchar             *scheme,
                                                                              GHashTable              *saved_outputs,
                                                                              XfceRROutput            *output);
+static XfceRROutput    *xfce_displays_helper_get_output                     (XfceDisplaysHelper      *helper,
+                                                                             RROutput                 id);
 static GPtrArray       *xfce_displays_helper_list_outputs                   (XfceDisplaysHelper      *helper);
 static void             xfce_displays_helper_free_output                    (XfceRROutput            *output);
+static gboolean         xfce_displays_helper_load_crtc                      (XfceDisplaysHelper      *helper,
+                                                                             XfceRRCrtc              *crtc);
 static GPtrArray       *xfce_displays_helper_list_crtcs                     (XfceDisplaysHelper      *helper);
 static XfceRRCrtc      *xfce_displays_helper_find_crtc_by_id                (XfceDisplaysHelper      *helper,
                                                                              RRCrtc                   id);
@@ -95,15 +158,15 @@ static void             xfce_displays_helper_get_topleftmost_pos            (Xfc
 static void             xfce_displays_helper_normalize_crtc                 (XfceRRCrtc              *crtc,
                                                                              XfceDisplaysHelper      *helper);
 static Status           xfce_displays_helper_disable_crtc                   (XfceDisplaysHelper      *helper,
-                                                                             RRCrtc                   crtc);
-static void             xfce_displays_helper_workaround_crtc_size           (XfceRRCrtc              *crtc,
-                                                                             XfceDisplaysHelper      *helper);
-static void             xfce_displays_helper_apply_crtc                     (XfceRRCrtc              *crtc,
-                                                                             XfceDisplaysHelper      *helper);
+                                                                             XfceRRCrtc              *crtc);
+static void             xfce_displays_helper_crtc_applied                   (XfceRRCrtc              *crtc);
+static GArray          *xfce_displays_helper_plan                           (XfceDisplaysHelper      *helper);
+static void             xfce_displays_helper_plan_run                       (XfceDisplaysHelper      *helper,
+                                                                             GArray                  *plan);
 static void             xfce_displays_helper_set_outputs                    (XfceRRCrtc              *crtc,
                                                                              XfceRROutput            *output);
 static void             xfce_displays_helper_apply_all                      (XfceDisplaysHelper      *helper);
-static void             xfce_displays_helper_channel_apply                  (XfceDisplaysHelper      *helper,
+static gboolean         xfce_displays_helper_channel_apply                  (XfceDisplaysHelper      *helper,
                                                                              const gchar             *scheme);
 static void             xfce_displays_helper_channel_property_changed       (XfconfChannel           *channel,
                                                                              const gchar             *property_name,
@@ -128,9 +191,24 @@ struct _XfceDisplaysHelper
     XfconfChannel      *channel;
     guint               handler;
 
+    /* parsed schemes by name, and settings of the channel, kept up
+     * to date by the property-changed signal */
+    GHashTable         *schemes;
+    gboolean            notify;
+    gboolean            dry_run;
+
+    /* set when an output of a scheme or a request of an apply failed */
+    gboolean            apply_failed;
+
+    /* scheme names by fingerprint of the connected monitors */
+    GHashTable         *profiles;
+
 #ifdef HAS_RANDR_ONE_POINT_THREE
     gint                has_1_3;
     gint                primary;
+
+    /* primary output on the server */
+    gint                cur_primary;
 #endif
 
 #ifdef HAVE_UPOWERGLIB
@@ -138,21 +216,37 @@ struct _XfceDisplaysHelper
     gint                phandler;
 #endif
 
-    GdkDisplay         *display;
-    GdkWindow          *root_window;
-    Display            *xdisplay;
-    gint                event_base;
+    /* the RandR requests go through the backend */
+    XfceDisplaysBackend   *backend;
 
     /* RandR cache */
-    XRRScreenResources *resources;
+    XfceDisplaysResources *resources;
     GPtrArray          *crtcs;
     GPtrArray          *outputs;
 
-    /* screen size */
+    /* cache entries by RandR id */
+    GHashTable         *crtc_index;
+    GHashTable         *output_index;
+    GHashTable         *mode_index;
+
+    /* hotplug bursts, the outputs before the burst and whether they
+     * were active */
+    guint               settle_id;
+    gint64              settle_start;
+    guint               settle_events;
+    guint               settle_swapped;
+    GHashTable         *settle_outputs;
+    guint               n_applies;
+
+    /* screen size, and the range of the screen */
     gint                width;
     gint                height;
     gint                mm_width;
     gint                mm_height;
+    gint                min_width;
+    gint                min_height;
+    gint                max_width;
+    gint                max_height;
 
     /* used to normalize positions */
     gint                min_x;
@@ -174,14 +268,53 @@ struct _XfceRRCrtc
     gint      npossible;
     RROutput *possible;
     gint      changed;
+
+    /* configuration on the server */
+    RRMode    cur_mode;
+    Rotation  cur_rotation;
+    gint      cur_width;
+    gint      cur_height;
+    gint      cur_x;
+    gint      cur_y;
+    gint      cur_noutput;
+    RROutput *cur_outputs;
 };
 
 struct _XfceRROutput
 {
-    RROutput       id;
-    XRROutputInfo *info;
-    RRMode         preferred_mode;
-    guint          active : 1;
+    RROutput                id;
+    XfceDisplaysOutputInfo *info;
+    RRMode                  preferred_mode;
+    guint                   active : 1;
+
+    /* identifies the monitor, 0 without EDID */
+    guint64                 edid_hash;
+
+    /* modes of the output by size and refresh rate */
+    GHashTable             *mode_lookup;
+};
+
+struct _XfceRRStep
+{
+    XfceRRStepType  type;
+    XfceRRCrtc     *crtc;
+};
+
+struct _XfceSavedOutput
+{
+    gchar    *name;
+    guint     exists : 1;
+    guint     primary : 1;
+    guint     has_active : 1;
+    guint     active : 1;
+    Rotation  rotation;
+    Rotation  reflection;
+    gchar    *resolution;
+    gint      width;
+    gint      height;
+    gdouble   rate;
+    gint      x;
+    gint      y;
 };
 
 
@@ -194,8 +327,19 @@ xfce_displays_helper_class_init (XfceDisplaysHelperClass *klass)
 {
     GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
 
+    gobject_class->set_property = xfce_displays_helper_set_property;
+    gobject_class->constructed = xfce_displays_helper_constructed;
     gobject_class->dispose = xfce_displays_helper_dispose;
     gobject_class->finalize = xfce_displays_helper_finalize;
+
+    /* the helper takes the backend, the X server is used without one */
+    g_object_class_install_property (gobject_class,
+                                     PROP_BACKEND,
+                                     g_param_spec_pointer ("backend",
+                                                           NULL, NULL,
+                                                           G_PARAM_WRITABLE
+                                                           | G_PARAM_CONSTRUCT_ONLY
+                                                           | G_PARAM_STATIC_STRINGS));
 }
 
 
@@ -203,57 +347,90 @@ xfce_displays_helper_class_init (XfceDisplaysHelperClass *klass)
 static void
 xfce_displays_helper_init (XfceDisplaysHelper *helper)
 {
-    gint major = 0, minor = 0;
-    gint error_base, err;
-
 #ifdef HAVE_UPOWERGLIB
     helper->power = NULL;
     helper->phandler = 0;
 #endif
+    helper->backend = NULL;
     helper->resources = NULL;
     helper->outputs = NULL;
     helper->crtcs = NULL;
+    helper->crtc_index = g_hash_table_new (g_direct_hash, g_direct_equal);
+    helper->output_index = g_hash_table_new (g_direct_hash, g_direct_equal);
+    helper->mode_index = g_hash_table_new (g_direct_hash, g_direct_equal);
+    helper->settle_outputs = g_hash_table_new (g_direct_hash, g_direct_equal);
+    helper->schemes = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                             (GDestroyNotify) g_hash_table_unref);
+    helper->profiles = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+    helper->settle_id = 0;
+    helper->n_applies = 0;
     helper->handler = 0;
+}
+
+
+
+static void
+xfce_displays_helper_set_property (GObject      *object,
+                                   guint         prop_id,
+                                   const GValue *value,
+                                   GParamSpec   *pspec)
+{
+    XfceDisplaysHelper *helper = XFCE_DISPLAYS_HELPER (object);
+
+    switch (prop_id)
+    {
+        case PROP_BACKEND:
+            helper->backend = g_value_get_pointer (value);
+            break;
+
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+            break;
+    }
+}
+
+
+
+static void
+xfce_displays_helper_constructed (GObject *object)
+{
+    XfceDisplaysHelper *helper = XFCE_DISPLAYS_HELPER (object);
+    gint                major = 0, minor = 0;
+    const gchar        *profile;
+
+    if (G_OBJECT_CLASS (xfce_displays_helper_parent_class)->constructed != NULL)
+        (*G_OBJECT_CLASS (xfce_displays_helper_parent_class)->constructed) (object);
 
-    /* get the default display */
-    helper->display = gdk_display_get_default ();
-    helper->xdisplay = gdk_x11_display_get_xdisplay (helper->display);
-    helper->root_window = gdk_get_default_root_window ();
+    /* use the default display */
+    if (helper->backend == NULL)
+        helper->backend = xfce_displays_backend_x11_new (gdk_display_get_default ());
 
     /* check if the randr extension is running */
-    if (XRRQueryExtension (helper->xdisplay, &helper->event_base, &error_base))
+    if (helper->backend->query_version (helper->backend, &major, &minor))
     {
         /* query the version */
-        if (XRRQueryVersion (helper->xdisplay, &major, &minor)
-            && (major > 1 || (major == 1 && minor >= 2)))
+        if (major > 1 || (major == 1 && minor >= 2))
         {
-            gdk_error_trap_push ();
             /* get the screen resource */
-            helper->resources = XRRGetScreenResources (helper->xdisplay,
-                                                       GDK_WINDOW_XID (helper->root_window));
-            gdk_flush ();
-            err = gdk_error_trap_pop ();
-            if (err)
+            helper->resources = helper->backend->get_screen_resources (helper->backend, FALSE);
+            if (helper->resources == NULL)
             {
-                g_critical ("XRRGetScreenResources failed (err: %d). "
-                            "Display settings won't be applied.", err);
+                g_critical ("XRRGetScreenResources failed. "
+                            "Display settings won't be applied.");
                 return;
             }
 
-            /* get all existing CRTCs and connected outputs */
+            /* get all existing modes, CRTCs and connected outputs */
+            xfce_displays_helper_query_size_range (helper);
+            xfce_displays_helper_index_modes (helper);
             helper->crtcs = xfce_displays_helper_list_crtcs (helper);
             helper->outputs = xfce_displays_helper_list_outputs (helper);
 
-            /* Set up RandR notifications */
-            XRRSelectInput (helper->xdisplay,
-                            GDK_WINDOW_XID (helper->root_window),
-                            RRScreenChangeNotifyMask);
-            gdk_x11_register_standard_event_type (helper->display,
-                                                  helper->event_base,
-                                                  RRNotify + 1);
-            gdk_window_add_filter (helper->root_window,
-                                   xfce_displays_helper_screen_on_event,
-                                   helper);
+            /* Set up RandR notifications, output and CRTC changes
+             * update the cache entry they are about */
+            xfce_displays_backend_set_notify (helper->backend,
+                                              xfce_displays_helper_screen_on_event,
+                                              helper);
 
 #ifdef HAVE_UPOWERGLIB
             helper->power = g_object_new (XFCE_TYPE_DISPLAYS_UPOWER, NULL);
@@ -269,6 +446,10 @@ xfce_displays_helper_init (XfceDisplaysHelper *helper)
             /* remove any leftover apply property before setting the monitor */
             xfconf_channel_reset_property (helper->channel, APPLY_SCHEME_PROP, FALSE);
 
+            helper->notify = xfconf_channel_get_bool (helper->channel, NOTIFY_PROP, FALSE);
+            helper->dry_run = xfconf_channel_get_bool (helper->channel, DRY_RUN_PROP, FALSE);
+            xfce_displays_helper_load_profiles (helper);
+
             /* monitor channel changes */
             helper->handler = g_signal_connect (G_OBJECT (helper->channel),
                                                 "property-changed",
@@ -277,9 +458,12 @@ xfce_displays_helper_init (XfceDisplaysHelper *helper)
 
 #ifdef HAS_RANDR_ONE_POINT_THREE
             helper->has_1_3 = (major > 1 || (major == 1 && minor >= 3));
+            if (helper->has_1_3)
+                helper->cur_primary = helper->backend->get_output_primary (helper->backend);
 #endif
-            /* restore the default scheme */
-            xfce_displays_helper_channel_apply (helper, DEFAULT_SCHEME_NAME);
+            /* restore the scheme of the connected monitors, or the default one */
+            profile = xfce_displays_helper_find_profile (helper);
+            xfce_displays_helper_channel_apply (helper, profile != NULL ? profile : DEFAULT_SCHEME_NAME);
         }
         else
         {
@@ -290,8 +474,7 @@ xfce_displays_helper_init (XfceDisplaysHelper *helper)
     }
     else
     {
-        g_critical ("No RANDR extension found in display %s. Display settings won't be applied.",
-                    gdk_display_get_name (helper->display));
+        g_critical ("No RANDR extension found. Display settings won't be applied.");
     }
 }
 
@@ -319,9 +502,17 @@ xfce_displays_helper_dispose (GObject *object)
     }
 #endif
 
-    gdk_window_remove_filter (helper->root_window,
-                              xfce_displays_helper_screen_on_event,
-                              helper);
+    if (helper->settle_id != 0)
+    {
+        g_source_remove (helper->settle_id);
+        helper->settle_id = 0;
+    }
+
+    if (helper->backend != NULL)
+        xfce_displays_backend_set_notify (helper->backend, NULL, NULL);
+
+    g_hash_table_remove_all (helper->output_index);
+    g_hash_table_remove_all (helper->crtc_index);
 
     if (helper->outputs)
     {
@@ -346,257 +537,919 @@ xfce_displays_helper_finalize (GObject *object)
     XfceDisplaysHelper *helper = XFCE_DISPLAYS_HELPER (object);
 
     /* Free the screen resources */
-    if (helper->resources)
+    xfce_displays_resources_free (helper->resources);
+    helper->resources = NULL;
+
+    xfce_displays_backend_free (helper->backend);
+
+    g_hash_table_destroy (helper->output_index);
+    g_hash_table_destroy (helper->crtc_index);
+    g_hash_table_destroy (helper->mode_index);
+    g_hash_table_destroy (helper->settle_outputs);
+    g_hash_table_destroy (helper->schemes);
+    g_hash_table_destroy (helper->profiles);
+
+    (*G_OBJECT_CLASS (xfce_displays_helper_parent_class)->finalize) (object);
+}
+
+
+
+static void
+xfce_displays_helper_refresh_resources (XfceDisplaysHelper *helper)
+{
+    XfceDisplaysResources *resources;
+    XfceRRCrtc            *crtc;
+    GHashTable            *ids;
+    gint                   n;
+    guint                  i;
+    gboolean               current = FALSE;
+
+    xfsettings_dbg (XFSD_DEBUG_DISPLAYS, "Refreshing RandR resources.");
+
+#ifdef HAS_RANDR_ONE_POINT_THREE
+    /* this is called after a xrandr notification, which means that X
+       is aware of the new hardware already. So, if possible, do not
+       reprobe the hardware again. */
+    current = helper->has_1_3;
+#endif
+
+    resources = helper->backend->get_screen_resources (helper->backend, current);
+    if (resources == NULL)
+    {
+        g_critical ("Failed to refresh the RandR resources.");
+        return;
+    }
+
+    /* the cached outputs and CRTCs do not point into the resources,
+     * only the modes and the configuration timestamp are renewed */
+    xfce_displays_resources_free (helper->resources);
+    helper->resources = resources;
+    xfce_displays_helper_query_size_range (helper);
+    xfce_displays_helper_index_modes (helper);
+
+    /* add CRTCs that appeared */
+    for (n = 0; n < resources->ncrtc; ++n)
     {
-        gdk_error_trap_push ();
-        XRRFreeScreenResources (helper->resources);
-        gdk_flush ();
-        if (gdk_error_trap_pop () != 0)
+        if (g_hash_table_lookup (helper->crtc_index, GUINT_TO_POINTER (resources->crtcs[n])) != NULL)
+            continue;
+
+        xfsettings_dbg (XFSD_DEBUG_DISPLAYS, "Detected CRTC %lu.", resources->crtcs[n]);
+
+        crtc = g_new0 (XfceRRCrtc, 1);
+        crtc->id = resources->crtcs[n];
+        if (!xfce_displays_helper_load_crtc (helper, crtc))
         {
-            g_critical ("Failed to free screen resources");
+            xfce_displays_helper_free_crtc (crtc);
+            continue;
         }
-        helper->resources = NULL;
+
+        g_ptr_array_add (helper->crtcs, crtc);
+        g_hash_table_insert (helper->crtc_index, GUINT_TO_POINTER (crtc->id), crtc);
     }
 
-    (*G_OBJECT_CLASS (xfce_displays_helper_parent_class)->finalize) (object);
+    /* drop CRTCs that are gone */
+    if (helper->crtcs->len > (guint) resources->ncrtc)
+    {
+        ids = g_hash_table_new (g_direct_hash, g_direct_equal);
+        for (n = 0; n < resources->ncrtc; ++n)
+            g_hash_table_insert (ids, GUINT_TO_POINTER (resources->crtcs[n]), ids);
+
+        for (i = helper->crtcs->len; i > 0; --i)
+        {
+            crtc = g_ptr_array_index (helper->crtcs, i - 1);
+            if (g_hash_table_lookup (ids, GUINT_TO_POINTER (crtc->id)) != NULL)
+                continue;
+
+            xfsettings_dbg (XFSD_DEBUG_DISPLAYS, "CRTC %lu removed.", crtc->id);
+            g_hash_table_remove (helper->crtc_index, GUINT_TO_POINTER (crtc->id));
+            g_ptr_array_remove_index (helper->crtcs, i - 1);
+        }
+
+        g_hash_table_destroy (ids);
+    }
 }
 
 
 
 static void
-xfce_displays_helper_reload (XfceDisplaysHelper *helper)
+xfce_displays_helper_crtc_changed (XfceDisplaysHelper      *helper,
+                                   const XfceDisplaysEvent *event)
 {
-    gint err;
+    XfceRRCrtc *crtc;
+
+    xfsettings_dbg (XFSD_DEBUG_DISPLAYS, "RRCrtcChangeNotify event received for CRTC %lu.",
+                    event->crtc);
+
+    crtc = g_hash_table_lookup (helper->crtc_index, GUINT_TO_POINTER (event->crtc));
+    if (crtc == NULL)
+    {
+        /* unknown CRTC, pick it up from the resources */
+        xfce_displays_helper_refresh_resources (helper);
+        return;
+    }
 
-    xfsettings_dbg (XFSD_DEBUG_DISPLAYS, "Refreshing RandR cache.");
+    /* the event lacks the outputs of the CRTC, so query only this one */
+    if (!xfce_displays_helper_load_crtc (helper, crtc))
+        g_warning ("Failed to update CRTC %lu.", crtc->id);
+}
 
-    /* Free the caches */
-    g_ptr_array_unref (helper->outputs);
-    g_ptr_array_unref (helper->crtcs);
 
-    gdk_error_trap_push ();
 
-    /* Free the screen resources */
-    XRRFreeScreenResources (helper->resources);
+static void
+xfce_displays_helper_output_changed (XfceDisplaysHelper      *helper,
+                                     const XfceDisplaysEvent *event)
+{
+    XfceRROutput *output, *updated;
+    guint         n;
+
+    xfsettings_dbg (XFSD_DEBUG_DISPLAYS, "RROutputChangeNotify event received for output %lu.",
+                    event->output);
+
+    output = g_hash_table_lookup (helper->output_index, GUINT_TO_POINTER (event->output));
+
+    if (event->connection == RR_Connected && output != NULL)
+    {
+        /* the event lacks the modes and the monitor of the output, which
+         * change with xrandr --addmode or a KVM switch, so query it again */
+        updated = xfce_displays_helper_get_output (helper, event->output);
+        if (updated == NULL)
+            return;
 
-    /* get the screen resource */
 #ifdef HAS_RANDR_ONE_POINT_THREE
-    /* xfce_displays_helper_reload () is usually called after a xrandr notification,
-       which means that X is aware of the new hardware already. So, if possible,
-       do not reprobe the hardware again. */
-    if (helper->has_1_3)
-        helper->resources = XRRGetScreenResourcesCurrent (helper->xdisplay,
-                                                          GDK_WINDOW_XID (helper->root_window));
-    else
+        /* the server notifies the outputs when the primary one changes */
+        if (helper->has_1_3)
+            helper->cur_primary = helper->backend->get_output_primary (helper->backend);
 #endif
-    helper->resources = XRRGetScreenResources (helper->xdisplay,
-                                               GDK_WINDOW_XID (helper->root_window));
 
-    gdk_flush ();
-    err = gdk_error_trap_pop ();
-    if (err)
-        g_critical ("Failed to reload the RandR cache (err: %d).", err);
+        /* another monitor behind the same output is handled like a
+         * hotplug, its layout may have to be restored */
+        if (updated->edid_hash != output->edid_hash)
+        {
+            xfsettings_dbg (XFSD_DEBUG_DISPLAYS, "Monitor changed on output %s.",
+                            updated->info->name);
+            xfce_displays_helper_settle_queue (helper);
+            helper->settle_swapped++;
+        }
+
+        for (n = 0; n < helper->outputs->len; ++n)
+        {
+            if (g_ptr_array_index (helper->outputs, n) == output)
+            {
+                g_hash_table_insert (helper->output_index, GUINT_TO_POINTER (updated->id), updated);
+                xfce_displays_helper_free_output (output);
+                g_ptr_array_index (helper->outputs, n) = updated;
+                break;
+            }
+        }
+    }
+    else if (event->connection == RR_Connected)
+    {
+        /* topology changes are handled once the outputs are stable */
+        xfce_displays_helper_settle_queue (helper);
+
+        /* the new monitor may come with new modes */
+        xfce_displays_helper_refresh_resources (helper);
+
+        output = xfce_displays_helper_get_output (helper, event->output);
+        if (output == NULL)
+            return;
+
+        g_ptr_array_add (helper->outputs, output);
+        g_hash_table_insert (helper->output_index, GUINT_TO_POINTER (output->id), output);
+
+        xfsettings_dbg (XFSD_DEBUG_DISPLAYS, "Output connected: %s", output->info->name);
+    }
+    else if (output != NULL)
+    {
+        xfce_displays_helper_settle_queue (helper);
+
+        xfsettings_dbg (XFSD_DEBUG_DISPLAYS, "Output disconnected: %s", output->info->name);
+
+        g_hash_table_remove (helper->output_index, GUINT_TO_POINTER (output->id));
+        g_ptr_array_remove (helper->outputs, output);
+
+        /* the configuration timestamp changed with the disconnection */
+        xfce_displays_helper_refresh_resources (helper);
+    }
+}
+
+
+
+/* Docks and KVM switches connect and disconnect outputs several times
+ * while the links are trained. Changes of the output set are collected
+ * until no output changed for SETTLE_TIMEOUT, then the difference with
+ * the outputs before the burst is handled at once.
+ */
+static void
+xfce_displays_helper_settle_queue (XfceDisplaysHelper *helper)
+{
+    XfceRROutput *output;
+    guint         n;
+
+    if (helper->settle_id == 0)
+    {
+        /* a new burst, remember the outputs it started with */
+        helper->settle_start = g_get_monotonic_time ();
+        helper->settle_events = 0;
+        helper->settle_swapped = 0;
+
+        g_hash_table_remove_all (helper->settle_outputs);
+        for (n = 0; n < helper->outputs->len; ++n)
+        {
+            output = g_ptr_array_index (helper->outputs, n);
+            g_hash_table_insert (helper->settle_outputs, GUINT_TO_POINTER (output->id),
+                                 GINT_TO_POINTER (output->active ? 2 : 1));
+        }
+    }
+    else
+    {
+        /* do not postpone forever if the outputs keep changing */
+        if (g_get_monotonic_time () - helper->settle_start >= SETTLE_MAX_TIME * 1000)
+            return;
+
+        g_source_remove (helper->settle_id);
+    }
+
+    helper->settle_events++;
+    helper->settle_id = g_timeout_add (SETTLE_TIMEOUT, xfce_displays_helper_settle, helper);
+}
+
+
+
+static gboolean
+xfce_displays_helper_settle (gpointer data)
+{
+    XfceDisplaysHelper *helper = XFCE_DISPLAYS_HELPER (data);
+    XfceRROutput       *output;
+    XfceRRCrtc         *crtc;
+    GHashTableIter      iter;
+    gpointer            id, state;
+    guint               n, nactive = 0, nconnected = 0, ndisconnected = 0;
+    guint               napplies = helper->n_applies;
+    gint                m;
+    gboolean            changed = FALSE, used;
+    const gchar        *profile = NULL;
+
+    helper->settle_id = 0;
+
+    /* outputs that are new since the start of the burst */
+    for (n = 0; n < helper->outputs->len; ++n)
+    {
+        output = g_ptr_array_index (helper->outputs, n);
+        if (g_hash_table_lookup (helper->settle_outputs, GUINT_TO_POINTER (output->id)) == NULL)
+        {
+            xfsettings_dbg (XFSD_DEBUG_DISPLAYS, "New output connected: %s",
+                            output->info->name);
+            ++nconnected;
+        }
+    }
+
+    /* outputs that are gone, if one was active we must recalculate
+     * the screen size */
+    g_hash_table_iter_init (&iter, helper->settle_outputs);
+    while (g_hash_table_iter_next (&iter, &id, &state))
+    {
+        if (g_hash_table_lookup (helper->output_index, id) == NULL)
+        {
+            ++ndisconnected;
+            changed |= GPOINTER_TO_INT (state) == 2;
+        }
+    }
+    g_hash_table_remove_all (helper->settle_outputs);
+
+    /* monitors swapped behind an output count as new ones */
+    nconnected += helper->settle_swapped;
+
+    /* a known set of monitors gets its layout back directly */
+    if (nconnected > 0 || ndisconnected > 0)
+        profile = xfce_displays_helper_find_profile (helper);
+
+    if (ndisconnected > 0)
+    {
+        /* force deconfiguring the CRTCs left without a connected output */
+        for (n = 0; n < helper->crtcs->len; ++n)
+        {
+            crtc = g_ptr_array_index (helper->crtcs, n);
+            if (crtc->mode == None || crtc->noutput == 0)
+                continue;
+
+            used = FALSE;
+            for (m = 0; m < crtc->noutput && !used; ++m)
+                used = g_hash_table_lookup (helper->output_index,
+                                            GUINT_TO_POINTER (crtc->outputs[m])) != NULL;
+
+            if (!used)
+            {
+                crtc->mode = None;
+                xfce_displays_helper_disable_crtc (helper, crtc);
+            }
+        }
+
+        /* Basically, this means the external output was disconnected,
+           so reenable the internal one if needed. */
+        for (n = 0; n < helper->outputs->len; ++n)
+        {
+            output = g_ptr_array_index (helper->outputs, n);
+            if (output->active)
+                ++nactive;
+        }
+        if (profile == NULL && nactive == 0)
+        {
+            xfsettings_dbg (XFSD_DEBUG_DISPLAYS, "No active output anymore! "
+                            "Attempting to re-enable the internal output.");
+            xfce_displays_helper_toggle_internal (NULL, FALSE, helper);
+        }
+        else if (profile == NULL && changed)
+            xfce_displays_helper_apply_all (helper);
+    }
 
-    /* recreate the caches */
-    helper->crtcs = xfce_displays_helper_list_crtcs (helper);
-    helper->outputs = xfce_displays_helper_list_outputs (helper);
+    if (profile != NULL)
+    {
+        xfsettings_dbg (XFSD_DEBUG_DISPLAYS, "Restoring scheme %s of the connected monitors.",
+                        profile);
+        xfce_displays_helper_channel_apply (helper, profile);
+    }
+    /* Start the minimal dialog according to the user preferences */
+    else if (nconnected > 0 && helper->notify)
+        xfce_spawn_command_line_on_screen (NULL, "xfce4-display-settings -m", FALSE,
+                                           FALSE, NULL);
+
+    xfsettings_dbg (XFSD_DEBUG_DISPLAYS, "Outputs settled after %.1f ms and %u changes: "
+                    "%u connected, %u disconnected, %u applies (%u in total).",
+                    (g_get_monotonic_time () - helper->settle_start) / 1000.0,
+                    helper->settle_events, nconnected, ndisconnected,
+                    helper->n_applies - napplies, helper->n_applies);
+
+    return FALSE;
 }
 
 
 
-static GdkFilterReturn
-xfce_displays_helper_screen_on_event (GdkXEvent *xevent,
-                                      GdkEvent  *event,
-                                      gpointer   data)
+static void
+xfce_displays_helper_screen_on_event (XfceDisplaysBackend     *backend,
+                                      const XfceDisplaysEvent *event,
+                                      gpointer                 data)
 {
     XfceDisplaysHelper *helper = XFCE_DISPLAYS_HELPER (data);
-    GPtrArray          *old_outputs;
-    XfceRRCrtc         *crtc = NULL;
-    XfceRROutput       *output, *o;
-    XEvent             *e = xevent;
-    gint                event_num;
-    guint               n, m, nactive = 0;
-    gboolean            found = FALSE, changed = FALSE;
 
-    if (!e)
-        return GDK_FILTER_CONTINUE;
+    switch (event->type)
+    {
+        case XFCE_DISPLAYS_EVENT_SCREEN:
+            xfsettings_dbg (XFSD_DEBUG_DISPLAYS, "RRScreenChangeNotify event received.");
+
+            /* outputs and CRTCs are updated by their own notifications,
+             * only renew the modes and the configuration timestamp */
+            xfce_displays_helper_refresh_resources (helper);
+
+            /* the burst is not over yet */
+            if (helper->settle_id != 0)
+                xfce_displays_helper_settle_queue (helper);
+            break;
+
+        case XFCE_DISPLAYS_EVENT_CRTC:
+            xfce_displays_helper_crtc_changed (helper, event);
+            break;
+
+        case XFCE_DISPLAYS_EVENT_OUTPUT:
+            xfce_displays_helper_output_changed (helper, event);
+            break;
+    }
+}
+
+
+
+static void
+xfce_displays_helper_query_size_range (XfceDisplaysHelper *helper)
+{
+    g_assert (XFCE_IS_DISPLAYS_HELPER (helper) && helper->backend);
+
+    /* get the screen size extremums, an apply does not need to ask */
+    if (!helper->backend->get_screen_size_range (helper->backend,
+                                                 &helper->min_width, &helper->min_height,
+                                                 &helper->max_width, &helper->max_height))
+    {
+        g_warning ("Unable to get the range of screen sizes. "
+                   "Display settings may fail to apply.");
+        helper->min_width = helper->min_height = G_MAXINT;
+        helper->max_width = helper->max_height = 0;
+        return;
+    }
+
+    xfsettings_dbg (XFSD_DEBUG_DISPLAYS, "min_h = %d, min_w = %d, max_h = %d, max_w = %d.",
+                    helper->min_height, helper->min_width,
+                    helper->max_height, helper->max_width);
+}
+
+
+
+static void
+xfce_displays_helper_index_modes (XfceDisplaysHelper *helper)
+{
+    gint m;
+
+    g_assert (XFCE_IS_DISPLAYS_HELPER (helper) && helper->resources);
+
+    /* the mode infos live in the screen resources */
+    g_hash_table_remove_all (helper->mode_index);
+    for (m = 0; m < helper->resources->nmode; ++m)
+        g_hash_table_insert (helper->mode_index,
+                             GUINT_TO_POINTER (helper->resources->modes[m].id),
+                             &helper->resources->modes[m]);
+}
+
+
+
+static gint64
+xfce_displays_helper_mode_key (gint    width,
+                               gint    height,
+                               gdouble rate)
+{
+    /* refresh rates are compared with one decimal, like the dialog */
+    return ((gint64) (width & 0xfffff) << 40)
+           | ((gint64) (height & 0xfffff) << 20)
+           | ((gint64) rint (rate * 10) & 0xfffff);
+}
+
+
+
+static void
+xfce_displays_helper_free_saved_output (XfceSavedOutput *saved)
+{
+    g_free (saved->name);
+    g_free (saved->resolution);
+    g_slice_free (XfceSavedOutput, saved);
+}
 
-    event_num = e->type - helper->event_base;
 
-    if (event_num == RRScreenChangeNotify)
+
+/* Group the properties of a scheme by output, so the outputs do not
+ * have to build and look up each of their property names. */
+static GHashTable *
+xfce_displays_helper_parse_scheme (const gchar *scheme,
+                                   GHashTable  *properties)
+{
+    GHashTable      *saved_outputs;
+    GHashTableIter   iter;
+    const gchar     *property, *name, *key, *str_value;
+    const GValue    *value;
+    gchar           *output_name, *end;
+    XfceSavedOutput *saved;
+    gsize            prefix_len;
+
+    saved_outputs = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+                                           (GDestroyNotify) xfce_displays_helper_free_saved_output);
+
+    /* properties are "/<scheme>/<output>[/<key>]" */
+    prefix_len = strlen (scheme) + 2;
+
+    g_hash_table_iter_init (&iter, properties);
+    while (g_hash_table_iter_next (&iter, (gpointer *) &property, (gpointer *) &value))
     {
-        xfsettings_dbg (XFSD_DEBUG_DISPLAYS, "RRScreenChangeNotify event received.");
+        if (strlen (property) <= prefix_len)
+            continue;
 
-        old_outputs = g_ptr_array_ref (helper->outputs);
-        xfce_displays_helper_reload (helper);
+        name = property + prefix_len;
+        if (strcmp (name, FINGERPRINT_PROP + 1) == 0)
+            continue;
+
+        key = strchr (name, '/');
+        if (key != NULL)
+            output_name = g_strndup (name, key - name);
+        else
+            output_name = g_strdup (name);
 
-        xfsettings_dbg (XFSD_DEBUG_DISPLAYS, "Noutput: before = %d, after = %d.",
-                        old_outputs->len, helper->outputs->len);
+        saved = g_hash_table_lookup (saved_outputs, output_name);
+        if (saved == NULL)
+        {
+            saved = g_slice_new0 (XfceSavedOutput);
+            saved->name = output_name;
+            saved->width = saved->height = -1;
+            saved->rotation = RR_Rotate_0;
+            g_hash_table_insert (saved_outputs, saved->name, saved);
+        }
+        else
+        {
+            g_free (output_name);
+        }
 
-        if (old_outputs->len > helper->outputs->len)
+        if (key == NULL)
+        {
+            /* the output exists in xfconf */
+            saved->exists = G_VALUE_HOLDS_STRING (value);
+        }
+        else if (strcmp (key, PRIMARY_PROP) == 0)
+        {
+            saved->primary = G_VALUE_HOLDS_BOOLEAN (value) && g_value_get_boolean (value);
+        }
+        else if (strcmp (key, ACTIVE_PROP) == 0)
         {
-            /* Diff the new and old output list to find removed outputs */
-            for (n = 0; n < old_outputs->len; ++n)
+            saved->has_active = G_VALUE_HOLDS_BOOLEAN (value);
+            saved->active = saved->has_active && g_value_get_boolean (value);
+        }
+        else if (strcmp (key, ROTATION_PROP) == 0)
+        {
+            /* convert to a Rotation */
+            switch (G_VALUE_HOLDS_INT (value) ? g_value_get_int (value) : 0)
             {
-                found = FALSE;
-                output = g_ptr_array_index (old_outputs, n);
-                for (m = 0; m < helper->outputs->len && !found; ++m)
-                {
-                    o = g_ptr_array_index (helper->outputs, m);
-                    found = o->id == output->id;
-                }
-                if (!found)
-                {
-                    xfsettings_dbg (XFSD_DEBUG_DISPLAYS, "Output disconnected: %s",
-                                    output->info->name);
-                    /* force deconfiguring the crtc for the removed output */
-                    if (output->info->crtc != None)
-                        crtc = xfce_displays_helper_find_crtc_by_id (helper,
-                                                                     output->info->crtc);
-                    if (crtc)
-                    {
-                        crtc->mode = None;
-                        xfce_displays_helper_disable_crtc (helper, crtc->id);
-                    }
-                    /* if the output was active, we must recalculate the screen size */
-                    changed |= output->active;
-                }
+                case 90:  saved->rotation = RR_Rotate_90;  break;
+                case 180: saved->rotation = RR_Rotate_180; break;
+                case 270: saved->rotation = RR_Rotate_270; break;
+                default:  saved->rotation = RR_Rotate_0;   break;
             }
+        }
+        else if (strcmp (key, REFLECTION_PROP) == 0)
+        {
+            str_value = G_VALUE_HOLDS_STRING (value) ? g_value_get_string (value) : "0";
+
+            /* convert to a Rotation */
+            if (g_strcmp0 (str_value, "X") == 0)
+                saved->reflection = RR_Reflect_X;
+            else if (g_strcmp0 (str_value, "Y") == 0)
+                saved->reflection = RR_Reflect_Y;
+            else if (g_strcmp0 (str_value, "XY") == 0)
+                saved->reflection = RR_Reflect_X|RR_Reflect_Y;
+            else
+                saved->reflection = 0;
+        }
+        else if (strcmp (key, RESOLUTION_PROP) == 0)
+        {
+            if (!G_VALUE_HOLDS_STRING (value) || g_value_get_string (value) == NULL)
+                continue;
 
-            /* Basically, this means the external output was disconnected,
-               so reenable the internal one if needed. */
-            for (n = 0; n < helper->outputs->len; ++n)
+            /* the display panel saves the mode as "<width>x<height>" */
+            g_free (saved->resolution);
+            saved->resolution = g_value_dup_string (value);
+
+            saved->width = g_ascii_strtoll (saved->resolution, &end, 10);
+            if (end != saved->resolution && *end == 'x')
             {
-                output = g_ptr_array_index (helper->outputs, n);
-                if (output->active)
-                    ++nactive;
+                str_value = end + 1;
+                saved->height = g_ascii_strtoll (str_value, &end, 10);
+                if (end == str_value || *end != '\0')
+                    saved->width = saved->height = -1;
             }
-            if (nactive == 0)
+            else
             {
-                xfsettings_dbg (XFSD_DEBUG_DISPLAYS, "No active output anymore! "
-                                "Attempting to re-enable the internal output.");
-                xfce_displays_helper_toggle_internal (NULL, FALSE, helper);
+                saved->width = -1;
             }
-            else if (changed)
-                xfce_displays_helper_apply_all (helper);
         }
-        else
+        else if (strcmp (key, RRATE_PROP) == 0)
         {
-            /* Diff the new and old output list to find new outputs */
-            for (n = 0; n < helper->outputs->len; ++n)
-            {
-                found = FALSE;
-                output = g_ptr_array_index (helper->outputs, n);
-                for (m = 0; m < old_outputs->len && !found; ++m)
-                {
-                    o = g_ptr_array_index (old_outputs, m);
-                    found = o->id == output->id;
-                }
-                if (!found)
-                {
-                    xfsettings_dbg (XFSD_DEBUG_DISPLAYS, "New output connected: %s",
-                                    output->info->name);
-                    changed = TRUE;
-                }
-            }
-            /* Start the minimal dialog according to the user preferences */
-            if (changed && xfconf_channel_get_bool (helper->channel, NOTIFY_PROP, FALSE))
-                xfce_spawn_command_line_on_screen (NULL, "xfce4-display-settings -m", FALSE,
-                                                   FALSE, NULL);
+            saved->rate = G_VALUE_HOLDS_DOUBLE (value) ? g_value_get_double (value) : 0.0;
+        }
+        else if (strcmp (key, POSX_PROP) == 0)
+        {
+            saved->x = G_VALUE_HOLDS_INT (value) ? g_value_get_int (value) : 0;
+        }
+        else if (strcmp (key, POSY_PROP) == 0)
+        {
+            saved->y = G_VALUE_HOLDS_INT (value) ? g_value_get_int (value) : 0;
         }
-        g_ptr_array_unref (old_outputs);
     }
 
-    /* Pass the event on to GTK+ */
-    return GDK_FILTER_CONTINUE;
+    return saved_outputs;
+}
+
+
+
+/* Parsed schemes are kept until one of their properties changes, so
+ * applying a scheme again does not talk to xfconfd. The returned
+ * table is owned by the cache. */
+static GHashTable *
+xfce_displays_helper_get_scheme (XfceDisplaysHelper *helper,
+                                 const gchar        *scheme)
+{
+    GHashTable *saved_outputs, *properties;
+    gchar       property[512];
+
+    saved_outputs = g_hash_table_lookup (helper->schemes, scheme);
+    if (saved_outputs != NULL)
+        return saved_outputs;
+
+    g_snprintf (property, sizeof (property), "/%s", scheme);
+    properties = xfconf_channel_get_properties (helper->channel, property);
+    if (properties != NULL)
+    {
+        saved_outputs = xfce_displays_helper_parse_scheme (scheme, properties);
+        g_hash_table_destroy (properties);
+    }
+    else
+    {
+        /* remember that nothing is saved */
+        saved_outputs = g_hash_table_new (g_str_hash, g_str_equal);
+    }
+
+    xfsettings_dbg (XFSD_DEBUG_DISPLAYS, "Parsed scheme %s with %u output(s).",
+                    scheme, g_hash_table_size (saved_outputs));
+
+    g_hash_table_insert (helper->schemes, g_strdup (scheme), saved_outputs);
+
+    return saved_outputs;
+}
+
+
+
+static guint64
+xfce_displays_helper_hash_bytes (guint64       hash,
+                                 gconstpointer data,
+                                 gsize         length)
+{
+    const guchar *bytes = data;
+    gsize         i;
+
+    /* FNV-1a */
+    for (i = 0; i < length; i++)
+    {
+        hash ^= bytes[i];
+        hash *= G_GUINT64_CONSTANT (1099511628211);
+    }
+
+    return hash;
+}
+
+
+
+static gint
+xfce_displays_helper_compare_hash (gconstpointer a,
+                                   gconstpointer b,
+                                   gpointer      user_data)
+{
+    guint64 hash_a = *(const guint64 *) a;
+    guint64 hash_b = *(const guint64 *) b;
+
+    return hash_a < hash_b ? -1 : (hash_a > hash_b ? 1 : 0);
+}
+
+
+
+/* The fingerprint of the connected monitors: the EDID of each monitor
+ * and the output it is plugged in, independent of the output order. */
+static gchar *
+xfce_displays_helper_fingerprint (XfceDisplaysHelper *helper)
+{
+    XfceRROutput *output;
+    guint64      *hashes;
+    guint64       hash;
+    guint         n;
+
+    hashes = g_new (guint64, MAX (helper->outputs->len, 1));
+    for (n = 0; n < helper->outputs->len; ++n)
+    {
+        output = g_ptr_array_index (helper->outputs, n);
+        hash = xfce_displays_helper_hash_bytes (G_GUINT64_CONSTANT (14695981039346656037),
+                                                output->info->name, strlen (output->info->name));
+        hashes[n] = xfce_displays_helper_hash_bytes (hash, &output->edid_hash,
+                                                     sizeof (output->edid_hash));
+    }
+    g_qsort_with_data (hashes, helper->outputs->len, sizeof (guint64),
+                       xfce_displays_helper_compare_hash, NULL);
+
+    hash = xfce_displays_helper_hash_bytes (G_GUINT64_CONSTANT (14695981039346656037),
+                                            hashes, helper->outputs->len * sizeof (guint64));
+    g_free (hashes);
+
+    return g_strdup_printf ("%016" G_GINT64_MODIFIER "x", hash);
+}
+
+
+
+/* Returns the scheme name if the property is "/<scheme>/Fingerprint" */
+static gchar *
+xfce_displays_helper_profile_scheme (const gchar *property)
+{
+    const gchar *end;
+
+    if (property[0] != '/')
+        return NULL;
+
+    end = strchr (property + 1, '/');
+    if (end == NULL || end == property + 1 || strcmp (end, FINGERPRINT_PROP) != 0)
+        return NULL;
+
+    return g_strndup (property + 1, end - property - 1);
+}
+
+
+
+static gboolean
+xfce_displays_helper_profile_remove (gpointer key,
+                                     gpointer value,
+                                     gpointer scheme)
+{
+    return g_strcmp0 (value, scheme) == 0;
+}
+
+
+
+/* Index the fingerprints of all schemes, afterwards the index follows
+ * the property-changed signal */
+static void
+xfce_displays_helper_load_profiles (XfceDisplaysHelper *helper)
+{
+    GHashTable     *properties;
+    GHashTableIter  iter;
+    gpointer        property, value;
+    gchar          *scheme;
+
+    properties = xfconf_channel_get_properties (helper->channel, NULL);
+    if (properties == NULL)
+        return;
+
+    g_hash_table_iter_init (&iter, properties);
+    while (g_hash_table_iter_next (&iter, &property, &value))
+    {
+        scheme = xfce_displays_helper_profile_scheme (property);
+        if (scheme == NULL)
+            continue;
+
+        if (G_VALUE_HOLDS_STRING (value) && g_value_get_string (value) != NULL)
+            g_hash_table_replace (helper->profiles, g_value_dup_string (value), scheme);
+        else
+            g_free (scheme);
+    }
+
+    g_hash_table_destroy (properties);
+
+    xfsettings_dbg (XFSD_DEBUG_DISPLAYS, "Found %u monitor profile(s).",
+                    g_hash_table_size (helper->profiles));
+}
+
+
+
+static const gchar *
+xfce_displays_helper_find_profile (XfceDisplaysHelper *helper)
+{
+    gchar       *fingerprint;
+    const gchar *scheme;
+
+    if (g_hash_table_size (helper->profiles) == 0)
+        return NULL;
+
+    fingerprint = xfce_displays_helper_fingerprint (helper);
+    scheme = g_hash_table_lookup (helper->profiles, fingerprint);
+
+    xfsettings_dbg (XFSD_DEBUG_DISPLAYS, "Monitors %s have %s.", fingerprint,
+                    scheme != NULL ? scheme : "no profile");
+
+    g_free (fingerprint);
+
+    return scheme;
+}
+
+
+
+/* Keep the MAX_PROFILES most recently saved profiles, the other
+ * profile schemes are removed from the channel */
+static void
+xfce_displays_helper_prune_profiles (XfceDisplaysHelper *helper,
+                                     const gchar        *saved)
+{
+    gchar          **order;
+    GPtrArray       *names;
+    GHashTable      *listed;
+    GHashTableIter   iter;
+    gpointer         profile;
+    gchar            property[512];
+    guint            n;
+
+    /* copies, the index changes when a profile is reset */
+    names = g_ptr_array_new_with_free_func (g_free);
+    listed = g_hash_table_new (g_str_hash, g_str_equal);
+
+    g_ptr_array_add (names, g_strdup (saved));
+    g_hash_table_insert (listed, (gpointer) saved, NULL);
+
+    /* the order of the previous saves */
+    order = xfconf_channel_get_string_list (helper->channel, PROFILES_PROP);
+    for (n = 0; order != NULL && order[n] != NULL; n++)
+    {
+        if (g_hash_table_lookup_extended (listed, order[n], NULL, NULL))
+            continue;
+
+        g_ptr_array_add (names, g_strdup (order[n]));
+        g_hash_table_insert (listed, order[n], NULL);
+    }
+
+    /* profiles missing in the order are the oldest */
+    g_hash_table_iter_init (&iter, helper->profiles);
+    while (g_hash_table_iter_next (&iter, NULL, &profile))
+    {
+        if (!g_str_has_prefix (profile, PROFILE_PREFIX)
+            || g_hash_table_lookup_extended (listed, profile, NULL, NULL))
+            continue;
+
+        g_ptr_array_add (names, g_strdup (profile));
+        g_hash_table_insert (listed, profile, NULL);
+    }
+
+    /* the index is not used anymore */
+    g_hash_table_destroy (listed);
+
+    for (n = MAX_PROFILES; n < names->len; n++)
+    {
+        xfsettings_dbg (XFSD_DEBUG_DISPLAYS, "Removing old profile %s.",
+                        (const gchar *) g_ptr_array_index (names, n));
+
+        g_snprintf (property, sizeof (property), "/%s",
+                    (const gchar *) g_ptr_array_index (names, n));
+        xfconf_channel_reset_property (helper->channel, property, TRUE);
+    }
+
+    g_ptr_array_set_size (names, MIN (names->len, MAX_PROFILES));
+    g_ptr_array_add (names, NULL);
+    xfconf_channel_set_string_list (helper->channel, PROFILES_PROP,
+                                    (const gchar * const *) names->pdata);
+
+    g_ptr_array_free (names, TRUE);
+    g_strfreev (order);
 }
 
 
 
+/* Copy a scheme the user applied to the profile of the connected
+ * monitors, so it is restored when they are connected again. */
 static void
-xfce_displays_helper_set_screen_size (XfceDisplaysHelper *helper)
+xfce_displays_helper_save_profile (XfceDisplaysHelper *helper,
+                                   const gchar        *scheme)
 {
-    gint min_width, min_height, max_width, max_height;
+    GHashTable     *properties;
+    GHashTableIter  iter;
+    gpointer        key, value;
+    gchar          *fingerprint;
+    gchar           prefix[512], property[512];
+    gsize           prefix_len;
+
+    /* profiles are only saved from user schemes */
+    if (g_str_has_prefix (scheme, PROFILE_PREFIX))
+        return;
+
+    prefix_len = g_snprintf (prefix, sizeof (prefix), "/%s", scheme);
+    properties = xfconf_channel_get_properties (helper->channel, prefix);
+    if (properties == NULL)
+        return;
+
+    fingerprint = xfce_displays_helper_fingerprint (helper);
 
-    g_assert (XFCE_IS_DISPLAYS_HELPER (helper) && helper->xdisplay && helper->resources);
+    /* drop what is left of an older layout of these monitors */
+    g_snprintf (prefix, sizeof (prefix), "/" PROFILE_PREFIX "%s", fingerprint);
+    xfconf_channel_reset_property (helper->channel, prefix, TRUE);
 
-    /* get the screen size extremums */
-    if (!XRRGetScreenSizeRange (helper->xdisplay, GDK_WINDOW_XID (helper->root_window),
-                                &min_width, &min_height, &max_width, &max_height))
+    g_hash_table_iter_init (&iter, properties);
+    while (g_hash_table_iter_next (&iter, &key, &value))
     {
-        g_warning ("Unable to get the range of screen sizes. "
-                   "Display settings may fail to apply.");
-        return;
+        if (strlen (key) <= prefix_len
+            || strcmp ((const gchar *) key + prefix_len, FINGERPRINT_PROP) == 0)
+            continue;
+
+        g_snprintf (property, sizeof (property), "%s%s", prefix,
+                    (const gchar *) key + prefix_len);
+        xfconf_channel_set_property (helper->channel, property, value);
     }
 
-    xfsettings_dbg (XFSD_DEBUG_DISPLAYS, "min_h = %d, min_w = %d, max_h = %d, max_w = %d, "
-                    "prev_h = %d, prev_w = %d, prev_hmm = %d, prev_wmm = %d, h = %d, w = %d, "
-                    "hmm = %d, wmm = %d.", min_height, min_width, max_height, max_width,
-                    gdk_screen_height (), gdk_screen_width (), gdk_screen_height_mm (),
-                    gdk_screen_width_mm (), helper->height, helper->width, helper->mm_height,
-                    helper->mm_width);
+    g_snprintf (property, sizeof (property), "%s" FINGERPRINT_PROP, prefix);
+    xfconf_channel_set_string (helper->channel, property, fingerprint);
 
-    /* set the screen size only if it's really needed and valid */
-    if (helper->width >= min_width && helper->width <= max_width
-        && helper->height >= min_height && helper->height <= max_height
-        && (helper->width != gdk_screen_width ()
-            || helper->height != gdk_screen_height ()
-            || helper->mm_width != gdk_screen_width_mm ()
-            || helper->mm_height != gdk_screen_height_mm ()))
-    {
-        xfsettings_dbg (XFSD_DEBUG_DISPLAYS, "Applying desktop dimensions: %dx%d (px), %dx%d (mm).",
-                        helper->width, helper->height, helper->mm_width, helper->mm_height);
-        XRRSetScreenSize (helper->xdisplay, GDK_WINDOW_XID (helper->root_window),
-                          helper->width, helper->height, helper->mm_width, helper->mm_height);
-    }
+    xfsettings_dbg (XFSD_DEBUG_DISPLAYS, "Saved scheme %s as profile %s.", scheme, prefix + 1);
+
+    xfce_displays_helper_prune_profiles (helper, prefix + 1);
+
+    g_hash_table_destroy (properties);
+    g_free (fingerprint);
 }
 
 
 
 static gboolean
 xfce_displays_helper_load_from_xfconf (XfceDisplaysHelper *helper,
-                                       const gchar        *scheme,
                                        GHashTable         *saved_outputs,
                                        XfceRROutput       *output)
 {
-    XfceRRCrtc  *crtc = NULL;
-    GValue      *value;
-    const gchar *str_value;
-    gchar        property[512];
-    gdouble      output_rate, rate;
-    RRMode       valid_mode;
-    Rotation     rot;
-    gint         x, y, n, m, int_value;
-    gboolean     active;
+    XfceRRCrtc      *crtc = NULL;
+    XfceSavedOutput *saved;
+    XfceDisplaysModeInfo *mode_info = NULL;
+    RRMode           valid_mode;
+    Rotation         rot;
+    gint64           key;
+    gboolean         active;
 
     g_assert (XFCE_IS_DISPLAYS_HELPER (helper) && helper->resources && output);
 
     active = output->active;
 
     /* does this output exist in xfconf? */
-    g_snprintf (property, sizeof (property), OUTPUT_FMT, scheme, output->info->name);
-    value = g_hash_table_lookup (saved_outputs, property);
+    saved = g_hash_table_lookup (saved_outputs, output->info->name);
 
-    if (value == NULL || !G_VALUE_HOLDS_STRING (value))
+    if (saved == NULL || !saved->exists)
         return active;
 
 #ifdef HAS_RANDR_ONE_POINT_THREE
-    if (helper->has_1_3)
-    {
-        /* is it the primary output? */
-        g_snprintf (property, sizeof (property), PRIMARY_PROP, scheme,
-                    output->info->name);
-        value = g_hash_table_lookup (saved_outputs, property);
-        if (G_VALUE_HOLDS_BOOLEAN (value) && g_value_get_boolean (value))
-            helper->primary = output->id;
-    }
+    /* is it the primary output? */
+    if (helper->has_1_3 && saved->primary)
+        helper->primary = output->id;
 #endif
 
     /* status */
-    g_snprintf (property, sizeof (property), ACTIVE_PROP, scheme, output->info->name);
-    value = g_hash_table_lookup (saved_outputs, property);
-
-    if (value == NULL || !G_VALUE_HOLDS_BOOLEAN (value))
+    if (!saved->has_active)
         return active;
 
     /* Get the associated CRTC */
@@ -605,7 +1458,7 @@ xfce_displays_helper_load_from_xfconf (XfceDisplaysHelper *helper,
         return active;
 
     /* disable inactive outputs */
-    if (!g_value_get_boolean (value))
+    if (!saved->active)
     {
         if (crtc->mode != None)
         {
@@ -620,38 +1473,8 @@ xfce_displays_helper_load_from_xfconf (XfceDisplaysHelper *helper,
         return active;
     }
 
-    /* rotation */
-    g_snprintf (property, sizeof (property), ROTATION_PROP, scheme, output->info->name);
-    value = g_hash_table_lookup (saved_outputs, property);
-    if (G_VALUE_HOLDS_INT (value))
-        int_value = g_value_get_int (value);
-    else
-        int_value = 0;
-
-    /* convert to a Rotation */
-    switch (int_value)
-    {
-        case 90:  rot = RR_Rotate_90;  break;
-        case 180: rot = RR_Rotate_180; break;
-        case 270: rot = RR_Rotate_270; break;
-        default:  rot = RR_Rotate_0;   break;
-    }
-
-    /* reflection */
-    g_snprintf (property, sizeof (property), REFLECTION_PROP, scheme, output->info->name);
-    value = g_hash_table_lookup (saved_outputs, property);
-    if (G_VALUE_HOLDS_STRING (value))
-        str_value = g_value_get_string (value);
-    else
-        str_value = "0";
-
-    /* convert to a Rotation */
-    if (g_strcmp0 (str_value, "X") == 0)
-        rot |= RR_Reflect_X;
-    else if (g_strcmp0 (str_value, "Y") == 0)
-        rot |= RR_Reflect_Y;
-    else if (g_strcmp0 (str_value, "XY") == 0)
-        rot |= (RR_Reflect_X|RR_Reflect_Y);
+    /* rotation and reflection */
+    rot = saved->rotation | saved->reflection;
 
     /* check rotation support */
     if ((crtc->rotations & rot) == 0)
@@ -667,60 +1490,23 @@ xfce_displays_helper_load_from_xfconf (XfceDisplaysHelper *helper,
         crtc->changed = TRUE;
     }
 
-    /* resolution */
-    g_snprintf (property, sizeof (property), RESOLUTION_PROP, scheme, output->info->name);
-    value = g_hash_table_lookup (saved_outputs, property);
-    if (value == NULL || !G_VALUE_HOLDS_STRING (value))
-        str_value = "";
-    else
-        str_value = g_value_get_string (value);
-
-    /* refresh rate */
-    g_snprintf (property, sizeof (property), RRATE_PROP, scheme, output->info->name);
-    value = g_hash_table_lookup (saved_outputs, property);
-    if (G_VALUE_HOLDS_DOUBLE (value))
-        output_rate = g_value_get_double (value);
-    else
-        output_rate = 0.0;
-
-    /* check mode validity */
+    /* check mode validity, the output indexes its modes by size and rate */
     valid_mode = None;
-    for (n = 0; n < output->info->nmode; ++n)
+    if (saved->width >= 0)
     {
-        /* walk all modes */
-        for (m = 0; m < helper->resources->nmode; ++m)
-        {
-            /* does the mode info match the mode we seek? */
-            if (helper->resources->modes[m].id != output->info->modes[n])
-                continue;
-
-            /* calculate the refresh rate */
-            rate = (gdouble) helper->resources->modes[m].dotClock /
-                    ((gdouble) helper->resources->modes[m].hTotal * (gdouble) helper->resources->modes[m].vTotal);
-
-            /* construct a string equivalent to the mode generated in displays */
-            /* property is the resources mode translated into display panel name */
-            g_snprintf (property, sizeof (property), "%dx%d", helper->resources->modes[m].width,
-                        helper->resources->modes[m].height);
-
-            /* find the mode corresponding to the saved values */
-            if (rint (rate * 10) == rint (output_rate * 10)
-                && (g_strcmp0 (property, str_value) == 0))
-            {
-                valid_mode = helper->resources->modes[m].id;
-                break;
-            }
-        }
-        /* found it */
+        key = xfce_displays_helper_mode_key (saved->width, saved->height, saved->rate);
+        valid_mode = GPOINTER_TO_UINT (g_hash_table_lookup (output->mode_lookup, &key));
         if (valid_mode != None)
-            break;
+            mode_info = g_hash_table_lookup (helper->mode_index, GUINT_TO_POINTER (valid_mode));
     }
 
-    if (valid_mode == None)
+    if (mode_info == NULL)
     {
         /* unsupported mode, abort for this output */
         g_warning ("Unknown mode '%s @ %.1f' for output %s, aborting.",
-                   str_value, output_rate, output->info->name);
+                   saved->resolution != NULL ? saved->resolution : "",
+                   saved->rate, output->info->name);
+        helper->apply_failed = TRUE;
         return active;
     }
     else if (crtc->mode != valid_mode)
@@ -736,38 +1522,20 @@ xfce_displays_helper_load_from_xfconf (XfceDisplaysHelper *helper,
     /* recompute dimensions according to the selected rotation */
     if ((crtc->rotation & (RR_Rotate_90|RR_Rotate_270)) != 0)
     {
-        crtc->width = helper->resources->modes[m].height;
-        crtc->height = helper->resources->modes[m].width;
+        crtc->width = mode_info->height;
+        crtc->height = mode_info->width;
     }
     else
     {
-        crtc->width = helper->resources->modes[m].width;
-        crtc->height = helper->resources->modes[m].height;
+        crtc->width = mode_info->width;
+        crtc->height = mode_info->height;
     }
 
-    /* position, x */
-    g_snprintf (property, sizeof (property), POSX_PROP, scheme,
-                output->info->name);
-    value = g_hash_table_lookup (saved_outputs, property);
-    if (G_VALUE_HOLDS_INT (value))
-        x = g_value_get_int (value);
-    else
-        x = 0;
-
-    /* position, y */
-    g_snprintf (property, sizeof (property), POSY_PROP, scheme,
-                output->info->name);
-    value = g_hash_table_lookup (saved_outputs, property);
-    if (G_VALUE_HOLDS_INT (value))
-        y = g_value_get_int (value);
-    else
-        y = 0;
-
     /* update CRTC position */
-    if (crtc->x != x || crtc->y != y)
+    if (crtc->x != saved->x || crtc->y != saved->y)
     {
-        crtc->x = x;
-        crtc->y = y;
+        crtc->x = saved->x;
+        crtc->y = saved->y;
         crtc->changed = TRUE;
     }
 
@@ -778,86 +1546,123 @@ xfce_displays_helper_load_from_xfconf (XfceDisplaysHelper *helper,
 
 
 
-static GPtrArray *
-xfce_displays_helper_list_outputs (XfceDisplaysHelper *helper)
+static XfceRROutput *
+xfce_displays_helper_get_output (XfceDisplaysHelper *helper,
+                                 RROutput            id)
 {
-    GPtrArray     *outputs;
-    XRROutputInfo *output_info;
-    XfceRROutput  *output;
-    XfceRRCrtc    *crtc;
-    gint           best_dist, dist, n, m, l, err;
+    XfceDisplaysOutputInfo *output_info;
+    XfceDisplaysModeInfo   *mode_info;
+    XfceRROutput           *output;
+    XfceRRCrtc             *crtc;
+    gint64                 *key;
+    gint                    best_dist, dist, l;
+    gint                    width, height, mm_width, mm_height;
+    guchar                 *edid;
+    gsize                   edid_length;
+
+    g_assert (XFCE_IS_DISPLAYS_HELPER (helper) && helper->backend && helper->resources);
+
+    output_info = helper->backend->get_output_info (helper->backend, helper->resources, id);
+    if (output_info == NULL)
+    {
+        g_warning ("Failed to load info for output %lu. Skipping.", id);
+        return NULL;
+    }
+
+    if (output_info->connection != RR_Connected)
+    {
+        xfce_displays_output_info_free (output_info);
+        return NULL;
+    }
 
-    g_assert (XFCE_IS_DISPLAYS_HELPER (helper) && helper->xdisplay && helper->resources);
+    output = g_new0 (XfceRROutput, 1);
+    output->id = id;
+    output->info = output_info;
+    output->mode_lookup = g_hash_table_new_full (g_int64_hash, g_int64_equal, g_free, NULL);
 
-    outputs = g_ptr_array_new ();
+    helper->backend->get_screen_size (helper->backend, &width, &height, &mm_width, &mm_height);
 
-    /* get all connected outputs */
-    outputs = g_ptr_array_new_with_free_func ((GDestroyNotify) xfce_displays_helper_free_output);
-    for (n = 0; n < helper->resources->noutput; ++n)
+    /* find the preferred mode and index the modes */
+    output->preferred_mode = None;
+    best_dist = 0;
+    for (l = 0; l < output->info->nmode; ++l)
     {
-        gdk_error_trap_push ();
-        output_info = XRRGetOutputInfo (helper->xdisplay, helper->resources, helper->resources->outputs[n]);
-        gdk_flush ();
-        err = gdk_error_trap_pop ();
-        if (err || !output_info)
-        {
-            g_warning ("Failed to load info for output %lu (err: %d). Skipping.",
-                       helper->resources->outputs[n], err);
+        mode_info = g_hash_table_lookup (helper->mode_index,
+                                         GUINT_TO_POINTER (output->info->modes[l]));
+        if (mode_info == NULL)
             continue;
-        }
 
-        if (output_info->connection != RR_Connected)
+        if (l < output->info->npreferred)
+            dist = 0;
+        else if (output->info->mm_height != 0)
+            dist = (1000 * height / MAX (mm_height, 1) -
+                    1000 * (gint) mode_info->height / (gint) output->info->mm_height);
+        else
+            dist = height - (gint) mode_info->height;
+
+        dist = ABS (dist);
+
+        if (output->preferred_mode == None || dist < best_dist)
         {
-            XRRFreeOutputInfo (output_info);
-            continue;
+            output->preferred_mode = mode_info->id;
+            best_dist = dist;
         }
 
-        output = g_new0 (XfceRROutput, 1);
-        output->id = helper->resources->outputs[n];
-        output->info = output_info;
+        /* the first mode with a size and rate wins, as the modes
+         * are sorted by preference */
+        key = g_new (gint64, 1);
+        *key = xfce_displays_helper_mode_key (mode_info->width, mode_info->height,
+                                              mode_info->rate);
+        if (g_hash_table_lookup (output->mode_lookup, key) == NULL)
+            g_hash_table_insert (output->mode_lookup, key, GUINT_TO_POINTER (mode_info->id));
+        else
+            g_free (key);
+    }
 
-        /* find the preferred mode */
-        output->preferred_mode = None;
-        best_dist = 0;
-        for (l = 0; l < output->info->nmode; ++l)
-        {
-            /* walk all modes */
-            for (m = 0; m < helper->resources->nmode; ++m)
-            {
-                /* does the mode info match the mode we seek? */
-                if (helper->resources->modes[m].id != output->info->modes[l])
-                    continue;
+    /* track active outputs */
+    crtc = xfce_displays_helper_find_crtc_by_id (helper, output->info->crtc);
+    output->active = crtc && crtc->mode != None;
 
-                if (l < output->info->npreferred)
-                    dist = 0;
-                else if (output->info->mm_height != 0)
-                    dist = (1000 * gdk_screen_height () / gdk_screen_height_mm () -
-                            1000 * helper->resources->modes[m].height / output->info->mm_height);
-                else
-                    dist = gdk_screen_height () - helper->resources->modes[m].height;
+    /* identify the monitor */
+    edid = helper->backend->get_edid (helper->backend, id, &edid_length);
+    if (edid != NULL)
+    {
+        output->edid_hash = xfce_displays_helper_hash_bytes (G_GUINT64_CONSTANT (14695981039346656037),
+                                                             edid, edid_length);
+        g_free (edid);
+    }
 
-                dist = ABS (dist);
+    /* Translate output->name into xfconf compatible format in place */
+    g_strcanon(output->info->name, "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_<>", '_');
 
-                if (output->preferred_mode == None || dist < best_dist)
-                {
-                    output->preferred_mode = helper->resources->modes[m].id;
-                    best_dist = dist;
-                }
-            }
-        }
+    xfsettings_dbg (XFSD_DEBUG_DISPLAYS, "Detected output %lu %s.", output->id,
+                    output->info->name);
 
-        /* track active outputs */
-        crtc = xfce_displays_helper_find_crtc_by_id (helper, output->info->crtc);
-        output->active = crtc && crtc->mode != None;
+    return output;
+}
 
-        /* Translate output->name into xfconf compatible format in place */
-        g_strcanon(output->info->name, "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_<>", '_');
 
-        xfsettings_dbg (XFSD_DEBUG_DISPLAYS, "Detected output %lu %s.", output->id,
-                        output->info->name);
+
+static GPtrArray *
+xfce_displays_helper_list_outputs (XfceDisplaysHelper *helper)
+{
+    GPtrArray    *outputs;
+    XfceRROutput *output;
+    gint          n;
+
+    g_assert (XFCE_IS_DISPLAYS_HELPER (helper) && helper->backend && helper->resources);
+
+    /* get all connected outputs */
+    outputs = g_ptr_array_new_with_free_func ((GDestroyNotify) xfce_displays_helper_free_output);
+    for (n = 0; n < helper->resources->noutput; ++n)
+    {
+        output = xfce_displays_helper_get_output (helper, helper->resources->outputs[n]);
+        if (output == NULL)
+            continue;
 
         /* cache it */
         g_ptr_array_add (outputs, output);
+        g_hash_table_insert (helper->output_index, GUINT_TO_POINTER (output->id), output);
     }
 
     return outputs;
@@ -871,14 +1676,79 @@ xfce_displays_helper_free_output (XfceRROutput *output)
     if (output == NULL)
         return;
 
-    gdk_error_trap_push ();
-    XRRFreeOutputInfo (output->info);
-    gdk_flush ();
-    if (gdk_error_trap_pop () != 0)
+    xfce_displays_output_info_free (output->info);
+    g_hash_table_destroy (output->mode_lookup);
+    g_free (output);
+}
+
+
+
+/* (Re)load a CRTC from the server, its cached changes are dropped */
+static gboolean
+xfce_displays_helper_load_crtc (XfceDisplaysHelper *helper,
+                                XfceRRCrtc         *crtc)
+{
+    XfceDisplaysCrtcInfo *crtc_info;
+
+    g_assert (XFCE_IS_DISPLAYS_HELPER (helper) && helper->backend && helper->resources && crtc);
+
+    crtc_info = helper->backend->get_crtc_info (helper->backend, helper->resources, crtc->id);
+    if (crtc_info == NULL)
     {
-        g_critical ("Failed to free output info");
+        g_warning ("Failed to load info for CRTC %lu. Skipping.", crtc->id);
+        return FALSE;
     }
-    g_free (output);
+
+    crtc->mode = crtc_info->mode;
+    crtc->rotation = crtc_info->rotation;
+    crtc->rotations = crtc_info->rotations;
+    crtc->width = crtc_info->width;
+    crtc->height = crtc_info->height;
+    crtc->x = crtc_info->x;
+    crtc->y = crtc_info->y;
+
+    g_free (crtc->outputs);
+    crtc->noutput = crtc_info->noutput;
+    crtc->outputs = NULL;
+    if (crtc_info->noutput > 0)
+        crtc->outputs = g_memdup (crtc_info->outputs,
+                                  crtc_info->noutput * sizeof (RROutput));
+
+    g_free (crtc->possible);
+    crtc->npossible = crtc_info->npossible;
+    crtc->possible = NULL;
+    if (crtc_info->npossible > 0)
+        crtc->possible = g_memdup (crtc_info->possible,
+                                   crtc_info->npossible * sizeof (RROutput));
+
+    crtc->changed = FALSE;
+    xfce_displays_crtc_info_free (crtc_info);
+
+    xfce_displays_helper_crtc_applied (crtc);
+
+    return TRUE;
+}
+
+
+
+/* The cached configuration of the CRTC is now the one on the server */
+static void
+xfce_displays_helper_crtc_applied (XfceRRCrtc *crtc)
+{
+    crtc->cur_mode = crtc->mode;
+    crtc->cur_rotation = crtc->rotation;
+    crtc->cur_width = crtc->width;
+    crtc->cur_height = crtc->height;
+    crtc->cur_x = crtc->x;
+    crtc->cur_y = crtc->y;
+
+    g_free (crtc->cur_outputs);
+    crtc->cur_noutput = crtc->noutput;
+    crtc->cur_outputs = NULL;
+    if (crtc->noutput > 0)
+        crtc->cur_outputs = g_memdup (crtc->outputs, crtc->noutput * sizeof (RROutput));
+
+    crtc->changed = FALSE;
 }
 
 
@@ -886,12 +1756,11 @@ xfce_displays_helper_free_output (XfceRROutput *output)
 static GPtrArray *
 xfce_displays_helper_list_crtcs (XfceDisplaysHelper *helper)
 {
-    GPtrArray   *crtcs;
-    XRRCrtcInfo *crtc_info;
-    XfceRRCrtc  *crtc;
-    gint         n, err;
+    GPtrArray  *crtcs;
+    XfceRRCrtc *crtc;
+    gint        n;
 
-    g_assert (XFCE_IS_DISPLAYS_HELPER (helper) && helper->xdisplay && helper->resources);
+    g_assert (XFCE_IS_DISPLAYS_HELPER (helper) && helper->backend && helper->resources);
 
     /* get all existing CRTCs */
     crtcs = g_ptr_array_new_with_free_func ((GDestroyNotify) xfce_displays_helper_free_crtc);
@@ -899,44 +1768,17 @@ xfce_displays_helper_list_crtcs (XfceDisplaysHelper *helper)
     {
         xfsettings_dbg (XFSD_DEBUG_DISPLAYS, "Detected CRTC %lu.", helper->resources->crtcs[n]);
 
-        gdk_error_trap_push ();
-        crtc_info = XRRGetCrtcInfo (helper->xdisplay, helper->resources, helper->resources->crtcs[n]);
-        gdk_flush ();
-        err = gdk_error_trap_pop ();
-        if (err || !crtc_info)
+        crtc = g_new0 (XfceRRCrtc, 1);
+        crtc->id = helper->resources->crtcs[n];
+        if (!xfce_displays_helper_load_crtc (helper, crtc))
         {
-            g_warning ("Failed to load info for CRTC %lu (err: %d). Skipping.",
-                       helper->resources->crtcs[n], err);
+            xfce_displays_helper_free_crtc (crtc);
             continue;
         }
 
-        crtc = g_new0 (XfceRRCrtc, 1);
-        crtc->id = helper->resources->crtcs[n];
-        crtc->mode = crtc_info->mode;
-        crtc->rotation = crtc_info->rotation;
-        crtc->rotations = crtc_info->rotations;
-        crtc->width = crtc_info->width;
-        crtc->height = crtc_info->height;
-        crtc->x = crtc_info->x;
-        crtc->y = crtc_info->y;
-
-        crtc->noutput = crtc_info->noutput;
-        crtc->outputs = NULL;
-        if (crtc_info->noutput > 0)
-            crtc->outputs = g_memdup (crtc_info->outputs,
-                                      crtc_info->noutput * sizeof (RROutput));
-
-        crtc->npossible = crtc_info->npossible;
-        crtc->possible = NULL;
-        if (crtc_info->npossible > 0)
-            crtc->possible = g_memdup (crtc_info->possible,
-                                       crtc_info->npossible * sizeof (RROutput));
-
-        crtc->changed = FALSE;
-        XRRFreeCrtcInfo (crtc_info);
-
         /* cache it */
         g_ptr_array_add (crtcs, crtc);
+        g_hash_table_insert (helper->crtc_index, GUINT_TO_POINTER (crtc->id), crtc);
     }
 
     return crtcs;
@@ -948,19 +1790,12 @@ static XfceRRCrtc *
 xfce_displays_helper_find_crtc_by_id (XfceDisplaysHelper *helper,
                                       RRCrtc              id)
 {
-    XfceRRCrtc *crtc;
-    guint       n;
-
     g_assert (XFCE_IS_DISPLAYS_HELPER (helper) && helper->crtcs);
 
-    for (n = 0; n < helper->crtcs->len; ++n)
-    {
-        crtc = g_ptr_array_index (helper->crtcs, n);
-        if (crtc->id == id)
-            return crtc;
-    }
+    if (id == None)
+        return NULL;
 
-    return NULL;
+    return g_hash_table_lookup (helper->crtc_index, GUINT_TO_POINTER (id));
 }
 
 
@@ -975,6 +1810,7 @@ xfce_displays_helper_free_crtc (XfceRRCrtc *crtc)
         g_free (crtc->outputs);
     if (crtc->possible != NULL)
         g_free (crtc->possible);
+    g_free (crtc->cur_outputs);
     g_free (crtc);
 }
 
@@ -1080,70 +1916,247 @@ xfce_displays_helper_normalize_crtc (XfceRRCrtc         *crtc,
 
 static Status
 xfce_displays_helper_disable_crtc (XfceDisplaysHelper *helper,
-                                   RRCrtc              crtc)
+                                   XfceRRCrtc         *crtc)
 {
-    g_assert (XFCE_IS_DISPLAYS_HELPER (helper) && helper->xdisplay && helper->resources);
+    Status ret;
+
+    g_assert (XFCE_IS_DISPLAYS_HELPER (helper) && helper->backend && helper->resources && crtc);
+
+    xfsettings_dbg (XFSD_DEBUG_DISPLAYS, "Disabling CRTC %lu.", crtc->id);
+
+    ret = helper->backend->set_crtc_config (helper->backend, helper->resources, crtc->id,
+                                            0, 0, None, RR_Rotate_0, NULL, 0);
 
-    xfsettings_dbg (XFSD_DEBUG_DISPLAYS, "Disabling CRTC %lu.", crtc);
+    if (ret == RRSetConfigSuccess)
+    {
+        crtc->cur_mode = None;
+        crtc->cur_width = crtc->cur_height = 0;
+        crtc->cur_noutput = 0;
+    }
+
+    return ret;
+}
+
+
+
+/* Whether the CRTC is configured on the server like in the cache */
+static gboolean
+xfce_displays_helper_crtc_is_current (XfceRRCrtc *crtc)
+{
+    if (crtc->mode != crtc->cur_mode)
+        return FALSE;
 
-    return XRRSetCrtcConfig (helper->xdisplay, helper->resources, crtc,
-                             CurrentTime, 0, 0, None, RR_Rotate_0, NULL, 0);
+    if (crtc->mode == None)
+        return TRUE;
+
+    return crtc->rotation == crtc->cur_rotation
+           && crtc->x == crtc->cur_x
+           && crtc->y == crtc->cur_y
+           && crtc->noutput == crtc->cur_noutput
+           && (crtc->noutput == 0
+               || memcmp (crtc->outputs, crtc->cur_outputs,
+                          crtc->noutput * sizeof (RROutput)) == 0);
 }
 
 
 
 static void
-xfce_displays_helper_workaround_crtc_size (XfceRRCrtc         *crtc,
-                                           XfceDisplaysHelper *helper)
+xfce_displays_helper_plan_add (GArray         *plan,
+                               XfceRRStepType  type,
+                               XfceRRCrtc     *crtc)
+{
+    XfceRRStep step;
+
+    step.type = type;
+    step.crtc = crtc;
+    g_array_append_val (plan, step);
+}
+
+
+
+/* Compute the requests to go from the configuration on the server to
+ * the one in the cache. CRTCs that are disabled or would not fit in the
+ * new screen are turned off first, then the screen is resized and the
+ * remaining CRTCs are set. CRTCs that end up unchanged are left alone.
+ */
+static GArray *
+xfce_displays_helper_plan (XfceDisplaysHelper *helper)
 {
-    XRRCrtcInfo *crtc_info;
+    GArray     *plan;
+    XfceRRCrtc *crtc;
+    guint       n;
+    gint        width, height, mm_width, mm_height;
+
+    g_assert (XFCE_IS_DISPLAYS_HELPER (helper) && helper->crtcs);
+
+    plan = g_array_new (FALSE, FALSE, sizeof (XfceRRStep));
+
+    for (n = 0; n < helper->crtcs->len; ++n)
+    {
+        crtc = g_ptr_array_index (helper->crtcs, n);
+        if (!crtc->changed)
+            continue;
+
+        if (xfce_displays_helper_crtc_is_current (crtc))
+        {
+            xfsettings_dbg (XFSD_DEBUG_DISPLAYS, "CRTC %lu is unchanged.", crtc->id);
+            crtc->changed = FALSE;
+            continue;
+        }
+
+        if (crtc->cur_mode != None
+            && (crtc->mode == None
+                || crtc->cur_x + crtc->cur_width > helper->width
+                || crtc->cur_y + crtc->cur_height > helper->height))
+            xfce_displays_helper_plan_add (plan, XFCE_RR_STEP_DISABLE_CRTC, crtc);
+    }
+
+    /* set the screen size only if it's really needed and valid */
+    helper->backend->get_screen_size (helper->backend, &width, &height, &mm_width, &mm_height);
+    if (helper->width >= helper->min_width && helper->width <= helper->max_width
+        && helper->height >= helper->min_height && helper->height <= helper->max_height
+        && (helper->width != width || helper->height != height
+            || helper->mm_width != mm_width || helper->mm_height != mm_height))
+        xfce_displays_helper_plan_add (plan, XFCE_RR_STEP_SCREEN_SIZE, NULL);
+
+    for (n = 0; n < helper->crtcs->len; ++n)
+    {
+        crtc = g_ptr_array_index (helper->crtcs, n);
+        if (crtc->changed && crtc->mode != None)
+            xfce_displays_helper_plan_add (plan, XFCE_RR_STEP_SET_CRTC, crtc);
+    }
+
+#ifdef HAS_RANDR_ONE_POINT_THREE
+    if (helper->has_1_3 && helper->primary != helper->cur_primary)
+        xfce_displays_helper_plan_add (plan, XFCE_RR_STEP_PRIMARY, NULL);
+#endif
+
+    return plan;
+}
+
+
 
-    g_assert (XFCE_IS_DISPLAYS_HELPER (helper) && helper->xdisplay && helper->resources && crtc);
+static void
+xfce_displays_helper_plan_print (XfceDisplaysHelper *helper,
+                                 GArray             *plan,
+                                 gboolean            dry_run)
+{
+    XfceRRStep *step;
+    gchar      *text;
+    guint       n;
 
-    /* The CRTC needs to be disabled if its previous mode won't fit in the new screen.
-       It will be reenabled with its new mode (known to fit) after the screen size is
-       changed, unless the user disabled it (no need to reenable it then). */
-    crtc_info = XRRGetCrtcInfo (helper->xdisplay, helper->resources, crtc->id);
-    if ((crtc_info->x + crtc_info->width > (guint) helper->width) ||
-        (crtc_info->y + crtc_info->height > (guint) helper->height))
+    for (n = 0; n < plan->len; ++n)
     {
-        xfsettings_dbg (XFSD_DEBUG_DISPLAYS, "CRTC %lu must be temporarily disabled.", crtc->id);
-        if (xfce_displays_helper_disable_crtc (helper, crtc->id) == RRSetConfigSuccess)
-            crtc->changed = (crtc->mode != None);
+        step = &g_array_index (plan, XfceRRStep, n);
+        switch (step->type)
+        {
+            case XFCE_RR_STEP_DISABLE_CRTC:
+                text = g_strdup_printf ("disable CRTC %lu", step->crtc->id);
+                break;
+
+            case XFCE_RR_STEP_SCREEN_SIZE:
+                text = g_strdup_printf ("set screen size %dx%d (%dx%d mm)",
+                                        helper->width, helper->height,
+                                        helper->mm_width, helper->mm_height);
+                break;
+
+            case XFCE_RR_STEP_SET_CRTC:
+                text = g_strdup_printf ("set CRTC %lu to mode %lu at %d,%d, rotation %d, "
+                                        "%d output(s)", step->crtc->id, step->crtc->mode,
+                                        step->crtc->x, step->crtc->y, step->crtc->rotation,
+                                        step->crtc->noutput);
+                break;
+
+#ifdef HAS_RANDR_ONE_POINT_THREE
+            case XFCE_RR_STEP_PRIMARY:
+                text = g_strdup_printf ("set primary output %d", helper->primary);
+                break;
+#endif
+
+            default:
+                g_assert_not_reached ();
+                continue;
+        }
+
+        if (dry_run)
+            g_message ("Display plan step %u: %s.", n + 1, text);
         else
-            g_warning ("Failed to temporarily disable CRTC %lu.", crtc->id);
+            xfsettings_dbg (XFSD_DEBUG_DISPLAYS, "Plan step %u: %s.", n + 1, text);
+
+        g_free (text);
     }
-    XRRFreeCrtcInfo (crtc_info);
 }
 
 
 
 static void
-xfce_displays_helper_apply_crtc (XfceRRCrtc         *crtc,
-                                 XfceDisplaysHelper *helper)
+xfce_displays_helper_plan_run (XfceDisplaysHelper *helper,
+                               GArray             *plan)
 {
-    Status ret;
+    XfceRRStep *step;
+    XfceRRCrtc *crtc;
+    guint       n;
 
-    g_assert (XFCE_IS_DISPLAYS_HELPER (helper) && helper->xdisplay && helper->resources && crtc);
+    g_assert (XFCE_IS_DISPLAYS_HELPER (helper) && helper->backend && helper->resources);
 
-    xfsettings_dbg (XFSD_DEBUG_DISPLAYS, "Configuring CRTC %lu.", crtc->id);
+    /* grab server to prevent clients from thinking no output is enabled */
+    helper->backend->grab (helper->backend);
 
-    /* check if we really need to do something */
-    if (crtc->changed)
+    for (n = 0; n < plan->len; ++n)
     {
-        xfsettings_dbg (XFSD_DEBUG_DISPLAYS, "Applying changes to CRTC %lu.", crtc->id);
+        step = &g_array_index (plan, XfceRRStep, n);
+        crtc = step->crtc;
 
-        if (crtc->mode == None)
-            ret = xfce_displays_helper_disable_crtc (helper, crtc->id);
-        else
-            ret = XRRSetCrtcConfig (helper->xdisplay, helper->resources, crtc->id,
-                                    CurrentTime, crtc->x, crtc->y, crtc->mode,
-                                    crtc->rotation, crtc->outputs, crtc->noutput);
+        switch (step->type)
+        {
+            case XFCE_RR_STEP_DISABLE_CRTC:
+                if (xfce_displays_helper_disable_crtc (helper, crtc) != RRSetConfigSuccess)
+                {
+                    g_warning ("Failed to disable CRTC %lu.", crtc->id);
+                    helper->apply_failed = TRUE;
+                }
+                else if (crtc->mode == None)
+                    crtc->changed = FALSE;
+                break;
 
-        if (ret == RRSetConfigSuccess)
-            crtc->changed = FALSE;
-        else
-            g_warning ("Failed to configure CRTC %lu.", crtc->id);
+            case XFCE_RR_STEP_SCREEN_SIZE:
+                helper->backend->set_screen_size (helper->backend,
+                                                  helper->width, helper->height,
+                                                  helper->mm_width, helper->mm_height);
+                break;
+
+            case XFCE_RR_STEP_SET_CRTC:
+                if (helper->backend->set_crtc_config (helper->backend, helper->resources,
+                                                      crtc->id, crtc->x, crtc->y, crtc->mode,
+                                                      crtc->rotation, crtc->outputs,
+                                                      crtc->noutput) == RRSetConfigSuccess)
+                {
+                    xfce_displays_helper_crtc_applied (crtc);
+                }
+                else
+                {
+                    g_warning ("Failed to configure CRTC %lu.", crtc->id);
+                    helper->apply_failed = TRUE;
+                }
+                break;
+
+#ifdef HAS_RANDR_ONE_POINT_THREE
+            case XFCE_RR_STEP_PRIMARY:
+                helper->backend->set_output_primary (helper->backend, helper->primary);
+                helper->cur_primary = helper->primary;
+                break;
+#endif
+
+            default:
+                g_assert_not_reached ();
+        }
+    }
+
+    /* release the grab, changes are done */
+    if (!helper->backend->ungrab (helper->backend))
+    {
+        g_critical ("Failed to apply display settings");
+        helper->apply_failed = TRUE;
     }
 }
 
@@ -1188,8 +2201,19 @@ xfce_displays_helper_set_outputs (XfceRRCrtc   *crtc,
 static void
 xfce_displays_helper_apply_all (XfceDisplaysHelper *helper)
 {
+    GArray *plan;
+    guint   n, nrequests;
+    gint64  start;
+
     g_assert (XFCE_IS_DISPLAYS_HELPER (helper) && helper->crtcs);
 
+    start = g_get_monotonic_time ();
+    nrequests = helper->backend->n_requests;
+
+    helper->n_applies++;
+    xfsettings_dbg (XFSD_DEBUG_DISPLAYS, "Applying the configuration (%u applies so far).",
+                    helper->n_applies);
+
     helper->mm_width = helper->mm_height = helper->width = helper->height = 0;
     helper->min_x = helper->min_y = 32768;
 
@@ -1197,63 +2221,57 @@ xfce_displays_helper_apply_all (XfceDisplaysHelper *helper)
     g_ptr_array_foreach (helper->crtcs, (GFunc) xfce_displays_helper_get_topleftmost_pos, helper);
     g_ptr_array_foreach (helper->crtcs, (GFunc) xfce_displays_helper_normalize_crtc, helper);
 
-    gdk_error_trap_push ();
-
-    /* grab server to prevent clients from thinking no output is enabled */
-    gdk_x11_display_grab (helper->display);
-
-    /* disable CRTCs that won't fit in the new screen */
-    g_ptr_array_foreach (helper->crtcs, (GFunc) xfce_displays_helper_workaround_crtc_size, helper);
-
-    /* set the screen size only if it's really needed and valid */
-    xfce_displays_helper_set_screen_size (helper);
-
-    /* final loop, apply crtc changes */
-    g_ptr_array_foreach (helper->crtcs, (GFunc) xfce_displays_helper_apply_crtc, helper);
-
-#ifdef HAS_RANDR_ONE_POINT_THREE
-        if (helper->has_1_3)
-            XRRSetOutputPrimary (helper->xdisplay, GDK_WINDOW_XID (helper->root_window),
-                                 helper->primary);
-#endif
+    plan = xfce_displays_helper_plan (helper);
+    xfce_displays_helper_plan_print (helper, plan, helper->dry_run);
 
-    /* release the grab, changes are done */
-    gdk_x11_display_ungrab (helper->display);
-    gdk_flush ();
-    if (gdk_error_trap_pop () != 0)
+    if (helper->dry_run)
     {
-        g_critical ("Failed to apply display settings");
+        /* forget the changes, the cache follows the server */
+        for (n = 0; n < helper->crtcs->len; ++n)
+            xfce_displays_helper_load_crtc (helper, g_ptr_array_index (helper->crtcs, n));
     }
+    else
+    {
+        xfce_displays_helper_plan_run (helper, plan);
+    }
+
+    xfsettings_dbg (XFSD_DEBUG_DISPLAYS, "Apply took %.2f ms and %u %s requests.",
+                    (g_get_monotonic_time () - start) / 1000.0,
+                    helper->backend->n_requests - nrequests, helper->backend->name);
+
+    g_array_free (plan, TRUE);
 }
 
 
 
-static void
+/* Returns TRUE if the scheme was applied without errors */
+static gboolean
 xfce_displays_helper_channel_apply (XfceDisplaysHelper *helper,
                                     const gchar        *scheme)
 {
-    gchar       property[512];
     guint       n, nactive;
     GHashTable *saved_outputs;
 
-    saved_outputs = NULL;
 #ifdef HAS_RANDR_ONE_POINT_THREE
     helper->primary = None;
 #endif
+    helper->apply_failed = FALSE;
 
-    /* finally the list of saved outputs from xfconf */
-    g_snprintf (property, sizeof (property), "/%s", scheme);
-    saved_outputs = xfconf_channel_get_properties (helper->channel, property);
+    /* finally the list of saved outputs, held while the scheme is applied */
+    saved_outputs = g_hash_table_ref (xfce_displays_helper_get_scheme (helper, scheme));
 
     /* nothing saved, nothing to do */
-    if (saved_outputs == NULL)
+    if (g_hash_table_size (saved_outputs) == 0)
+    {
+        helper->apply_failed = TRUE;
         goto err_cleanup;
+    }
 
     /* first loop, loads all the outputs, and gets the number of active ones */
     nactive = 0;
     for (n = 0; n < helper->outputs->len; ++n)
     {
-        if (xfce_displays_helper_load_from_xfconf (helper, scheme, saved_outputs,
+        if (xfce_displays_helper_load_from_xfconf (helper, saved_outputs,
                                                    g_ptr_array_index (helper->outputs,
                                                                       n)))
             ++nactive;
@@ -1265,6 +2283,7 @@ xfce_displays_helper_channel_apply (XfceDisplaysHelper *helper,
     if (nactive == 0)
     {
         g_critical ("Stored Xfconf properties disable all outputs, aborting.");
+        helper->apply_failed = TRUE;
         goto err_cleanup;
     }
 
@@ -1272,9 +2291,9 @@ xfce_displays_helper_channel_apply (XfceDisplaysHelper *helper,
     xfce_displays_helper_apply_all (helper);
 
 err_cleanup:
-    /* Free the xfconf properties */
-    if (saved_outputs)
-        g_hash_table_destroy (saved_outputs);
+    g_hash_table_unref (saved_outputs);
+
+    return !helper->apply_failed;
 }
 
 
@@ -1285,11 +2304,44 @@ xfce_displays_helper_channel_property_changed (XfconfChannel      *channel,
                                                const GValue       *value,
                                                XfceDisplaysHelper *helper)
 {
+    const gchar *end;
+    gchar       *scheme;
+
+    /* update the profile index */
+    scheme = xfce_displays_helper_profile_scheme (property_name);
+    if (scheme != NULL)
+    {
+        g_hash_table_foreach_remove (helper->profiles, xfce_displays_helper_profile_remove, scheme);
+        if (G_VALUE_HOLDS_STRING (value) && g_value_get_string (value) != NULL)
+            g_hash_table_replace (helper->profiles, g_value_dup_string (value), scheme);
+        else
+            g_free (scheme);
+    }
+
+    /* drop the parsed scheme the property belongs to */
+    if (property_name[0] == '/')
+    {
+        end = strchr (property_name + 1, '/');
+        scheme = end != NULL ? g_strndup (property_name + 1, end - property_name - 1)
+                             : g_strdup (property_name + 1);
+        if (g_hash_table_remove (helper->schemes, scheme))
+            xfsettings_dbg (XFSD_DEBUG_DISPLAYS, "Scheme %s changed.", scheme);
+        g_free (scheme);
+    }
+
+    if (g_strcmp0 (property_name, NOTIFY_PROP) == 0)
+        helper->notify = G_VALUE_HOLDS_BOOLEAN (value) && g_value_get_boolean (value);
+    else if (g_strcmp0 (property_name, DRY_RUN_PROP) == 0)
+        helper->dry_run = G_VALUE_HOLDS_BOOLEAN (value) && g_value_get_boolean (value);
+
     if (G_UNLIKELY (G_VALUE_HOLDS_STRING (value) &&
         g_strcmp0 (property_name, APPLY_SCHEME_PROP) == 0))
     {
-        /* apply */
-        xfce_displays_helper_channel_apply (helper, g_value_get_string (value));
+        /* apply, and remember a working choice for these monitors */
+        if (xfce_displays_helper_channel_apply (helper, g_value_get_string (value))
+            && !helper->dry_run)
+            xfce_displays_helper_save_profile (helper, g_value_get_string (value));
+
         /* remove the apply property */
         xfconf_channel_reset_property (channel, APPLY_SCHEME_PROP, FALSE);
     }
@@ -1305,9 +2357,9 @@ xfce_displays_helper_toggle_internal (gpointer           *power,
     GHashTable    *saved_outputs;
     XfceRRCrtc    *crtc = NULL;
     XfceRROutput  *output, *lvds = NULL;
+    XfceDisplaysModeInfo *mode_info;
     gboolean       active = FALSE;
     guint          n;
-    gint           m;
 
     for (n = 0; n < helper->outputs->len; ++n)
     {
@@ -1343,8 +2395,8 @@ xfce_displays_helper_toggle_internal (gpointer           *power,
     else if (!lvds->active && !lid_is_closed)
     {
         /* re-activate it because the user opened the lid */
-        saved_outputs = xfconf_channel_get_properties (helper->channel, "/" DEFAULT_SCHEME_NAME);
-        if (saved_outputs)
+        saved_outputs = g_hash_table_ref (xfce_displays_helper_get_scheme (helper, DEFAULT_SCHEME_NAME));
+        if (g_hash_table_size (saved_outputs) > 0)
         {
             /* first, ensure the position of the other outputs is correct */
             for (n = 0; n < helper->outputs->len; ++n)
@@ -1355,15 +2407,13 @@ xfce_displays_helper_toggle_internal (gpointer           *power,
                 if (output->id == lvds->id)
                     continue;
 
-                xfce_displays_helper_load_from_xfconf (helper, DEFAULT_SCHEME_NAME,
-                                                       saved_outputs, output);
+                xfce_displays_helper_load_from_xfconf (helper, saved_outputs, output);
             }
 
             /* try to load user saved settings for lvds */
-            active = xfce_displays_helper_load_from_xfconf (helper, DEFAULT_SCHEME_NAME,
-                                                            saved_outputs, lvds);
-            g_hash_table_destroy (saved_outputs);
+            active = xfce_displays_helper_load_from_xfconf (helper, saved_outputs, lvds);
         }
+        g_hash_table_unref (saved_outputs);
         if (!active)
         {
             /* autoset the preferred mode */
@@ -1374,14 +2424,12 @@ xfce_displays_helper_toggle_internal (gpointer           *power,
             crtc->rotation = RR_Rotate_0;
             crtc->x = crtc->y = 0;
             /* set width and height */
-            for (m = 0; m < helper->resources->nmode; ++m)
+            mode_info = g_hash_table_lookup (helper->mode_index,
+                                             GUINT_TO_POINTER (lvds->preferred_mode));
+            if (mode_info != NULL)
             {
-                if (helper->resources->modes[m].id == lvds->preferred_mode)
-                {
-                    crtc->width = helper->resources->modes[m].width;
-                    crtc->height = helper->resources->modes[m].height;
-                    break;
-                }
+                crtc->width = mode_info->width;
+                crtc->height = mode_info->height;
             }
             xfce_displays_helper_set_outputs (crtc, lvds);
             crtc->changed = TRUE;
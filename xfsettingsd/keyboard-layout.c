@@ -30,6 +30,7 @@
 
 #include <X11/Xlib.h>
 #include <X11/XKBlib.h>
+#include <X11/extensions/XInput.h>
 
 #include <glib.h>
 #include <gtk/gtk.h>
@@ -42,6 +43,7 @@
 #endif /* HAVE_LIBXKLAVIER */
 
 #include "debug.h"
+#include "dispatcher.h"
 #include "keyboard-layout.h"
 
 static void xfce_keyboard_layout_helper_finalize                  (GObject                       *object);
@@ -63,6 +65,8 @@ static gchar* xfce_keyboard_layout_get_option                     (gchar
 static GdkFilterReturn handle_xevent                              (GdkXEvent                     *xev,
                                                                    GdkEvent                      *event,
                                                                    XfceKeyboardLayoutHelper      *helper);
+static void xfce_keyboard_layout_helper_dispatch                  (XfceKeyboardLayoutHelper      *helper,
+                                                                   gboolean                       add);
 static void xfce_keyboard_layout_reset_xkl_config                 (XklEngine                     *xklengine,
                                                                    XfceKeyboardLayoutHelper      *helper);
 #endif /* HAVE_LIBXKLAVIER */
@@ -121,7 +125,7 @@ xfce_keyboard_layout_helper_init (XfceKeyboardLayoutHelper *helper)
     xkl_config_rec_get_from_server (helper->config, helper->engine);
     helper->system_keyboard_model = g_strdup (helper->config->model);
 
-    gdk_window_add_filter (NULL, (GdkFilterFunc) handle_xevent, helper);
+    xfce_keyboard_layout_helper_dispatch (helper, TRUE);
     g_signal_connect (helper->engine, "X-new-device",
                       G_CALLBACK (xfce_keyboard_layout_reset_xkl_config), helper);
     xkl_engine_start_listen (helper->engine, XKLL_TRACK_KEYBOARD_STATE);
@@ -144,7 +148,7 @@ xfce_keyboard_layout_helper_finalize (GObject *object)
     XfceKeyboardLayoutHelper *helper = XFCE_KEYBOARD_LAYOUT_HELPER (object);
 
     xkl_engine_stop_listen (helper->engine, XKLL_TRACK_KEYBOARD_STATE);
-    gdk_window_remove_filter (NULL, (GdkFilterFunc) handle_xevent, helper);
+    xfce_keyboard_layout_helper_dispatch (helper, FALSE);
     g_object_unref (helper->config);
     g_object_unref (helper->engine);
     g_free (helper->system_keyboard_model);
@@ -415,6 +419,67 @@ handle_xevent (GdkXEvent * xev, GdkEvent * event, XfceKeyboardLayoutHelper *help
     return GDK_FILTER_CONTINUE;
 }
 
+static void
+xfce_keyboard_layout_helper_dispatch_type (XfceKeyboardLayoutHelper *helper,
+                                           gint                      event_type,
+                                           gboolean                  add)
+{
+    if (add)
+        xfsettings_dispatcher_add (event_type, (GdkFilterFunc) handle_xevent, helper);
+    else
+        xfsettings_dispatcher_remove (event_type, (GdkFilterFunc) handle_xevent, helper);
+}
+
+/* The events xkl_engine_filter_events handles, it used to get every
+ * event of the display:
+ *  - the core events below, to track the focus and the windows for
+ *    the per window layouts and the keymap changes;
+ *  - all xkb events (they share the xkb event base), for the group
+ *    and indicator state and new keyboard descriptions;
+ *  - the XInput DevicePresenceNotify event, libxklavier emits
+ *    "X-new-device" on it, so a hotplugged keyboard gets the layout
+ *    and model again */
+static void
+xfce_keyboard_layout_helper_dispatch (XfceKeyboardLayoutHelper *helper,
+                                      gboolean                  add)
+{
+    static const gint event_types[] =
+    {
+        FocusIn, FocusOut, PropertyNotify, CreateNotify, DestroyNotify,
+        UnmapNotify, MapNotify, ReparentNotify, GravityNotify, MappingNotify
+    };
+    gint               dummy, xkb_event_type = 0;
+    guint              i;
+    XExtensionVersion *version;
+#ifdef DevicePresence
+    gint               device_presence_event_type = 0;
+    XEventClass        event_class;
+#endif
+
+    for (i = 0; i < G_N_ELEMENTS (event_types); i++)
+        xfce_keyboard_layout_helper_dispatch_type (helper, event_types[i], add);
+
+    if (XkbQueryExtension (GDK_DISPLAY (), &dummy, &xkb_event_type, &dummy, &dummy, &dummy))
+        xfce_keyboard_layout_helper_dispatch_type (helper, xkb_event_type, add);
+
+    /* the device presence event needs XI 1.4, libxklavier selects it */
+    version = XGetExtensionVersion (GDK_DISPLAY (), INAME);
+    if (version != NULL && ((long) version) != NoSuchExtension)
+    {
+#ifdef DevicePresence
+        if (version->present
+            && (version->major_version > 1
+                || (version->major_version == 1 && version->minor_version >= 4)))
+        {
+            DevicePresence (GDK_DISPLAY (), device_presence_event_type, event_class);
+            if (device_presence_event_type > 0)
+                xfce_keyboard_layout_helper_dispatch_type (helper, device_presence_event_type, add);
+        }
+#endif
+        XFree (version);
+    }
+}
+
 static void
 xfce_keyboard_layout_reset_xkl_config (XklEngine *xklengine,
                                        XfceKeyboardLayoutHelper *helper)
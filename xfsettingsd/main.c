@@ -50,6 +50,7 @@
 #include <libxfce4ui/libxfce4ui.h>
 
 #include "debug.h"
+#include "dispatcher.h"
 #include "accessibility.h"
 #include "pointers.h"
 #include "keyboards.h"
@@ -65,10 +66,55 @@
 #endif
 
 #define XFSETTINGS_DBUS_NAME    "org.xfce.SettingsDaemon"
+#define XFSETTINGS_DBUS_PATH    "/org/xfce/SettingsDaemon"
 #define XFSETTINGS_DESKTOP_FILE (SYSCONFIGDIR "/xdg/autostart/xfsettingsd.desktop")
 
 
+typedef struct
+{
+    const gchar *name;
+    GType      (*get_type) (void);
+    GObject     *object;
+}
+XfsdHelper;
+
+typedef struct
+{
+    const gchar *name;
+
+    /* monotonic time in usec, since the start of the daemon */
+    gint64       start;
+    gint64       duration;
+}
+XfsdStartupSpan;
+
+
+
 static XfceSMClient *sm_client = NULL;
+static GObject      *clipboard_daemon = NULL;
+
+static gint64  startup_time = 0;
+static GArray *startup_spans = NULL;
+
+/* All helpers are constructed at startup, each of them has to act at
+ * login: the displays, pointers, keyboards, accessibility and layout
+ * helpers restore X and device state, keyboard-shortcuts grabs the
+ * keys, workspaces sets the names and decorations syncs the button
+ * layout. The clipboard manager has to own CLIPBOARD_MANAGER before
+ * the first client exits, so it cannot wait either. */
+static XfsdHelper helpers[] =
+{
+#ifdef HAVE_XRANDR
+    { "displays", xfce_displays_helper_get_type, NULL },
+#endif
+    { "pointers", xfce_pointers_helper_get_type, NULL },
+    { "keyboards", xfce_keyboards_helper_get_type, NULL },
+    { "accessibility", xfce_accessibility_helper_get_type, NULL },
+    { "keyboard-shortcuts", xfce_keyboard_shortcuts_helper_get_type, NULL },
+    { "keyboard-layout", xfce_keyboard_layout_helper_get_type, NULL },
+    { "workspaces", xfce_workspaces_helper_get_type, NULL },
+    { "decorations", xfce_decorations_helper_get_type, NULL },
+};
 
 static gboolean opt_version = FALSE;
 static gboolean opt_no_daemon = FALSE;
@@ -87,12 +133,273 @@ static void
 signal_handler (gint signum,
                 gpointer user_data)
 {
+    /* dump the debug log */
+    if (signum == SIGUSR1)
+    {
+        xfsettings_dbg_dump ();
+        return;
+    }
+
     /* quit the main loop */
     gtk_main_quit ();
 }
 
 
 
+static gint64
+startup_span_begin (void)
+{
+    return g_get_monotonic_time ();
+}
+
+
+
+static void
+startup_span_end (const gchar *name,
+                  gint64       start)
+{
+    XfsdStartupSpan span;
+
+    span.name = name;
+    span.start = start - startup_time;
+    span.duration = g_get_monotonic_time () - start;
+
+    g_array_append_val (startup_spans, span);
+
+    xfsettings_dbg (XFSD_DEBUG_STARTUP, "%s started in %.1f ms (at %.1f ms)",
+                    name, span.duration / 1000.0, span.start / 1000.0);
+}
+
+
+
+static void
+helper_construct (XfsdHelper *helper)
+{
+    gint64 start;
+
+    g_return_if_fail (helper->object == NULL);
+
+    start = startup_span_begin ();
+    helper->object = g_object_new (helper->get_type (), NULL);
+    startup_span_end (helper->name, start);
+}
+
+
+
+static void
+dbus_debug_log_append (gint64       time,
+                       const gchar *domain_name,
+                       const gchar *message,
+                       gpointer     user_data)
+{
+    DBusMessageIter *array = user_data;
+    DBusMessageIter  item;
+    dbus_uint64_t    usec = time;
+
+    dbus_message_iter_open_container (array, DBUS_TYPE_STRUCT, NULL, &item);
+    dbus_message_iter_append_basic (&item, DBUS_TYPE_UINT64, &usec);
+    dbus_message_iter_append_basic (&item, DBUS_TYPE_STRING, &domain_name);
+    dbus_message_iter_append_basic (&item, DBUS_TYPE_STRING, &message);
+    dbus_message_iter_close_container (array, &item);
+}
+
+
+
+static void
+dbus_dict_append_double (DBusMessageIter *array,
+                         const gchar     *key,
+                         gdouble          value)
+{
+    DBusMessageIter entry;
+
+    dbus_message_iter_open_container (array, DBUS_TYPE_DICT_ENTRY, NULL, &entry);
+    dbus_message_iter_append_basic (&entry, DBUS_TYPE_STRING, &key);
+    dbus_message_iter_append_basic (&entry, DBUS_TYPE_DOUBLE, &value);
+    dbus_message_iter_close_container (array, &entry);
+}
+
+
+
+static void
+dbus_clipboard_history_append (guint        id,
+                               gint64       time,
+                               const gchar *preview,
+                               gsize        size,
+                               gpointer     user_data)
+{
+    DBusMessageIter *array = user_data;
+    DBusMessageIter  item;
+    dbus_uint32_t    entry_id = id;
+    dbus_int64_t     usec = time;
+    dbus_uint64_t    bytes = size;
+
+    dbus_message_iter_open_container (array, DBUS_TYPE_STRUCT, NULL, &item);
+    dbus_message_iter_append_basic (&item, DBUS_TYPE_UINT32, &entry_id);
+    dbus_message_iter_append_basic (&item, DBUS_TYPE_INT64, &usec);
+    dbus_message_iter_append_basic (&item, DBUS_TYPE_STRING, &preview);
+    dbus_message_iter_append_basic (&item, DBUS_TYPE_UINT64, &bytes);
+    dbus_message_iter_close_container (array, &item);
+}
+
+
+
+static DBusHandlerResult
+dbus_object_message_func (DBusConnection *connection,
+                          DBusMessage    *message,
+                          void           *user_data)
+{
+    DBusMessage       *reply;
+    DBusMessageIter    iter, array, item;
+    XfsdStartupSpan   *span;
+    dbus_uint64_t      start, duration;
+    guint              i;
+    GsdClipboardStats  stats;
+    dbus_uint32_t      entry_id;
+    dbus_bool_t        restored, enabled;
+
+    if (dbus_message_is_method_call (message, XFSETTINGS_DBUS_NAME, "GetStartupTimes"))
+    {
+        /* array of (helper name, start, duration) in usec */
+        reply = dbus_message_new_method_return (message);
+        dbus_message_iter_init_append (reply, &iter);
+        dbus_message_iter_open_container (&iter, DBUS_TYPE_ARRAY, "(stt)", &array);
+
+        for (i = 0; i < startup_spans->len; i++)
+        {
+            span = &g_array_index (startup_spans, XfsdStartupSpan, i);
+            start = span->start;
+            duration = span->duration;
+
+            dbus_message_iter_open_container (&array, DBUS_TYPE_STRUCT, NULL, &item);
+            dbus_message_iter_append_basic (&item, DBUS_TYPE_STRING, &span->name);
+            dbus_message_iter_append_basic (&item, DBUS_TYPE_UINT64, &start);
+            dbus_message_iter_append_basic (&item, DBUS_TYPE_UINT64, &duration);
+            dbus_message_iter_close_container (&array, &item);
+        }
+
+        dbus_message_iter_close_container (&iter, &array);
+
+        dbus_connection_send (connection, reply, NULL);
+        dbus_message_unref (reply);
+
+        return DBUS_HANDLER_RESULT_HANDLED;
+    }
+    else if (dbus_message_is_method_call (message, XFSETTINGS_DBUS_NAME, "GetDebugLog"))
+    {
+        /* array of (monotonic time in usec, domain, message) */
+        reply = dbus_message_new_method_return (message);
+        dbus_message_iter_init_append (reply, &iter);
+        dbus_message_iter_open_container (&iter, DBUS_TYPE_ARRAY, "(tss)", &array);
+        xfsettings_dbg_foreach (dbus_debug_log_append, &array);
+        dbus_message_iter_close_container (&iter, &array);
+
+        dbus_connection_send (connection, reply, NULL);
+        dbus_message_unref (reply);
+
+        return DBUS_HANDLER_RESULT_HANDLED;
+    }
+    else if (dbus_message_is_method_call (message, XFSETTINGS_DBUS_NAME, "SetDebugLogEnabled"))
+    {
+        /* start or stop recording the debug log */
+        if (!dbus_message_get_args (message, NULL,
+                                    DBUS_TYPE_BOOLEAN, &enabled,
+                                    DBUS_TYPE_INVALID))
+        {
+            reply = dbus_message_new_error (message, DBUS_ERROR_INVALID_ARGS,
+                                            "Expected a boolean");
+        }
+        else
+        {
+            xfsettings_dbg_set_ring (enabled);
+            reply = dbus_message_new_method_return (message);
+        }
+
+        dbus_connection_send (connection, reply, NULL);
+        dbus_message_unref (reply);
+
+        return DBUS_HANDLER_RESULT_HANDLED;
+    }
+    else if (dbus_message_is_method_call (message, XFSETTINGS_DBUS_NAME, "GetClipboardStats"))
+    {
+        /* dictionary of clipboard statistics, empty if the
+         * clipboard manager is not running */
+        reply = dbus_message_new_method_return (message);
+        dbus_message_iter_init_append (reply, &iter);
+        dbus_message_iter_open_container (&iter, DBUS_TYPE_ARRAY, "{sd}", &array);
+
+        if (clipboard_daemon != NULL)
+        {
+            gsd_clipboard_manager_get_stats (GSD_CLIPBOARD_MANAGER (clipboard_daemon), &stats);
+
+            dbus_dict_append_double (&array, "saves", stats.n_saves);
+            dbus_dict_append_double (&array, "bytes-saved", stats.n_bytes_saved);
+            dbus_dict_append_double (&array, "save-rate", stats.save_rate);
+            dbus_dict_append_double (&array, "save-latency-p50", stats.save_latency_p50);
+            dbus_dict_append_double (&array, "save-latency-p99", stats.save_latency_p99);
+            dbus_dict_append_double (&array, "transfers", stats.n_transfers);
+            dbus_dict_append_double (&array, "bytes-sent", stats.n_bytes_sent);
+            dbus_dict_append_double (&array, "send-rate", stats.send_rate);
+            dbus_dict_append_double (&array, "chunk-latency-p50", stats.chunk_latency_p50);
+            dbus_dict_append_double (&array, "chunk-latency-p99", stats.chunk_latency_p99);
+            dbus_dict_append_double (&array, "peak-rss", stats.peak_rss);
+        }
+
+        dbus_message_iter_close_container (&iter, &array);
+
+        dbus_connection_send (connection, reply, NULL);
+        dbus_message_unref (reply);
+
+        return DBUS_HANDLER_RESULT_HANDLED;
+    }
+    else if (dbus_message_is_method_call (message, XFSETTINGS_DBUS_NAME, "GetClipboardHistory"))
+    {
+        /* array of (id, real time in usec, preview, size), most recent first */
+        reply = dbus_message_new_method_return (message);
+        dbus_message_iter_init_append (reply, &iter);
+        dbus_message_iter_open_container (&iter, DBUS_TYPE_ARRAY, "(uxst)", &array);
+
+        if (clipboard_daemon != NULL)
+            gsd_clipboard_manager_history_foreach (GSD_CLIPBOARD_MANAGER (clipboard_daemon),
+                                                   dbus_clipboard_history_append, &array);
+
+        dbus_message_iter_close_container (&iter, &array);
+
+        dbus_connection_send (connection, reply, NULL);
+        dbus_message_unref (reply);
+
+        return DBUS_HANDLER_RESULT_HANDLED;
+    }
+    else if (dbus_message_is_method_call (message, XFSETTINGS_DBUS_NAME, "RestoreClipboardHistory"))
+    {
+        /* own the clipboard with the contents of a history entry */
+        if (!dbus_message_get_args (message, NULL,
+                                    DBUS_TYPE_UINT32, &entry_id,
+                                    DBUS_TYPE_INVALID))
+        {
+            reply = dbus_message_new_error (message, DBUS_ERROR_INVALID_ARGS,
+                                            "Expected the id of a history entry");
+        }
+        else
+        {
+            restored = clipboard_daemon != NULL
+                       && gsd_clipboard_manager_history_restore (GSD_CLIPBOARD_MANAGER (clipboard_daemon),
+                                                                 entry_id);
+
+            reply = dbus_message_new_method_return (message);
+            dbus_message_append_args (reply, DBUS_TYPE_BOOLEAN, &restored, DBUS_TYPE_INVALID);
+        }
+
+        dbus_connection_send (connection, reply, NULL);
+        dbus_message_unref (reply);
+
+        return DBUS_HANDLER_RESULT_HANDLED;
+    }
+
+    return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+}
+
+
+
 static DBusHandlerResult
 dbus_connection_filter_func (DBusConnection *connection,
                              DBusMessage    *message,
@@ -155,23 +462,17 @@ main (gint argc, gchar **argv)
 {
     GError               *error = NULL;
     GOptionContext       *context;
-    GObject              *pointer_helper;
-    GObject              *keyboards_helper;
-    GObject              *accessibility_helper;
-    GObject              *shortcuts_helper;
-    GObject              *keyboard_layout_helper;
-    GObject              *gtk_decorations_helper;
     GObject              *xsettings_helper;
-    GObject              *clipboard_daemon = NULL;
-#ifdef HAVE_XRANDR
-    GObject              *displays_helper;
-#endif
-    GObject              *workspaces_helper;
     guint                 i;
-    const gint            signums[] = { SIGQUIT, SIGTERM };
+    const gint            signums[] = { SIGQUIT, SIGTERM, SIGUSR1 };
     DBusConnection       *dbus_connection;
     gint                  result;
     guint                 dbus_flags;
+    gint64                start;
+    static const DBusObjectPathVTable dbus_vtable = { NULL, dbus_object_message_func, };
+
+    startup_time = g_get_monotonic_time ();
+    startup_spans = g_array_new (FALSE, FALSE, sizeof (XfsdStartupSpan));
 
     xfce_textdomain (GETTEXT_PACKAGE, LOCALEDIR, "UTF-8");
 
@@ -257,6 +558,10 @@ main (gint argc, gchar **argv)
 
         dbus_bus_add_match (dbus_connection, "type='signal',member='NameOwnerChanged',arg0='"XFSETTINGS_DBUS_NAME"'", NULL);
         dbus_connection_add_filter (dbus_connection, dbus_connection_filter_func, NULL, NULL);
+
+        /* object to query the startup times */
+        dbus_connection_register_object_path (dbus_connection, XFSETTINGS_DBUS_PATH,
+                                              &dbus_vtable, NULL);
     }
     else
     {
@@ -286,24 +591,19 @@ main (gint argc, gchar **argv)
     }
 
     /* launch settings manager */
+    start = startup_span_begin ();
     xsettings_helper = g_object_new (XFCE_TYPE_XSETTINGS_HELPER, NULL);
     xfce_xsettings_helper_register (XFCE_XSETTINGS_HELPER (xsettings_helper),
                                     gdk_display_get_default (), opt_replace);
+    startup_span_end ("xsettings", start);
 
     /* create the sub daemons */
-#ifdef HAVE_XRANDR
-    displays_helper = g_object_new (XFCE_TYPE_DISPLAYS_HELPER, NULL);
-#endif
-    pointer_helper = g_object_new (XFCE_TYPE_POINTERS_HELPER, NULL);
-    keyboards_helper = g_object_new (XFCE_TYPE_KEYBOARDS_HELPER, NULL);
-    accessibility_helper = g_object_new (XFCE_TYPE_ACCESSIBILITY_HELPER, NULL);
-    shortcuts_helper = g_object_new (XFCE_TYPE_KEYBOARD_SHORTCUTS_HELPER, NULL);
-    keyboard_layout_helper = g_object_new (XFCE_TYPE_KEYBOARD_LAYOUT_HELPER, NULL);
-    workspaces_helper = g_object_new (XFCE_TYPE_WORKSPACES_HELPER, NULL);
-    gtk_decorations_helper = g_object_new (XFCE_TYPE_DECORATIONS_HELPER, NULL);
+    for (i = 0; i < G_N_ELEMENTS (helpers); i++)
+        helper_construct (&helpers[i]);
 
     if (g_getenv ("XFSETTINGSD_NO_CLIPBOARD") == NULL)
     {
+        start = startup_span_begin ();
         clipboard_daemon = g_object_new (GSD_TYPE_CLIPBOARD_MANAGER, NULL);
         if (!gsd_clipboard_manager_start (GSD_CLIPBOARD_MANAGER (clipboard_daemon), opt_replace))
         {
@@ -312,8 +612,12 @@ main (gint argc, gchar **argv)
 
             g_printerr (G_LOG_DOMAIN ": %s\n", "Another clipboard manager is already running.");
         }
+        startup_span_end ("clipboard", start);
     }
 
+    xfsettings_dbg (XFSD_DEBUG_STARTUP, "startup took %.1f ms",
+                    (g_get_monotonic_time () - startup_time) / 1000.0);
+
     /* setup signal handlers to properly quit the main loop */
     if (xfce_posix_signal_handler_init (NULL))
     {
@@ -323,9 +627,12 @@ main (gint argc, gchar **argv)
 
     gtk_main();
 
+    xfsettings_dispatcher_dump_stats ();
+
     /* release the dbus name */
     if (dbus_connection != NULL)
     {
+        dbus_connection_unregister_object_path (dbus_connection, XFSETTINGS_DBUS_PATH);
         dbus_connection_remove_filter (dbus_connection, dbus_connection_filter_func, NULL);
         dbus_bus_release_name (dbus_connection, XFSETTINGS_DBUS_NAME, NULL);
         dbus_connection_unref (dbus_connection);
@@ -333,16 +640,12 @@ main (gint argc, gchar **argv)
 
     /* release the sub daemons */
     g_object_unref (G_OBJECT (xsettings_helper));
-#ifdef HAVE_XRANDR
-    g_object_unref (G_OBJECT (displays_helper));
-#endif
-    g_object_unref (G_OBJECT (pointer_helper));
-    g_object_unref (G_OBJECT (keyboards_helper));
-    g_object_unref (G_OBJECT (accessibility_helper));
-    g_object_unref (G_OBJECT (shortcuts_helper));
-    g_object_unref (G_OBJECT (keyboard_layout_helper));
-    g_object_unref (G_OBJECT (workspaces_helper));
-    g_object_unref (G_OBJECT (gtk_decorations_helper));
+
+    for (i = 0; i < G_N_ELEMENTS (helpers); i++)
+    {
+        if (helpers[i].object != NULL)
+            g_object_unref (helpers[i].object);
+    }
 
     if (G_LIKELY (clipboard_daemon != NULL))
     {
@@ -354,5 +657,7 @@ main (gint argc, gchar **argv)
 
     g_object_unref (G_OBJECT (sm_client));
 
+    g_array_free (startup_spans, TRUE);
+
     return EXIT_SUCCESS;
 }
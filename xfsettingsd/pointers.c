@@ -43,6 +43,7 @@
 #include <dbus/dbus-glib.h>
 
 #include "debug.h"
+#include "dispatcher.h"
 #include "pointers.h"
 #include "pointers-defines.h"
 
@@ -181,9 +182,11 @@ xfce_pointers_helper_init (XfcePointersHelper *helper)
             DevicePresence (xdisplay, helper->device_presence_event_type, event_class);
             XSelectExtensionEvent (xdisplay, RootWindow (xdisplay, DefaultScreen (xdisplay)), &event_class, 1);
 
-            /* add an event filter */
+            /* add an event filter, the old catch-all filter only
+             * looked at DevicePresenceNotify too */
             if (gdk_error_trap_pop () == 0)
-                gdk_window_add_filter (NULL, xfce_pointers_helper_event_filter, helper);
+                xfsettings_dispatcher_add (helper->device_presence_event_type,
+                                           xfce_pointers_helper_event_filter, helper);
             else
                 g_warning ("Failed to create device filter");
         }
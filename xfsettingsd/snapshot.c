@@ -0,0 +1,444 @@
+/*
+ *  Copyright (c) 2015 The Xfce development team
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Snapshots are a copy of the properties of an xfconf channel on disk,
+ * so the daemon can set the X state at login without waiting for the
+ * xfconf daemon. The file is mapped in memory and has the layout below,
+ * in the byte order of the machine, all records are padded to 4 bytes:
+ *
+ * 4  CARD32  magic
+ * 4  CARD32  version
+ * 4  CARD32  n-properties
+ * 4          unused
+ *
+ * For each property:
+ *
+ * 1  CARD8   type
+ * 1          unused
+ * 2  CARD16  name-len, including the nul-terminator
+ * 4  CARD32  value-len
+ * n  STRING8 name
+ * P          unused, p=pad(n)
+ * m          value
+ * P          unused, p=pad(m)
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#include <glib.h>
+#include <glib-object.h>
+#include <libxfce4util/libxfce4util.h>
+
+#include "debug.h"
+#include "snapshot.h"
+
+#define SNAPSHOT_MAGIC   0x58465353 /* XFSS */
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_PAD(n)  (((n) + 3) & ~3)
+
+
+
+enum
+{
+    SNAPSHOT_TYPE_BOOLEAN,
+    SNAPSHOT_TYPE_INT,
+    SNAPSHOT_TYPE_UINT,
+    SNAPSHOT_TYPE_INT64,
+    SNAPSHOT_TYPE_UINT64,
+    SNAPSHOT_TYPE_DOUBLE,
+    SNAPSHOT_TYPE_STRING
+};
+
+typedef struct
+{
+    guint32 magic;
+    guint32 version;
+    guint32 n_properties;
+    guint32 unused;
+}
+SnapshotHeader;
+
+typedef struct
+{
+    guint8  type;
+    guint8  unused;
+    guint16 name_len;
+    guint32 value_len;
+}
+SnapshotRecord;
+
+
+
+static gchar *
+xfsettings_snapshot_filename (const gchar *channel_name,
+                              gboolean     create)
+{
+    gchar *resource;
+    gchar *filename;
+
+    resource = g_strdup_printf ("xfce4" G_DIR_SEPARATOR_S "xfsettingsd"
+                                G_DIR_SEPARATOR_S "%s.snapshot", channel_name);
+    filename = xfce_resource_save_location (XFCE_RESOURCE_CACHE, resource, create);
+    g_free (resource);
+
+    return filename;
+}
+
+
+
+static void
+xfsettings_snapshot_value_free (gpointer data)
+{
+    GValue *value = data;
+
+    g_value_unset (value);
+    g_free (value);
+}
+
+
+
+static GValue *
+xfsettings_snapshot_value_read (guint8        type,
+                                const guint8 *data,
+                                guint32       len)
+{
+    GValue *value;
+    union
+    {
+        gint32  v_int;
+        guint32 v_uint;
+        gint64  v_int64;
+        guint64 v_uint64;
+        gdouble v_double;
+    }
+    num;
+
+    value = g_new0 (GValue, 1);
+
+    switch (type)
+    {
+        case SNAPSHOT_TYPE_BOOLEAN:
+        case SNAPSHOT_TYPE_INT:
+        case SNAPSHOT_TYPE_UINT:
+            if (len != 4)
+                goto invalid;
+            memcpy (&num, data, 4);
+
+            if (type == SNAPSHOT_TYPE_BOOLEAN)
+            {
+                g_value_init (value, G_TYPE_BOOLEAN);
+                g_value_set_boolean (value, num.v_int != 0);
+            }
+            else if (type == SNAPSHOT_TYPE_INT)
+            {
+                g_value_init (value, G_TYPE_INT);
+                g_value_set_int (value, num.v_int);
+            }
+            else
+            {
+                g_value_init (value, G_TYPE_UINT);
+                g_value_set_uint (value, num.v_uint);
+            }
+            break;
+
+        case SNAPSHOT_TYPE_INT64:
+        case SNAPSHOT_TYPE_UINT64:
+        case SNAPSHOT_TYPE_DOUBLE:
+            if (len != 8)
+                goto invalid;
+            memcpy (&num, data, 8);
+
+            if (type == SNAPSHOT_TYPE_INT64)
+            {
+                g_value_init (value, G_TYPE_INT64);
+                g_value_set_int64 (value, num.v_int64);
+            }
+            else if (type == SNAPSHOT_TYPE_UINT64)
+            {
+                g_value_init (value, G_TYPE_UINT64);
+                g_value_set_uint64 (value, num.v_uint64);
+            }
+            else
+            {
+                g_value_init (value, G_TYPE_DOUBLE);
+                g_value_set_double (value, num.v_double);
+            }
+            break;
+
+        case SNAPSHOT_TYPE_STRING:
+            /* strings are stored with their nul-terminator */
+            if (len == 0 || data[len - 1] != '\0')
+                goto invalid;
+
+            g_value_init (value, G_TYPE_STRING);
+            g_value_set_string (value, (const gchar *) data);
+            break;
+
+        default:
+            goto invalid;
+    }
+
+    return value;
+
+  invalid:
+    g_free (value);
+
+    return NULL;
+}
+
+
+
+GHashTable *
+xfsettings_snapshot_load (const gchar *channel_name)
+{
+    gchar                *filename;
+    GMappedFile          *mapped;
+    const guint8         *data, *end;
+    gsize                 len;
+    SnapshotHeader        header;
+    SnapshotRecord        record;
+    GHashTable           *properties = NULL;
+    GValue               *value;
+    guint32               i;
+    GError               *error = NULL;
+
+    g_return_val_if_fail (channel_name != NULL, NULL);
+
+    filename = xfsettings_snapshot_filename (channel_name, FALSE);
+    if (filename == NULL)
+        return NULL;
+
+    mapped = g_mapped_file_new (filename, FALSE, &error);
+    if (mapped == NULL)
+    {
+        xfsettings_dbg (XFSD_DEBUG_SNAPSHOT, "no snapshot for %s: %s",
+                        channel_name, error->message);
+        g_error_free (error);
+        g_free (filename);
+
+        return NULL;
+    }
+
+    data = (const guint8 *) g_mapped_file_get_contents (mapped);
+    len = g_mapped_file_get_length (mapped);
+    end = data + len;
+
+    if (len < sizeof (header))
+        goto invalid;
+
+    memcpy (&header, data, sizeof (header));
+    if (header.magic != SNAPSHOT_MAGIC || header.version != SNAPSHOT_VERSION)
+        goto invalid;
+    data += sizeof (header);
+
+    properties = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                        xfsettings_snapshot_value_free);
+
+    for (i = 0; i < header.n_properties; i++)
+    {
+        if ((gsize) (end - data) < sizeof (record))
+            goto invalid;
+
+        memcpy (&record, data, sizeof (record));
+        data += sizeof (record);
+
+        /* check the record fits in the file */
+        if (record.name_len == 0
+            || (gsize) (end - data) < SNAPSHOT_PAD ((gsize) record.name_len)
+            || (gsize) (end - data) - SNAPSHOT_PAD ((gsize) record.name_len)
+               < SNAPSHOT_PAD ((gsize) record.value_len)
+            || data[record.name_len - 1] != '\0')
+            goto invalid;
+
+        value = xfsettings_snapshot_value_read (record.type,
+                                                data + SNAPSHOT_PAD (record.name_len),
+                                                record.value_len);
+        if (value == NULL)
+            goto invalid;
+
+        g_hash_table_replace (properties, g_strdup ((const gchar *) data), value);
+
+        data += SNAPSHOT_PAD ((gsize) record.name_len) + SNAPSHOT_PAD ((gsize) record.value_len);
+    }
+
+    xfsettings_dbg (XFSD_DEBUG_SNAPSHOT, "loaded %u properties for %s (len=%"G_GSIZE_FORMAT")",
+                    header.n_properties, channel_name, len);
+
+    g_mapped_file_unref (mapped);
+    g_free (filename);
+
+    return properties;
+
+  invalid:
+    g_warning ("Snapshot \"%s\" is invalid, ignoring it", filename);
+
+    if (properties != NULL)
+        g_hash_table_destroy (properties);
+    g_mapped_file_unref (mapped);
+    g_free (filename);
+
+    return NULL;
+}
+
+
+
+static void
+xfsettings_snapshot_append (const gchar  *name,
+                            const GValue *value,
+                            GByteArray   *buf)
+{
+    SnapshotRecord  record;
+    const guint8    zeros[4] = { 0, };
+    const gchar    *str;
+    guint8         *data;
+    union
+    {
+        gint32  v_int;
+        guint32 v_uint;
+        gint64  v_int64;
+        guint64 v_uint64;
+        gdouble v_double;
+    }
+    num;
+
+    memset (&record, 0, sizeof (record));
+    data = (guint8 *) &num;
+
+    switch (G_VALUE_TYPE (value))
+    {
+        case G_TYPE_BOOLEAN:
+            record.type = SNAPSHOT_TYPE_BOOLEAN;
+            record.value_len = 4;
+            num.v_int = g_value_get_boolean (value);
+            break;
+
+        case G_TYPE_INT:
+            record.type = SNAPSHOT_TYPE_INT;
+            record.value_len = 4;
+            num.v_int = g_value_get_int (value);
+            break;
+
+        case G_TYPE_UINT:
+            record.type = SNAPSHOT_TYPE_UINT;
+            record.value_len = 4;
+            num.v_uint = g_value_get_uint (value);
+            break;
+
+        case G_TYPE_INT64:
+            record.type = SNAPSHOT_TYPE_INT64;
+            record.value_len = 8;
+            num.v_int64 = g_value_get_int64 (value);
+            break;
+
+        case G_TYPE_UINT64:
+            record.type = SNAPSHOT_TYPE_UINT64;
+            record.value_len = 8;
+            num.v_uint64 = g_value_get_uint64 (value);
+            break;
+
+        case G_TYPE_DOUBLE:
+            record.type = SNAPSHOT_TYPE_DOUBLE;
+            record.value_len = 8;
+            num.v_double = g_value_get_double (value);
+            break;
+
+        case G_TYPE_STRING:
+            str = g_value_get_string (value);
+            if (str == NULL)
+                str = "";
+            record.type = SNAPSHOT_TYPE_STRING;
+            record.value_len = strlen (str) + 1;
+            data = (guint8 *) str;
+            break;
+
+        default:
+            /* arrays and other types are not stored, the
+             * helpers pick them up when reading from xfconf */
+            return;
+    }
+
+    record.name_len = strlen (name) + 1;
+
+    g_byte_array_append (buf, (const guint8 *) &record, sizeof (record));
+    g_byte_array_append (buf, (const guint8 *) name, record.name_len);
+    g_byte_array_append (buf, zeros, SNAPSHOT_PAD (record.name_len) - record.name_len);
+    g_byte_array_append (buf, data, record.value_len);
+    g_byte_array_append (buf, zeros, SNAPSHOT_PAD (record.value_len) - record.value_len);
+
+    /* number of properties is in the header */
+    ((SnapshotHeader *) buf->data)->n_properties++;
+}
+
+
+
+gboolean
+xfsettings_snapshot_save (const gchar *channel_name,
+                          GHashTable  *properties)
+{
+    gchar          *filename;
+    GByteArray     *buf;
+    SnapshotHeader  header;
+    GError         *error = NULL;
+    gboolean        succeed;
+
+    g_return_val_if_fail (channel_name != NULL, FALSE);
+    g_return_val_if_fail (properties != NULL, FALSE);
+
+    filename = xfsettings_snapshot_filename (channel_name, TRUE);
+    if (G_UNLIKELY (filename == NULL))
+    {
+        g_warning ("Unable to create the snapshot location for %s", channel_name);
+        return FALSE;
+    }
+
+    memset (&header, 0, sizeof (header));
+    header.magic = SNAPSHOT_MAGIC;
+    header.version = SNAPSHOT_VERSION;
+
+    buf = g_byte_array_sized_new (sizeof (header) + g_hash_table_size (properties) * 64);
+    g_byte_array_append (buf, (const guint8 *) &header, sizeof (header));
+
+    g_hash_table_foreach (properties, (GHFunc) xfsettings_snapshot_append, buf);
+
+    /* write to a temporary file and rename it, so the file we
+     * map at startup is always complete */
+    succeed = g_file_set_contents (filename, (const gchar *) buf->data, buf->len, &error);
+    if (succeed)
+    {
+        xfsettings_dbg (XFSD_DEBUG_SNAPSHOT, "saved %u properties for %s (len=%u)",
+                        ((SnapshotHeader *) buf->data)->n_properties,
+                        channel_name, buf->len);
+    }
+    else
+    {
+        g_warning ("Failed to save snapshot \"%s\": %s", filename, error->message);
+        g_error_free (error);
+    }
+
+    g_byte_array_free (buf, TRUE);
+    g_free (filename);
+
+    return succeed;
+}
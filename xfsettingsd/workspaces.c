@@ -34,6 +34,7 @@
 #endif
 
 #include "debug.h"
+#include "dispatcher.h"
 #include "workspaces.h"
 
 #define WORKSPACES_CHANNEL    "xfwm4"
@@ -127,7 +128,11 @@ xfce_workspaces_helper_init (XfceWorkspacesHelper *helper)
     root_window = gdk_get_default_root_window ();
     events = gdk_window_get_events (root_window);
     gdk_window_set_events (root_window, events | GDK_PROPERTY_CHANGE_MASK);
-    gdk_window_add_filter (root_window, xfce_workspaces_helper_filter_func, helper);
+#ifdef GDK_WINDOWING_X11
+    /* only the desktop count and names on the root window matter, the
+     * filter checks the window */
+    xfsettings_dispatcher_add (PropertyNotify, xfce_workspaces_helper_filter_func, helper);
+#endif
 
     xfce_workspaces_helper_set_names (helper, FALSE);
 
@@ -147,6 +152,10 @@ xfce_workspaces_helper_finalize (GObject *object)
                                          G_CALLBACK (xfce_workspaces_helper_prop_changed),
                                          helper);
 
+#ifdef GDK_WINDOWING_X11
+    xfsettings_dispatcher_remove (PropertyNotify, xfce_workspaces_helper_filter_func, helper);
+#endif
+
     G_OBJECT_CLASS (xfce_workspaces_helper_parent_class)->finalize (object);
 }
 
@@ -162,7 +171,8 @@ xfce_workspaces_helper_filter_func (GdkXEvent  *gdkxevent,
     XEvent                *xevent = gdkxevent;
     GTimeVal               timestamp;
 
-    if (xevent->type == PropertyNotify)
+    if (xevent->type == PropertyNotify
+        && xevent->xproperty.window == GDK_WINDOW_XID (gdk_get_default_root_window ()))
     {
         if (xevent->xproperty.atom == atom_net_number_of_desktops)
         {
@@ -35,6 +35,18 @@
 #ifdef HAVE_TIME_H
 #include <time.h>
 #endif
+#ifdef HAVE_ERRNO_H
+#include <errno.h>
+#endif
+#ifdef HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#endif
+#ifdef HAVE_SCHED_H
+#include <sched.h>
+#endif
+#ifdef HAVE_SYS_SYSCALL_H
+#include <sys/syscall.h>
+#endif
 
 #include <X11/Xlib.h>
 #include <X11/Xmd.h>
@@ -50,6 +62,8 @@
 #include <fontconfig/fontconfig.h>
 
 #include "xsettings.h"
+#include "snapshot.h"
+#include "dispatcher.h"
 #include "debug.h"
 
 #define XSettingsTypeInteger 0
@@ -65,30 +79,94 @@
 #define FC_TIMEOUT_SEC 2 /* timeout before xsettings notify */
 #define FC_PROPERTY    "/Fontconfig/Timestamp"
 
+#define FC_CACHE_PROP  "/Xfsettingsd/RegenerateFontCaches"
+
+/* io priorities from linux/ioprio.h */
+#define IOPRIO_CLASS_IDLE       3
+#define IOPRIO_WHO_PROCESS      1
+#define IOPRIO_CLASS_SHIFT      13
+
+#ifdef HAVE_SYS_INOTIFY_H
+#define FC_INOTIFY_MASK (IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_MOVED_FROM \
+                         | IN_MOVED_TO | IN_CREATE | IN_DELETE | IN_DELETE_SELF \
+                         | IN_MOVE_SELF | IN_MASK_ADD)
+#endif
+
+#define SNAPSHOT_TIMEOUT_SEC   5 /* timeout before saving the snapshot */
+
+#define NOTIFY_DELAY_PROP      "/Xfsettingsd/NotifyDelay"
+#define NOTIFY_MAX_DELAY_PROP  "/Xfsettingsd/NotifyMaxDelay"
+#define NOTIFY_DELAY_MSEC      100 /* quiet window before notify */
+#define NOTIFY_MAX_DELAY_MSEC  500 /* max delay after the first change */
+
+/* settings of the daemon, they are kept in the snapshot too */
+static const gchar *daemon_props[] =
+{
+    NOTIFY_DELAY_PROP,
+    NOTIFY_MAX_DELAY_PROP,
+    FC_CACHE_PROP
+};
+
 
 
 typedef struct _XfceXSettingsScreen XfceXSettingsScreen;
 typedef struct _XfceXSetting        XfceXSetting;
 typedef struct _XfceXSettingsNotify XfceXSettingsNotify;
+typedef struct _XfceXSettingsSchedule XfceXSettingsSchedule;
+typedef struct _XfceXSettingsResources XfceXSettingsResources;
+typedef struct _XfceXSettingsFcWatch XfceXSettingsFcWatch;
+typedef struct _XfceXSettingsFcJob   XfceXSettingsFcJob;
 
 
 
 static void     xfce_xsettings_helper_finalize     (GObject             *object);
 static void     xfce_xsettings_helper_fc_free      (XfceXSettingsHelper *helper);
 static gboolean xfce_xsettings_helper_fc_init      (gpointer             data);
-static gboolean xfce_xsettings_helper_notify_idle  (gpointer             data);
+static gboolean xfce_xsettings_helper_notify_timeout (gpointer           data);
+static gboolean xfce_xsettings_helper_notify_xft_timeout (gpointer       data);
+static void     xfce_xsettings_helper_schedule     (XfceXSettingsHelper   *helper,
+                                                    XfceXSettingsSchedule *schedule);
 static void     xfce_xsettings_helper_setting_free (gpointer             data);
+static void     xfce_xsettings_helper_setting_touch (XfceXSettingsHelper *helper,
+                                                     XfceXSetting        *setting);
 static void     xfce_xsettings_helper_prop_changed (XfconfChannel       *channel,
                                                     const gchar         *prop_name,
                                                     const GValue        *value,
                                                     XfceXSettingsHelper *helper);
-static void     xfce_xsettings_helper_load         (XfceXSettingsHelper *helper);
+static void     xfce_xsettings_helper_load         (XfceXSettingsHelper *helper,
+                                                    GHashTable          *props);
+static gboolean xfce_xsettings_helper_reconcile    (gpointer             data);
 static void     xfce_xsettings_helper_screen_free  (XfceXSettingsScreen *screen);
 static void     xfce_xsettings_helper_notify_xft   (XfceXSettingsHelper *helper);
+static void     xfce_xsettings_helper_resources_free (XfceXSettingsResources *resources);
 static void     xfce_xsettings_helper_notify       (XfceXSettingsHelper *helper);
 
 
 
+struct _XfceXSettingsSchedule
+{
+    guint       source_id;
+    GSourceFunc func;
+
+    /* monotonic time of the first change in this burst */
+    gint64      first_change;
+
+    /* number of changes in this burst and over the lifetime */
+    guint       n_changes;
+    guint       n_changes_total;
+    guint       n_notifies;
+};
+
+struct _XfceXSettingsResources
+{
+    /* the string we last read or wrote on the root window */
+    gchar      *str;
+
+    /* resource lines and an index from resource name to line */
+    GPtrArray  *lines;
+    GHashTable *index;
+};
+
 struct _XfceXSettingsHelperClass
 {
     GObjectClass __parent__;
@@ -109,23 +187,105 @@ struct _XfceXSettingsHelper
     /* auto increasing serial for each time we notify */
     gulong         serial;
 
-    /* idle notifications */
-    guint          notify_idle_id;
-    guint          notify_xft_idle_id;
+    /* delayed notifications */
+    XfceXSettingsSchedule notify;
+    XfceXSettingsSchedule notify_xft;
+
+    /* quiet window and max latency for notifications in msec */
+    guint          notify_delay;
+    guint          notify_max_delay;
 
     /* atom for xsetting property changes */
     Atom           xsettings_atom;
 
-    /* fontconfig monitoring */
-    GPtrArray     *fc_monitors;
+    /* parsed resource manager string of screen 0 */
+    XfceXSettingsResources *resources;
+
+    /* the settings were loaded from the snapshot and still need
+     * to be compared with xfconf */
+    guint          reconcile_id;
+    guint          snapshot_save_id;
+
+    /* fontconfig monitoring, table with path and XfceXSettingsFcWatch */
+    GHashTable    *fc_watches;
     guint          fc_notify_timeout_id;
     guint          fc_init_id;
+
+    /* running fontconfig rescan and whether another rescan
+     * should start once it finished */
+    XfceXSettingsFcJob *fc_job;
+    guint          fc_rescan_pending : 1;
+
+    /* regenerate the caches of changed font directories in
+     * the background before notifying the clients */
+    guint          fc_regenerate_caches : 1;
+    GHashTable    *fc_changed_dirs;
+
+#ifdef HAVE_SYS_INOTIFY_H
+    /* single inotify instance for all paths and a table with
+     * watch descriptor and a list of XfceXSettingsFcWatch */
+    gint           fc_inotify_fd;
+    guint          fc_inotify_watch_id;
+    GHashTable    *fc_inotify_wds;
+#endif
+};
+
+struct _XfceXSettingsFcJob
+{
+    XfceXSettingsHelper *helper;
+    GCancellable        *cancellable;
+
+    /* the new configuration, NULL if the setup did not change */
+    FcConfig            *config;
+
+    /* font directories to regenerate the caches for, and the number
+     * of them the job got to before it was cancelled */
+    gchar              **cache_dirs;
+    guint                n_cache_dirs_done;
+    guint                n_caches;
+
+    /* the thread got the idle CPU scheduler */
+    guint                sched_idle : 1;
+
+    /* time the rescan took */
+    gint64               start_time;
+    gint64               end_time;
+};
+
+struct _XfceXSettingsFcWatch
+{
+    gchar        *path;
+
+#ifdef HAVE_SYS_INOTIFY_H
+    /* watch descriptor, -1 if the path is not watched */
+    gint          wd;
+
+    /* the path does not exist (yet), wd watches the parent
+     * directory for a child with this name */
+    const gchar  *missing_name;
+#else
+    GFileMonitor *monitor;
+#endif
+
+    /* whether the path was in the last fontconfig path list */
+    guint         in_config : 1;
+
+    /* whether the path is a font directory or a config file */
+    guint         is_font_dir : 1;
 };
 
 struct _XfceXSetting
 {
     GValue *value;
     gulong  last_change_serial;
+
+    /* serialized setting record, NULL if the setting changed
+     * since the last notification */
+    guchar *record;
+    gsize   record_len;
+
+    /* offset of the dpi value in the record, 0 if not screen dependent */
+    gsize   record_dpi_offset;
 };
 
 struct _XfceXSettingsNotify
@@ -134,6 +294,9 @@ struct _XfceXSettingsNotify
     gsize   buf_len;
     gint    n_settings;
     gsize   dpi_offset;
+
+    /* number of records serialized for this notification */
+    gint    n_serialized;
 };
 
 struct _XfceXSettingsScreen
@@ -164,12 +327,42 @@ xfce_xsettings_helper_class_init (XfceXSettingsHelperClass *klass)
 static void
 xfce_xsettings_helper_init (XfceXSettingsHelper *helper)
 {
+    GHashTable *props;
+    guint       i;
+
     helper->channel = xfconf_channel_new ("xsettings");
 
+#ifdef HAVE_SYS_INOTIFY_H
+    helper->fc_inotify_fd = -1;
+#endif
+
+    helper->notify.func = xfce_xsettings_helper_notify_timeout;
+    helper->notify_xft.func = xfce_xsettings_helper_notify_xft_timeout;
+
+    helper->fc_changed_dirs = g_hash_table_new_full (g_str_hash, g_str_equal,
+        g_free, NULL);
+
     helper->settings = g_hash_table_new_full (g_str_hash, g_str_equal,
         g_free, xfce_xsettings_helper_setting_free);
 
-    xfce_xsettings_helper_load (helper);
+    /* load the settings from the snapshot of the last session, so we
+     * can notify without waiting for xfconf, and compare with the
+     * channel once the main loop is running */
+    props = xfsettings_snapshot_load ("xsettings");
+    if (props != NULL)
+        helper->reconcile_id = g_idle_add (xfce_xsettings_helper_reconcile, helper);
+    else
+        props = xfconf_channel_get_properties (helper->channel, NULL);
+
+    /* the settings of the daemon come from the same table */
+    for (i = 0; i < G_N_ELEMENTS (daemon_props); i++)
+    {
+        xfce_xsettings_helper_prop_changed (helper->channel, daemon_props[i],
+            props != NULL ? g_hash_table_lookup (props, daemon_props[i]) : NULL,
+            helper);
+    }
+
+    xfce_xsettings_helper_load (helper, props);
 
     g_signal_connect (G_OBJECT (helper->channel), "property-changed",
         G_CALLBACK (xfce_xsettings_helper_prop_changed), helper);
@@ -187,11 +380,17 @@ xfce_xsettings_helper_finalize (GObject *object)
     xfce_xsettings_helper_fc_free (helper);
 
     /* stop pending update */
-    if (helper->notify_idle_id != 0)
-        g_source_remove (helper->notify_idle_id);
+    if (helper->reconcile_id != 0)
+        g_source_remove (helper->reconcile_id);
+
+    if (helper->snapshot_save_id != 0)
+        g_source_remove (helper->snapshot_save_id);
+
+    if (helper->notify.source_id != 0)
+        g_source_remove (helper->notify.source_id);
 
-    if (helper->notify_xft_idle_id != 0)
-        g_source_remove (helper->notify_xft_idle_id);
+    if (helper->notify_xft.source_id != 0)
+        g_source_remove (helper->notify_xft.source_id);
 
     g_object_unref (G_OBJECT (helper->channel));
 
@@ -201,25 +400,56 @@ xfce_xsettings_helper_finalize (GObject *object)
     g_slist_free (helper->screens);
 
     g_hash_table_destroy (helper->settings);
+    g_hash_table_destroy (helper->fc_changed_dirs);
+
+    if (helper->resources != NULL)
+        xfce_xsettings_helper_resources_free (helper->resources);
 
     (*G_OBJECT_CLASS (xfce_xsettings_helper_parent_class)->finalize) (object);
 }
 
 
 
+static void xfce_xsettings_helper_fc_rescan (XfceXSettingsHelper *helper);
+
+
+
 static gboolean
-xfce_xsettings_helper_fc_notify (gpointer data)
+xfce_xsettings_helper_fc_rescan_done (gpointer data)
 {
-    XfceXSettingsHelper *helper = XFCE_XSETTINGS_HELPER (data);
+    XfceXSettingsFcJob  *job = data;
+    XfceXSettingsHelper *helper = job->helper;
     XfceXSetting        *setting;
+    guint                i;
 
-    helper->fc_notify_timeout_id = 0;
+    g_return_val_if_fail (helper->fc_job == job, FALSE);
+    helper->fc_job = NULL;
 
-    /* check if the font config setup changed */
-    if (!FcConfigUptoDate (NULL) && FcInitReinitialize ())
+    if (g_cancellable_is_cancelled (job->cancellable))
+    {
+        xfsettings_dbg (XFSD_DEBUG_FONTCONFIG, "rescan cancelled after %.1f ms",
+                        (job->end_time - job->start_time) / 1000.0);
+
+        /* drop the result, another change happened during the scan */
+        if (job->config != NULL)
+            FcConfigDestroy (job->config);
+
+        /* hand the directories the job did not get to back, for the
+         * rescan that follows */
+        if (job->cache_dirs != NULL)
+        {
+            for (i = job->n_cache_dirs_done; job->cache_dirs[i] != NULL; i++)
+            {
+                g_hash_table_replace (helper->fc_changed_dirs, job->cache_dirs[i], NULL);
+                job->cache_dirs[i] = NULL;
+            }
+        }
+    }
+    else if (job->config != NULL)
     {
-        /* stop the monitors */
-        xfce_xsettings_helper_fc_free (helper);
+        /* activate the new configuration, this takes a reference */
+        FcConfigSetCurrent (job->config);
+        FcConfigDestroy (job->config);
 
         setting = g_hash_table_lookup (helper->settings, FC_PROPERTY);
         if (setting == NULL)
@@ -232,20 +462,206 @@ xfce_xsettings_helper_fc_notify (gpointer data)
         }
 
         /* update setting */
-        setting->last_change_serial = helper->serial;
+        xfce_xsettings_helper_setting_touch (helper, setting);
         g_value_set_int (setting->value, time (NULL));
 
-        xfsettings_dbg (XFSD_DEBUG_FONTCONFIG, "timestamp updated (time=%d)",
-                        g_value_get_int (setting->value));
+        xfsettings_dbg (XFSD_DEBUG_FONTCONFIG, "timestamp updated (time=%d, rescan=%.1f ms, "
+                        "%u caches regenerated%s)", g_value_get_int (setting->value),
+                        (job->end_time - job->start_time) / 1000.0, job->n_caches,
+                        job->cache_dirs != NULL && !job->sched_idle
+                            ? ", without the idle CPU scheduler" : "");
 
         /* schedule xsettings update */
-        if (helper->notify_idle_id == 0)
-            helper->notify_idle_id = g_idle_add (xfce_xsettings_helper_notify_idle, helper);
+        xfce_xsettings_helper_schedule (helper, &helper->notify);
+    }
 
-        /* restart monitoring */
+    /* update the monitored paths, the font directories might have
+     * changed or a missing path was created */
+    if (helper->fc_init_id == 0)
         helper->fc_init_id = g_idle_add (xfce_xsettings_helper_fc_init, helper);
+
+    /* start the rescan that was requested during this one */
+    if (helper->fc_rescan_pending)
+    {
+        helper->fc_rescan_pending = FALSE;
+        xfce_xsettings_helper_fc_rescan (helper);
+    }
+
+    g_strfreev (job->cache_dirs);
+    g_object_unref (G_OBJECT (job->cancellable));
+    g_object_unref (G_OBJECT (helper));
+    g_slice_free (XfceXSettingsFcJob, job);
+
+    return FALSE;
+}
+
+
+
+static gboolean
+xfce_xsettings_helper_fc_rescan_priority (void)
+{
+    gboolean sched_idle = FALSE;
+
+#ifdef SCHED_IDLE
+    struct sched_param param = { 0, };
+
+    /* on linux this only changes the priority of the calling thread */
+    if (sched_setscheduler (0, SCHED_IDLE, &param) == -1)
+        g_warning ("Failed to lower the priority of the fontconfig thread: %s",
+                   g_strerror (errno));
+    else
+        sched_idle = sched_getscheduler (0) == SCHED_IDLE;
+#endif
+
+#if defined (__linux__) && defined (SYS_ioprio_set)
+    syscall (SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0,
+             IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT);
+#endif
+
+    return sched_idle;
+}
+
+
+
+static gpointer
+xfce_xsettings_helper_fc_rescan_thread (gpointer data)
+{
+    XfceXSettingsFcJob *job = data;
+    FcCache            *cache;
+    guint               i;
+
+    job->start_time = g_get_monotonic_time ();
+
+    if (job->cache_dirs != NULL)
+    {
+        /* regenerating the caches should not compete with the session */
+        job->sched_idle = xfce_xsettings_helper_fc_rescan_priority ();
+
+        /* write the caches of the changed directories, so the
+         * clients do not have to scan them once we notify */
+        for (i = 0; job->cache_dirs[i] != NULL; i++)
+        {
+            if (g_cancellable_is_cancelled (job->cancellable))
+                break;
+
+            job->n_cache_dirs_done = i + 1;
+
+            if (FcDirCacheValid ((const FcChar8 *) job->cache_dirs[i]))
+                continue;
+
+            cache = FcDirCacheRead ((const FcChar8 *) job->cache_dirs[i], FcFalse, NULL);
+            if (cache != NULL)
+            {
+                FcDirCacheUnload (cache);
+                job->n_caches++;
+            }
+        }
+    }
+
+    /* check if the font config setup changed and load the new
+     * configuration, without activating it */
+    if (!g_cancellable_is_cancelled (job->cancellable)
+        && !FcConfigUptoDate (NULL))
+    {
+        job->config = FcInitLoadConfigAndFonts ();
     }
 
+    job->end_time = g_get_monotonic_time ();
+
+    /* only the result is handled in the main loop */
+    g_idle_add (xfce_xsettings_helper_fc_rescan_done, job);
+
+    return NULL;
+}
+
+
+
+static void
+xfce_xsettings_helper_fc_steal_dirs (XfceXSettingsHelper *helper,
+                                     XfceXSettingsFcJob  *job)
+{
+    GHashTableIter  iter;
+    gpointer        path;
+    guint           i = 0;
+
+    job->cache_dirs = g_new (gchar *, g_hash_table_size (helper->fc_changed_dirs) + 1);
+
+    g_hash_table_iter_init (&iter, helper->fc_changed_dirs);
+    while (g_hash_table_iter_next (&iter, &path, NULL))
+    {
+        job->cache_dirs[i++] = path;
+        g_hash_table_iter_steal (&iter);
+    }
+
+    job->cache_dirs[i] = NULL;
+}
+
+
+
+static void
+xfce_xsettings_helper_fc_rescan (XfceXSettingsHelper *helper)
+{
+    XfceXSettingsFcJob *job;
+    GThread            *thread;
+    GError             *error = NULL;
+    guint               i;
+
+    /* wait for the running rescan to finish */
+    if (helper->fc_job != NULL)
+    {
+        helper->fc_rescan_pending = TRUE;
+        return;
+    }
+
+    job = g_slice_new0 (XfceXSettingsFcJob);
+    job->helper = g_object_ref (G_OBJECT (helper));
+    job->cancellable = g_cancellable_new ();
+    helper->fc_job = job;
+
+    /* hand the changed font directories over to the job */
+    if (helper->fc_regenerate_caches
+        && g_hash_table_size (helper->fc_changed_dirs) > 0)
+    {
+        xfce_xsettings_helper_fc_steal_dirs (helper, job);
+    }
+
+    thread = g_thread_try_new ("fontconfig", xfce_xsettings_helper_fc_rescan_thread,
+                               job, &error);
+    if (G_LIKELY (thread != NULL))
+    {
+        g_thread_unref (thread);
+    }
+    else
+    {
+        g_warning ("Failed to start fontconfig rescan thread: %s", error->message);
+        g_error_free (error);
+
+        /* regenerating the caches lowers the priority of the calling
+         * thread, keep the directories for a rescan that gets one */
+        if (job->cache_dirs != NULL)
+        {
+            for (i = 0; job->cache_dirs[i] != NULL; i++)
+                g_hash_table_replace (helper->fc_changed_dirs, job->cache_dirs[i], NULL);
+            g_free (job->cache_dirs);
+            job->cache_dirs = NULL;
+        }
+
+        /* scan in the main loop instead */
+        xfce_xsettings_helper_fc_rescan_thread (job);
+    }
+}
+
+
+
+static gboolean
+xfce_xsettings_helper_fc_notify (gpointer data)
+{
+    XfceXSettingsHelper *helper = XFCE_XSETTINGS_HELPER (data);
+
+    helper->fc_notify_timeout_id = 0;
+
+    xfce_xsettings_helper_fc_rescan (helper);
+
     return FALSE;
 }
 
@@ -254,6 +670,11 @@ xfce_xsettings_helper_fc_notify (gpointer data)
 static void
 xfce_xsettings_helper_fc_changed (XfceXSettingsHelper *helper)
 {
+    /* the running rescan is outdated, a new one is started
+     * once the monitor timeout is reached */
+    if (helper->fc_job != NULL)
+        g_cancellable_cancel (helper->fc_job->cancellable);
+
     /* reschedule monitor */
     if (helper->fc_notify_timeout_id != 0)
         g_source_remove (helper->fc_notify_timeout_id);
@@ -264,6 +685,195 @@ xfce_xsettings_helper_fc_changed (XfceXSettingsHelper *helper)
 
 
 
+#ifdef HAVE_SYS_INOTIFY_H
+static void
+xfce_xsettings_helper_fc_watch_stop (XfceXSettingsHelper  *helper,
+                                     XfceXSettingsFcWatch *watch)
+{
+    GSList *watches;
+
+    if (watch->wd < 0)
+        return;
+
+    /* remove the watch from the watch descriptor list and drop the
+     * descriptor once no other path uses it */
+    watches = g_hash_table_lookup (helper->fc_inotify_wds, GINT_TO_POINTER (watch->wd));
+    g_hash_table_steal (helper->fc_inotify_wds, GINT_TO_POINTER (watch->wd));
+
+    watches = g_slist_remove (watches, watch);
+    if (watches != NULL)
+        g_hash_table_insert (helper->fc_inotify_wds, GINT_TO_POINTER (watch->wd), watches);
+    else
+        inotify_rm_watch (helper->fc_inotify_fd, watch->wd);
+
+    watch->wd = -1;
+    watch->missing_name = NULL;
+}
+
+
+
+static void
+xfce_xsettings_helper_fc_watch_start (XfceXSettingsHelper  *helper,
+                                      XfceXSettingsFcWatch *watch)
+{
+    gchar  *dirname;
+    GSList *watches;
+
+    g_return_if_fail (watch->wd == -1);
+
+    watch->wd = inotify_add_watch (helper->fc_inotify_fd, watch->path, FC_INOTIFY_MASK);
+    if (watch->wd == -1 && errno == ENOENT)
+    {
+        /* watch the parent for the creation of the path */
+        dirname = g_path_get_dirname (watch->path);
+        watch->wd = inotify_add_watch (helper->fc_inotify_fd, dirname, FC_INOTIFY_MASK);
+        g_free (dirname);
+
+        if (watch->wd != -1)
+            watch->missing_name = strrchr (watch->path, G_DIR_SEPARATOR) + 1;
+    }
+
+    if (G_UNLIKELY (watch->wd == -1))
+    {
+        xfsettings_dbg_filtered (XFSD_DEBUG_FONTCONFIG, "failed to monitor \"%s\": %s",
+                                 watch->path, g_strerror (errno));
+        return;
+    }
+
+    /* paths can share a descriptor, for example a config file that
+     * is symlinked or a missing directory in another font directory */
+    watches = g_hash_table_lookup (helper->fc_inotify_wds, GINT_TO_POINTER (watch->wd));
+    g_hash_table_steal (helper->fc_inotify_wds, GINT_TO_POINTER (watch->wd));
+    g_hash_table_insert (helper->fc_inotify_wds, GINT_TO_POINTER (watch->wd),
+                         g_slist_prepend (watches, watch));
+
+    xfsettings_dbg_filtered (XFSD_DEBUG_FONTCONFIG, "monitoring \"%s\"%s",
+                             watch->path, watch->missing_name != NULL ? " (missing)" : "");
+}
+
+
+
+static gboolean
+xfce_xsettings_helper_fc_inotify_event (XfceXSettingsHelper        *helper,
+                                        const struct inotify_event *event)
+{
+    GSList               *watches, *li;
+    XfceXSettingsFcWatch *watch;
+    gboolean              changed = FALSE;
+
+    /* the event queue overflowed, so we missed events */
+    if (event->mask & IN_Q_OVERFLOW)
+        return TRUE;
+
+    watches = g_hash_table_lookup (helper->fc_inotify_wds, GINT_TO_POINTER (event->wd));
+    if (watches == NULL)
+        return FALSE;
+
+    if (event->mask & IN_IGNORED)
+    {
+        /* the kernel removed the watch, because the path was deleted,
+         * reset the watches so they are added again on the next update */
+        for (li = watches; li != NULL; li = li->next)
+        {
+            watch = li->data;
+            watch->wd = -1;
+            watch->missing_name = NULL;
+        }
+
+        g_hash_table_remove (helper->fc_inotify_wds, GINT_TO_POINTER (event->wd));
+
+        return TRUE;
+    }
+
+    for (li = watches; li != NULL; li = li->next)
+    {
+        watch = li->data;
+
+        /* for missing paths we only care about the child we wait for */
+        if (watch->missing_name == NULL
+            || (event->len > 0 && strcmp (event->name, watch->missing_name) == 0))
+        {
+            changed = TRUE;
+
+            /* remember the directory for regenerating its cache */
+            if (watch->is_font_dir
+                && helper->fc_regenerate_caches
+                && !g_hash_table_lookup_extended (helper->fc_changed_dirs, watch->path, NULL, NULL))
+            {
+                g_hash_table_insert (helper->fc_changed_dirs, g_strdup (watch->path), NULL);
+            }
+        }
+    }
+
+    return changed;
+}
+
+
+
+static gboolean
+xfce_xsettings_helper_fc_inotify_read (GIOChannel   *source,
+                                       GIOCondition  condition,
+                                       gpointer      data)
+{
+    XfceXSettingsHelper        *helper = XFCE_XSETTINGS_HELPER (data);
+    gchar                       buf[4096] __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+    const struct inotify_event *event;
+    gssize                      len;
+    gchar                      *ptr;
+    gboolean                    changed = FALSE;
+    guint                       n_events = 0;
+
+    /* drain all the pending events and handle them as one batch */
+    for (;;)
+    {
+        len = read (helper->fc_inotify_fd, buf, sizeof (buf));
+        if (len <= 0)
+            break;
+
+        for (ptr = buf; ptr < buf + len; ptr += sizeof (struct inotify_event) + event->len)
+        {
+            event = (const struct inotify_event *) ptr;
+            if (xfce_xsettings_helper_fc_inotify_event (helper, event))
+                changed = TRUE;
+            n_events++;
+        }
+    }
+
+    if (len == -1 && errno != EAGAIN && errno != EINTR)
+    {
+        g_critical ("Failed to read fontconfig monitor events: %s", g_strerror (errno));
+        helper->fc_inotify_watch_id = 0;
+        return FALSE;
+    }
+
+    xfsettings_dbg_filtered (XFSD_DEBUG_FONTCONFIG, "%u inotify events, %s",
+                             n_events, changed ? "rescheduling" : "ignored");
+
+    if (changed)
+        xfce_xsettings_helper_fc_changed (helper);
+
+    return TRUE;
+}
+#endif
+
+
+
+static void
+xfce_xsettings_helper_fc_watch_free (gpointer data)
+{
+    XfceXSettingsFcWatch *watch = data;
+
+#ifndef HAVE_SYS_INOTIFY_H
+    if (watch->monitor != NULL)
+        g_object_unref (G_OBJECT (watch->monitor));
+#endif
+
+    g_free (watch->path);
+    g_slice_free (XfceXSettingsFcWatch, watch);
+}
+
+
+
 static void
 xfce_xsettings_helper_fc_free (XfceXSettingsHelper *helper)
 {
@@ -281,107 +891,306 @@ xfce_xsettings_helper_fc_free (XfceXSettingsHelper *helper)
         helper->fc_init_id = 0;
     }
 
-    if (helper->fc_monitors != NULL)
-    {
-        /* remove monitors */
-        g_ptr_array_foreach (helper->fc_monitors, (GFunc) g_object_unref, NULL);
-        g_ptr_array_free (helper->fc_monitors, TRUE);
-        helper->fc_monitors = NULL;
-    }
+#ifdef HAVE_SYS_INOTIFY_H
+    if (helper->fc_inotify_watch_id != 0)
+    {
+        g_source_remove (helper->fc_inotify_watch_id);
+        helper->fc_inotify_watch_id = 0;
+    }
+
+    if (helper->fc_inotify_wds != NULL)
+    {
+        g_hash_table_destroy (helper->fc_inotify_wds);
+        helper->fc_inotify_wds = NULL;
+    }
+
+    if (helper->fc_inotify_fd != -1)
+    {
+        /* closing the descriptor removes all the watches */
+        close (helper->fc_inotify_fd);
+        helper->fc_inotify_fd = -1;
+    }
+#endif
+
+    if (helper->fc_watches != NULL)
+    {
+        /* remove monitors */
+        g_hash_table_destroy (helper->fc_watches);
+        helper->fc_watches = NULL;
+    }
+}
+
+
+
+static void
+xfce_xsettings_helper_fc_monitor (XfceXSettingsHelper *helper,
+                                  FcStrList           *files,
+                                  gboolean             font_dirs)
+{
+    const gchar          *path;
+    XfceXSettingsFcWatch *watch;
+#ifndef HAVE_SYS_INOTIFY_H
+    GFile                *file;
+#endif
+
+    if (G_UNLIKELY (files == NULL))
+        return;
+
+    for (;;)
+    {
+        path = (const gchar *) FcStrListNext (files);
+        if (G_UNLIKELY (path == NULL))
+            break;
+
+        watch = g_hash_table_lookup (helper->fc_watches, path);
+        if (watch == NULL)
+        {
+            watch = g_slice_new0 (XfceXSettingsFcWatch);
+            watch->path = g_strdup (path);
+#ifdef HAVE_SYS_INOTIFY_H
+            watch->wd = -1;
+#endif
+            g_hash_table_insert (helper->fc_watches, watch->path, watch);
+        }
+
+        watch->in_config = TRUE;
+        watch->is_font_dir = !!font_dirs;
+
+#ifdef HAVE_SYS_INOTIFY_H
+        /* (re)start watches that are new, were removed by the kernel
+         * or wait for a missing path that might exist now */
+        if (watch->missing_name != NULL)
+            xfce_xsettings_helper_fc_watch_stop (helper, watch);
+        if (watch->wd == -1)
+            xfce_xsettings_helper_fc_watch_start (helper, watch);
+#else
+        if (watch->monitor == NULL)
+        {
+            file = g_file_new_for_path (path);
+            watch->monitor = g_file_monitor (file, G_FILE_MONITOR_NONE, NULL, NULL);
+            g_object_unref (G_OBJECT (file));
+
+            if (G_LIKELY (watch->monitor != NULL))
+            {
+                g_signal_connect_swapped (G_OBJECT (watch->monitor), "changed",
+                    G_CALLBACK (xfce_xsettings_helper_fc_changed), helper);
+
+                xfsettings_dbg_filtered (XFSD_DEBUG_FONTCONFIG, "monitoring \"%s\"",
+                                         path);
+            }
+        }
+#endif
+    }
+
+    FcStrListDone (files);
+}
+
+
+
+static gboolean
+xfce_xsettings_helper_fc_watch_reset (gpointer key,
+                                      gpointer value,
+                                      gpointer data)
+{
+    XfceXSettingsFcWatch *watch = value;
+
+    watch->in_config = FALSE;
+
+    return FALSE;
+}
+
+
+
+static gboolean
+xfce_xsettings_helper_fc_watch_remove (gpointer key,
+                                       gpointer value,
+                                       gpointer data)
+{
+    XfceXSettingsFcWatch *watch = value;
+
+    if (watch->in_config)
+        return FALSE;
+
+    xfsettings_dbg_filtered (XFSD_DEBUG_FONTCONFIG, "stop monitoring \"%s\"",
+                             watch->path);
+
+#ifdef HAVE_SYS_INOTIFY_H
+    xfce_xsettings_helper_fc_watch_stop (XFCE_XSETTINGS_HELPER (data), watch);
+#endif
+
+    return TRUE;
+}
+
+
+
+static void
+xfce_xsettings_helper_fc_watch_size (gpointer key,
+                                     gpointer value,
+                                     gpointer data)
+{
+    XfceXSettingsFcWatch *watch = value;
+    gsize                *size = data;
+
+    *size += sizeof (XfceXSettingsFcWatch) + strlen (watch->path) + 1;
 }
 
 
 
-static void
-xfce_xsettings_helper_fc_monitor (XfceXSettingsHelper *helper,
-                                  FcStrList           *files)
+static gboolean
+xfce_xsettings_helper_fc_init (gpointer data)
 {
-    const gchar  *path;
-    GFile        *file;
-    GFileMonitor *monitor;
+    XfceXSettingsHelper *helper = XFCE_XSETTINGS_HELPER (data);
+    gsize                size = 0;
+#ifdef HAVE_SYS_INOTIFY_H
+    GIOChannel          *channel;
+#endif
 
-    if (G_UNLIKELY (files == NULL))
-        return;
+    helper->fc_init_id = 0;
 
-    for (;;)
+    if (FcInit ())
     {
-        path = (const gchar *) FcStrListNext (files);
-        if (G_UNLIKELY (path == NULL))
-            break;
+        if (helper->fc_watches == NULL)
+        {
+            helper->fc_watches = g_hash_table_new_full (g_str_hash, g_str_equal,
+                NULL, xfce_xsettings_helper_fc_watch_free);
 
-        file = g_file_new_for_path (path);
-        monitor = g_file_monitor (file, G_FILE_MONITOR_NONE, NULL, NULL);
-        g_object_unref (G_OBJECT (file));
+#ifdef HAVE_SYS_INOTIFY_H
+            helper->fc_inotify_wds = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+                NULL, (GDestroyNotify) g_slist_free);
 
-        if (G_LIKELY (monitor != NULL))
-        {
-            g_ptr_array_add (helper->fc_monitors, monitor);
-            g_signal_connect_swapped (G_OBJECT (monitor), "changed",
-                G_CALLBACK (xfce_xsettings_helper_fc_changed), helper);
+            helper->fc_inotify_fd = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC);
+            if (G_UNLIKELY (helper->fc_inotify_fd == -1))
+            {
+                g_critical ("Failed to initialize fontconfig monitoring: %s",
+                            g_strerror (errno));
+                return FALSE;
+            }
 
-            xfsettings_dbg_filtered (XFSD_DEBUG_FONTCONFIG, "monitoring \"%s\"",
-                                     path);
+            channel = g_io_channel_unix_new (helper->fc_inotify_fd);
+            helper->fc_inotify_watch_id = g_io_add_watch (channel, G_IO_IN,
+                xfce_xsettings_helper_fc_inotify_read, helper);
+            g_io_channel_unref (channel);
+#endif
         }
+#ifdef HAVE_SYS_INOTIFY_H
+        else if (helper->fc_inotify_fd == -1)
+        {
+            return FALSE;
+        }
+#endif
+
+        /* start monitoring config files and font directories, paths that
+         * are already monitored are kept, the others are removed */
+        g_hash_table_foreach (helper->fc_watches,
+            (GHFunc) xfce_xsettings_helper_fc_watch_reset, NULL);
+
+        xfce_xsettings_helper_fc_monitor (helper, FcConfigGetConfigFiles (NULL), FALSE);
+        xfce_xsettings_helper_fc_monitor (helper, FcConfigGetFontDirs (NULL), TRUE);
+
+        g_hash_table_foreach_remove (helper->fc_watches,
+            xfce_xsettings_helper_fc_watch_remove, helper);
+
+        g_hash_table_foreach (helper->fc_watches,
+            xfce_xsettings_helper_fc_watch_size, &size);
+
+#ifdef HAVE_SYS_INOTIFY_H
+        xfsettings_dbg (XFSD_DEBUG_FONTCONFIG,
+                        "monitoring %u paths with %u inotify watches "
+                        "(%"G_GSIZE_FORMAT" bytes)",
+                        g_hash_table_size (helper->fc_watches),
+                        g_hash_table_size (helper->fc_inotify_wds), size);
+#else
+        xfsettings_dbg (XFSD_DEBUG_FONTCONFIG,
+                        "monitoring %u paths (%"G_GSIZE_FORMAT" bytes)",
+                        g_hash_table_size (helper->fc_watches), size);
+#endif
     }
 
-    FcStrListDone (files);
+    return FALSE;
 }
 
 
 
-static gboolean
-xfce_xsettings_helper_fc_init (gpointer data)
+static void
+xfce_xsettings_helper_schedule (XfceXSettingsHelper   *helper,
+                                XfceXSettingsSchedule *schedule)
 {
-    XfceXSettingsHelper *helper = XFCE_XSETTINGS_HELPER (data);
-
-    g_return_val_if_fail (helper->fc_monitors == NULL, FALSE);
+    gint64 now, deadline;
+    guint  timeout;
 
-    helper->fc_init_id = 0;
+    now = g_get_monotonic_time ();
 
-    if (FcInit ())
+    if (schedule->source_id == 0)
+    {
+        /* first change of a new burst */
+        schedule->first_change = now;
+        schedule->n_changes = 0;
+    }
+    else
     {
-        helper->fc_monitors = g_ptr_array_new ();
+        /* restart the quiet window */
+        g_source_remove (schedule->source_id);
+    }
 
-        /* start monitoring config files and font directories */
-        xfce_xsettings_helper_fc_monitor (helper, FcConfigGetConfigFiles (NULL));
-        xfce_xsettings_helper_fc_monitor (helper, FcConfigGetFontDirs (NULL));
+    schedule->n_changes++;
+    schedule->n_changes_total++;
 
-        xfsettings_dbg (XFSD_DEBUG_FONTCONFIG, "monitoring %d paths",
-                        helper->fc_monitors->len);
-    }
+    /* wait until changes stop arriving, but never delay the
+     * notification longer than the max delay after the first change */
+    timeout = helper->notify_delay;
+    deadline = schedule->first_change + (gint64) helper->notify_max_delay * 1000;
+    if (now + (gint64) timeout * 1000 > deadline)
+        timeout = deadline > now ? (deadline - now) / 1000 : 0;
 
-    return FALSE;
+    schedule->source_id = g_timeout_add (timeout, schedule->func, helper);
+}
+
+
+
+static void
+xfce_xsettings_helper_schedule_done (XfceXSettingsSchedule *schedule,
+                                     const gchar           *name)
+{
+    schedule->source_id = 0;
+    schedule->n_notifies++;
+
+    xfsettings_dbg_filtered (XFSD_DEBUG_XSETTINGS,
+                             "%s notify after %u changes in %.1f ms "
+                             "(%u changes in %u notifies)", name,
+                             schedule->n_changes,
+                             (g_get_monotonic_time () - schedule->first_change) / 1000.0,
+                             schedule->n_changes_total, schedule->n_notifies);
 }
 
 
 
 static gboolean
-xfce_xsettings_helper_notify_idle (gpointer data)
+xfce_xsettings_helper_notify_timeout (gpointer data)
 {
     XfceXSettingsHelper *helper = XFCE_XSETTINGS_HELPER (data);
 
+    xfce_xsettings_helper_schedule_done (&helper->notify, "xsettings");
+
     /* only update if there are screen registered */
     if (helper->screens != NULL)
         xfce_xsettings_helper_notify (helper);
 
-    helper->notify_idle_id = 0;
-
     return FALSE;
 }
 
 
 
 static gboolean
-xfce_xsettings_helper_notify_xft_idle (gpointer data)
+xfce_xsettings_helper_notify_xft_timeout (gpointer data)
 {
     XfceXSettingsHelper *helper = XFCE_XSETTINGS_HELPER (data);
 
+    xfce_xsettings_helper_schedule_done (&helper->notify_xft, "xft");
+
     /* only update if there are screen registered */
     if (helper->screens != NULL)
         xfce_xsettings_helper_notify_xft (helper);
 
-    helper->notify_xft_idle_id = 0;
-
     return FALSE;
 }
 
@@ -439,6 +1248,20 @@ xfce_xsettings_helper_prop_load (gchar               *prop_name,
 
 
 
+static guint
+xfce_xsettings_helper_prop_msec (const GValue *value,
+                                 guint         fallback)
+{
+    if (value != NULL && G_VALUE_HOLDS_UINT (value))
+        return g_value_get_uint (value);
+    else if (value != NULL && G_VALUE_HOLDS_INT (value))
+        return MAX (g_value_get_int (value), 0);
+
+    return fallback;
+}
+
+
+
 static void
 xfce_xsettings_helper_prop_changed (XfconfChannel       *channel,
                                     const gchar         *prop_name,
@@ -450,7 +1273,27 @@ xfce_xsettings_helper_prop_changed (XfconfChannel       *channel,
     g_return_if_fail (helper->channel == channel);
 
     xfsettings_dbg_filtered (XFSD_DEBUG_XSETTINGS, "prop \"%s\" changed (type=%s)",
-                             prop_name, G_VALUE_TYPE_NAME (value));
+                             prop_name, value != NULL ? G_VALUE_TYPE_NAME (value) : "none");
+
+    /* notification delays of the daemon */
+    if (strcmp (prop_name, NOTIFY_DELAY_PROP) == 0)
+    {
+        helper->notify_delay = xfce_xsettings_helper_prop_msec (value, NOTIFY_DELAY_MSEC);
+        return;
+    }
+    else if (strcmp (prop_name, NOTIFY_MAX_DELAY_PROP) == 0)
+    {
+        helper->notify_max_delay = xfce_xsettings_helper_prop_msec (value, NOTIFY_MAX_DELAY_MSEC);
+        return;
+    }
+    else if (strcmp (prop_name, FC_CACHE_PROP) == 0)
+    {
+        helper->fc_regenerate_caches = value != NULL && G_VALUE_HOLDS_BOOLEAN (value)
+                                       && g_value_get_boolean (value);
+        if (!helper->fc_regenerate_caches)
+            g_hash_table_remove_all (helper->fc_changed_dirs);
+        return;
+    }
 
     if (G_LIKELY (value != NULL))
     {
@@ -463,8 +1306,8 @@ xfce_xsettings_helper_prop_changed (XfconfChannel       *channel,
             g_value_reset (setting->value);
             g_value_copy (value, setting->value);
 
-            /* update the serial */
-            setting->last_change_serial = helper->serial;
+            /* update the serial and drop the old record */
+            xfce_xsettings_helper_setting_touch (helper, setting);
         }
         else if (xfce_xsettings_helper_prop_valid (prop_name, value))
         {
@@ -492,28 +1335,22 @@ xfce_xsettings_helper_prop_changed (XfconfChannel       *channel,
         g_hash_table_remove (helper->settings, prop_name);
     }
 
-    if (helper->notify_idle_id == 0)
-    {
-        /* schedule an update */
-        helper->notify_idle_id = g_idle_add (xfce_xsettings_helper_notify_idle, helper);
-    }
+    /* schedule an update */
+    xfce_xsettings_helper_schedule (helper, &helper->notify);
 
-    if (helper->notify_xft_idle_id == 0
-        && (g_str_has_prefix (prop_name, "/Xft/")
-            || g_str_has_prefix (prop_name, "/Gtk/CursorTheme")))
+    if (g_str_has_prefix (prop_name, "/Xft/")
+        || g_str_has_prefix (prop_name, "/Gtk/CursorTheme"))
     {
-        helper->notify_xft_idle_id = g_idle_add (xfce_xsettings_helper_notify_xft_idle, helper);
+        xfce_xsettings_helper_schedule (helper, &helper->notify_xft);
     }
 }
 
 
 
 static void
-xfce_xsettings_helper_load (XfceXSettingsHelper *helper)
+xfce_xsettings_helper_load (XfceXSettingsHelper *helper,
+                            GHashTable          *props)
 {
-    GHashTable *props;
-
-    props = xfconf_channel_get_properties (helper->channel, NULL);
     if (G_LIKELY (props != NULL))
       {
         /* steal properties and put them in the settings table */
@@ -527,6 +1364,143 @@ xfce_xsettings_helper_load (XfceXSettingsHelper *helper)
 
 
 
+static gboolean
+xfce_xsettings_helper_value_equal (const GValue *a,
+                                   const GValue *b)
+{
+    if (G_VALUE_TYPE (a) != G_VALUE_TYPE (b))
+        return FALSE;
+
+    switch (G_VALUE_TYPE (a))
+    {
+        case G_TYPE_INT:
+            return g_value_get_int (a) == g_value_get_int (b);
+
+        case G_TYPE_BOOLEAN:
+            return g_value_get_boolean (a) == g_value_get_boolean (b);
+
+        case G_TYPE_STRING:
+            return g_strcmp0 (g_value_get_string (a), g_value_get_string (b)) == 0;
+
+        default:
+            return FALSE;
+    }
+}
+
+
+
+static gboolean
+xfce_xsettings_helper_reconcile (gpointer data)
+{
+    XfceXSettingsHelper *helper = XFCE_XSETTINGS_HELPER (data);
+    GHashTable          *props;
+    GHashTableIter       iter;
+    gpointer             prop_name, value;
+    XfceXSetting        *setting;
+    GSList              *removed = NULL, *li;
+    guint                n_changed = 0, i;
+
+    helper->reconcile_id = 0;
+
+    props = xfconf_channel_get_properties (helper->channel, NULL);
+    if (G_UNLIKELY (props == NULL))
+        return FALSE;
+
+    /* apply the properties that changed since the snapshot was saved */
+    g_hash_table_iter_init (&iter, props);
+    while (g_hash_table_iter_next (&iter, &prop_name, &value))
+    {
+        setting = g_hash_table_lookup (helper->settings, prop_name);
+        if (setting != NULL
+            && xfce_xsettings_helper_value_equal (setting->value, value))
+            continue;
+
+        /* types cannot change, so remove the setting first */
+        if (setting != NULL)
+            xfce_xsettings_helper_prop_changed (helper->channel, prop_name, NULL, helper);
+
+        xfce_xsettings_helper_prop_changed (helper->channel, prop_name, value, helper);
+        n_changed++;
+    }
+
+    /* remove settings that are no longer in the channel */
+    g_hash_table_iter_init (&iter, helper->settings);
+    while (g_hash_table_iter_next (&iter, &prop_name, NULL))
+    {
+        if (strcmp (prop_name, FC_PROPERTY) != 0
+            && g_hash_table_lookup (props, prop_name) == NULL)
+            removed = g_slist_prepend (removed, g_strdup (prop_name));
+    }
+
+    for (li = removed; li != NULL; li = li->next)
+    {
+        xfce_xsettings_helper_prop_changed (helper->channel, li->data, NULL, helper);
+        g_free (li->data);
+        n_changed++;
+    }
+    g_slist_free (removed);
+
+    /* settings of the daemon that were reset since the snapshot */
+    for (i = 0; i < G_N_ELEMENTS (daemon_props); i++)
+    {
+        if (g_hash_table_lookup (props, daemon_props[i]) == NULL)
+            xfce_xsettings_helper_prop_changed (helper->channel, daemon_props[i], NULL, helper);
+    }
+
+    xfsettings_dbg (XFSD_DEBUG_XSETTINGS, "reconciled snapshot with xfconf, %u changes",
+                    n_changed);
+
+    g_hash_table_destroy (props);
+
+    return FALSE;
+}
+
+
+
+static gboolean
+xfce_xsettings_helper_snapshot_save (gpointer data)
+{
+    XfceXSettingsHelper *helper = XFCE_XSETTINGS_HELPER (data);
+    GHashTable          *props;
+    GHashTableIter       iter;
+    gpointer             prop_name, setting;
+    GValue               notify_delay = G_VALUE_INIT;
+    GValue               notify_max_delay = G_VALUE_INIT;
+    GValue               fc_regenerate_caches = G_VALUE_INIT;
+
+    helper->snapshot_save_id = 0;
+
+    /* table with the values owned by the settings, without
+     * the fontconfig timestamp that is not in xfconf */
+    props = g_hash_table_new (g_str_hash, g_str_equal);
+
+    g_hash_table_iter_init (&iter, helper->settings);
+    while (g_hash_table_iter_next (&iter, &prop_name, &setting))
+        if (strcmp (prop_name, FC_PROPERTY) != 0)
+            g_hash_table_insert (props, prop_name, ((XfceXSetting *) setting)->value);
+
+    /* the settings of the daemon, so it starts without xfconf */
+    g_value_init (&notify_delay, G_TYPE_UINT);
+    g_value_set_uint (&notify_delay, helper->notify_delay);
+    g_hash_table_insert (props, NOTIFY_DELAY_PROP, &notify_delay);
+
+    g_value_init (&notify_max_delay, G_TYPE_UINT);
+    g_value_set_uint (&notify_max_delay, helper->notify_max_delay);
+    g_hash_table_insert (props, NOTIFY_MAX_DELAY_PROP, &notify_max_delay);
+
+    g_value_init (&fc_regenerate_caches, G_TYPE_BOOLEAN);
+    g_value_set_boolean (&fc_regenerate_caches, helper->fc_regenerate_caches);
+    g_hash_table_insert (props, FC_CACHE_PROP, &fc_regenerate_caches);
+
+    xfsettings_snapshot_save ("xsettings", props);
+
+    g_hash_table_destroy (props);
+
+    return FALSE;
+}
+
+
+
 static void
 xfce_xsettings_helper_setting_free (gpointer data)
 {
@@ -534,11 +1508,27 @@ xfce_xsettings_helper_setting_free (gpointer data)
 
     g_value_unset (setting->value);
     g_free (setting->value);
+    g_free (setting->record);
     g_slice_free (XfceXSetting, setting);
 }
 
 
 
+static void
+xfce_xsettings_helper_setting_touch (XfceXSettingsHelper *helper,
+                                     XfceXSetting        *setting)
+{
+    setting->last_change_serial = helper->serial;
+
+    /* the record is outdated, serialize it again on the next notify */
+    g_free (setting->record);
+    setting->record = NULL;
+    setting->record_len = 0;
+    setting->record_dpi_offset = 0;
+}
+
+
+
 static gint
 xfce_xsettings_helper_screen_dpi (XfceXSettingsScreen *screen)
 {
@@ -578,26 +1568,113 @@ xfce_xsettings_helper_screen_dpi (XfceXSettingsScreen *screen)
 
 
 static void
-xfce_xsettings_helper_notify_xft_update (GString      *resource,
-                                         const gchar  *name,
-                                         const GValue *value)
+xfce_xsettings_helper_resources_free (XfceXSettingsResources *resources)
+{
+    g_free (resources->str);
+    g_ptr_array_free (resources->lines, TRUE);
+    g_hash_table_destroy (resources->index);
+    g_slice_free (XfceXSettingsResources, resources);
+}
+
+
+
+static XfceXSettingsResources *
+xfce_xsettings_helper_resources_parse (const gchar *str)
+{
+    XfceXSettingsResources  *resources;
+    gchar                  **lines;
+    gchar                   *colon;
+    guint                    i;
+
+    resources = g_slice_new0 (XfceXSettingsResources);
+    resources->str = g_strdup (str);
+    resources->lines = g_ptr_array_new_with_free_func (g_free);
+    resources->index = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+    if (str == NULL)
+        return resources;
+
+    lines = g_strsplit (str, "\n", -1);
+    for (i = 0; lines[i] != NULL; i++)
+    {
+        /* the line array takes ownership of the strings */
+        if (*lines[i] == '\0')
+        {
+            g_free (lines[i]);
+            continue;
+        }
+
+        /* index the resource name including the colon, like the strstr
+         * lookup we used before, the first occurrence wins */
+        colon = strchr (lines[i], ':');
+        if (colon != NULL)
+        {
+            gchar *name = g_strndup (lines[i], colon - lines[i] + 1);
+
+            if (g_hash_table_lookup (resources->index, name) == NULL)
+            {
+                g_hash_table_insert (resources->index, name,
+                                     GUINT_TO_POINTER (resources->lines->len + 1));
+            }
+            else
+            {
+                g_free (name);
+            }
+        }
+
+        g_ptr_array_add (resources->lines, lines[i]);
+    }
+
+    /* only free the array, the strings are owned by the line array */
+    g_free (lines);
+
+    return resources;
+}
+
+
+
+static gchar *
+xfce_xsettings_helper_resources_to_string (XfceXSettingsResources *resources)
+{
+    GString     *str;
+    guint        i;
+    const gchar *line;
+
+    str = g_string_sized_new (resources->str != NULL ? strlen (resources->str) + 64 : 256);
+
+    /* lines of removed resources are NULL */
+    for (i = 0; i < resources->lines->len; i++)
+    {
+        line = g_ptr_array_index (resources->lines, i);
+        if (line != NULL)
+        {
+            g_string_append (str, line);
+            g_string_append_c (str, '\n');
+        }
+    }
+
+    return g_string_free (str, FALSE);
+}
+
+
+
+static void
+xfce_xsettings_helper_notify_xft_update (XfceXSettingsResources *resources,
+                                         const gchar            *name,
+                                         const GValue           *value)
 {
-    gchar       *found;
-    gchar       *end;
     const gchar *str = NULL;
     gchar        s[64];
     gint         num;
+    guint        n;
+    gchar      **line = NULL;
 
     g_return_if_fail (g_str_has_suffix (name, ":"));
 
-    /* remove the old property */
-    found = strstr (resource->str, name);
-    if (found != NULL)
-    {
-        end = strchr (found, '\n');
-        g_string_erase (resource, found - resource->str,
-                        end != NULL ? end - found + 1 : -1);
-    }
+    /* lookup the line of the old property */
+    n = GPOINTER_TO_UINT (g_hash_table_lookup (resources->index, name));
+    if (n > 0)
+        line = (gchar **) &g_ptr_array_index (resources->lines, n - 1);
 
     switch (G_VALUE_TYPE (value))
     {
@@ -614,7 +1691,7 @@ xfce_xsettings_helper_notify_xft_update (GString      *resource,
 
             /* -1 means default in xft, so only remove it */
             if (num == -1)
-                return;
+                break;
 
             /* special case for dpi */
             if (strcmp (name, "Xft.dpi:") == 0)
@@ -630,12 +1707,54 @@ xfce_xsettings_helper_notify_xft_update (GString      *resource,
 
     if (str != NULL)
     {
-        /* append a new line if required */
-        if (!g_str_has_suffix (resource->str, "\n"))
-            g_string_append_c (resource, '\n');
+        if (line != NULL)
+        {
+            /* replace the old property */
+            g_free (*line);
+            *line = g_strdup_printf ("%s\t%s", name, str);
+        }
+        else
+        {
+            /* append a new property */
+            g_hash_table_insert (resources->index, g_strdup (name),
+                                 GUINT_TO_POINTER (resources->lines->len + 1));
+            g_ptr_array_add (resources->lines, g_strdup_printf ("%s\t%s", name, str));
+        }
+    }
+    else if (line != NULL)
+    {
+        /* remove the old property */
+        g_free (*line);
+        *line = NULL;
+        g_hash_table_remove (resources->index, name);
+    }
+}
+
 
-        g_string_append_printf (resource, "%s\t%s\n", name, str);
+
+static gchar *
+xfce_xsettings_helper_notify_xft_get (Display *xdisplay)
+{
+    Atom    type;
+    gint    format;
+    gulong  n_items, bytes_after;
+    guchar *data = NULL;
+    gchar  *str = NULL;
+
+    /* read the current string from the root window, because other
+     * applications (xrdb) may have changed it since we last wrote it */
+    if (XGetWindowProperty (xdisplay, RootWindow (xdisplay, 0),
+                            XA_RESOURCE_MANAGER, 0, G_MAXLONG, False,
+                            XA_STRING, &type, &format, &n_items,
+                            &bytes_after, &data) == Success
+        && data != NULL)
+    {
+        if (type == XA_STRING && format == 8)
+            str = g_strndup ((const gchar *) data, n_items);
+        XFree (data);
     }
+
+    return str;
 }
 
 
@@ -645,7 +1764,7 @@ xfce_xsettings_helper_notify_xft (XfceXSettingsHelper *helper)
 {
     Display      *xdisplay;
     gchar        *str;
-    GString      *resource;
+    gchar        *merged;
     XfceXSetting *setting;
     guint         i;
     GValue        bool_val = { 0, };
@@ -667,12 +1786,26 @@ xfce_xsettings_helper_notify_xft (XfceXSettingsHelper *helper)
     if (G_LIKELY (helper->screens == NULL))
         return;
 
-    xdisplay = XOpenDisplay (NULL);
-    g_return_if_fail (xdisplay != NULL);
+    /* all screens share the connection of the gdk display */
+    xdisplay = ((XfceXSettingsScreen *) helper->screens->data)->xdisplay;
+
+    gdk_error_trap_push ();
 
     /* get the resource string from this display from screen zero */
-    str = XResourceManagerString (xdisplay);
-    resource = g_string_new (str);
+    str = xfce_xsettings_helper_notify_xft_get (xdisplay);
+
+    /* only parse the string again if it changed behind our back */
+    if (helper->resources == NULL
+        || g_strcmp0 (helper->resources->str, str) != 0)
+    {
+        if (helper->resources != NULL)
+            xfce_xsettings_helper_resources_free (helper->resources);
+        helper->resources = xfce_xsettings_helper_resources_parse (str);
+
+        xfsettings_dbg_filtered (XFSD_DEBUG_XSETTINGS,
+                                 "resource manager parsed (%u lines)",
+                                 helper->resources->lines->len);
+    }
 
     /* update/insert the properties */
     for (i = 0; i < G_N_ELEMENTS (props); i++)
@@ -680,7 +1813,7 @@ xfce_xsettings_helper_notify_xft (XfceXSettingsHelper *helper)
         setting = g_hash_table_lookup (helper->settings, props[i][0]);
         if (G_LIKELY (setting != NULL))
         {
-            xfce_xsettings_helper_notify_xft_update (resource, props[i][1],
+            xfce_xsettings_helper_notify_xft_update (helper->resources, props[i][1],
                                                      setting->value);
         }
     }
@@ -688,39 +1821,48 @@ xfce_xsettings_helper_notify_xft (XfceXSettingsHelper *helper)
     /* set for Xcursor.theme */
     g_value_init (&bool_val, G_TYPE_BOOLEAN);
     g_value_set_boolean (&bool_val, TRUE);
-    xfce_xsettings_helper_notify_xft_update (resource, "Xcursor.theme_core:", &bool_val);
+    xfce_xsettings_helper_notify_xft_update (helper->resources, "Xcursor.theme_core:", &bool_val);
     g_value_unset (&bool_val);
 
-    gdk_error_trap_push ();
-
-    /* set the new resource manager string */
-    XChangeProperty (xdisplay,
-                     RootWindow (xdisplay, 0),
-                     XA_RESOURCE_MANAGER, XA_STRING, 8,
-                     PropModeReplace,
-                     (guchar *) resource->str,
-                     resource->len);
+    merged = xfce_xsettings_helper_resources_to_string (helper->resources);
 
-    XCloseDisplay (xdisplay);
+    /* only set the new resource manager string if it differs */
+    if (g_strcmp0 (merged, str) != 0)
+    {
+        XChangeProperty (xdisplay,
+                         RootWindow (xdisplay, 0),
+                         XA_RESOURCE_MANAGER, XA_STRING, 8,
+                         PropModeReplace,
+                         (guchar *) merged,
+                         strlen (merged));
+
+        xfsettings_dbg (XFSD_DEBUG_XSETTINGS,
+                        "resource manager (xft) changed (len=%"G_GSIZE_FORMAT")",
+                        strlen (merged));
+    }
+    else
+    {
+        xfsettings_dbg_filtered (XFSD_DEBUG_XSETTINGS,
+                                 "resource manager (xft) unchanged");
+    }
 
     if (gdk_error_trap_pop () != 0)
         g_critical ("Failed to update the resource manager string");
 
-    xfsettings_dbg (XFSD_DEBUG_XSETTINGS,
-                    "resource manager (xft) changed (len=%"G_GSIZE_FORMAT")",
-                    resource->len);
+    /* remember what is on the root window now */
+    g_free (helper->resources->str);
+    helper->resources->str = merged;
 
-    g_string_free (resource, TRUE);
+    g_free (str);
 }
 
 
 
 static void
-xfce_xsettings_helper_setting_append (const gchar         *name,
-                                      XfceXSetting        *setting,
-                                      XfceXSettingsNotify *notify)
+xfce_xsettings_helper_setting_serialize (const gchar  *name,
+                                         XfceXSetting *setting)
 {
-    gsize        buf_len, new_len;
+    gsize        buf_len;
     gsize        name_len, name_len_pad;
     gsize        value_len, value_len_pad;
     const gchar *str = NULL;
@@ -728,6 +1870,8 @@ xfce_xsettings_helper_setting_append (const gchar         *name,
     guchar       type = 0;
     gint         num;
 
+    g_return_if_fail (setting->record == NULL);
+
     name_len = strlen (name) - 1 /* -1 for the xfconf slash */;
     name_len_pad = XSETTINGS_PAD (name_len, 4);
 
@@ -765,15 +1909,10 @@ xfce_xsettings_helper_setting_append (const gchar         *name,
             break;
     }
 
-    /* additional length for this setting */
-    new_len = notify->buf_len + buf_len;
-
-    /* resize the buffer to fit this setting */
-    notify->buf = g_renew (guchar, notify->buf, new_len);
-    if (G_UNLIKELY (notify->buf == NULL))
-      return;
-    needle = notify->buf + notify->buf_len;
-    notify->buf_len = new_len;
+    setting->record = g_new (guchar, buf_len);
+    setting->record_len = buf_len;
+    setting->record_dpi_offset = 0;
+    needle = setting->record;
 
     /* setting record:
      *
@@ -855,7 +1994,7 @@ xfce_xsettings_helper_setting_append (const gchar         *name,
                      * or clamp the value and set 1/1024ths of an inch
                      * for Xft */
                     if (num < 1)
-                        notify->dpi_offset = needle - notify->buf;
+                        setting->record_dpi_offset = needle - setting->record;
                     else
                         num = CLAMP (num, DPI_LOW_REASONABLE, DPI_HIGH_REASONABLE) * 1024;
                 }
@@ -890,6 +2029,42 @@ xfce_xsettings_helper_setting_append (const gchar         *name,
             break;
     }
 
+    g_assert (needle == setting->record + setting->record_len);
+}
+
+
+
+static void
+xfce_xsettings_helper_setting_measure (const gchar         *name,
+                                       XfceXSetting        *setting,
+                                       XfceXSettingsNotify *notify)
+{
+    /* only serialize settings that changed since the last notify */
+    if (setting->record == NULL)
+    {
+        xfce_xsettings_helper_setting_serialize (name, setting);
+        notify->n_serialized++;
+    }
+
+    notify->buf_len += setting->record_len;
+}
+
+
+
+static void
+xfce_xsettings_helper_setting_append (const gchar         *name,
+                                      XfceXSetting        *setting,
+                                      XfceXSettingsNotify *notify)
+{
+    g_return_if_fail (setting->record != NULL);
+
+    /* remember the offset for screen dependend dpi */
+    if (setting->record_dpi_offset > 0)
+        notify->dpi_offset = notify->buf_len + setting->record_dpi_offset;
+
+    memcpy (notify->buf + notify->buf_len, setting->record, setting->record_len);
+    notify->buf_len += setting->record_len;
+
     notify->n_settings++;
 }
 
@@ -898,21 +2073,25 @@ xfce_xsettings_helper_setting_append (const gchar         *name,
 static void
 xfce_xsettings_helper_notify (XfceXSettingsHelper *helper)
 {
-    XfceXSettingsNotify *notify;
+    XfceXSettingsNotify  notify = { NULL, 0, 0, 0, 0 };
     CARD32               orderint = 0x01020304;
     guchar              *needle;
     XfceXSettingsScreen *screen;
     GSList              *li;
     gint                 dpi;
+    gsize                buf_len;
 
     g_return_if_fail (XFCE_IS_XSETTINGS_HELPER (helper));
 
-    notify = g_slice_new0 (XfceXSettingsNotify);
-    notify->buf = g_new0 (guchar, 12);
-    if (G_UNLIKELY (notify->buf == NULL))
-      goto errnomem;
-    notify->buf_len = 12;
-    needle = notify->buf;
+    /* update the outdated records and calculate the total size */
+    notify.buf_len = 12;
+    g_hash_table_foreach (helper->settings,
+        (GHFunc) xfce_xsettings_helper_setting_measure, &notify);
+
+    /* allocate the buffer once */
+    buf_len = notify.buf_len;
+    notify.buf = g_new (guchar, buf_len);
+    needle = notify.buf;
 
     /* general notification form:
      *
@@ -924,21 +2103,21 @@ xfce_xsettings_helper_notify (XfceXSettingsHelper *helper)
 
     /* byte-order */
     *(CARD8 *)needle = (*(char *)&orderint == 1) ? MSBFirst : LSBFirst;
+    *(needle + 1) = *(needle + 2) = *(needle + 3) = 0;
     needle += 4;
 
     /* serial for this notification */
     *(CARD32 *)needle = helper->serial++;
 
-    /* add all the settings */
+    /* copy all the setting records */
+    notify.buf_len = 12;
     g_hash_table_foreach (helper->settings,
-        (GHFunc) xfce_xsettings_helper_setting_append, notify);
-
-    if (G_UNLIKELY (notify->buf == NULL))
-      goto errnomem;
+        (GHFunc) xfce_xsettings_helper_setting_append, &notify);
+    g_assert (notify.buf_len == buf_len);
 
     /* number of settings */
-    needle = notify->buf + 8;
-    *(CARD32 *)needle = notify->n_settings;
+    needle = notify.buf + 8;
+    *(CARD32 *)needle = notify.n_settings;
 
     gdk_error_trap_push ();
 
@@ -948,16 +2127,16 @@ xfce_xsettings_helper_notify (XfceXSettingsHelper *helper)
         screen = li->data;
 
         /* set the accurate dpi for this screen */
-        if (notify->dpi_offset > 0)
+        if (notify.dpi_offset > 0)
         {
             dpi = xfce_xsettings_helper_screen_dpi (screen);
-            needle = notify->buf + notify->dpi_offset;
+            needle = notify.buf + notify.dpi_offset;
             *(INT32 *)needle = dpi * 1024;
         }
 
         XChangeProperty (screen->xdisplay, screen->window,
                          helper->xsettings_atom, helper->xsettings_atom,
-                         8, PropModeReplace, notify->buf, notify->buf_len);
+                         8, PropModeReplace, notify.buf, notify.buf_len);
     }
 
     if (gdk_error_trap_pop () != 0)
@@ -966,12 +2145,21 @@ xfce_xsettings_helper_notify (XfceXSettingsHelper *helper)
     }
 
     xfsettings_dbg (XFSD_DEBUG_XSETTINGS,
-                    "%d settings changed (serial=%lu, len=%"G_GSIZE_FORMAT")",
-                    notify->n_settings, helper->serial - 1, notify->buf_len);
+                    "%d settings changed, %d serialized (serial=%lu, len=%"G_GSIZE_FORMAT")",
+                    notify.n_settings, notify.n_serialized, helper->serial - 1,
+                    notify.buf_len);
+
+    g_free (notify.buf);
 
-    g_free (notify->buf);
-  errnomem:
-    g_slice_free (XfceXSettingsNotify, notify);
+    /* save the settings for the next session, unless they
+     * still need to be compared with xfconf */
+    if (helper->reconcile_id == 0)
+    {
+        if (helper->snapshot_save_id != 0)
+            g_source_remove (helper->snapshot_save_id);
+        helper->snapshot_save_id = g_timeout_add_seconds (SNAPSHOT_TIMEOUT_SEC,
+            xfce_xsettings_helper_snapshot_save, helper);
+    }
 }
 
 
@@ -1015,7 +2203,7 @@ xfce_xsettings_helper_event_filter (GdkXEvent *gdkxevent,
 
                 /* remove this filter if there are no screens */
                 if (helper->screens == NULL)
-                    gdk_window_remove_filter (NULL, xfce_xsettings_helper_event_filter, data);
+                    xfsettings_dispatcher_remove (SelectionClear, xfce_xsettings_helper_event_filter, data);
 
                 return GDK_FILTER_REMOVE;
             }
@@ -1169,8 +2357,9 @@ xfce_xsettings_helper_register (XfceXSettingsHelper *helper,
 
     if (helper->screens != NULL)
     {
-        /* watch for selection changes */
-        gdk_window_add_filter (NULL, xfce_xsettings_helper_event_filter, helper);
+        /* watch for selection changes, losing the XSETTINGS selection
+         * of a screen is the only event the filter handles */
+        xfsettings_dispatcher_add (SelectionClear, xfce_xsettings_helper_event_filter, helper);
 
         /* send notifications */
         xfce_xsettings_helper_notify (helper);